@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L
+#include "base.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lex.h"
+#include "parser.h"
+#include "ast.h"
+#include "codegen.h"
+#include "stats.h"
+#include "gen.h"
+
+/*
+ * Front-to-back throughput benchmark for the compiler.
+ *
+ * For every input size (1K, 16K, ... up to --max-size) a synthetic program is
+ * generated and each phase is run on its own until at least --min-time
+ * seconds have passed. Throughput is compared against a stored baseline so a
+ * slowdown shows up as a non-zero exit code.
+ * */
+
+enum bench_phase : u8 {
+    BENCH_LEX,
+    BENCH_PARSE,
+    BENCH_PRINT,
+    BENCH_CODEGEN,
+    __bench_phase_count,
+};
+
+static const char* bench_phase_names[__bench_phase_count] = {
+    [BENCH_LEX] = "lex",
+    [BENCH_PARSE] = "parse",
+    [BENCH_PRINT] = "print",
+    [BENCH_CODEGEN] = "codegen",
+};
+
+struct bench_result {
+    usize size;
+    enum bench_phase phase;
+    f64 mb_per_sec;
+};
+
+struct bench_results {
+    struct bench_result* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bench_options {
+    usize max_size;
+    f64 min_time;
+    f64 tolerance;
+    const char* baseline;
+    const char* save_baseline;
+};
+
+struct bench_input {
+    struct string src;
+    u64 tokens;
+    u64 nodes;
+};
+
+static FILE* devnull = NULL;
+
+static inline f64 now(void) {
+    return (f64)stats_now().ns * 1e-9;
+}
+
+static inline void run_phase(enum bench_phase phase, struct bench_input* input) {
+    struct lexer lexer;
+    struct ast ast;
+    i32 saved_stdout;
+
+    switch (phase) {
+        case BENCH_LEX:
+            lexer = lex(input->src);
+            input->tokens = 0;
+            while (lexer_advance(&lexer)) input->tokens++;
+            break;
+        case BENCH_PARSE:
+            ast = parse(input->src);
+            input->nodes = ast.length;
+            ast_free(&ast);
+            break;
+        case BENCH_PRINT:
+            ast = parse(input->src);
+            fflush(stdout);
+            saved_stdout = dup(STDOUT_FILENO);
+            dup2(fileno(devnull), STDOUT_FILENO);
+            ast_pretty_print(&ast);
+            fflush(stdout);
+            dup2(saved_stdout, STDOUT_FILENO);
+            close(saved_stdout);
+            ast_free(&ast);
+            break;
+        case BENCH_CODEGEN:
+            ast = parse(input->src);
+            code_gen(&ast, devnull, CODEGEN_OPTIONS_DEFAULT);
+            fflush(devnull);
+            ast_free(&ast);
+            break;
+        case __bench_phase_count:
+            UNREACHABLE("run_phase:__bench_phase_count");
+            break;
+    }
+}
+
+/*
+ * Print and codegen need an AST, which is rebuilt every iteration so the
+ * node array is cold like it would be in the real compiler. The parse time
+ * is subtracted back out using the measurement from BENCH_PARSE.
+ * */
+static inline f64 time_phase(enum bench_phase phase, struct bench_input* input,
+                             f64 min_time, f64 parse_time) {
+    u64 iterations = 0;
+    f64 start = now();
+    f64 elapsed;
+
+    do {
+        run_phase(phase, input);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+
+    elapsed /= (f64)iterations;
+    if (phase == BENCH_PRINT || phase == BENCH_CODEGEN) elapsed = MAX(elapsed - parse_time, 1e-9);
+
+    return elapsed;
+}
+
+static inline f64 baseline_lookup(struct bench_results* baseline, usize size, enum bench_phase phase) {
+    for (usize i = 0; i < baseline->length; ++i) {
+        if (baseline->at[i].size == size && baseline->at[i].phase == phase) {
+            return baseline->at[i].mb_per_sec;
+        }
+    }
+
+    return 0.0;
+}
+
+static inline void baseline_load(const char* path, struct bench_results* baseline) {
+    FILE* file = fopen(path, "r");
+    char name[32];
+    struct bench_result result;
+
+    if (file == NULL) return;
+
+    while (fscanf(file, "%zu %31s %lf", &result.size, name, &result.mb_per_sec) == 3) {
+        for (usize p = 0; p < __bench_phase_count; ++p) {
+            if (strcmp(name, bench_phase_names[p]) == 0) {
+                result.phase = p;
+                DYNARRAY_APPEND(*baseline, result);
+            }
+        }
+    }
+
+    fclose(file);
+}
+
+static inline void baseline_save(const char* path, struct bench_results* results) {
+    FILE* file = fopen(path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "nomibench: could not write `%s'\n", path);
+        exit(1);
+    }
+
+    for (usize i = 0; i < results->length; ++i) {
+        struct bench_result r = results->at[i];
+        fprintf(file, "%zu %s %.3f\n", r.size, bench_phase_names[r.phase], r.mb_per_sec);
+    }
+
+    fclose(file);
+}
+
+static inline u64 parse_size(const char* str) {
+    char* end;
+    u64 size = strtoull(str, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size = KILOBYTES(size); break;
+        case 'm': case 'M': size = MEGABYTES(size); break;
+        case 'g': case 'G': size = GIGABYTES(size); break;
+        default: break;
+    }
+
+    return size;
+}
+
+i32 main(i32 argc, char** argv) {
+    struct bench_options options = {
+        .max_size = MEGABYTES(64),
+        .min_time = 0.2,
+        .tolerance = 0.10,
+        .baseline = "bench/baseline.txt",
+        .save_baseline = NULL,
+    };
+    struct bench_results results = {0};
+    struct bench_results baseline = {0};
+    u32 regressions = 0;
+
+    for (i32 i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "nomibench: `%s' expects an argument\n", argv[i]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--max-size") == 0) options.max_size = parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--min-time") == 0) options.min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--tolerance") == 0) options.tolerance = atof(argv[++i]) / 100.0;
+        else if (strcmp(argv[i], "--baseline") == 0) options.baseline = argv[++i];
+        else if (strcmp(argv[i], "--save-baseline") == 0) options.save_baseline = argv[++i];
+        else {
+            fprintf(stderr, "nomibench: unknown option `%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    devnull = fopen("/dev/null", "w");
+    ASSERT(devnull);
+
+    if (options.save_baseline == NULL) baseline_load(options.baseline, &baseline);
+
+    printf("%-10s %-8s %12s %10s %14s %14s %10s\n",
+           "size", "phase", "time (ms)", "MB/s", "tokens/s", "nodes/s", "baseline");
+
+    for (usize size = KILOBYTES(1); size <= options.max_size; size *= 16) {
+        struct gen_params params = GEN_PARAMS_DEFAULT;
+        struct bench_input input = {0};
+        f64 parse_time = 0.0;
+
+        params.size = size;
+        input.src = gen_program(params);
+
+        /* one untimed warm-up run so every row knows its tokens and nodes */
+        run_phase(BENCH_LEX, &input);
+        run_phase(BENCH_PARSE, &input);
+
+        for (usize p = 0; p < __bench_phase_count; ++p) {
+            f64 elapsed = time_phase(p, &input, options.min_time, parse_time);
+            f64 mb_per_sec = (f64)input.src.length / elapsed / 1e6;
+            f64 base = baseline_lookup(&baseline, size, p);
+            struct bench_result result = { size, p, mb_per_sec };
+            const char* verdict = "";
+
+            if (p == BENCH_PARSE) parse_time = elapsed;
+
+            if (base > 0.0) {
+                if (mb_per_sec < base * (1.0 - options.tolerance)) {
+                    verdict = "REGRESSION";
+                    regressions++;
+                } else {
+                    verdict = "ok";
+                }
+            }
+
+            printf("%-10zu %-8s %12.3f %10.2f %14.0f %14.0f %10s\n",
+                   input.src.length, bench_phase_names[p], elapsed * 1e3, mb_per_sec,
+                   (f64)input.tokens / elapsed, (f64)input.nodes / elapsed, verdict);
+            fflush(stdout);
+
+            DYNARRAY_APPEND(results, result);
+        }
+
+        free((void*)input.src.cstr);
+    }
+
+    if (options.save_baseline) {
+        baseline_save(options.save_baseline, &results);
+        printf("baseline written to %s\n", options.save_baseline);
+    } else if (baseline.length == 0) {
+        printf("no baseline at %s (make bench-baseline to record one)\n", options.baseline);
+    } else if (regressions > 0) {
+        printf("%u regression(s) beyond %.0f%% of %s\n", regressions,
+               options.tolerance * 100.0, options.baseline);
+    }
+
+    fclose(devnull);
+    DYNARRAY_FREE(results);
+    DYNARRAY_FREE(baseline);
+
+    return regressions > 0;
+}
@@ -0,0 +1,159 @@
+#include "gen.h"
+
+struct gen {
+    struct gen_params params;
+    struct gen_buffer out;
+    u64 state;
+};
+
+/* xorshift64*, plenty for picking shapes of programs */
+static inline u64 gen_next(struct gen* gen) {
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return gen->state * 0x2545f4914f6cdd1dull;
+}
+
+static inline u32 gen_range(struct gen* gen, u32 lo, u32 hi) {
+    return lo + (u32)(gen_next(gen) % (u64)(hi - lo + 1));
+}
+
+static inline void gen_write(struct gen* gen, const char* str, usize length) {
+    struct gen_buffer* out = &gen->out;
+
+    if (out->length + length > out->capacity) {
+        out->capacity = MAX(out->capacity * 2, out->length + length);
+        out->at = realloc(out->at, out->capacity);
+    }
+
+    memcpy(out->at + out->length, str, length);
+    out->length += length;
+}
+
+static inline void gen_cstr(struct gen* gen, const char* cstr) {
+    gen_write(gen, cstr, strlen(cstr));
+}
+
+static inline void gen_indent(struct gen* gen, u32 depth) {
+    for (u32 i = 0; i < depth; ++i) gen_write(gen, "    ", 4);
+}
+
+/*
+ * Identifiers are random letters with the function index in base 26 at the
+ * end, so they are unique without skewing the length distribution.
+ * */
+static inline void gen_ident(struct gen* gen, u32 index) {
+    char buf[64];
+    char suffix[8];
+    u32 suffix_len = 0;
+    u32 length = gen_range(gen, gen->params.ident_min, gen->params.ident_max);
+
+    do {
+        suffix[suffix_len++] = 'a' + index % 26;
+        index /= 26;
+    } while (index > 0);
+
+    length = CLAMP(length, suffix_len, (u32)sizeof(buf));
+
+    for (u32 i = 0; i < length - suffix_len; ++i) {
+        u32 c = gen_range(gen, 0, 52);
+        buf[i] = c < 26 ? 'a' + c : c < 52 ? 'A' + (c - 26) : '_';
+    }
+    for (u32 i = 0; i < suffix_len; ++i) {
+        buf[length - suffix_len + i] = suffix[i];
+    }
+
+    gen_write(gen, buf, length);
+}
+
+static inline void gen_number(struct gen* gen) {
+    char buf[32];
+    u32 digits = gen_range(gen, 1, gen->params.number_max_digits);
+
+    buf[0] = '1' + gen_range(gen, 0, 8);
+    for (u32 i = 1; i < digits; ++i) buf[i] = '0' + gen_range(gen, 0, 9);
+
+    gen_write(gen, buf, digits);
+}
+
+static inline void gen_block(struct gen* gen, u32 depth) {
+    gen_cstr(gen, "{\n");
+
+    for (u32 i = 0; i < gen->params.statements; ++i) {
+        gen_indent(gen, depth + 1);
+
+        if (depth + 1 < gen->params.depth && gen_range(gen, 0, gen->params.statements - 1) == 0) {
+            gen_block(gen, depth + 1);
+        } else {
+            gen_cstr(gen, "return ");
+            gen_number(gen);
+            gen_cstr(gen, ";\n");
+        }
+    }
+
+    gen_indent(gen, depth);
+    gen_cstr(gen, "}\n");
+}
+
+static inline void gen_func_decl(struct gen* gen, u32 index) {
+    gen_cstr(gen, "func ");
+    if (index == 0) gen_cstr(gen, "main");
+    else gen_ident(gen, index);
+    gen_cstr(gen, "() i32 ");
+    gen_block(gen, 0);
+    gen_cstr(gen, "\n");
+}
+
+/*
+ * Every level calls the next one twice, shuffling its parameters around, so
+ * main makes 2^depth calls in total and almost all of the time is spent
+ * passing arguments around. Good for comparing calling conventions.
+ * */
+static inline void gen_call_tree(struct gen* gen) {
+    char buf[256];
+    u32 depth = gen->params.call_depth;
+
+    for (u32 i = 1; i < depth; ++i) {
+        snprintf(buf, sizeof(buf),
+                 "func f%u(a i32, b i32, c i32, d i32) i32 {\n"
+                 "    f%u(a, b, c, d);\n"
+                 "    return f%u(d, c, b, a);\n"
+                 "}\n\n", i, i + 1, i + 1);
+        gen_cstr(gen, buf);
+    }
+
+    snprintf(buf, sizeof(buf),
+             "func f%u(a i32, b i32, c i32, d i32) i32 {\n"
+             "    return b;\n"
+             "}\n\n", depth);
+    gen_cstr(gen, buf);
+
+    gen_cstr(gen, "func main() i32 {\n"
+                  "    return f1(1, 42, 3, 4);\n"
+                  "}\n");
+}
+
+struct string gen_program(struct gen_params params) {
+    struct gen gen = {
+        .params = params,
+        .out = {0},
+        .state = params.seed ? params.seed : 1,
+    };
+
+    ASSERT(params.statements > 0);
+    ASSERT(params.ident_min <= params.ident_max);
+
+    if (params.call_depth > 0) {
+        gen_call_tree(&gen);
+        gen_write(&gen, "", 1);
+        return STRING_FROM_PARTS(gen.out.at, gen.out.length - 1);
+    }
+
+    for (u32 i = 0; params.functions == 0 || i < params.functions; ++i) {
+        if (params.size != 0 && gen.out.length >= params.size) break;
+        gen_func_decl(&gen, i);
+    }
+
+    gen_write(&gen, "", 1);
+    return STRING_FROM_PARTS(gen.out.at, gen.out.length - 1);
+}
@@ -0,0 +1,47 @@
+#ifndef __GEN_H
+#define __GEN_H
+
+#include "base.h"
+#include "string.h"
+
+/*
+ * Deterministic generator of synthetic Nomi programs for benchmarking.
+ *
+ * The same parameters and seed always produce byte-for-byte the same
+ * program, so numbers from different runs (and different machines) are
+ * measuring the same input.
+ * */
+
+struct gen_params {
+    u64 seed;
+    u32 functions;      /* number of functions, 0 to keep going until `size' */
+    usize size;         /* stop after this many bytes, 0 for no limit */
+    u32 depth;          /* maximum nesting depth of blocks inside a function */
+    u32 statements;     /* statements per block */
+    u32 ident_min;      /* identifier lengths are uniform in [min, max] */
+    u32 ident_max;
+    u32 number_max_digits;
+    u32 call_depth;     /* when set, a binary tree of calls this deep instead */
+};
+
+#define GEN_PARAMS_DEFAULT (struct gen_params){ \
+    .seed = 0x6e6f6d69, \
+    .functions = 0, \
+    .size = KILOBYTES(64), \
+    .depth = 4, \
+    .statements = 4, \
+    .ident_min = 4, \
+    .ident_max = 16, \
+    .number_max_digits = 9, \
+    .call_depth = 0, \
+}
+
+struct gen_buffer {
+    char* at;
+    DYNARRAY_FIELDS;
+};
+
+/* The returned string is heap allocated and owned by the caller */
+struct string gen_program(struct gen_params params);
+
+#endif  /*__GEN_H*/
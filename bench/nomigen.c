@@ -0,0 +1,68 @@
+#include "base.h"
+#include "gen.h"
+
+static inline u64 parse_size(const char* str) {
+    char* end;
+    u64 size = strtoull(str, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size = KILOBYTES(size); break;
+        case 'm': case 'M': size = MEGABYTES(size); break;
+        case 'g': case 'G': size = GIGABYTES(size); break;
+        default: break;
+    }
+
+    return size;
+}
+
+static inline void usage(void) {
+    fprintf(stderr,
+            "usage: nomigen [options]\n"
+            "  --seed N           seed for the generator\n"
+            "  --functions N      number of functions (0 = until --size)\n"
+            "  --size N[KMG]      stop once the program is this big\n"
+            "  --depth N          maximum block nesting depth\n"
+            "  --statements N     statements per block\n"
+            "  --ident MIN:MAX    identifier length range\n"
+            "  --digits N         maximum digits in a number literal (1-9)\n"
+            "  --call-depth N     a tree of 2^N calls instead of random functions\n");
+    exit(1);
+}
+
+i32 main(i32 argc, char** argv) {
+    struct gen_params params = GEN_PARAMS_DEFAULT;
+
+    for (i32 i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) usage();
+
+        if (strcmp(argv[i], "--seed") == 0) {
+            params.seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--functions") == 0) {
+            params.functions = (u32)strtoul(argv[++i], NULL, 10);
+            params.size = 0;
+        } else if (strcmp(argv[i], "--size") == 0) {
+            params.size = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            params.depth = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--statements") == 0) {
+            params.statements = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ident") == 0) {
+            if (sscanf(argv[++i], "%u:%u", &params.ident_min, &params.ident_max) != 2) usage();
+        } else if (strcmp(argv[i], "--digits") == 0) {
+            params.number_max_digits = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--call-depth") == 0) {
+            params.call_depth = (u32)strtoul(argv[++i], NULL, 10);
+        } else {
+            usage();
+        }
+    }
+
+    if (params.statements == 0 || params.ident_min > params.ident_max) usage();
+    if (params.number_max_digits == 0 || params.number_max_digits > 9) usage();
+
+    struct string program = gen_program(params);
+    fwrite(program.cstr, 1, program.length, stdout);
+    free((void*)program.cstr);
+
+    return 0;
+}
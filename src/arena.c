@@ -7,6 +7,7 @@ static inline void arena_init(struct arena* arena, usize capacity) {
     arena->capacity = capacity;
     arena->mem_start = mem;
     arena->mem_cursor = mem;
+    arena->peak = 0;
 }
 
 struct arena arena_create(usize capacity) {
@@ -22,6 +23,7 @@ void arena_destroy(struct arena* arena) {
     arena->mem_cursor = 0;
     arena->mem_start = 0;
     arena->capacity = 0;
+    arena->peak = 0;
 }
 
 void* arena_alloc(struct arena* arena, usize size) {
@@ -29,7 +31,10 @@ void* arena_alloc(struct arena* arena, usize size) {
 
     ASSERT(size <= arena->capacity - arena_used(arena));
 
-    return (arena->mem_cursor += size) - size;
+    arena->mem_cursor += size;
+    arena->peak = MAX(arena->peak, arena_used(arena));
+
+    return arena->mem_cursor - size;
 }
 
 void arena_clear(struct arena* arena) {
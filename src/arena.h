@@ -9,6 +9,7 @@ struct arena {
     void* mem_start;
     void* mem_cursor;
     usize capacity;
+    usize peak; /* high-water mark of `arena_used', survives `arena_clear' */
 };
 
 struct arena arena_create(usize capacity);
@@ -7,14 +7,56 @@ struct node node_create_root(struct node_link link) {
     return node;
 }
 
-struct node node_create_func_decl(u32 symbol_node, u32 body) {
+struct node node_create_func_decl(u32 proto, u32 body) {
     struct node node = {0};
     node.kind = NODE_FUNCDECL;
-    node.func_decl.symbol = symbol_node;
+    node.func_decl.proto = proto;
     node.func_decl.body = body;
     return node;
 }
 
+struct node node_create_proto(u32 symbol_node, u32 params, enum type_kind ret) {
+    struct node node = {0};
+    node.kind = NODE_PROTO;
+    node.proto.symbol = symbol_node;
+    node.proto.params = params;
+    node.type = ret;
+    return node;
+}
+
+struct node node_create_param(const char* ptr, u16 length, enum type_kind type) {
+    struct node node = {0};
+    node.kind = NODE_PARAM;
+    node.str = ptr;
+    node.length = length;
+    node.type = type;
+    return node;
+}
+
+struct node node_create_call(u32 callee, u32 args) {
+    struct node node = {0};
+    node.kind = NODE_CALL;
+    node.call.callee = callee;
+    node.call.args = args;
+    return node;
+}
+
+struct node node_create_param_ref(u32 index) {
+    struct node node = {0};
+    node.kind = NODE_PARAMREF;
+    node.param_ref.index = index;
+    return node;
+}
+
+struct node node_create_binary(enum node_kind kind, u32 lhs, u32 rhs) {
+    struct node node = {0};
+    ASSERT(node_is_binary(kind));
+    node.kind = kind;
+    node.binary.lhs = lhs;
+    node.binary.rhs = rhs;
+    return node;
+}
+
 struct node node_create_block(struct node_link link) {
     struct node node = {0};
     node.kind = NODE_BLOCK;
@@ -29,6 +71,22 @@ struct node node_create_return(u32 expr) {
     return node;
 }
 
+struct node node_create_if(u32 cond, u32 arms) {
+    struct node node = {0};
+    node.kind = NODE_IF;
+    node.if_stmt.cond = cond;
+    node.if_stmt.arms = arms;
+    return node;
+}
+
+struct node node_create_arms(u32 then, u32 otherwise) {
+    struct node node = {0};
+    node.kind = NODE_ARMS;
+    node.arms.then = then;
+    node.arms.otherwise = otherwise;
+    return node;
+}
+
 struct node node_create_number(i64 number) {
     struct node node = {0};
     node.kind = NODE_NUMBER;
@@ -36,6 +94,48 @@ struct node node_create_number(i64 number) {
     return node;
 }
 
+struct node node_create_index(u32 slice, u32 expr) {
+    struct node node = {0};
+    node.kind = NODE_INDEX;
+    node.index.slice = slice;
+    node.index.expr = expr;
+    return node;
+}
+
+struct node node_create_slice(u32 ptr, u32 len) {
+    struct node node = {0};
+    node.kind = NODE_SLICE;
+    node.slice.ptr = ptr;
+    node.slice.len = len;
+    node.type = TYPE_SLICE;
+    return node;
+}
+
+struct node node_create_data(u32 elems, u32 count) {
+    struct node node = {0};
+    node.kind = NODE_DATA;
+    node.data.elems = elems;
+    node.data.count = count;
+    node.type = TYPE_SLICE;
+    return node;
+}
+
+struct node node_create_optional(u32 value, u32 present, enum type_kind type) {
+    struct node node = {0};
+    node.kind = NODE_OPTIONAL;
+    node.optional.value = value;
+    node.optional.present = present;
+    node.type = type;
+    return node;
+}
+
+struct node node_create_comptime(u32 expr) {
+    struct node node = {0};
+    node.kind = NODE_COMPTIME;
+    node.comptime.expr = expr;
+    return node;
+}
+
 struct node node_create_symbol(const char* ptr, u16 length) {
     struct node node = {0};
     node.kind = NODE_SYMBOL;
@@ -51,13 +151,133 @@ struct node node_create_link(u32 ptr, u32 next) {
     return node;
 }
 
+const char* type_kind_to_cstr(enum type_kind kind) {
+    switch (kind) {
+        case TYPE_NONE: return "<none>"; break;
+        case TYPE_VOID: return "void"; break;
+        case TYPE_I32: return "i32"; break;
+        case TYPE_SLICE: return "[]i32"; break;
+        case TYPE_OPT_I32: return "?i32"; break;
+        case TYPE_OPT_SLICE: return "?[]i32"; break;
+        case TYPE_NULL: return "null"; break;
+        case __type_kind_count: break;
+    }
+
+    UNREACHABLE("type_kind_to_cstr");
+}
+
+bool type_is_pair(enum type_kind kind) {
+    return kind == TYPE_SLICE || kind == TYPE_OPT_I32 || kind == TYPE_OPT_SLICE;
+}
+
+bool type_is_pointer(enum type_kind kind) {
+    return kind == TYPE_SLICE || kind == TYPE_OPT_SLICE;
+}
+
 struct ast ast_from_node_list(struct node_list nodes) {
     return (struct ast){
-        .ptr    = nodes.at,
-        .length = nodes.length,
+        .ptr      = nodes.at,
+        .length   = nodes.length,
+        .capacity = nodes.capacity,
+        .instances = {0},
+        .names    = {0},
+        .generic_calls = 0,
+        .comptime = {0},
+        .exports  = {0},
     };
 }
 
+void ast_free(struct ast* ast) {
+    for (usize i = 0; i < ast->names.length; ++i) free(ast->names.at[i]);
+    DYNARRAY_FREE(ast->names);
+    DYNARRAY_FREE(ast->instances);
+    DYNARRAY_FREE(ast->comptime);
+    DYNARRAY_FREE(ast->exports);
+    free(ast->ptr);
+    ast->ptr = NULL;
+    ast->length = ast->capacity = 0;
+}
+
+u32 ast_add_node(struct ast* ast, struct node node) {
+    if (ast->length >= ast->capacity) {
+        ast->capacity = ast->capacity ? ast->capacity * 2 : 8;
+        ast->ptr = realloc(ast->ptr, ast->capacity * sizeof(*ast->ptr));
+    }
+
+    node.id = (u32)ast->length;
+    ast->ptr[ast->length++] = node;
+    return node.id;
+}
+
+bool node_is_binary(enum node_kind kind) {
+    return node_is_arithmetic(kind) || node_is_compare(kind);
+}
+
+bool node_is_arithmetic(enum node_kind kind) {
+    return kind == NODE_ADD || kind == NODE_SUB || kind == NODE_MUL;
+}
+
+bool node_is_compare(enum node_kind kind) {
+    return kind >= NODE_EQ && kind <= NODE_GE;
+}
+
+enum node_kind node_compare_mirror(enum node_kind kind) {
+    switch (kind) {
+        case NODE_LT: return NODE_GT; break;
+        case NODE_LE: return NODE_GE; break;
+        case NODE_GT: return NODE_LT; break;
+        case NODE_GE: return NODE_LE; break;
+        default: break;
+    }
+
+    ASSERT(kind == NODE_EQ || kind == NODE_NE);
+    return kind;
+}
+
+enum node_kind node_compare_negate(enum node_kind kind) {
+    switch (kind) {
+        case NODE_EQ: return NODE_NE; break;
+        case NODE_NE: return NODE_EQ; break;
+        case NODE_LT: return NODE_GE; break;
+        case NODE_LE: return NODE_GT; break;
+        case NODE_GT: return NODE_LE; break;
+        case NODE_GE: return NODE_LT; break;
+        default: break;
+    }
+
+    UNREACHABLE("node_compare_negate: not a comparison");
+}
+
+bool ast_link_advance(struct ast* ast, struct node_link* link) {
+    if (link->next == 0) return false;
+
+    ASSERT(ast->ptr[link->next].kind == NODE_LINK);
+    *link = ast->ptr[link->next].link;
+    return true;
+}
+
+u32 ast_list_length(struct ast* ast, u32 head) {
+    struct node_link link;
+    u32 length = 1;
+
+    if (head == 0) return 0;
+
+    link = ast->ptr[head].link;
+    while (ast_link_advance(ast, &link)) length++;
+
+    return length;
+}
+
+struct node ast_func_proto(struct ast* ast, struct node func_decl) {
+    ASSERT(func_decl.kind == NODE_FUNCDECL);
+    return ast->ptr[func_decl.func_decl.proto];
+}
+
+struct string ast_func_name(struct ast* ast, struct node func_decl) {
+    struct node sym = ast->ptr[ast_func_proto(ast, func_decl).proto.symbol];
+    return STRING_FROM_PARTS(sym.str, sym.length);
+}
+
 static inline void __indent(i32 indent) {
     for (i32 i = 0; i < indent * 2; ++i)
         putchar(' ');
@@ -85,18 +305,100 @@ void ast_pretty_print_node(struct ast* ast, struct node node, i32 indent) {
             ast_pretty_print_link(ast, node.link, indent+1);
             break;
         case NODE_FUNCDECL:
-            puts("func_decl:");
-            __indent(indent+1);
-            puts("name:");
-            ast_pretty_print_node(ast, ast->ptr[node.func_decl.symbol], indent+2);
+            puts(node.func_decl.body ? "func_decl:" : "extern func_decl:");
+            ast_pretty_print_node(ast, ast->ptr[node.func_decl.proto], indent+1);
+            if (node.func_decl.body == 0) break;
             __indent(indent+1);
             puts("body:");
             ast_pretty_print_node(ast, ast->ptr[node.func_decl.body], indent+2);
             break;
+        case NODE_PROTO:
+            puts("name:");
+            ast_pretty_print_node(ast, ast->ptr[node.proto.symbol], indent+1);
+            if (node.proto.params) {
+                __indent(indent);
+                puts("params:");
+                ast_pretty_print_link(ast, ast->ptr[node.proto.params].link, indent+1);
+            }
+            __indent(indent);
+            printf("returns: %s\n", type_kind_to_cstr(node.type));
+            break;
+        case NODE_PARAM:
+            printf("param: %.*s %s\n", (i32)node.length, node.str, type_kind_to_cstr(node.type));
+            break;
         case NODE_RETURN:
             puts("return:");
+            if (node.return_stmt.expr == 0) break;
             ast_pretty_print_node(ast, ast->ptr[node.return_stmt.expr], indent+1);
             break;
+        case NODE_CALL: {
+            struct string callee = ast_func_name(ast, ast->ptr[node.call.callee]);
+            puts("call:");
+            __indent(indent+1);
+            printf("callee: %.*s\n", (i32)callee.length, callee.cstr);
+            if (node.call.args == 0) break;
+            __indent(indent+1);
+            puts("args:");
+            ast_pretty_print_link(ast, ast->ptr[node.call.args].link, indent+2);
+        } break;
+        case NODE_PARAMREF:
+            printf("param_ref: %u\n", node.param_ref.index);
+            break;
+        case NODE_INDEX:
+            puts("index:");
+            ast_pretty_print_node(ast, ast->ptr[node.index.slice], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.index.expr], indent+1);
+            break;
+        case NODE_SLICE:
+            puts("slice:");
+            ast_pretty_print_node(ast, ast->ptr[node.slice.ptr], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.slice.len], indent+1);
+            break;
+        case NODE_DATA:
+            printf("data: %u element(s)\n", node.data.count);
+            if (node.data.elems != 0) ast_pretty_print_link(ast, ast->ptr[node.data.elems].link, indent+1);
+            break;
+        case NODE_OPTIONAL:
+            printf("optional: %s\n", type_kind_to_cstr(node.type));
+            if (node.type == TYPE_NULL) break;
+            ast_pretty_print_node(ast, ast->ptr[node.optional.value], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.optional.present], indent+1);
+            break;
+        case NODE_COMPTIME:
+            puts("comptime:");
+            ast_pretty_print_node(ast, ast->ptr[node.comptime.expr], indent+1);
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+            puts(node.kind == NODE_ADD ? "add:" : node.kind == NODE_SUB ? "sub:" : "mul:");
+            ast_pretty_print_node(ast, ast->ptr[node.binary.lhs], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.binary.rhs], indent+1);
+            break;
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE: {
+            static const char* names[] = { "eq:", "ne:", "lt:", "le:", "gt:", "ge:" };
+            puts(names[node.kind - NODE_EQ]);
+            ast_pretty_print_node(ast, ast->ptr[node.binary.lhs], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.binary.rhs], indent+1);
+        } break;
+        case NODE_IF:
+            puts("if:");
+            ast_pretty_print_node(ast, ast->ptr[node.if_stmt.cond], indent+1);
+            ast_pretty_print_node(ast, ast->ptr[node.if_stmt.arms], indent);
+            break;
+        case NODE_ARMS:
+            puts("then:");
+            ast_pretty_print_node(ast, ast->ptr[node.arms.then], indent+1);
+            if (node.arms.otherwise == 0) break;
+            __indent(indent);
+            puts("else:");
+            ast_pretty_print_node(ast, ast->ptr[node.arms.otherwise], indent+1);
+            break;
         case NODE_NUMBER:
             puts("number:");
             __indent(indent+1);
@@ -104,8 +406,7 @@ void ast_pretty_print_node(struct ast* ast, struct node node, i32 indent) {
             break;
         case NODE_BLOCK:
             puts("block:");
-            ASSERT(node.link.ptr != 0);
-            ast_pretty_print_link(ast, node.link, indent+1);
+            if (node.link.ptr != 0) ast_pretty_print_link(ast, node.link, indent+1);
             break;
         case NODE_SYMBOL:
             puts("symbol:");
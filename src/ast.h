@@ -2,6 +2,7 @@
 #define __AST_H
 
 #include "base.h"
+#include "string.h"
 
 struct node_link {
     u32 ptr;
@@ -15,15 +16,100 @@ struct node {
 
         struct node_link link;
 
-        /* TASK(251219-204326): Add argument support to user-defined functions */
         struct {
-            u32 symbol;
-            u32 body;
+            u32 proto;
+            u32 body;   /* 0 for extern functions */
         } func_decl;
 
+        /* the return type lives in `node.type' */
         struct {
-            u32 expr;
+            u32 symbol;
+            u32 params; /* list of NODE_PARAM, 0 when there are none */
+        } proto;
+
+        /* 
+         * `callee' is the NODE_SYMBOL while parsing and is resolved to the
+         * NODE_FUNCDECL before `parse' returns
+         * */
+        struct {
+            u32 callee;
+            u32 args;   /* list of expressions, 0 when there are none */
+        } call;
+
+        struct {
+            u32 index;  /* position in the parameter list of the function */
+        } param_ref;
+
+        struct {
+            u32 expr;   /* 0 for `return;' */
         } return_stmt;
+
+        /*
+         * NODE_ADD, NODE_SUB, NODE_MUL and the comparisons. Arithmetic wraps
+         * around like i32 does in hardware, comparisons are signed and give 0
+         * or 1.
+         * */
+        struct {
+            u32 lhs;
+            u32 rhs;
+        } binary;
+
+        /* NODE_IF, `arms' is the NODE_ARMS holding the two branches */
+        struct {
+            u32 cond;
+            u32 arms;
+        } if_stmt;
+
+        struct {
+            u32 then;
+            u32 otherwise;  /* 0 when there is no `else' */
+        } arms;
+
+        /*
+         * NODE_INDEX, `slice[expr]'. `slice' is a NODE_SLICE, the access
+         * traps unless 0 <= expr < len(slice).
+         * */
+        struct {
+            u32 slice;
+            u32 expr;
+        } index;
+
+        /*
+         * NODE_SLICE, a `[]i32' taken apart into the pointer to its first
+         * element and its length. Both are NODE_PARAMREFs (a slice parameter
+         * is two parameters, see `parse_params') or the NODE_DATA and
+         * NODE_NUMBER of a slice literal, so they can be read any number of
+         * times.
+         * */
+        struct {
+            u32 ptr;
+            u32 len;
+        } slice;
+
+        /* NODE_DATA, the elements of a slice literal in read-only memory */
+        struct {
+            u32 elems;  /* list of NODE_NUMBER, 0 for `[]' */
+            u32 count;
+        } data;
+
+        /*
+         * NODE_OPTIONAL, an optional parameter taken apart like a slice (see
+         * layout.h), or `null' with both 0 until it is known which optional
+         * it is. Only the parser sees them, they are passed along as their
+         * two parts and compared with `null' as a test of `present'.
+         * */
+        struct {
+            u32 value;
+            u32 present;
+        } optional;
+
+        /*
+         * NODE_COMPTIME, `comptime expr'. Evaluated while compiling and
+         * replaced by the NODE_NUMBER it comes to, see comptime.h.
+         * */
+        struct {
+            u32 expr;
+        } comptime;
     };
 
     u32 id; /* each ast node will know it's own id */
@@ -31,9 +117,29 @@ struct node {
     enum node_kind : u8 {
         NODE_ROOT,
         NODE_FUNCDECL,
+        NODE_PROTO,
+        NODE_PARAM,
         NODE_RETURN,
         NODE_NUMBER,
+        NODE_CALL,
+        NODE_PARAMREF,
+        NODE_ADD,
+        NODE_SUB,
+        NODE_MUL,
+        NODE_EQ,
+        NODE_NE,
+        NODE_LT,
+        NODE_LE,
+        NODE_GT,
+        NODE_GE,
+        NODE_IF,
+        NODE_ARMS,
         NODE_BLOCK,
+        NODE_INDEX,
+        NODE_SLICE,
+        NODE_DATA,
+        NODE_OPTIONAL,
+        NODE_COMPTIME,
         NODE_SYMBOL,
         NODE_LINK,
         __node_kind_count,
@@ -44,7 +150,22 @@ struct node {
      * separate length field  */
     u16 length;
 
-    u8 padding;
+    /*
+     * return type of a NODE_PROTO, type of a NODE_PARAM. The expressions
+     * standing for the pointer half of a slice (NODE_PARAMREF, NODE_DATA)
+     * are TYPE_SLICE as well, the first half of an optional is its type,
+     * everything else is an i32.
+     * */
+    enum type_kind : u8 {
+        TYPE_NONE,
+        TYPE_VOID,
+        TYPE_I32,
+        TYPE_SLICE,     /* []i32 */
+        TYPE_OPT_I32,   /* ?i32 */
+        TYPE_OPT_SLICE, /* ?[]i32 */
+        TYPE_NULL,      /* `null', before it is known which optional it is */
+        __type_kind_count,
+    } type;
 };
 
 struct node_list {
@@ -54,19 +175,93 @@ struct node_list {
 };
 
 struct node node_create_root(struct node_link link);
-struct node node_create_func_decl(u32 symbol_node, u32 body);
+struct node node_create_func_decl(u32 proto, u32 body);
+struct node node_create_proto(u32 symbol_node, u32 params, enum type_kind ret);
+struct node node_create_param(const char* ptr, u16 length, enum type_kind type);
+struct node node_create_call(u32 callee, u32 args);
+struct node node_create_param_ref(u32 index);
+struct node node_create_binary(enum node_kind kind, u32 lhs, u32 rhs);
 struct node node_create_block(struct node_link link);
 struct node node_create_return(u32 expr);
+struct node node_create_if(u32 cond, u32 arms);
+struct node node_create_arms(u32 then, u32 otherwise);
 struct node node_create_number(i64 number);
+struct node node_create_index(u32 slice, u32 expr);
+struct node node_create_slice(u32 ptr, u32 len);
+struct node node_create_data(u32 elems, u32 count);
+struct node node_create_optional(u32 value, u32 present, enum type_kind type);
+struct node node_create_comptime(u32 expr);
 struct node node_create_symbol(const char* ptr, u16 length);
 struct node node_create_link(u32 ptr, u32 next);
 
+/* A generic function instantiated for one set of type arguments, see `parse' */
+struct ast_instance {
+    u32 decl;       /* the NODE_FUNCDECL it became */
+    u32 generic;    /* which generic function, numbered in declaration order */
+};
+
+struct ast_instances {
+    struct ast_instance* at;
+    DYNARRAY_FIELDS;
+};
+
+struct ast_decls {
+    u32* at;
+    DYNARRAY_FIELDS;
+};
+
+/* Names which are not in the source, like the symbols of instances */
+struct ast_names {
+    char** at;
+    DYNARRAY_FIELDS;
+};
+
 struct ast {
     struct node* ptr;
     usize length;
+    usize capacity;
+    struct ast_instances instances;
+    struct ast_names names;
+    u32 generic_calls;  /* calls to generic functions, each one an instance or a hit in the cache */
+    struct ast_decls comptime;  /* NODE_FUNCDECLs declared `comptime', see comptime.h */
+    struct ast_decls exports;   /* NODE_FUNCDECLs declared `export', see prune.h */
 };
 
+const char* type_kind_to_cstr(enum type_kind kind);
+/* Slices and optionals are passed as two parameters, the second one always an i32 */
+bool type_is_pair(enum type_kind kind);
+/* The first half is a pointer, 64 bits wide */
+bool type_is_pointer(enum type_kind kind);
+
 struct ast ast_from_node_list(struct node_list nodes);
+void ast_free(struct ast* ast);
+
+/* For passes which rewrite the tree after parsing. Returns the id of the new node */
+u32 ast_add_node(struct ast* ast, struct node node);
+
+/* Arithmetic and comparisons, everything using `node.binary' */
+bool node_is_binary(enum node_kind kind);
+bool node_is_arithmetic(enum node_kind kind);
+bool node_is_compare(enum node_kind kind);
+
+/* `a < b' is `b > a' */
+enum node_kind node_compare_mirror(enum node_kind kind);
+/* `!(a < b)' is `a >= b' */
+enum node_kind node_compare_negate(enum node_kind kind);
+
+/*
+ * Lists (root, block, params, args) are chains of NODE_LINKs. Moves `link'
+ * to the next element and returns false when there is none.
+ * */
+bool ast_link_advance(struct ast* ast, struct node_link* link);
+
+/* Number of elements in the list whose head is the NODE_LINK `head' (0 is empty) */
+u32 ast_list_length(struct ast* ast, u32 head);
+
+/* Convenience accessors for function declarations */
+struct node ast_func_proto(struct ast* ast, struct node func_decl);
+struct string ast_func_name(struct ast* ast, struct node func_decl);
+
 void ast_pretty_print_link(struct ast* ast, struct node_link link, i32 indent);
 void ast_pretty_print_node(struct ast* ast, struct node node, i32 indent);
 void ast_pretty_print(struct ast* ast);
@@ -94,6 +94,23 @@ typedef long double     f128;
 #define MEGABYTES(n) (KILOBYTES(n) * 1024)
 #define GIGABYTES(n) (MEGABYTES(n) * 1024)
 
+/* Hashing */
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/* FNV-1a of `length' bytes at `data', carrying on from `hash', which is FNV_OFFSET to start with */
+static inline u64 fnv1a(u64 hash, const void* data, usize length) {
+    const u8* bytes = data;
+
+    for (usize i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
 /*
  * ==================================================
  * =                 DATA STRUCTURES                =
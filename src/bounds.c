@@ -0,0 +1,631 @@
+#include "bounds.h"
+
+/*
+ * What is known at a point of a function: facts `lhs < rhs + k' between
+ * terms. A term is a pure expression, compared by its shape, or a constant
+ * when `node' is 0. Constants on either side are folded into the constant,
+ * so that `k' is only ever needed between two expressions.
+ * */
+
+struct term {
+    u32 node;
+    i64 value;
+};
+
+enum fact_origin : u8 {
+    ORIGIN_CONDITION = 1 << 0,
+    ORIGIN_CHECK = 1 << 1,      /* an access, checked or proven */
+    ORIGIN_GUARD = 1 << 2,      /* assumed on entry to the fast version */
+};
+
+struct fact {
+    struct term lhs;
+    struct term rhs;
+    i64 k;
+    enum fact_origin origin;
+};
+
+struct facts {
+    struct fact* at;
+    DYNARRAY_FIELDS;
+};
+
+/* A guard being tried, with nodes to stand for its parameter and length in facts */
+struct candidate {
+    struct bounds_guard guard;
+    u32 param_node;
+    u32 len_node;
+    bool preserved;     /* by every tail call to the function seen so far */
+};
+
+struct candidates {
+    struct candidate* at;
+    DYNARRAY_FIELDS;
+};
+
+struct walker {
+    struct ast* ast;
+    struct bounds* bounds;
+    struct facts facts;
+    u32 decl;
+    u8* types;                  /* of the parameters, by index */
+    u32 nparams;
+    struct candidates guards;   /* assumed on entry when `fast' */
+    bool fast;
+    bool collect;               /* suggest guards for the checks which stay */
+    bool record;                /* the last walk, decisions and stats are written */
+    u32 tail_calls;             /* to the function itself */
+    u32 induction;              /* accesses only proven thanks to the guards */
+};
+
+static inline struct term term_of(struct ast* ast, u32 nodeid);
+static inline struct term constant(i64 value);
+static inline bool is_pure(struct ast* ast, u32 nodeid);
+static inline bool same_node(struct ast* ast, u32 a, u32 b);
+static inline bool same_term(struct ast* ast, struct term a, struct term b);
+static inline void add_fact(struct walker* w, struct term lhs, struct term rhs, i64 k, enum fact_origin origin);
+static inline bool is_len(struct walker* w, u32 nodeid);
+static inline bool known_lt(struct walker* w, struct term a, struct term b, i64 k, u8* origin);
+static inline bool offset_of(struct ast* ast, u32 nodeid, u32* base, i64* offset);
+static inline bool no_overflow(struct walker* w, struct term x, i64 c, u8* origin);
+static inline bool known_nonneg(struct walker* w, u32 nodeid, u8* origin);
+static inline bool known_below(struct walker* w, u32 nodeid, u32 len, u8* origin);
+static inline void learn_condition(struct walker* w, u32 cond, bool holds);
+static inline void suggest_guards(struct walker* w, struct node node, bool lower, bool upper);
+static inline void check_access(struct walker* w, struct node node);
+static inline u32 arg_at(struct ast* ast, u32 args, u32 index);
+static inline bool keeps_guard(struct walker* w, struct node call, struct candidate* c);
+static inline void tail_call(struct walker* w, struct node call);
+static inline void walk_expression(struct walker* w, u32 nodeid);
+static inline bool walk_statement(struct walker* w, u32 nodeid);
+static inline void walk_func(struct walker* w, u32 body);
+static inline void analyze_func(struct walker* w, struct node decl);
+
+static inline struct term term_of(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+
+    if (node.kind == NODE_NUMBER) return constant(node.number);
+    return (struct term){ .node = nodeid, .value = 0 };
+}
+
+static inline struct term constant(i64 value) {
+    return (struct term){ .node = 0, .value = value };
+}
+
+/* Evaluates to the same value every time, parameters never change */
+static inline bool is_pure(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+
+    if (node.kind == NODE_NUMBER || node.kind == NODE_PARAMREF) return true;
+    if (!node_is_binary(node.kind)) return false;
+    return is_pure(ast, node.binary.lhs) && is_pure(ast, node.binary.rhs);
+}
+
+static inline bool same_node(struct ast* ast, u32 a, u32 b) {
+    struct node x = ast->ptr[a], y = ast->ptr[b];
+
+    if (a == b) return true;
+    if (x.kind != y.kind) return false;
+
+    switch (x.kind) {
+        case NODE_NUMBER: return x.number == y.number; break;
+        case NODE_PARAMREF: return x.param_ref.index == y.param_ref.index; break;
+        default: break;
+    }
+
+    if (!node_is_binary(x.kind)) return false;
+    return same_node(ast, x.binary.lhs, y.binary.lhs) && same_node(ast, x.binary.rhs, y.binary.rhs);
+}
+
+static inline bool same_term(struct ast* ast, struct term a, struct term b) {
+    if (a.node == 0 || b.node == 0) return a.node == b.node && a.value == b.value;
+    return same_node(ast, a.node, b.node);
+}
+
+static inline void add_fact(struct walker* w, struct term lhs, struct term rhs, i64 k, enum fact_origin origin) {
+    if (lhs.node == 0) {
+        lhs.value -= k;
+        k = 0;
+    } else if (rhs.node == 0) {
+        rhs.value += k;
+        k = 0;
+    }
+
+    DYNARRAY_APPEND(w->facts, ((struct fact){ .lhs = lhs, .rhs = rhs, .k = k, .origin = origin }));
+}
+
+/* The length of a slice parameter, the unnamed one after its pointer */
+static inline bool is_len(struct walker* w, u32 nodeid) {
+    struct node node = w->ast->ptr[nodeid];
+
+    if (node.kind != NODE_PARAMREF) return false;
+    return node.param_ref.index > 0 && w->types[node.param_ref.index - 1] == TYPE_SLICE;
+}
+
+/*
+ * `a < b + k', straight from the constants or a single fact: any fact
+ * `l < r + j' with a <= l and r + j <= b + k will do.
+ * */
+static inline bool known_lt(struct walker* w, struct term a, struct term b, i64 k, u8* origin) {
+    struct fact fact;
+    bool below, above;
+
+    if (a.node == 0 && b.node == 0) return a.value < b.value + k;
+    if (same_term(w->ast, a, b) && k > 0) return true;
+
+    for (usize i = w->facts.length; i-- > 0;) {
+        fact = w->facts.at[i];
+
+        below = same_term(w->ast, a, fact.lhs) || (a.node == 0 && fact.lhs.node == 0 && a.value <= fact.lhs.value);
+        if (!below) continue;
+
+        above = (same_term(w->ast, fact.rhs, b) && fact.k <= k) ||
+                (fact.rhs.node == 0 && b.node == 0 && fact.rhs.value + fact.k <= b.value + k);
+        if (!above) continue;
+
+        *origin |= fact.origin;
+        return true;
+    }
+
+    return false;
+}
+
+/* `nodeid' is `base + offset' for a constant offset, `x - 1' and `x + -1' alike */
+static inline bool offset_of(struct ast* ast, u32 nodeid, u32* base, i64* offset) {
+    struct node node = ast->ptr[nodeid];
+    struct node rhs;
+
+    if (node.kind != NODE_ADD && node.kind != NODE_SUB) return false;
+    rhs = ast->ptr[node.binary.rhs];
+    if (rhs.kind != NODE_NUMBER) return false;
+
+    *base = node.binary.lhs;
+    *offset = node.kind == NODE_ADD ? rhs.number : -rhs.number;
+    return true;
+}
+
+/* `x + c' doesn't wrap around past INT32_MAX, for c >= 0 */
+static inline bool no_overflow(struct walker* w, struct term x, i64 c, u8* origin) {
+    struct fact fact;
+
+    if (x.node == 0) return x.value + c <= INT32_MAX;
+
+    for (usize i = 0; i < w->facts.length; ++i) {
+        fact = w->facts.at[i];
+        if (!same_term(w->ast, fact.lhs, x)) continue;
+
+        /* x < r + k, and r is an i32 itself */
+        if ((fact.rhs.node == 0 && fact.rhs.value + fact.k - 1 + c <= INT32_MAX) ||
+            (fact.rhs.node != 0 && fact.k + c <= 1)) {
+            *origin |= fact.origin;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* 0 <= nodeid */
+static inline bool known_nonneg(struct walker* w, u32 nodeid, u8* origin) {
+    struct term term = term_of(w->ast, nodeid);
+    u8 found = 0;
+    u32 base;
+    i64 offset;
+
+    if (term.node == 0) return term.value >= 0;
+    if (is_len(w, nodeid)) return true;
+    if (known_lt(w, constant(-1), term, 0, origin)) return true;
+    if (!offset_of(w->ast, nodeid, &base, &offset) || !is_pure(w->ast, base)) return false;
+
+    /* x - c is not negative when c <= x, x + c when x isn't and doesn't wrap around */
+    if (offset < 0) {
+        if (!known_lt(w, constant(-offset - 1), term_of(w->ast, base), 0, &found)) return false;
+    } else {
+        if (!known_nonneg(w, base, &found) || !no_overflow(w, term_of(w->ast, base), offset, &found)) return false;
+    }
+
+    *origin |= found;
+    return true;
+}
+
+/* nodeid < len */
+static inline bool known_below(struct walker* w, u32 nodeid, u32 len, u8* origin) {
+    struct term term = term_of(w->ast, nodeid);
+    u8 found = 0;
+    u32 base;
+    i64 offset;
+
+    if (known_lt(w, term, term_of(w->ast, len), 0, origin)) return true;
+    if (!offset_of(w->ast, nodeid, &base, &offset) || offset >= 0 || !is_pure(w->ast, base)) return false;
+
+    /* x - c < len when x < len + c and x - c doesn't wrap around, `len(s) - 1' is one */
+    if (!known_lt(w, term_of(w->ast, base), term_of(w->ast, len), -offset, &found)) return false;
+    if (!known_nonneg(w, base, &found)) return false;
+
+    *origin |= found;
+    return true;
+}
+
+/* What `cond' being `holds' says about its operands */
+static inline void learn_condition(struct walker* w, u32 cond, bool holds) {
+    struct node node = w->ast->ptr[cond];
+    struct term a, b;
+    enum node_kind kind;
+
+    if (!node_is_compare(node.kind) || !is_pure(w->ast, cond)) return;
+
+    a = term_of(w->ast, node.binary.lhs);
+    b = term_of(w->ast, node.binary.rhs);
+    kind = node.kind;
+
+    if (!holds) {
+        switch (kind) {
+            case NODE_LT: kind = NODE_GE; break;
+            case NODE_LE: kind = NODE_GT; break;
+            case NODE_GT: kind = NODE_LE; break;
+            case NODE_GE: kind = NODE_LT; break;
+            case NODE_EQ: kind = NODE_NE; break;
+            case NODE_NE: kind = NODE_EQ; break;
+            default: UNREACHABLE("learn_condition: not a comparison");
+        }
+    }
+
+    switch (kind) {
+        case NODE_LT: add_fact(w, a, b, 0, ORIGIN_CONDITION); break;
+        case NODE_LE: add_fact(w, a, b, 1, ORIGIN_CONDITION); break;
+        case NODE_GT: add_fact(w, b, a, 0, ORIGIN_CONDITION); break;
+        case NODE_GE: add_fact(w, b, a, 1, ORIGIN_CONDITION); break;
+        case NODE_EQ:
+            add_fact(w, a, b, 1, ORIGIN_CONDITION);
+            add_fact(w, b, a, 1, ORIGIN_CONDITION);
+            break;
+        default:
+            break;
+    }
+}
+
+/* `s[i]' for parameters `s' and `i' can have what it is missing checked on entry instead */
+static inline void suggest_guards(struct walker* w, struct node node, bool lower, bool upper) {
+    struct node slice = w->ast->ptr[node.index.slice];
+    struct node index = w->ast->ptr[node.index.expr];
+    struct candidate c = {0};
+
+    if (index.kind != NODE_PARAMREF || !is_len(w, slice.slice.len)) return;
+    if (w->types[index.param_ref.index] == TYPE_SLICE) return;
+
+    for (u32 g = 0; g < 2; ++g) {
+        if (g == 0 ? lower : upper) continue;
+
+        c = (struct candidate){
+            .guard = {
+                .decl = w->decl,
+                .param = index.param_ref.index,
+                .len = g == 0 ? BOUNDS_NONNEG : w->ast->ptr[slice.slice.len].param_ref.index,
+            },
+            .param_node = index.id,
+            .len_node = slice.slice.len,
+            .preserved = true,
+        };
+
+        for (usize i = 0; i < w->guards.length && c.param_node != 0; ++i) {
+            if (w->guards.at[i].guard.param == c.guard.param && w->guards.at[i].guard.len == c.guard.len) {
+                c.param_node = 0;
+            }
+        }
+        if (c.param_node != 0) DYNARRAY_APPEND(w->guards, c);
+    }
+}
+
+static inline void check_access(struct walker* w, struct node node) {
+    struct node slice = w->ast->ptr[node.index.slice];
+    struct term index = term_of(w->ast, node.index.expr);
+    struct term len = term_of(w->ast, slice.slice.len);
+    bool repeated = false, lower, upper;
+    u8 origin = 0;
+
+    /* the same access checked before, unless the guards had to help with that one */
+    for (usize i = 0; i < w->facts.length && index.node != 0; ++i) {
+        struct fact fact = w->facts.at[i];
+        repeated |= fact.origin == ORIGIN_CHECK && fact.k == 0 && same_term(w->ast, fact.lhs, index) &&
+                    same_term(w->ast, fact.rhs, len);
+    }
+
+    lower = known_nonneg(w, node.index.expr, &origin);
+    upper = known_below(w, node.index.expr, slice.slice.len, &origin);
+
+    if (w->collect && !(lower && upper)) suggest_guards(w, node, lower, upper);
+    if (lower && upper && (origin & ORIGIN_GUARD)) w->induction++;
+
+    if (w->record) {
+        w->bounds->stats.accesses++;
+
+        if (lower && upper) {
+            w->bounds->check[node.id] = origin & ORIGIN_GUARD ? BOUNDS_UNCHECKED_FAST : BOUNDS_UNCHECKED;
+
+            if (origin & ORIGIN_GUARD) w->bounds->stats.induction++;
+            else if (index.node == 0 && len.node == 0) w->bounds->stats.constant++;
+            else if (repeated) w->bounds->stats.repeated++;
+            else w->bounds->stats.dominated++;
+        }
+    }
+
+    /* whatever happened, past here the index is in bounds */
+    if (!is_pure(w->ast, node.index.expr)) return;
+    add_fact(w, constant(-1), index, 0, ORIGIN_CHECK);
+    add_fact(w, index, len, 0, ORIGIN_CHECK);
+}
+
+static inline u32 arg_at(struct ast* ast, u32 args, u32 index) {
+    struct node_link link = ast->ptr[args].link;
+
+    for (u32 i = 0; i < index; ++i) ast_link_advance(ast, &link);
+    return link.ptr;
+}
+
+/* Do the arguments of a tail call to ourselves satisfy the guard again? */
+static inline bool keeps_guard(struct walker* w, struct node call, struct candidate* c) {
+    u32 arg = arg_at(w->ast, call.call.args, c->guard.param);
+    struct node ptr, len;
+    u8 origin = 0;
+
+    if (c->guard.len == BOUNDS_NONNEG) return known_nonneg(w, arg, &origin);
+
+    /* the same slice is passed along */
+    ptr = w->ast->ptr[arg_at(w->ast, call.call.args, c->guard.len - 1)];
+    len = w->ast->ptr[arg_at(w->ast, call.call.args, c->guard.len)];
+    if (ptr.kind != NODE_PARAMREF || ptr.param_ref.index != c->guard.len - 1) return false;
+    if (len.kind != NODE_PARAMREF || len.param_ref.index != c->guard.len) return false;
+
+    return known_below(w, arg, c->len_node, &origin);
+}
+
+static inline void tail_call(struct walker* w, struct node call) {
+    bool keeps = w->fast;
+
+    w->tail_calls++;
+
+    for (usize i = 0; i < w->guards.length && w->fast; ++i) {
+        w->guards.at[i].preserved &= keeps_guard(w, call, &w->guards.at[i]);
+        keeps &= w->guards.at[i].preserved;
+    }
+
+    if (w->record && keeps) w->bounds->check[call.id] = BOUNDS_KEEPS_GUARDS;
+}
+
+static inline void walk_expression(struct walker* w, u32 nodeid) {
+    struct node node = w->ast->ptr[nodeid];
+    struct facts args = {0};
+    struct node_link link;
+    usize mark;
+
+    switch (node.kind) {
+        case NODE_INDEX:
+            walk_expression(w, node.index.expr);
+            check_access(w, node);
+            break;
+        case NODE_CALL:
+            if (node.call.args == 0) break;
+
+            /* the arguments can be evaluated in any order, none learns from another */
+            mark = w->facts.length;
+            link = w->ast->ptr[node.call.args].link;
+            do {
+                walk_expression(w, link.ptr);
+                for (usize i = mark; i < w->facts.length; ++i) DYNARRAY_APPEND(args, w->facts.at[i]);
+                w->facts.length = mark;
+            } while (ast_link_advance(w->ast, &link));
+
+            for (usize i = 0; i < args.length; ++i) DYNARRAY_APPEND(w->facts, args.at[i]);
+            DYNARRAY_FREE(args);
+            break;
+        default:
+            if (!node_is_binary(node.kind)) break;
+            walk_expression(w, node.binary.lhs);
+            walk_expression(w, node.binary.rhs);
+            break;
+    }
+}
+
+/* Returns whether the statement always returns, everything after it is unreachable */
+static inline bool walk_statement(struct walker* w, u32 nodeid) {
+    struct node node = w->ast->ptr[nodeid];
+    struct node arms, expr;
+    struct node_link link;
+    bool then_returns, otherwise_returns, record;
+    usize mark;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr == 0) return true;
+
+            walk_expression(w, node.return_stmt.expr);
+            expr = w->ast->ptr[node.return_stmt.expr];
+            if (expr.kind == NODE_CALL && expr.call.callee == w->decl) tail_call(w, expr);
+            return true;
+        case NODE_IF:
+            arms = w->ast->ptr[node.if_stmt.arms];
+            walk_expression(w, node.if_stmt.cond);
+            mark = w->facts.length;
+
+            learn_condition(w, node.if_stmt.cond, true);
+            then_returns = walk_statement(w, arms.arms.then);
+            w->facts.length = mark;
+
+            learn_condition(w, node.if_stmt.cond, false);
+            otherwise_returns = arms.arms.otherwise != 0 && walk_statement(w, arms.arms.otherwise);
+            if (then_returns && !otherwise_returns) return false;
+            w->facts.length = mark;
+
+            /* past the `if' only the `then' arm ran, walked again for what it learned on the way */
+            if (otherwise_returns && !then_returns) {
+                record = w->record;
+                w->record = false;
+                learn_condition(w, node.if_stmt.cond, true);
+                walk_statement(w, arms.arms.then);
+                w->record = record;
+            }
+            return then_returns && otherwise_returns;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return false;
+            link = node.link;
+            do {
+                if (walk_statement(w, link.ptr)) return true;
+            } while (ast_link_advance(w->ast, &link));
+            return false;
+        default:
+            walk_expression(w, nodeid);
+            return false;
+    }
+}
+
+static inline void walk_func(struct walker* w, u32 body) {
+    struct candidate c;
+
+    DYNARRAY_CLEAR(w->facts);
+    w->tail_calls = 0;
+    w->induction = 0;
+
+    for (usize i = 0; i < w->guards.length && w->fast; ++i) {
+        c = w->guards.at[i];
+        w->guards.at[i].preserved = true;
+        if (c.guard.len == BOUNDS_NONNEG) add_fact(w, constant(-1), term_of(w->ast, c.param_node), 0, ORIGIN_GUARD);
+        else add_fact(w, term_of(w->ast, c.param_node), term_of(w->ast, c.len_node), 0, ORIGIN_GUARD);
+    }
+
+    walk_statement(w, body);
+}
+
+/*
+ * The checks left over suggest guards. They are worth it when the function
+ * loops by calling itself: guards which some tail call doesn't keep are
+ * dropped until all of them are kept, and then the guards have to make
+ * some check go away.
+ * */
+static inline void analyze_func(struct walker* w, struct node decl) {
+    struct node proto = ast_func_proto(w->ast, decl);
+    struct node_link link;
+    usize kept;
+    u32 index = 0;
+
+    w->decl = decl.id;
+    w->nparams = ast_list_length(w->ast, proto.proto.params);
+    w->types = realloc(w->types, MAX(w->nparams, 1));
+    ASSERT(w->types);
+
+    if (proto.proto.params != 0) {
+        link = w->ast->ptr[proto.proto.params].link;
+        do {
+            w->types[index++] = w->ast->ptr[link.ptr].type;
+        } while (ast_link_advance(w->ast, &link));
+    }
+
+    DYNARRAY_CLEAR(w->guards);
+    w->fast = false;
+    w->collect = true;
+    w->record = false;
+    walk_func(w, decl.func_decl.body);
+    w->collect = false;
+
+    if (w->tail_calls == 0) DYNARRAY_CLEAR(w->guards);
+
+    while (w->guards.length > 0) {
+        w->fast = true;
+        walk_func(w, decl.func_decl.body);
+
+        kept = 0;
+        for (usize i = 0; i < w->guards.length; ++i) {
+            if (w->guards.at[i].preserved) w->guards.at[kept++] = w->guards.at[i];
+        }
+        if (kept == w->guards.length) break;
+        w->guards.length = kept;
+    }
+
+    if (w->guards.length > 0 && w->induction == 0) DYNARRAY_CLEAR(w->guards);
+
+    w->fast = w->guards.length > 0;
+    w->record = true;
+    walk_func(w, decl.func_decl.body);
+
+    for (usize i = 0; i < w->guards.length; ++i) {
+        DYNARRAY_APPEND(w->bounds->guards, w->guards.at[i].guard);
+    }
+    w->bounds->stats.guards += (u32)w->guards.length;
+    w->bounds->stats.versioned += w->guards.length > 0;
+}
+
+struct bounds bounds_analyze(struct ast* ast, bool enabled) {
+    struct bounds bounds = {
+        .check = calloc(MAX(ast->length, 1), sizeof(u8)),
+        .nodes = (u32)ast->length,
+        .guards = {0},
+        .stats = {0},
+    };
+    struct walker w = {
+        .ast = ast,
+        .bounds = &bounds,
+        .facts = {0},
+        .types = NULL,
+        .guards = {0},
+    };
+    struct node_link link;
+    struct node decl;
+
+    ASSERT(bounds.check);
+    if (ast->ptr[0].link.ptr == 0) return bounds;
+
+    /* every access is counted and kept */
+    if (!enabled) {
+        for (u32 i = 0; i < ast->length; ++i) bounds.stats.accesses += ast->ptr[i].kind == NODE_INDEX;
+        return bounds;
+    }
+
+    link = ast->ptr[0].link;
+    do {
+        decl = ast->ptr[link.ptr];
+        if (decl.kind == NODE_FUNCDECL && decl.func_decl.body != 0) analyze_func(&w, decl);
+    } while (ast_link_advance(ast, &link));
+
+    DYNARRAY_FREE(w.facts);
+    DYNARRAY_FREE(w.guards);
+    free(w.types);
+
+    return bounds;
+}
+
+void bounds_free(struct bounds* bounds) {
+    free(bounds->check);
+    DYNARRAY_FREE(bounds->guards);
+    bounds->check = NULL;
+}
+
+enum bounds_check bounds_of(const struct bounds* bounds, u32 nodeid) {
+    if (bounds == NULL || nodeid >= bounds->nodes) return BOUNDS_CHECKED;
+    return (enum bounds_check)bounds->check[nodeid];
+}
+
+const struct bounds_guard* bounds_guards_of(const struct bounds* bounds, u32 decl, u32* count) {
+    const struct bounds_guard* first = NULL;
+
+    *count = 0;
+    if (bounds == NULL) return NULL;
+
+    for (usize i = 0; i < bounds->guards.length; ++i) {
+        if (bounds->guards.at[i].decl != decl) continue;
+        if (first == NULL) first = &bounds->guards.at[i];
+        (*count)++;
+    }
+
+    return first;
+}
+
+void bounds_report(FILE* out, const struct bounds* bounds) {
+    const struct bounds_stats* s = &bounds->stats;
+    u32 eliminated = s->constant + s->repeated + s->dominated + s->induction;
+
+    fprintf(out, "%-16s %10u\n", "accesses", s->accesses);
+    fprintf(out, "%-16s %10u\n", "constant", s->constant);
+    fprintf(out, "%-16s %10u\n", "repeated", s->repeated);
+    fprintf(out, "%-16s %10u\n", "dominated", s->dominated);
+    fprintf(out, "%-16s %10u (%u guards in %u functions)\n", "induction", s->induction, s->guards, s->versioned);
+    fprintf(out, "%-16s %10u\n", "kept", s->accesses - eliminated);
+}
@@ -0,0 +1,86 @@
+#ifndef __BOUNDS_H
+#define __BOUNDS_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Bounds check elimination.
+ *
+ * `s[i]' traps unless 0 <= i < len(s), which both backends check with a
+ * single unsigned compare. This pass walks every function in evaluation
+ * order with the facts known to hold at each point, `a < b + k' between
+ * pure expressions, and drops the check of every access whose index is
+ * already known to be in bounds:
+ *
+ *  - constant indexes into slice literals, or into slices already known to
+ *    be longer,
+ *  - repeated indexes, `s[i]' checked once is in bounds from there on,
+ *  - checks dominated by a condition or by an earlier check, like `s[i]'
+ *    under `if i < len(s)' or `s[i - 1]' after `s[i]' under `if i > 0'.
+ *
+ * Facts come from the condition of every `if' (in its arms, and after it
+ * when the other arm returns) and from every check on the way. Arguments of
+ * one call can be evaluated in any order, so they never learn from each
+ * other. A slice's length is never negative.
+ *
+ * Nomi has no loops, loops are functions calling themselves in tail
+ * position. For those, the checks which only fail for some values of the
+ * parameters on entry (`i < 0' in `sum(s, i + 1, ...)') are moved to the
+ * entry as guards on the parameters. The function is compiled twice: a fast
+ * version without the checks, which runs when the guards hold and which its
+ * tail calls jump back into when their arguments keep the guards true, and
+ * the fully checked original for everything else. Only the native backend
+ * does that, the interpreter keeps those checks.
+ * */
+
+enum bounds_check : u8 {
+    BOUNDS_CHECKED,         /* the default, nothing is known */
+    BOUNDS_UNCHECKED,       /* always in bounds */
+    BOUNDS_UNCHECKED_FAST,  /* in bounds in the fast version of its function */
+    BOUNDS_KEEPS_GUARDS,    /* a tail call to its own function which can go straight to the fast version */
+};
+
+#define BOUNDS_NONNEG UINT32_MAX
+
+/* What the fast version of `decl' assumes on entry: `0 <= param', or `param < len' */
+struct bounds_guard {
+    u32 decl;
+    u32 param;
+    u32 len;    /* the length parameter, BOUNDS_NONNEG for `0 <= param' */
+};
+
+struct bounds_guards {
+    struct bounds_guard* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bounds_stats {
+    u32 accesses;
+    u32 constant;
+    u32 repeated;
+    u32 dominated;
+    u32 induction;      /* only in the fast version */
+    u32 guards;
+    u32 versioned;      /* functions with a fast version */
+};
+
+struct bounds {
+    u8* check;          /* by node id, an `enum bounds_check' for NODE_INDEX and NODE_CALL */
+    u32 nodes;
+    struct bounds_guards guards;    /* grouped by function, in declaration order */
+    struct bounds_stats stats;
+};
+
+/* Finds the checks which can go, for every function; with `enabled' false every access stays checked */
+struct bounds bounds_analyze(struct ast* ast, bool enabled);
+void bounds_free(struct bounds* bounds);
+
+/* BOUNDS_CHECKED for nodes the pass has not seen */
+enum bounds_check bounds_of(const struct bounds* bounds, u32 nodeid);
+/* The first guard of `decl' and how many there are, NULL when it has no fast version */
+const struct bounds_guard* bounds_guards_of(const struct bounds* bounds, u32 decl, u32* count);
+
+void bounds_report(FILE* out, const struct bounds* bounds);
+
+#endif  /*__BOUNDS_H*/
@@ -0,0 +1,492 @@
+#include "bytecode.h"
+
+struct bc_lowering {
+    struct ast* ast;
+    const struct bounds* bounds;
+    struct bc_program* program;
+    struct bc_func* func;
+    u16 next_reg;
+    u32 label;      /* the last pc a jump was pointed at */
+};
+
+static inline void lowering_error(struct string func, const char* msg);
+static inline u32 emit(struct bc_lowering* l, bc_inst inst);
+static inline u8 alloc_reg(struct bc_lowering* l);
+static inline u32 add_constant(struct bc_lowering* l, i64 value);
+static inline u32 add_data(struct bc_lowering* l, struct node node);
+static inline u32 func_index(struct bc_lowering* l, u32 decl);
+
+static inline void lower_into(struct bc_lowering* l, struct node node, u8 dst);
+static inline u32 emit_jump(struct bc_lowering* l, enum bc_op op, u8 a);
+static inline void patch_jump(struct bc_lowering* l, u32 pc);
+static inline u8 lower_call(struct bc_lowering* l, struct node node, enum bc_op op);
+static inline void lower_binary(struct bc_lowering* l, struct node node, u8 dst, u8* lhs, u8* rhs);
+static inline u8 lower_operand(struct bc_lowering* l, struct node node);
+static inline bool is_leaf(struct node node);
+static inline u8 lower_slice(struct bc_lowering* l, struct node slice);
+static inline void lower_statement(struct bc_lowering* l, struct node node);
+static inline void lower_if(struct bc_lowering* l, struct node node);
+static inline void lower_link(struct bc_lowering* l, struct node_link link);
+static inline void lower_func_decl(struct bc_lowering* l, struct bc_func* func);
+
+const char* bc_op_to_cstr(enum bc_op op) {
+    switch (op) {
+        case BC_LOADI: return "LOADI"; break;
+        case BC_LOADK: return "LOADK"; break;
+        case BC_MOV: return "MOV"; break;
+        case BC_ADD: return "ADD"; break;
+        case BC_SUB: return "SUB"; break;
+        case BC_MUL: return "MUL"; break;
+        case BC_EQ: return "EQ"; break;
+        case BC_NE: return "NE"; break;
+        case BC_LT: return "LT"; break;
+        case BC_LE: return "LE"; break;
+        case BC_DATA: return "DATA"; break;
+        case BC_INDEX: return "INDEX"; break;
+        case BC_INDEXU: return "INDEXU"; break;
+        case BC_JMP: return "JMP"; break;
+        case BC_JMPF: return "JMPF"; break;
+        case BC_CALL: return "CALL"; break;
+        case BC_TAILCALL: return "TAILCALL"; break;
+        case BC_RET: return "RET"; break;
+        case BC_RETV: return "RETV"; break;
+        case __bc_op_count: break;
+    }
+
+    UNREACHABLE("bc_op_to_cstr");
+}
+
+/* Past one of the limits of the instruction format, the native backend has none of them */
+static inline void lowering_error(struct string func, const char* msg) {
+    fprintf(stderr, "nomic: error: interpreter: %s in `%.*s'\n", msg, (i32)func.length, func.cstr);
+    exit(1);
+}
+
+static inline u32 emit(struct bc_lowering* l, bc_inst inst) {
+    u32 pc = l->program->code.length;
+    DYNARRAY_APPEND(l->program->code, inst);
+    return pc;
+}
+
+static inline u8 alloc_reg(struct bc_lowering* l) {
+    if (l->next_reg >= BC_MAX_REGS) lowering_error(l->func->name, "an expression needs more than 256 registers");
+
+    u8 reg = (u8)l->next_reg++;
+    l->func->nregs = MAX(l->func->nregs, l->next_reg);
+    return reg;
+}
+
+static inline u32 add_constant(struct bc_lowering* l, i64 value) {
+    struct bc_constants* k = &l->program->constants;
+
+    for (usize i = 0; i < k->length; ++i) {
+        if (k->at[i] == value) return (u32)i;
+    }
+
+    if (k->length > UINT16_MAX) lowering_error(l->func->name, "more than 65536 constants");
+
+    DYNARRAY_APPEND(*k, value);
+    return (u32)(k->length - 1);
+}
+
+/* The elements of a slice literal, every literal gets its own copy */
+static inline u32 add_data(struct bc_lowering* l, struct node node) {
+    struct bc_data* d = &l->program->data;
+    u32 start = d->length;
+    struct node_link link;
+
+    if (node.data.elems != 0) {
+        link = l->ast->ptr[node.data.elems].link;
+        do {
+            DYNARRAY_APPEND(*d, (i32)l->ast->ptr[link.ptr].number);
+        } while (ast_link_advance(l->ast, &link));
+    }
+
+    if (start > UINT16_MAX) lowering_error(l->func->name, "slice literals start past the first 65536 elements");
+    return start;
+}
+
+/* The offset is filled in by `patch_jump' once the target is known */
+static inline u32 emit_jump(struct bc_lowering* l, enum bc_op op, u8 a) {
+    return emit(l, BC_ABX(op, a, 0));
+}
+
+/* Points the jump at `pc' to the next instruction to be emitted */
+static inline void patch_jump(struct bc_lowering* l, u32 pc) {
+    bc_inst* inst = &l->program->code.at[pc];
+    i64 offset = (i64)l->program->code.length - (pc + 1);
+
+    if (offset > BC_SBX_MAX) lowering_error(l->func->name, "a jump further than 32767 instructions");
+
+    *inst = BC_ABX(BC_OP(*inst), BC_A(*inst), offset);
+    l->label = l->program->code.length;
+}
+
+/* Functions are lowered in declaration order, which is also the order of their node ids */
+static inline u32 func_index(struct bc_lowering* l, u32 decl) {
+    struct bc_funcs* funcs = &l->program->funcs;
+    usize lo = 0, hi = funcs->length;
+
+    while (lo < hi) {
+        usize mid = lo + (hi - lo) / 2;
+        if (funcs->at[mid].decl < decl) lo = mid + 1;
+        else hi = mid;
+    }
+
+    ASSERT(lo < funcs->length && funcs->at[lo].decl == decl);
+    return (u32)lo;
+}
+
+/*
+ * The temporaries used on the way are free again afterwards. The left
+ * operand is computed into `dst' itself, or the right one first when the
+ * left is a number or a parameter, so that nesting on either side doesn't
+ * take a register per level.
+ * */
+static inline void lower_into(struct bc_lowering* l, struct node node, u8 dst) {
+    u16 saved_reg = l->next_reg;
+    u8 src, lhs, rhs;
+    enum bc_op op;
+
+    switch (node.kind) {
+        case NODE_DATA:
+            emit(l, BC_ABX(BC_DATA, dst, add_data(l, node)));
+            break;
+        case NODE_INDEX:
+            op = bounds_of(l->bounds, node.id) == BOUNDS_UNCHECKED ? BC_INDEXU : BC_INDEX;
+            lhs = lower_slice(l, l->ast->ptr[node.index.slice]);
+            rhs = lower_operand(l, l->ast->ptr[node.index.expr]);
+            emit(l, BC_ABC(op, dst, lhs, rhs));
+            break;
+        case NODE_NUMBER:
+            if (node.number >= BC_SBX_MIN && node.number <= BC_SBX_MAX) {
+                emit(l, BC_ABX(BC_LOADI, dst, node.number));
+            } else {
+                emit(l, BC_ABX(BC_LOADK, dst, add_constant(l, node.number)));
+            }
+            break;
+        case NODE_PARAMREF:
+        case NODE_CALL:
+            src = lower_operand(l, node);
+            if (src != dst) emit(l, BC_ABC(BC_MOV, dst, src, 0));
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+            op = node.kind == NODE_ADD ? BC_ADD : node.kind == NODE_SUB ? BC_SUB : BC_MUL;
+            lower_binary(l, node, dst, &lhs, &rhs);
+            emit(l, BC_ABC(op, dst, lhs, rhs));
+            break;
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            lower_binary(l, node, dst, &lhs, &rhs);
+            switch (node.kind) {
+                case NODE_EQ: emit(l, BC_ABC(BC_EQ, dst, lhs, rhs)); break;
+                case NODE_NE: emit(l, BC_ABC(BC_NE, dst, lhs, rhs)); break;
+                case NODE_LT: emit(l, BC_ABC(BC_LT, dst, lhs, rhs)); break;
+                case NODE_LE: emit(l, BC_ABC(BC_LE, dst, lhs, rhs)); break;
+                /* `a > b' is `b < a' */
+                case NODE_GT: emit(l, BC_ABC(BC_LT, dst, rhs, lhs)); break;
+                case NODE_GE: emit(l, BC_ABC(BC_LE, dst, rhs, lhs)); break;
+                default: UNREACHABLE("lower_into: not a comparison");
+            }
+            break;
+        default:
+            TODO("lower_into: the rest of them...");
+    }
+
+    l->next_reg = saved_reg;
+}
+
+/* Nothing to evaluate, so it doesn't matter when */
+static inline bool is_leaf(struct node node) {
+    return node.kind == NODE_NUMBER || node.kind == NODE_PARAMREF;
+}
+
+/* The registers holding both operands of `node', one of which may be `dst' */
+static inline void lower_binary(struct bc_lowering* l, struct node node, u8 dst, u8* lhs, u8* rhs) {
+    struct node left = l->ast->ptr[node.binary.lhs];
+    struct node right = l->ast->ptr[node.binary.rhs];
+
+    if (is_leaf(left) && !is_leaf(right)) {
+        lower_into(l, right, dst);
+        *rhs = dst;
+        *lhs = lower_operand(l, left);
+    } else if (left.kind == NODE_PARAMREF || (left.kind == NODE_CALL && is_leaf(right))) {
+        *lhs = lower_operand(l, left);
+        *rhs = lower_operand(l, right);
+    } else {
+        /* a call is moved out of its register, which the right operand can then use */
+        lower_into(l, left, dst);
+        *lhs = dst;
+        *rhs = lower_operand(l, right);
+    }
+}
+
+/* `op' is BC_CALL or BC_TAILCALL */
+static inline u8 lower_call(struct bc_lowering* l, struct node node, enum bc_op op) {
+    u32 func = func_index(l, node.call.callee);
+    u16 nargs = l->program->funcs.at[func].nparams;
+    u8 base = alloc_reg(l);
+    u8 arg = base;
+    struct node_link link;
+
+    /* the arguments have to sit in consecutive registers starting at `base' */
+    for (u16 i = 1; i < nargs; ++i) alloc_reg(l);
+
+    if (node.call.args != 0) {
+        link = l->ast->ptr[node.call.args].link;
+        do {
+            lower_into(l, l->ast->ptr[link.ptr], arg++);
+        } while (ast_link_advance(l->ast, &link));
+    }
+
+    if (func > UINT16_MAX) lowering_error(l->func->name, "a call to one of more than 65536 functions");
+    emit(l, BC_ABX(op, base, func));
+
+    /* everything above the result is dead once the call returns */
+    l->next_reg = base + 1;
+
+    return base;
+}
+
+/* Returns the register holding the value of `node', a fresh one unless it is a parameter */
+static inline u8 lower_operand(struct bc_lowering* l, struct node node) {
+    u8 dst;
+
+    switch (node.kind) {
+        case NODE_PARAMREF:
+            return (u8)node.param_ref.index;
+        case NODE_CALL:
+            return lower_call(l, node, BC_CALL);
+        default:
+            dst = alloc_reg(l);
+            lower_into(l, node, dst);
+            return dst;
+    }
+}
+
+/* The first of the two registers holding `slice', its parameters or two fresh ones for a literal */
+static inline u8 lower_slice(struct bc_lowering* l, struct node slice) {
+    struct node ptr = l->ast->ptr[slice.slice.ptr];
+    u8 dst;
+
+    if (ptr.kind == NODE_PARAMREF) return (u8)ptr.param_ref.index;
+
+    dst = alloc_reg(l);
+    alloc_reg(l);
+    lower_into(l, ptr, dst);
+    lower_into(l, l->ast->ptr[slice.slice.len], dst + 1);
+    return dst;
+}
+
+static inline void lower_link(struct bc_lowering* l, struct node_link link) {
+    do {
+        lower_statement(l, l->ast->ptr[link.ptr]);
+    } while (ast_link_advance(l->ast, &link));
+}
+
+static inline void lower_if(struct bc_lowering* l, struct node node) {
+    struct node arms = l->ast->ptr[node.if_stmt.arms];
+    u32 skip_then, skip_else;
+
+    skip_then = emit_jump(l, BC_JMPF, lower_operand(l, l->ast->ptr[node.if_stmt.cond]));
+    lower_statement(l, l->ast->ptr[arms.arms.then]);
+
+    if (arms.arms.otherwise == 0) {
+        patch_jump(l, skip_then);
+        return;
+    }
+
+    skip_else = emit_jump(l, BC_JMP, 0);
+    patch_jump(l, skip_then);
+    lower_statement(l, l->ast->ptr[arms.arms.otherwise]);
+    patch_jump(l, skip_else);
+}
+
+static inline void lower_statement(struct bc_lowering* l, struct node node) {
+    u16 saved_reg = l->next_reg;
+    struct node expr;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            expr = l->ast->ptr[node.return_stmt.expr];
+            if (node.return_stmt.expr == 0) {
+                emit(l, BC_ABC(BC_RETV, 0, 0, 0));
+            } else if (expr.kind == NODE_CALL) {
+                /* the callee returns straight to our caller, deep recursion runs in constant space */
+                lower_call(l, expr, BC_TAILCALL);
+            } else {
+                emit(l, BC_ABC(BC_RET, lower_operand(l, l->ast->ptr[node.return_stmt.expr]), 0, 0));
+            }
+            break;
+        case NODE_IF:
+            lower_if(l, node);
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr != 0) lower_link(l, node.link);
+            break;
+        default:
+            /* expression statement */
+            lower_operand(l, node);
+            break;
+    }
+
+    /* temporaries die at the end of the statement */
+    l->next_reg = saved_reg;
+}
+
+static inline void lower_func_decl(struct bc_lowering* l, struct bc_func* func) {
+    struct node decl = l->ast->ptr[func->decl];
+    enum bc_op last;
+
+    l->func = func;
+    l->func->code_start = l->program->code.length;
+    l->next_reg = func->nparams;
+    l->func->nregs = func->nparams;
+
+    lower_statement(l, l->ast->ptr[decl.func_decl.body]);
+
+    /* falling off the end of the function, or jumping past the last statement */
+    last = l->program->code.length == l->func->code_start ? BC_RETV :
+           BC_OP(l->program->code.at[l->program->code.length - 1]);
+    if (l->program->code.length == l->func->code_start || l->label == l->program->code.length ||
+        (last != BC_RET && last != BC_RETV && last != BC_TAILCALL)) {
+        emit(l, BC_ABC(BC_RETV, 0, 0, 0));
+    }
+
+    l->func->code_length = l->program->code.length - l->func->code_start;
+}
+
+struct bc_program bc_lower(struct ast* ast, const struct bounds* bounds) {
+    struct bc_program program = {0};
+    struct bc_lowering l = {
+        .ast = ast,
+        .bounds = bounds,
+        .program = &program,
+        .func = NULL,
+        .next_reg = 0,
+        .label = UINT32_MAX,
+    };
+
+    ASSERT(ast->length > 0);
+    struct node_link link = ast->ptr[0].link;
+
+    /* every function gets its index up front so calls can refer to later ones */
+    do {
+        struct node decl = ast->ptr[link.ptr];
+        struct node proto;
+        struct bc_func func = {0};
+
+        if (decl.kind != NODE_FUNCDECL) continue;
+
+        proto = ast_func_proto(ast, decl);
+        func.name = ast_func_name(ast, decl);
+        func.decl = decl.id;
+        func.nparams = (u16)ast_list_length(ast, proto.proto.params);
+        func.is_extern = decl.func_decl.body == 0;
+
+        if (func.nparams > BC_MAX_REGS) lowering_error(func.name, "more than 256 parameters");
+
+        DYNARRAY_APPEND(program.funcs, func);
+    } while (ast_link_advance(ast, &link));
+
+    for (usize i = 0; i < program.funcs.length; ++i) {
+        if (!program.funcs.at[i].is_extern) lower_func_decl(&l, &program.funcs.at[i]);
+    }
+
+    return program;
+}
+
+void bc_program_free(struct bc_program* program) {
+    DYNARRAY_FREE(program->code);
+    DYNARRAY_FREE(program->constants);
+    DYNARRAY_FREE(program->data);
+    DYNARRAY_FREE(program->funcs);
+}
+
+u32 bc_find_func(const struct bc_program* program, struct string name) {
+    for (usize i = 0; i < program->funcs.length; ++i) {
+        if (string_equal(program->funcs.at[i].name, name)) return (u32)i;
+    }
+
+    return BC_NO_FUNC;
+}
+
+void bc_print_inst(const struct bc_program* program, bc_inst inst) {
+    enum bc_op op = BC_OP(inst);
+
+    printf("%-6s ", bc_op_to_cstr(op));
+
+    switch (op) {
+        case BC_LOADI:
+            printf("r%u, %d\n", BC_A(inst), BC_SBX(inst));
+            break;
+        case BC_LOADK:
+            printf("r%u, k%u ; %ld\n", BC_A(inst), BC_BX(inst),
+                   program->constants.at[BC_BX(inst)]);
+            break;
+        case BC_MOV:
+            printf("r%u, r%u\n", BC_A(inst), BC_B(inst));
+            break;
+        case BC_DATA:
+            printf("r%u, d%u\n", BC_A(inst), BC_BX(inst));
+            break;
+        case BC_INDEX:
+        case BC_INDEXU:
+            printf("r%u, r%u[r%u]\n", BC_A(inst), BC_B(inst), BC_C(inst));
+            break;
+        case BC_ADD:
+        case BC_SUB:
+        case BC_MUL:
+        case BC_EQ:
+        case BC_NE:
+        case BC_LT:
+        case BC_LE:
+            printf("r%u, r%u, r%u\n", BC_A(inst), BC_B(inst), BC_C(inst));
+            break;
+        case BC_JMP:
+            printf("%+d\n", BC_SBX(inst));
+            break;
+        case BC_JMPF:
+            printf("r%u, %+d\n", BC_A(inst), BC_SBX(inst));
+            break;
+        case BC_CALL:
+        case BC_TAILCALL:
+            printf("r%u, f%u ; %.*s\n", BC_A(inst), BC_BX(inst),
+                   (i32)program->funcs.at[BC_BX(inst)].name.length,
+                   program->funcs.at[BC_BX(inst)].name.cstr);
+            break;
+        case BC_RET:
+            printf("r%u\n", BC_A(inst));
+            break;
+        case BC_RETV:
+            putchar('\n');
+            break;
+        case __bc_op_count:
+            UNREACHABLE("bc_print_inst:__bc_op_count");
+            break;
+    }
+}
+
+void bc_print(const struct bc_program* program) {
+    for (usize f = 0; f < program->funcs.length; ++f) {
+        struct bc_func func = program->funcs.at[f];
+
+        if (func.is_extern) {
+            printf("extern %.*s ; nparams=%u\n", (i32)func.name.length, func.name.cstr, func.nparams);
+            continue;
+        }
+
+        printf("%.*s: ; nparams=%u nregs=%u\n", (i32)func.name.length, func.name.cstr,
+               func.nparams, func.nregs);
+        for (u32 pc = func.code_start; pc < func.code_start + func.code_length; ++pc) {
+            printf("  %04u  ", pc);
+            bc_print_inst(program, program->code.at[pc]);
+        }
+    }
+}
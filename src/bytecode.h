@@ -0,0 +1,133 @@
+#ifndef __BYTECODE_H
+#define __BYTECODE_H
+
+#include "base.h"
+#include "string.h"
+#include "ast.h"
+#include "bounds.h"
+
+/*
+ * Nomi bytecode
+ *
+ * A compact, register-based instruction format lowered straight from the
+ * `struct ast`. It exists so we can run Nomi programs without the native
+ * backend (and without an assembler): compile-time evaluation, quick scripts
+ * and differential testing against the code we emit for x86_64.
+ *
+ * Every instruction is a single u32 so that a function's code is as dense as
+ * possible in the cache. The layout borrows from Lua:
+ *
+ *   31             16 15      8 7       0
+ *  +----------------+---------+---------+
+ *  |       Bx       |    A    |   op    |    A,  Bx (unsigned) / sBx (signed)
+ *  +--------+-------+---------+---------+
+ *  |   C    |   B   |    A    |   op    |    A,  B,  C
+ *  +--------+-------+---------+---------+
+ *
+ * Registers are local to a call frame. Constants which do not fit in a sBx
+ * live in the program's constant pool and are loaded with BC_LOADK. Jump
+ * offsets are relative to the instruction after the jump.
+ * A slice is two consecutive registers, the address of its first element
+ * and its length. The elements of slice literals live in the data pool.
+ * Arithmetic wraps around to i32, the same as the native code does.
+ * */
+
+typedef u32 bc_inst;
+
+#define BC_OP(i)    ((enum bc_op)((i) & 0xff))
+#define BC_A(i)     (((i) >> 8) & 0xff)
+#define BC_B(i)     (((i) >> 16) & 0xff)
+#define BC_C(i)     (((i) >> 24) & 0xff)
+#define BC_BX(i)    (((i) >> 16) & 0xffff)
+#define BC_SBX(i)   ((i32)(i16)BC_BX(i))
+
+#define BC_ABC(op, a, b, c) \
+    ((bc_inst)(op) | ((bc_inst)(a) << 8) | ((bc_inst)(b) << 16) | ((bc_inst)(c) << 24))
+#define BC_ABX(op, a, bx) \
+    ((bc_inst)(op) | ((bc_inst)(a) << 8) | ((bc_inst)(u16)(bx) << 16))
+
+#define BC_SBX_MIN INT16_MIN
+#define BC_SBX_MAX INT16_MAX
+#define BC_MAX_REGS 256
+
+/* Keep this in sync with the dispatch table in vm.c */
+enum bc_op : u8 {
+    BC_LOADI,   /* R[A] = sBx */
+    BC_LOADK,   /* R[A] = K[Bx] */
+    BC_MOV,     /* R[A] = R[B] */
+    BC_ADD,     /* R[A] = R[B] + R[C] */
+    BC_SUB,     /* R[A] = R[B] - R[C] */
+    BC_MUL,     /* R[A] = R[B] * R[C] */
+    BC_EQ,      /* R[A] = R[B] == R[C] */
+    BC_NE,      /* R[A] = R[B] != R[C] */
+    BC_LT,      /* R[A] = R[B] < R[C] */
+    BC_LE,      /* R[A] = R[B] <= R[C] */
+    BC_DATA,    /* R[A] = &D[Bx] */
+    BC_INDEX,   /* R[A] = R[B][R[C]], traps unless 0 <= R[C] < R[B+1] */
+    BC_INDEXU,  /* R[A] = R[B][R[C]], known to be in bounds */
+    BC_JMP,     /* pc += sBx */
+    BC_JMPF,    /* if R[A] == 0 then pc += sBx */
+    BC_CALL,    /* R[A] = F[Bx](R[A], R[A+1], ...) */
+    BC_TAILCALL,/* return F[Bx](R[A], R[A+1], ...), reusing the frame */
+    BC_RET,     /* return R[A] */
+    BC_RETV,    /* return nothing */
+    __bc_op_count,
+};
+
+/*
+ * A function's parameters arrive in its first registers. The register window
+ * of a callee starts at the first argument register of the caller, so the
+ * arguments never have to be copied and the result lands in R[A].
+ * */
+struct bc_func {
+    struct string name;
+    u32 decl;           /* NODE_FUNCDECL this was lowered from */
+    u32 code_start;     /* index of the first instruction in the program */
+    u32 code_length;
+    u16 nregs;          /* size of the register window for one call */
+    u16 nparams;
+    bool is_extern;     /* declared only, the interpreter cannot call it */
+};
+
+struct bc_code {
+    bc_inst* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bc_constants {
+    i64* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bc_data {
+    i32* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bc_funcs {
+    struct bc_func* at;
+    DYNARRAY_FIELDS;
+};
+
+struct bc_program {
+    struct bc_code code;
+    struct bc_constants constants;
+    struct bc_data data;
+    struct bc_funcs funcs;
+};
+
+#define BC_NO_FUNC UINT32_MAX
+
+const char* bc_op_to_cstr(enum bc_op op);
+
+/* Accesses `bounds' says are always in bounds are not checked, NULL checks all of them */
+struct bc_program bc_lower(struct ast* ast, const struct bounds* bounds);
+void bc_program_free(struct bc_program* program);
+
+/* Returns BC_NO_FUNC when there is no function called `name' */
+u32 bc_find_func(const struct bc_program* program, struct string name);
+
+void bc_print_inst(const struct bc_program* program, bc_inst inst);
+void bc_print(const struct bc_program* program);
+
+#endif  /*__BYTECODE_H*/
@@ -0,0 +1,336 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* An entry in the directory, for trimming and the report */
+struct cache_entry {
+    char name[CACHE_KEY_LENGTH + 8];
+    u64 size;
+    struct timespec used;
+};
+
+struct cache_entries {
+    struct cache_entry* at;
+    DYNARRAY_FIELDS;
+};
+
+static inline bool make_dirs(const char* dir);
+static inline void add_input(struct cache* cache, const void* at, usize length);
+static inline bool is_cache_flag(const char* arg);
+static inline void entry_path(const struct cache* cache, char* buf, usize size);
+static inline bool copy_file(const char* from, FILE* to, u64* copied);
+static inline bool copy_stream(FILE* from, FILE* to, u64* copied);
+static inline bool same_inputs(const struct cache* cache, FILE* entry);
+static inline struct cache_entries scan(const struct cache* cache, u64* total);
+static int compare_used(const void* a, const void* b);
+static inline void trim(struct cache* cache);
+
+const char* cache_dir_default(void) {
+    static char dir[4096];
+    const char* env;
+
+    if ((env = getenv("NOMIC_CACHE_DIR")) != NULL && env[0] != '\0') return env;
+
+    if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/nomic", env);
+    } else {
+        env = getenv("HOME");
+        snprintf(dir, sizeof(dir), "%s/.cache/nomic", env != NULL ? env : "/tmp");
+    }
+    return dir;
+}
+
+/* `mkdir -p' */
+static inline bool make_dirs(const char* dir) {
+    char path[4096];
+    usize length = strlen(dir);
+
+    if (length >= sizeof(path)) return false;
+    memcpy(path, dir, length + 1);
+
+    for (usize i = 1; i <= length; ++i) {
+        if (path[i] != '/' && path[i] != '\0') continue;
+        path[i] = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return false;
+        path[i] = i < length ? '/' : '\0';
+    }
+    return true;
+}
+
+struct cache cache_open(const char* dir, u64 limit) {
+    struct cache cache = { .limit = limit };
+    char path[4200];
+    FILE* file;
+
+    if (strlen(dir) >= sizeof(cache.dir) || !make_dirs(dir)) {
+        fprintf(stderr, "nomic: error: could not create the cache directory `%s'\n", dir);
+        exit(1);
+    }
+    strcpy(cache.dir, dir);
+
+    snprintf(path, sizeof(path), "%s/stats", cache.dir);
+    if ((file = fopen(path, "r")) != NULL) {
+        if (fscanf(file, "hits %lu misses %lu bytes_saved %lu", &cache.stats.hits, &cache.stats.misses,
+                   &cache.stats.bytes_saved) != 3) {
+            cache.stats = (struct cache_stats){0};
+        }
+        fclose(file);
+    }
+
+    return cache;
+}
+
+static inline void add_input(struct cache* cache, const void* at, usize length) {
+    struct cache_inputs* inputs = &cache->inputs;
+
+    if (inputs->length + length > inputs->capacity) {
+        inputs->capacity = MAX(inputs->capacity * 2, inputs->length + length);
+        inputs->at = realloc(inputs->at, inputs->capacity);
+        if (inputs->at == NULL) {
+            fprintf(stderr, "nomic: error: out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(inputs->at + inputs->length, at, length);
+    inputs->length += length;
+}
+
+static inline bool is_cache_flag(const char* arg) {
+    return strcmp(arg, "--cache") == 0 || strncmp(arg, "--cache=", 8) == 0 ||
+           strncmp(arg, "--cache-", 8) == 0 || strcmp(arg, "--no-cache") == 0;
+}
+
+void cache_key(struct cache* cache, struct string source, i32 argc, char** argv, const char* profile) {
+    struct stat exe;
+    FILE* file;
+    u8 buf[4096];
+    usize n;
+
+    DYNARRAY_CLEAR(cache->inputs);
+    add_input(cache, CACHE_VERSION, sizeof(CACHE_VERSION));
+    if (stat("/proc/self/exe", &exe) == 0) {
+        add_input(cache, &exe.st_size, sizeof(exe.st_size));
+        add_input(cache, &exe.st_mtime, sizeof(exe.st_mtime));
+    }
+
+    /* in order, the last of two conflicting flags wins */
+    for (i32 i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            i++;
+            continue;
+        }
+        if (argv[i][0] != '-' || is_cache_flag(argv[i])) continue;
+        add_input(cache, argv[i], strlen(argv[i]) + 1);
+    }
+
+    add_input(cache, &source.length, sizeof(source.length));
+    add_input(cache, source.cstr, source.length);
+
+    if (profile != NULL && (file = fopen(profile, "rb")) != NULL) {
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) add_input(cache, buf, n);
+        fclose(file);
+    }
+
+    snprintf(cache->key, sizeof(cache->key), "%016lx", fnv1a(FNV_OFFSET, cache->inputs.at, cache->inputs.length));
+}
+
+static inline void entry_path(const struct cache* cache, char* buf, usize size) {
+    snprintf(buf, size, "%s/%s.s", cache->dir, cache->key);
+}
+
+static inline bool copy_file(const char* from, FILE* to, u64* copied) {
+    FILE* file = fopen(from, "rb");
+    bool ok;
+
+    if (file == NULL) return false;
+    ok = copy_stream(file, to, copied) && !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+/* False when writing failed, reading can be told apart with ferror(from) */
+static inline bool copy_stream(FILE* from, FILE* to, u64* copied) {
+    u8 buf[16384];
+    usize n;
+    bool ok = true;
+
+    *copied = 0;
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+        if (fwrite(buf, 1, n, to) != n) ok = false;
+        *copied += n;
+    }
+    return ok;
+}
+
+/* The entry's header is the length of its inputs and then the inputs */
+static inline bool same_inputs(const struct cache* cache, FILE* entry) {
+    u8 buf[16384];
+    u64 length;
+    usize n;
+
+    if (fread(&length, sizeof(length), 1, entry) != 1 || length != cache->inputs.length) return false;
+
+    for (usize at = 0; at < length; at += n) {
+        n = MIN(sizeof(buf), length - at);
+        if (fread(buf, 1, n, entry) != n || memcmp(buf, cache->inputs.at + at, n) != 0) return false;
+    }
+    return true;
+}
+
+bool cache_fetch(struct cache* cache, const char* output) {
+    char path[4200];
+    FILE* entry;
+    FILE* out;
+    u64 copied;
+    bool written, read;
+
+    ASSERT(cache->key[0] != '\0');
+    entry_path(cache, path, sizeof(path));
+
+    /* once it is open, trimming it away from under us doesn't matter anymore */
+    if ((entry = fopen(path, "rb")) == NULL || !same_inputs(cache, entry)) {
+        if (entry != NULL) fclose(entry);
+        cache->stats.misses++;
+        return false;
+    }
+
+    if ((out = fopen(output, "wb")) == NULL) {
+        fprintf(stderr, "nomic: could not open `%s'\n", output);
+        exit(1);
+    }
+    written = copy_stream(entry, out, &copied);
+    read = !ferror(entry);
+    fclose(entry);
+    if (fclose(out) != 0 || !written) {
+        fprintf(stderr, "nomic: could not write `%s'\n", output);
+        exit(1);
+    }
+    /* the compile writes over what was copied */
+    if (!read) {
+        cache->stats.misses++;
+        return false;
+    }
+
+    /* the modification time is when it was last used */
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    cache->stats.hits++;
+    cache->stats.bytes_saved += copied;
+    return true;
+}
+
+void cache_store(struct cache* cache, const char* output) {
+    char path[4200], tmp[4300];
+    FILE* file;
+    u64 copied, length = cache->inputs.length;
+    bool ok;
+
+    ASSERT(cache->key[0] != '\0');
+    entry_path(cache, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    /* a cache that can't be written to just doesn't cache */
+    if ((file = fopen(tmp, "wb")) == NULL) return;
+    ok = fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(cache->inputs.at, 1, length, file) == length &&
+         copy_file(output, file, &copied);
+    if (fclose(file) != 0 || !ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    trim(cache);
+}
+
+static inline struct cache_entries scan(const struct cache* cache, u64* total) {
+    struct cache_entries entries = {0};
+    struct cache_entry entry;
+    char path[4400];
+    struct dirent* dirent;
+    struct stat st;
+    usize length;
+    DIR* dir;
+
+    *total = 0;
+    if ((dir = opendir(cache->dir)) == NULL) return entries;
+
+    while ((dirent = readdir(dir)) != NULL) {
+        length = strlen(dirent->d_name);
+        if (length != CACHE_KEY_LENGTH + 2 || strcmp(dirent->d_name + CACHE_KEY_LENGTH, ".s") != 0) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, dirent->d_name);
+        if (stat(path, &st) != 0) continue;
+
+        memcpy(entry.name, dirent->d_name, length + 1);
+        entry.size = (u64)st.st_size;
+        entry.used = st.st_mtim;
+        *total += entry.size;
+        DYNARRAY_APPEND(entries, entry);
+    }
+
+    closedir(dir);
+    return entries;
+}
+
+static int compare_used(const void* a, const void* b) {
+    const struct cache_entry* x = a;
+    const struct cache_entry* y = b;
+
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Least recently used first, down to the limit */
+static inline void trim(struct cache* cache) {
+    struct cache_entries entries;
+    char path[4400];
+    u64 total;
+
+    entries = scan(cache, &total);
+    if (total > cache->limit) {
+        qsort(entries.at, entries.length, sizeof(*entries.at), compare_used);
+
+        for (usize i = 0; i < entries.length && total > cache->limit; ++i) {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, entries.at[i].name);
+            if (unlink(path) == 0) total -= entries.at[i].size;
+        }
+    }
+
+    DYNARRAY_FREE(entries);
+}
+
+void cache_close(struct cache* cache) {
+    char path[4200], tmp[4300];
+    FILE* file;
+
+    DYNARRAY_FREE(cache->inputs);
+
+    snprintf(path, sizeof(path), "%s/stats", cache->dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+
+    /* builds running side by side may lose a count, never the file */
+    if ((file = fopen(tmp, "w")) == NULL) return;
+    fprintf(file, "hits %lu misses %lu bytes_saved %lu\n", cache->stats.hits, cache->stats.misses,
+            cache->stats.bytes_saved);
+    if (fclose(file) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+void cache_report(FILE* out, const struct cache* cache) {
+    struct cache_entries entries;
+    u64 total, lookups = cache->stats.hits + cache->stats.misses;
+
+    entries = scan(cache, &total);
+
+    fprintf(out, "cache %s\n", cache->dir);
+    fprintf(out, "%lu hit(s), %lu miss(es), %.1f%% hit rate, %lu byte(s) saved\n", cache->stats.hits,
+            cache->stats.misses, lookups > 0 ? 100.0 * (f64)cache->stats.hits / (f64)lookups : 0.0,
+            cache->stats.bytes_saved);
+    fprintf(out, "%zu entries, %lu of %lu byte(s)\n", entries.length, total, cache->limit);
+
+    DYNARRAY_FREE(entries);
+}
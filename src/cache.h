@@ -0,0 +1,75 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include "base.h"
+#include "string.h"
+
+/*
+ * On-disk cache of compiled assembly (--cache).
+ *
+ * Every compile that only produces assembly is keyed by a hash of everything
+ * that goes into it: the source, the flags minus where the files are, the
+ * profile read by -fprofile-use, the compiler and the target. The compiler
+ * is the version below and the size and modification time of the running
+ * binary, so rebuilding nomic throws the old entries away as well. When the
+ * key is already in the cache directory the assembly is copied out and
+ * nothing is parsed.
+ *
+ * The key is a 64-bit FNV-1a, which is fast but does nothing to keep two
+ * different compiles from sharing it. An entry therefore starts with
+ * everything that was hashed into its key, and it is only a hit when that is
+ * byte for byte what this compile hashed. An entry that doesn't match or
+ * can't be read is a miss, and the compile just runs.
+ *
+ * Entries are written to a temporary file and renamed into place, so builds
+ * sharing a directory never see half an entry. A hit touches the entry, and
+ * after every store the least recently used ones are removed until the
+ * directory is under its limit. Hits, misses and the bytes not produced are
+ * added up across runs in the `stats' file of the directory.
+ * */
+
+#define CACHE_TARGET "x86_64-linux"
+#define CACHE_VERSION "nomic 0.1 " CACHE_TARGET
+#define CACHE_LIMIT_DEFAULT MEGABYTES(512)
+#define CACHE_KEY_LENGTH 16
+
+struct cache_stats {
+    u64 hits;
+    u64 misses;
+    u64 bytes_saved;
+};
+
+/* What the key is a hash of */
+struct cache_inputs {
+    u8* at;
+    DYNARRAY_FIELDS;
+};
+
+struct cache {
+    char dir[4096];
+    u64 limit;
+    char key[CACHE_KEY_LENGTH + 1];
+    struct cache_inputs inputs;
+    struct cache_stats stats;
+};
+
+/* NOMIC_CACHE_DIR, otherwise nomic under XDG_CACHE_HOME or ~/.cache */
+const char* cache_dir_default(void);
+
+/* Creates `dir' when there is none and reads what it has counted so far */
+struct cache cache_open(const char* dir, u64 limit);
+
+/* Everything but the input path, `-o' and its value and the --cache flags of `argv' is part of the key */
+void cache_key(struct cache* cache, struct string source, i32 argc, char** argv, const char* profile);
+
+/* Copies the entry to `output' on a hit, false on a miss or when the entry couldn't be read */
+bool cache_fetch(struct cache* cache, const char* output);
+/* Adds `output' as the entry for the key, trimming the cache down to its limit */
+void cache_store(struct cache* cache, const char* output);
+
+/* Saves the counters and frees the inputs */
+void cache_close(struct cache* cache);
+
+void cache_report(FILE* out, const struct cache* cache);
+
+#endif  /*__CACHE_H*/
@@ -0,0 +1,344 @@
+#include "callgraph.h"
+
+#define UNVISITED UINT32_MAX
+
+struct tarjan_frame {
+    u32 func;
+    u32 next_site;  /* next outgoing edge of `func' to look at */
+};
+
+struct affinity {
+    u32 callee;
+    u32 caller;
+    u64 weight;
+};
+
+struct layout_key {
+    u64 heat;
+    u32 first;      /* lowest function index, for ties */
+    u32 func;
+};
+
+static inline void collect_sites(struct ast* ast, struct call_graph* graph, u32 caller, u32 nodeid);
+static inline void find_sccs(struct call_graph* graph);
+static inline u32 find_cluster(u32* leader, u32 func);
+static int compare_affinity(const void* a, const void* b);
+static int compare_layout_key(const void* a, const void* b);
+
+/* Calls are recorded after their arguments, the order they are evaluated in */
+static inline void collect_sites(struct ast* ast, struct call_graph* graph, u32 caller, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+    struct call_site site;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr != 0) collect_sites(ast, graph, caller, node.return_stmt.expr);
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) break;
+            link = node.link;
+            do {
+                collect_sites(ast, graph, caller, link.ptr);
+            } while (ast_link_advance(ast, &link));
+            break;
+        case NODE_IF:
+            collect_sites(ast, graph, caller, node.if_stmt.cond);
+            collect_sites(ast, graph, caller, node.if_stmt.arms);
+            break;
+        case NODE_ARMS:
+            collect_sites(ast, graph, caller, node.arms.then);
+            if (node.arms.otherwise != 0) collect_sites(ast, graph, caller, node.arms.otherwise);
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            collect_sites(ast, graph, caller, node.binary.lhs);
+            collect_sites(ast, graph, caller, node.binary.rhs);
+            break;
+        case NODE_INDEX:
+            /* the halves of the slice are parameters or constants */
+            collect_sites(ast, graph, caller, node.index.expr);
+            break;
+        case NODE_CALL:
+            if (node.call.args != 0) {
+                link = ast->ptr[node.call.args].link;
+                do {
+                    collect_sites(ast, graph, caller, link.ptr);
+                } while (ast_link_advance(ast, &link));
+            }
+
+            site = (struct call_site){
+                .call = nodeid,
+                .caller = caller,
+                .callee = call_graph_func(graph, node.call.callee),
+            };
+            ASSERT(site.callee != CALL_GRAPH_NO_FUNC);
+            DYNARRAY_APPEND(graph->sites, site);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Tarjan's algorithm, with an explicit stack so that long chains of calls
+ * cannot overflow ours. Components come out callees first, which is exactly
+ * the bottom-up order the inliner wants.
+ * */
+static inline void find_sccs(struct call_graph* graph) {
+    u32 nfuncs = (u32)graph->funcs.length;
+    u32* index = malloc(nfuncs * sizeof(*index));
+    u32* low = malloc(nfuncs * sizeof(*low));
+    bool* on_stack = calloc(nfuncs, sizeof(*on_stack));
+    u32* stack = malloc(nfuncs * sizeof(*stack));
+    struct tarjan_frame* frames = malloc(nfuncs * sizeof(*frames));
+    u32 sp = 0, fp = 0, counter = 0, ordered = 0, sccs = 0;
+
+    for (u32 i = 0; i < nfuncs; ++i) index[i] = UNVISITED;
+
+    for (u32 root = 0; root < nfuncs; ++root) {
+        if (index[root] != UNVISITED) continue;
+
+        index[root] = low[root] = counter++;
+        stack[sp++] = root;
+        on_stack[root] = true;
+        frames[fp++] = (struct tarjan_frame){ root, 0 };
+
+        while (fp > 0) {
+            struct tarjan_frame* frame = &frames[fp - 1];
+            u32 v = frame->func;
+            struct call_graph_func* func = &graph->funcs.at[v];
+
+            if (frame->next_site < func->nsites) {
+                u32 w = graph->sites.at[func->sites + frame->next_site++].callee;
+
+                if (w == v) func->recursive = true;
+
+                if (index[w] == UNVISITED) {
+                    index[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    on_stack[w] = true;
+                    frames[fp++] = (struct tarjan_frame){ w, 0 };
+                } else if (on_stack[w]) {
+                    low[v] = MIN(low[v], index[w]);
+                }
+                continue;
+            }
+
+            fp--;
+            if (fp > 0) low[frames[fp - 1].func] = MIN(low[frames[fp - 1].func], low[v]);
+            if (low[v] != index[v]) continue;
+
+            u32 first = ordered;
+            u32 w;
+            do {
+                w = stack[--sp];
+                on_stack[w] = false;
+                graph->funcs.at[w].scc = sccs;
+                graph->order[ordered++] = w;
+            } while (w != v);
+
+            if (ordered - first > 1) {
+                for (u32 i = first; i < ordered; ++i) graph->funcs.at[graph->order[i]].recursive = true;
+            }
+            sccs++;
+        }
+    }
+
+    free(index);
+    free(low);
+    free(on_stack);
+    free(stack);
+    free(frames);
+}
+
+struct call_graph call_graph_build(struct ast* ast) {
+    struct call_graph graph = {0};
+    struct node_link link = ast->ptr[0].link;
+
+    do {
+        struct node decl = ast->ptr[link.ptr];
+        struct call_graph_func func = {0};
+
+        if (decl.kind != NODE_FUNCDECL) continue;
+
+        func.decl = decl.id;
+        func.is_extern = decl.func_decl.body == 0;
+        DYNARRAY_APPEND(graph.funcs, func);
+    } while (ast_link_advance(ast, &link));
+
+    for (u32 i = 0; i < graph.funcs.length; ++i) {
+        struct call_graph_func* func = &graph.funcs.at[i];
+        u32 body = ast->ptr[func->decl].func_decl.body;
+
+        func->sites = (u32)graph.sites.length;
+        if (body != 0) collect_sites(ast, &graph, i, body);
+        func->nsites = (u32)graph.sites.length - func->sites;
+    }
+
+    for (usize i = 0; i < graph.sites.length; ++i) {
+        graph.funcs.at[graph.sites.at[i].callee].ncallers++;
+    }
+
+    graph.order = malloc(MAX(graph.funcs.length, 1) * sizeof(*graph.order));
+    find_sccs(&graph);
+
+    return graph;
+}
+
+void call_graph_free(struct call_graph* graph) {
+    DYNARRAY_FREE(graph->funcs);
+    DYNARRAY_FREE(graph->sites);
+    free(graph->order);
+    graph->order = NULL;
+}
+
+/* Functions are numbered in declaration order, which is also the order of their node ids */
+u32 call_graph_func(const struct call_graph* graph, u32 decl) {
+    usize lo = 0, hi = graph->funcs.length;
+
+    while (lo < hi) {
+        usize mid = lo + (hi - lo) / 2;
+        if (graph->funcs.at[mid].decl < decl) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == graph->funcs.length || graph->funcs.at[lo].decl != decl) return CALL_GRAPH_NO_FUNC;
+    return (u32)lo;
+}
+
+void call_graph_print(struct ast* ast, const struct call_graph* graph) {
+    for (usize i = 0; i < graph->funcs.length; ++i) {
+        struct call_graph_func func = graph->funcs.at[graph->order[i]];
+        struct string name = ast_func_name(ast, ast->ptr[func.decl]);
+
+        printf("%.*s: scc=%u callers=%u%s%s\n", (i32)name.length, name.cstr, func.scc,
+               func.ncallers, func.recursive ? " recursive" : "", func.is_extern ? " extern" : "");
+
+        for (u32 s = func.sites; s < func.sites + func.nsites; ++s) {
+            struct call_graph_func callee = graph->funcs.at[graph->sites.at[s].callee];
+            struct string callee_name = ast_func_name(ast, ast->ptr[callee.decl]);
+            printf("  -> %.*s\n", (i32)callee_name.length, callee_name.cstr);
+        }
+    }
+}
+
+static inline u32 find_cluster(u32* leader, u32 func) {
+    while (leader[func] != func) {
+        leader[func] = leader[leader[func]];
+        func = leader[func];
+    }
+    return func;
+}
+
+static int compare_affinity(const void* a, const void* b) {
+    const struct affinity* x = a;
+    const struct affinity* y = b;
+
+    if (x->callee != y->callee) return x->callee < y->callee ? -1 : 1;
+    return x->caller < y->caller ? -1 : x->caller > y->caller;
+}
+
+/* Hottest first, then in source order */
+static int compare_layout_key(const void* a, const void* b) {
+    const struct layout_key* x = a;
+    const struct layout_key* y = b;
+
+    if (x->heat != y->heat) return x->heat > y->heat ? -1 : 1;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+u32* call_graph_layout(const struct call_graph* graph, const u64* weights, const u64* heat) {
+    u32 nfuncs = (u32)graph->funcs.length, nsites = (u32)graph->sites.length;
+    u32* order = malloc(MAX(nfuncs, 1) * sizeof(*order));
+    u32* leader = malloc(MAX(nfuncs, 1) * sizeof(*leader));
+    u32* next = malloc(MAX(nfuncs, 1) * sizeof(*next));
+    u32* tail = malloc(MAX(nfuncs, 1) * sizeof(*tail));
+    u32* best_caller = malloc(MAX(nfuncs, 1) * sizeof(*best_caller));
+    u64* best_weight = calloc(MAX(nfuncs, 1), sizeof(*best_weight));
+    struct layout_key* keys = malloc(MAX(nfuncs, 1) * sizeof(*keys));
+    struct affinity* pairs = malloc(MAX(nsites, 1) * sizeof(*pairs));
+    u32 f, a, b, nclusters = 0, ordered = 0;
+    u64 sum;
+
+    for (u32 i = 0; i < nfuncs; ++i) {
+        leader[i] = tail[i] = i;
+        next[i] = CALL_GRAPH_NO_FUNC;
+        best_caller[i] = CALL_GRAPH_NO_FUNC;
+        keys[i] = (struct layout_key){ .heat = heat ? heat[i] : 0, .first = i, .func = i };
+    }
+
+    /* the heaviest caller of every function, adding up the sites between the same two */
+    for (u32 s = 0; s < nsites; ++s) {
+        pairs[s] = (struct affinity){
+            .callee = graph->sites.at[s].callee,
+            .caller = graph->sites.at[s].caller,
+            .weight = weights[s],
+        };
+    }
+    qsort(pairs, nsites, sizeof(*pairs), compare_affinity);
+
+    for (u32 s = 0, run; s < nsites; s = run) {
+        sum = 0;
+        for (run = s; run < nsites && compare_affinity(&pairs[run], &pairs[s]) == 0; ++run) {
+            sum += pairs[run].weight;
+        }
+        if (pairs[s].callee != pairs[s].caller && sum > best_weight[pairs[s].callee]) {
+            best_weight[pairs[s].callee] = sum;
+            best_caller[pairs[s].callee] = pairs[s].caller;
+        }
+    }
+
+    qsort(keys, nfuncs, sizeof(*keys), compare_layout_key);
+
+    for (u32 i = 0; i < nfuncs; ++i) {
+        f = keys[i].func;
+        if (best_caller[f] == CALL_GRAPH_NO_FUNC || graph->funcs.at[f].is_extern) continue;
+
+        a = find_cluster(leader, best_caller[f]);
+        b = find_cluster(leader, f);
+        if (a == b) continue;
+
+        next[tail[a]] = b;
+        tail[a] = tail[b];
+        leader[b] = a;
+    }
+
+    /* a cluster is as hot as all of its functions together */
+    for (u32 i = 0; i < nfuncs; ++i) {
+        keys[i] = (struct layout_key){ .heat = 0, .first = i, .func = i };
+    }
+    for (u32 i = 0; i < nfuncs; ++i) {
+        a = find_cluster(leader, i);
+        keys[a].heat += heat ? heat[i] : 0;
+        keys[a].first = MIN(keys[a].first, i);
+    }
+    for (u32 i = 0; i < nfuncs; ++i) {
+        if (leader[i] == i) keys[nclusters++] = keys[i];
+    }
+    qsort(keys, nclusters, sizeof(*keys), compare_layout_key);
+
+    for (u32 c = 0; c < nclusters; ++c) {
+        for (f = keys[c].func; f != CALL_GRAPH_NO_FUNC; f = next[f]) {
+            order[ordered++] = f;
+        }
+    }
+    ASSERT(ordered == nfuncs);
+
+    free(leader);
+    free(next);
+    free(tail);
+    free(best_caller);
+    free(best_weight);
+    free(keys);
+    free(pairs);
+
+    return order;
+}
@@ -0,0 +1,70 @@
+#ifndef __CALLGRAPH_H
+#define __CALLGRAPH_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Whole translation unit call graph.
+ *
+ * Built straight from the `struct ast' once calls have been resolved to
+ * their NODE_FUNCDECLs. Functions are numbered in declaration order (which is
+ * also the order of their node ids) and every NODE_CALL in a body is an edge.
+ * `order' lists the functions bottom-up: callees come before their callers,
+ * except inside a cycle of recursive functions, which is kept together.
+ * */
+
+struct call_site {
+    u32 call;       /* the NODE_CALL */
+    u32 caller;     /* function indices */
+    u32 callee;
+};
+
+struct call_graph_func {
+    u32 decl;       /* NODE_FUNCDECL */
+    u32 sites;      /* first of this function's outgoing call sites */
+    u32 nsites;
+    u32 ncallers;   /* call sites anywhere in the program which call this function */
+    u32 scc;        /* strongly connected component, in bottom-up order */
+    bool recursive; /* part of a cycle, possibly calling only itself */
+    bool is_extern;
+};
+
+struct call_graph_funcs {
+    struct call_graph_func* at;
+    DYNARRAY_FIELDS;
+};
+
+struct call_sites {
+    struct call_site* at;
+    DYNARRAY_FIELDS;
+};
+
+struct call_graph {
+    struct call_graph_funcs funcs;
+    struct call_sites sites;    /* grouped by caller, in evaluation order within one */
+    u32* order;                 /* funcs.length function indices, callees first */
+};
+
+#define CALL_GRAPH_NO_FUNC UINT32_MAX
+
+struct call_graph call_graph_build(struct ast* ast);
+void call_graph_free(struct call_graph* graph);
+
+/* Returns CALL_GRAPH_NO_FUNC when `decl' is not a function declaration */
+u32 call_graph_func(const struct call_graph* graph, u32 decl);
+
+void call_graph_print(struct ast* ast, const struct call_graph* graph);
+
+/*
+ * An order to lay the functions out in, so that callers sit right before the
+ * callees they call most (call-chain clustering). `weights' has how often
+ * every call site runs, `heat' how often every function is entered or NULL
+ * without a profile. Functions are visited hottest first and each one's
+ * cluster is appended to the cluster of its most frequent caller; clusters
+ * then come out hottest first, in source order otherwise. The result is
+ * funcs.length function indices, for the caller to free.
+ * */
+u32* call_graph_layout(const struct call_graph* graph, const u64* weights, const u64* heat);
+
+#endif  /*__CALLGRAPH_H*/
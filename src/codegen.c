@@ -0,0 +1,2227 @@
+#include "codegen.h"
+#include "callgraph.h"
+#include "prune.h"
+#include "stats.h"
+
+#define femit(f, ...) STATEMENT( fprintf(f, __VA_ARGS__); fprintf(f, "\n"); )
+
+#define CODEGEN_MAX_ARGS 64
+
+/*
+ * SysV AMD64 calling convention
+ *
+ * The first six integer arguments go in registers, the rest are pushed right
+ * to left, and %rsp must be 16 byte aligned at every `call'. Leaf functions
+ * keep their parameters in the argument registers and never touch the stack.
+ * Functions which do make calls move their parameters into callee-saved
+ * registers (saving only the ones they use), so that the parameters survive
+ * the calls and can be passed along without going through memory.
+ * */
+
+static const enum x86_reg arg_regs[] = { X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9 };
+static const enum x86_reg saved_regs[] = { X86_RBX, X86_R12, X86_R13, X86_R14, X86_R15 };
+
+#define ARG_REGS ARRLENGTH(arg_regs)
+#define SAVED_REGS ARRLENGTH(saved_regs)
+
+/* Never used for arguments, so parameters of leaf functions stay where they are */
+static const enum x86_reg scratch_regs[] = { X86_R11, X86_R10 };
+
+#define SCRATCH_REGS ARRLENGTH(scratch_regs)
+
+/*
+ * System calls
+ *
+ * An extern function named after a Linux system call is never called.
+ * Its arguments go straight into the registers the kernel reads them from
+ * and a `syscall' takes the place of the `call', so freestanding programs
+ * don't go through a stub for every write. The arguments are passed as
+ * they are to any other extern function, a slice being its pointer and its
+ * length, except that the kernel gets the length in bytes.
+ *
+ * The kernel only changes %rax, %rcx and %r11, and doesn't care how the
+ * stack is aligned or what is below %rsp. A function whose only calls are
+ * system calls stays a leaf, its parameters in the argument registers and
+ * its temporaries in the red zone. Unless a system call overwrites one of
+ * those parameters while the function still reads it: such functions are
+ * emitted again the way any other function making calls is, with their
+ * parameters in callee-saved registers. Nothing runs after a system call
+ * which doesn't return, so whatever it overwrites is left alone.
+ * */
+
+struct syscall {
+    struct string name;
+    u32 number;
+};
+
+static const struct syscall syscalls[] = {
+    { STRING_LIT("sys_read"), 0 },
+    { STRING_LIT("sys_write"), 1 },
+    { STRING_LIT("sys_open"), 2 },
+    { STRING_LIT("sys_close"), 3 },
+    { STRING_LIT("sys_getpid"), 39 },
+    { STRING_LIT("sys_exit"), 60 },
+    { STRING_LIT("sys_kill"), 62 },
+    { STRING_LIT("sys_exit_group"), 231 },
+};
+
+static const enum x86_reg syscall_regs[] = { X86_RDI, X86_RSI, X86_RDX, X86_R10, X86_R8, X86_R9 };
+
+#define SYSCALL_REGS ARRLENGTH(syscall_regs)
+
+/*
+ * Stack slots
+ *
+ * A value which has to wait while something else is computed gets a slot
+ * in the frame instead of being pushed. That covers the left hand side of an
+ * operation once the scratch registers run out, arguments parked across
+ * calls and a borrowed base register. Pushes are left to the stack arguments
+ * of calls, which need them where the callee expects them.
+ *
+ * A temporary lives from its spill to its reload and their lifetimes nest,
+ * so the interference graph is an interval graph. Coloring it greedily
+ * takes exactly as many slots as temporaries are ever live at once: the k-th
+ * live temporary gets slot k, and temporaries which are never live together
+ * share one. Every slot holds a whole register, like the parameters spilled
+ * to the frame, so with all of them 8 bytes and 8 byte aligned the only
+ * padding left is what keeps calls aligned. Nothing moves %rsp between
+ * calls either, so calls in the middle of an expression no longer need
+ * padding of their own.
+ *
+ * With a frame the slots sit below the saved registers and the parameters,
+ * and the frame is sized once the function has been emitted. A leaf calls
+ * nobody, so nothing overwrites the 128 bytes below %rsp (the red zone of
+ * the ABI). Its slots go there without a frame or any change to %rsp, and
+ * only the temporaries past it are pushed.
+ * */
+
+#define RED_ZONE 128
+#define RED_ZONE_SLOTS (RED_ZONE / 8)
+
+#define EAX x86_reg(X86_RAX, 4)
+#define RAX x86_reg(X86_RAX, 8)
+#define RSP x86_reg(X86_RSP, 8)
+#define RBP x86_reg(X86_RBP, 8)
+
+/*
+ * Instruction selection
+ *
+ * Expressions are covered with tiles from the pattern table further down.
+ * A pattern matches the shape of the subtree below one node, names the
+ * subtrees it still needs computed into a register (its leaves) and what
+ * its own instructions cost, in the cycles of `x86_inst_cycles'. The
+ * cheapest cover of every node is worked out bottom-up and remembered in
+ * `covers', then the chosen tiles are emitted top-down, each leaving its
+ * value in the 32 bit register it is asked for. Teaching the backend a new
+ * x86 idiom means writing a match and an emit function and adding a line to
+ * the table.
+ * */
+
+struct tile {
+    u32 cost;                   /* of the instructions of the tile, without its leaves */
+    u32 leaves[2];
+    u32 nleaves;
+    struct x86_operand operand; /* immediate or parameter folded into the instruction */
+    struct x86_operand address; /* lea, a register of X86_NO_REG stands for the leaf */
+    bool has_base;
+    bool swapped;               /* the leaf is the right hand side, `operand' the left */
+};
+
+struct codegen;
+
+struct pattern {
+    const char* name;
+    bool (*match)(struct codegen* cg, struct node node, struct tile* tile);
+    void (*emit)(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+};
+
+struct cover {
+    u32 cost;   /* 0 until the node has been looked at */
+    u8 pattern;
+};
+
+/*
+ * Code layout
+ *
+ * The arm of an `if' which is less likely to run is moved out of the way so
+ * that the likely path falls through: unlikely arms go after the function's
+ * `ret', cold ones into .text.unlikely, next to every other piece of code
+ * which never runs. Which arm that is comes from the profile when there is
+ * one, and from static guesses otherwise: arms calling one of the functions
+ * below are error paths and cold, and the arm which returns early is
+ * unlikely (it is usually the base case of a recursion).
+ * */
+
+static const struct string noreturn_funcs[] = {
+    STRING_LIT("exit"), STRING_LIT("_exit"), STRING_LIT("abort"), STRING_LIT("sys_exit"), STRING_LIT("sys_exit_group"),
+};
+
+enum arm_place : u8 {
+    ARM_INLINE,
+    ARM_UNLIKELY,   /* after the `ret' of the function */
+    ARM_COLD,       /* in .text.unlikely */
+};
+
+/* An arm of an `if' emitted after the rest of the function */
+struct outlined_arm {
+    u32 label;
+    u32 ifid;
+    u32 stmt;
+    bool then;
+    bool cold;
+    u32 resume;     /* where it jumps back to */
+    u32 depth;
+    bool fast;      /* part of the fast version of the function, see bounds.h */
+};
+
+struct outlined_arms {
+    struct outlined_arm* at;
+    DYNARRAY_FIELDS;
+};
+
+/* An instance of a generic function as it was emitted, with its labels counted from `labels' */
+struct emitted_instance {
+    u32 generic;
+    struct string name;
+    u32 labels;
+    u32 cold_label;
+    bool cold;
+    struct x86_insts insts;
+};
+
+struct emitted_instances {
+    struct emitted_instance* at;
+    DYNARRAY_FIELDS;
+};
+
+/* Instructions adding or subtracting the size of the frame, which is only known at the end */
+struct frame_fixups {
+    u32* at;
+    DYNARRAY_FIELDS;
+};
+
+struct codegen {
+    FILE* out;
+    struct ast* ast;
+    struct codegen_options options;
+    struct x86_insts insts; /* the function being emitted, printed once it is done */
+    u32 labels;             /* labels are numbered across the whole file */
+    struct cover* covers;   /* indexed by node id */
+    bool has_roots;         /* `main' or an exported function is among those emitted */
+
+    /* the function currently being emitted */
+    u32 decl;
+    u32 nparams;
+    u64 wide;           /* parameters holding pointers, which are moved around as 64 bits */
+    bool leaf;
+    bool framed;        /* isn't one, whatever its calls, see `System calls' */
+    u64 read_params;    /* of a leaf, which were read from their register */
+    u64 clobbered;      /* of a leaf, whose register a system call has overwritten */
+    bool frame;         /* %rbp has been set up */
+    u32 saved;          /* callee-saved registers pushed after %rbp */
+    u32 slots;          /* 8 byte stack slots below the saved registers for parameters */
+    u32 temps;          /* temporaries live, see `Stack slots' */
+    bool spilled;       /* a temporary went to a slot */
+    bool push_temps;    /* they are pushed instead */
+    struct x86_insts pushed;    /* the other version of the function, see `emit_func_decl' */
+    struct frame_fixups fixups;
+    u32 depth;          /* bytes pushed since the prologue, to keep calls aligned */
+    u32 scratch;        /* scratch registers holding a value */
+    u32 ret_label;      /* the epilogue, every return jumps there */
+    bool loops;         /* calls itself in tail position, which jumps to `body_label' */
+    u32 body_label;     /* right after the prologue */
+    bool is_main;
+    bool local;         /* isn't `main' or exported while something is, the symbol stays in the file */
+    bool cold;          /* the whole function never ran, it goes to .text.unlikely */
+    bool in_cold;       /* emitting a cold arm, whatever it outlines is cold too */
+    u32 cold_label;     /* the first instruction of .text.unlikely, UINT32_MAX when there is none */
+    struct outlined_arms outlined;
+    bool section_cold;  /* .text.unlikely is the current section */
+
+    /*
+     * Out of bounds accesses jump to `trap_label', a `ud2' after everything
+     * else, UINT32_MAX until an access needs it. A function with bounds
+     * guards is emitted twice, the `fast' version first, and its tail calls
+     * which keep the guards true jump to `fast_label'.
+     * */
+    u32 trap_label;
+    bool fast;
+    u32 fast_label;
+    bool* literals;     /* by the node id of their elements, slice literals which go into .rodata */
+
+    u32* generic_of;    /* by node id, the generic a NODE_FUNCDECL is an instance of, UINT32_MAX for the rest */
+    struct emitted_instances emitted;
+};
+
+static inline void emit(struct codegen* cg, struct x86_inst inst);
+static inline const struct syscall* syscall_of(struct ast* ast, struct node call);
+static inline bool find_call(struct ast* ast, u32 nodeid, bool with_syscalls);
+static inline bool contains_call(struct ast* ast, u32 nodeid);
+static inline bool makes_call(struct ast* ast, u32 nodeid);
+static inline bool reads_param(struct ast* ast, u32 nodeid, u32 index);
+static inline bool is_tail_call(struct codegen* cg, struct node ret);
+static inline bool needs_frame(struct codegen* cg, u32 nodeid);
+static inline bool temp_in_slot(struct codegen* cg, u32 k);
+static inline struct x86_operand temp_slot(struct codegen* cg, u32 k, u8 size);
+static inline struct x86_operand emit_spill(struct codegen* cg, struct x86_operand reg);
+static inline void emit_reload(struct codegen* cg, struct x86_operand dst);
+static inline void emit_frame_adjust(struct codegen* cg, enum x86_op op);
+static inline u32 frame_slots(struct codegen* cg);
+static inline u32 frame_size(struct codegen* cg);
+static inline void fix_frame(struct codegen* cg);
+static inline u32 count_insts(const struct x86_insts* insts);
+static inline void emit_func_insts(struct codegen* cg, struct node node);
+static inline bool param_in_register(struct codegen* cg, u32 index);
+static inline struct x86_operand param_operand(struct codegen* cg, u32 index, u8 size);
+static inline u8 param_size(struct codegen* cg, u32 index);
+static inline struct x86_operand len_operand(struct codegen* cg, struct node slice);
+static inline bool index_checked(struct codegen* cg, u32 nodeid);
+static inline u32 trap_label(struct codegen* cg);
+static inline enum x86_op binary_op(struct node node);
+static inline enum x86_cond compare_cond(enum node_kind kind);
+static inline u32 binary_cost(struct node node, struct x86_operand operand, bool swapped);
+static inline void emit_binary_op(struct codegen* cg, struct node node, struct x86_operand operand,
+                                  struct x86_operand dst, bool swapped);
+
+static inline bool address_reg(struct codegen* cg, u32 nodeid, u8 scale, struct tile* tile);
+static inline bool address_disp(struct tile* tile, i64 disp);
+static bool match_address(struct codegen* cg, u32 nodeid, struct tile* tile);
+
+static bool match_number(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_param(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_data(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_call(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_index(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_op_imm(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_op_rm(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_op_rm_swap(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_imul_imm(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_lea(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_op_reg(struct codegen* cg, struct node node, struct tile* tile);
+static bool match_op_spill(struct codegen* cg, struct node node, struct tile* tile);
+
+static void emit_mov(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_data(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_call_value(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_index(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_op_operand(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_imul_imm(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_lea(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_op_reg(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+static void emit_op_spill(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst);
+
+static inline u32 select_tile(struct codegen* cg, u32 nodeid);
+static inline void emit_tile(struct codegen* cg, u32 nodeid, struct x86_operand dst);
+
+static inline void emit_expression(struct codegen* cg, struct node node);
+static inline void emit_expression_into(struct codegen* cg, struct node node, struct x86_operand reg);
+static inline void emit_push(struct codegen* cg, struct node node);
+static inline u32 call_args(struct codegen* cg, struct node node, u32 args[CODEGEN_MAX_ARGS]);
+static inline void emit_call(struct codegen* cg, struct node node);
+static inline void emit_syscall_arg(struct codegen* cg, struct node arg, bool bytes, struct x86_operand reg);
+static inline void emit_syscall(struct codegen* cg, struct node node, const struct syscall* syscall);
+static inline void emit_tail_call(struct codegen* cg, struct node node);
+static inline void emit_epilogue(struct codegen* cg);
+static inline void emit_return(struct codegen* cg, struct node node);
+static inline void emit_branch(struct codegen* cg, u32 nodeid, bool when, u32 label);
+static inline void emit_count(struct codegen* cg, u32 nodeid, u32 offset);
+static inline void emit_arm(struct codegen* cg, u32 ifid, u32 stmt, bool then);
+static inline bool is_noreturn_call(struct codegen* cg, u32 nodeid);
+static inline bool arm_traps(struct codegen* cg, u32 stmt);
+static inline bool arm_returns(struct codegen* cg, u32 stmt);
+static inline bool has_profile(struct codegen* cg);
+static inline void place_arms(struct codegen* cg, struct node node, enum arm_place* then_place,
+                              enum arm_place* otherwise_place, bool* flip);
+static inline void emit_if(struct codegen* cg, struct node node);
+static inline void emit_guard(struct codegen* cg, struct bounds_guard guard, u32 label);
+static inline void emit_statement(struct codegen* cg, struct node node);
+static inline bool exits_program(struct codegen* cg, struct x86_inst inst);
+static inline bool same_operand(struct x86_operand a, u32 a_labels, struct x86_operand b, u32 b_labels);
+static inline const struct emitted_instance* fold_instance(struct codegen* cg, u32 labels);
+static inline void emit_func_decl(struct codegen* cg, struct node node);
+static inline void emit_outlined(struct codegen* cg, bool cold);
+static inline void switch_section(struct codegen* cg, bool cold);
+static inline void count_calls(struct codegen* cg, u32 nodeid, u64 count, u64* counts);
+static inline void emit_profile_runtime(struct codegen* cg);
+static inline void emit_literals(struct codegen* cg);
+
+/* Tried in this order, ties go to the pattern found first */
+static const struct pattern patterns[] = {
+    { "number", match_number, emit_mov },                   /* mov $n, %r */
+    { "param", match_param, emit_mov },                     /* mov p, %r */
+    { "data", match_data, emit_data },                      /* lea .Lslice(%rip), %r */
+    { "call", match_call, emit_call_value },
+    { "index", match_index, emit_index },                   /* cmp len, %r; jae trap; mov (p,%r,4), %r */
+    { "op-imm", match_op_imm, emit_op_operand },            /* x + n: add $n, %r */
+    { "op-rm", match_op_rm, emit_op_operand },              /* x + p: add p, %r, p in a register or memory */
+    { "op-rm-swap", match_op_rm_swap, emit_op_operand },    /* p + x: add p, %r, p - x: sub p, %r; neg %r */
+    { "imul-imm", match_imul_imm, emit_imul_imm },          /* p * n: imul $n, p, %r */
+    { "lea", match_lea, emit_lea },                         /* p + q*4 + n: lea n(p,q,4), %r */
+    { "op-reg", match_op_reg, emit_op_reg },                /* x + y, y in a scratch register */
+    { "op-spill", match_op_spill, emit_op_spill },          /* x + y, x pushed and used from memory */
+};
+
+#define PATTERNS ARRLENGTH(patterns)
+
+static inline void emit(struct codegen* cg, struct x86_inst inst) {
+    DYNARRAY_APPEND(cg->insts, inst);
+}
+
+/* The system call `call' lowers to, NULL for anything else */
+static inline const struct syscall* syscall_of(struct ast* ast, struct node call) {
+    struct node callee = ast->ptr[call.call.callee];
+
+    if (callee.func_decl.body != 0 || ast_list_length(ast, call.call.args) > SYSCALL_REGS) return NULL;
+
+    for (u32 i = 0; i < ARRLENGTH(syscalls); ++i) {
+        if (string_equal(ast_func_name(ast, callee), syscalls[i].name)) return &syscalls[i];
+    }
+    return NULL;
+}
+
+/* Without `with_syscalls', system calls only count for the calls in their arguments */
+static inline bool find_call(struct ast* ast, u32 nodeid, bool with_syscalls) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_CALL:
+            if (with_syscalls || syscall_of(ast, node) == NULL) return true;
+            if (node.call.args == 0) return false;
+            link = ast->ptr[node.call.args].link;
+            do {
+                if (find_call(ast, link.ptr, with_syscalls)) return true;
+            } while (ast_link_advance(ast, &link));
+            return false;
+        case NODE_RETURN:
+            return node.return_stmt.expr != 0 && find_call(ast, node.return_stmt.expr, with_syscalls);
+        case NODE_IF:
+            return find_call(ast, node.if_stmt.cond, with_syscalls) ||
+                   find_call(ast, node.if_stmt.arms, with_syscalls);
+        case NODE_ARMS:
+            return find_call(ast, node.arms.then, with_syscalls) ||
+                   (node.arms.otherwise != 0 && find_call(ast, node.arms.otherwise, with_syscalls));
+        case NODE_INDEX:
+            return find_call(ast, node.index.expr, with_syscalls);
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            return find_call(ast, node.binary.lhs, with_syscalls) ||
+                   find_call(ast, node.binary.rhs, with_syscalls);
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return false;
+            link = node.link;
+            do {
+                if (find_call(ast, link.ptr, with_syscalls)) return true;
+            } while (ast_link_advance(ast, &link));
+            return false;
+        default:
+            return false;
+    }
+}
+
+static inline bool contains_call(struct ast* ast, u32 nodeid) {
+    return find_call(ast, nodeid, true);
+}
+
+/* Calls which need a frame, see `System calls' */
+static inline bool makes_call(struct ast* ast, u32 nodeid) {
+    return find_call(ast, nodeid, false);
+}
+
+static inline bool reads_param(struct ast* ast, u32 nodeid, u32 index) {
+    struct node node = ast->ptr[nodeid];
+    struct node slice;
+    struct node_link link;
+
+    if (node.kind == NODE_PARAMREF) return node.param_ref.index == index;
+    if (node.kind == NODE_INDEX) {
+        slice = ast->ptr[node.index.slice];
+        return reads_param(ast, slice.slice.ptr, index) || reads_param(ast, slice.slice.len, index) ||
+               reads_param(ast, node.index.expr, index);
+    }
+    if (node_is_binary(node.kind)) {
+        return reads_param(ast, node.binary.lhs, index) || reads_param(ast, node.binary.rhs, index);
+    }
+    if (node.kind != NODE_CALL || node.call.args == 0) return false;
+
+    link = ast->ptr[node.call.args].link;
+    do {
+        if (reads_param(ast, link.ptr, index)) return true;
+    } while (ast_link_advance(ast, &link));
+    return false;
+}
+
+/*
+ * `return f(...)' which can jump to `f' instead of calling it. Calls to
+ * ourselves become a jump back to the top of the body and work with either
+ * convention. Anything else reuses our return address, so every argument
+ * has to go in a register: the caller's stack arguments are not ours to
+ * grow.
+ * */
+static inline bool is_tail_call(struct codegen* cg, struct node ret) {
+    struct node call;
+    bool is_extern;
+
+    if (!cg->options.tail_calls || ret.return_stmt.expr == 0) return false;
+
+    call = cg->ast->ptr[ret.return_stmt.expr];
+    if (call.kind != NODE_CALL) return false;
+    if (call.call.callee == cg->decl) return true;
+    if (syscall_of(cg->ast, call) != NULL) return false;
+    /* the counters are written out when `main' returns */
+    if (cg->options.instrument && cg->is_main) return false;
+
+    is_extern = cg->ast->ptr[call.call.callee].func_decl.body == 0;
+    if (cg->options.call_conv == CALL_CONV_STACK && !is_extern) return false;
+
+    return ast_list_length(cg->ast, call.call.args) <= ARG_REGS;
+}
+
+/*
+ * Does the statement make calls which need a frame? Tail calls leave with
+ * the stack as it was on entry, so a function whose only calls are tail
+ * calls needs none, unless their arguments make calls of their own. Tail
+ * calls to the function itself are noted in `loops' on the way.
+ * */
+static inline bool needs_frame(struct codegen* cg, u32 nodeid) {
+    struct node node = cg->ast->ptr[nodeid];
+    struct node arms;
+    struct node_link link;
+    bool result = false;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr == 0) return false;
+            if (!is_tail_call(cg, node)) return makes_call(cg->ast, node.return_stmt.expr);
+
+            node = cg->ast->ptr[node.return_stmt.expr];
+            cg->loops |= node.call.callee == cg->decl;
+            if (node.call.args == 0) return false;
+            link = cg->ast->ptr[node.call.args].link;
+            do {
+                result |= makes_call(cg->ast, link.ptr);
+            } while (ast_link_advance(cg->ast, &link));
+            return result;
+        case NODE_IF:
+            arms = cg->ast->ptr[node.if_stmt.arms];
+            result = makes_call(cg->ast, node.if_stmt.cond);
+            result |= needs_frame(cg, arms.arms.then);
+            if (arms.arms.otherwise != 0) result |= needs_frame(cg, arms.arms.otherwise);
+            return result;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return false;
+            link = node.link;
+            do {
+                result |= needs_frame(cg, link.ptr);
+            } while (ast_link_advance(cg->ast, &link));
+            return result;
+        default:
+            return makes_call(cg->ast, nodeid);
+    }
+}
+
+static inline bool param_in_register(struct codegen* cg, u32 index) {
+    if (cg->options.call_conv == CALL_CONV_STACK) return false;
+    if (cg->leaf) return index < ARG_REGS;
+    return index < SAVED_REGS;
+}
+
+/* Where parameter `index' lives, `size' bytes wide */
+static inline struct x86_operand param_operand(struct codegen* cg, u32 index, u8 size) {
+    if (cg->options.call_conv == CALL_CONV_STACK) {
+        return x86_mem(X86_RBP, 16 + 8 * index, size);
+    } else if (cg->leaf) {
+        if (index < ARG_REGS) {
+            cg->read_params |= (u64)1 << index;
+            return x86_reg(arg_regs[index], size);
+        }
+        return x86_mem(X86_RSP, 8 + cg->depth + 8 * (index - (u32)ARG_REGS), size);
+    } else {
+        if (index < SAVED_REGS) return x86_reg(saved_regs[index], size);
+        if (index < ARG_REGS) return x86_mem(X86_RBP, -8 * (i32)(cg->saved + 1 + index - (u32)SAVED_REGS), size);
+        return x86_mem(X86_RBP, 16 + 8 * (index - (u32)ARG_REGS), size);
+    }
+}
+
+static inline u8 param_size(struct codegen* cg, u32 index) {
+    return index < 64 && (cg->wide >> index) & 1 ? 8 : 4;
+}
+
+/* Without a frame, only the red zone can be written without moving %rsp */
+static inline bool temp_in_slot(struct codegen* cg, u32 k) {
+    return !cg->push_temps && (cg->frame || k < RED_ZONE_SLOTS);
+}
+
+/* Where the k-th live temporary goes, when it has a slot */
+static inline struct x86_operand temp_slot(struct codegen* cg, u32 k, u8 size) {
+    if (cg->frame) return x86_mem(X86_RBP, -8 * (i32)(cg->saved + cg->slots + 1 + k), size);
+    return x86_mem(X86_RSP, (i32)cg->depth - 8 * (i32)(k + 1), size);
+}
+
+/* Parks the whole of `reg' until the matching `emit_reload', returns where it went */
+static inline struct x86_operand emit_spill(struct codegen* cg, struct x86_operand reg) {
+    u32 k = cg->temps++;
+    struct x86_operand slot;
+
+    reg = x86_reg(reg.reg, 8);
+    if (temp_in_slot(cg, k)) {
+        cg->spilled = true;
+        slot = temp_slot(cg, k, 8);
+        emit(cg, x86_inst2(X86_MOV, reg, slot));
+        return slot;
+    }
+
+    /* past the red zone, which the pushes must not land in */
+    if (!cg->push_temps && !cg->frame && k == RED_ZONE_SLOTS) {
+        emit(cg, x86_inst2(X86_SUB, x86_imm(RED_ZONE), RSP));
+        cg->depth += RED_ZONE;
+    }
+    emit(cg, x86_inst1(X86_PUSH, reg));
+    cg->depth += 8;
+    return x86_mem(X86_RSP, 0, 8);
+}
+
+/* Takes the last temporary back into `dst', or just drops it when `dst' is X86_NONE */
+static inline void emit_reload(struct codegen* cg, struct x86_operand dst) {
+    u32 k = --cg->temps;
+    struct x86_inst* last = cg->insts.length > 0 ? &cg->insts.at[cg->insts.length - 1] : NULL;
+    struct x86_operand slot;
+
+    if (dst.kind == X86_REG) dst = x86_reg(dst.reg, 8);
+
+    if (!temp_in_slot(cg, k)) {
+        if (dst.kind == X86_REG) emit(cg, x86_inst1(X86_POP, dst));
+        else emit(cg, x86_inst2(X86_ADD, x86_imm(8), RSP));
+        cg->depth -= 8;
+        if (!cg->push_temps && !cg->frame && k == RED_ZONE_SLOTS) {
+            emit(cg, x86_inst2(X86_ADD, x86_imm(RED_ZONE), RSP));
+            cg->depth -= RED_ZONE;
+        }
+        return;
+    }
+
+    if (dst.kind != X86_REG) return;
+
+    /* reloaded right away, the value never has to go through memory */
+    slot = temp_slot(cg, k, 8);
+    if (last != NULL && last->op == X86_MOV && x86_operand_equal(last->dst, slot)) {
+        *last = x86_inst2(X86_MOV, last->src, dst);
+        if (last->src.reg == dst.reg) cg->insts.length--;
+        return;
+    }
+
+    emit(cg, x86_inst2(X86_MOV, slot, dst));
+}
+
+/* `op' $frame, %rsp, the size is filled in by `fix_frame' */
+static inline void emit_frame_adjust(struct codegen* cg, enum x86_op op) {
+    DYNARRAY_APPEND(cg->fixups, (u32)cg->insts.length);
+    emit(cg, x86_inst2(op, x86_imm(0), RSP));
+}
+
+/* The slots below the saved registers the code uses, temporaries reloaded right away never got to theirs */
+static inline u32 frame_slots(struct codegen* cg) {
+    u32 deepest = cg->saved + cg->slots;
+    struct x86_operand operands[3];
+
+    for (usize i = 0; i < cg->insts.length; ++i) {
+        operands[0] = cg->insts.at[i].src;
+        operands[1] = cg->insts.at[i].dst;
+        operands[2] = cg->insts.at[i].aux;
+        for (u32 j = 0; j < 3; ++j) {
+            if (operands[j].kind != X86_MEM || operands[j].reg != X86_RBP || operands[j].disp >= 0) continue;
+            deepest = MAX(deepest, (u32)-operands[j].disp / 8);
+        }
+    }
+
+    return deepest - cg->saved;
+}
+
+/* The slots of a leaf can stay in the red zone, anything else keeps %rsp 16 byte aligned at calls */
+static inline u32 frame_size(struct codegen* cg) {
+    u32 slots = frame_slots(cg);
+
+    if (cg->leaf && 8 * slots <= RED_ZONE) return 0;
+    return 8 * slots + ((cg->saved + slots) % 2 ? 8 : 0);
+}
+
+static inline void fix_frame(struct codegen* cg) {
+    u32 size = frame_size(cg);
+    usize kept = 0;
+
+    for (usize i = 0; i < cg->fixups.length; ++i) {
+        if (size) cg->insts.at[cg->fixups.at[i]].src = x86_imm(size);
+        else cg->insts.at[cg->fixups.at[i]].op = X86_NOP;
+    }
+    if (size || cg->fixups.length == 0) return;
+
+    for (usize i = 0; i < cg->insts.length; ++i) {
+        if (cg->insts.at[i].op != X86_NOP) cg->insts.at[kept++] = cg->insts.at[i];
+    }
+    cg->insts.length = kept;
+}
+
+/* The length of a slice, a parameter or the constant of a literal */
+static inline struct x86_operand len_operand(struct codegen* cg, struct node slice) {
+    struct node len = cg->ast->ptr[slice.slice.len];
+
+    if (len.kind == NODE_NUMBER) return x86_imm(len.number);
+    return param_operand(cg, len.param_ref.index, 4);
+}
+
+static inline bool index_checked(struct codegen* cg, u32 nodeid) {
+    enum bounds_check check = bounds_of(cg->options.bounds, nodeid);
+    return check == BOUNDS_CHECKED || (check == BOUNDS_UNCHECKED_FAST && !cg->fast);
+}
+
+static inline u32 trap_label(struct codegen* cg) {
+    if (cg->trap_label == UINT32_MAX) cg->trap_label = cg->labels++;
+    return cg->trap_label;
+}
+
+static inline enum x86_op binary_op(struct node node) {
+    switch (node.kind) {
+        case NODE_ADD: return X86_ADD; break;
+        case NODE_SUB: return X86_SUB; break;
+        case NODE_MUL: return X86_IMUL; break;
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            return X86_CMP;
+        default: break;
+    }
+
+    UNREACHABLE("binary_op: not a binary expression");
+}
+
+static inline enum x86_cond compare_cond(enum node_kind kind) {
+    switch (kind) {
+        case NODE_EQ: return X86_CC_E; break;
+        case NODE_NE: return X86_CC_NE; break;
+        case NODE_LT: return X86_CC_L; break;
+        case NODE_LE: return X86_CC_LE; break;
+        case NODE_GT: return X86_CC_G; break;
+        case NODE_GE: return X86_CC_GE; break;
+        default: break;
+    }
+
+    UNREACHABLE("compare_cond: not a comparison");
+}
+
+/* What `emit_binary_op' costs */
+static inline u32 binary_cost(struct node node, struct x86_operand operand, bool swapped) {
+    u32 cost = x86_inst_cycles(x86_inst2(binary_op(node), operand, EAX));
+
+    if (node_is_compare(node.kind)) {
+        cost += x86_inst_cycles(x86_setcc(X86_CC_E, x86_reg(X86_RAX, 1)));
+        cost += x86_inst_cycles(x86_inst2(X86_MOVZX, x86_reg(X86_RAX, 1), EAX));
+    } else if (swapped && node.kind == NODE_SUB) {
+        cost += x86_inst_cycles(x86_inst1(X86_NEG, EAX));
+    }
+
+    return cost;
+}
+
+/*
+ * `dst = dst op operand', with `dst' holding the left hand side. When it is
+ * `swapped', `dst' holds the right hand side and `operand' the left.
+ * Comparisons turn the flags into 0 or 1.
+ * */
+static inline void emit_binary_op(struct codegen* cg, struct node node, struct x86_operand operand,
+                                  struct x86_operand dst, bool swapped) {
+    enum x86_cond cond;
+
+    emit(cg, x86_inst2(binary_op(node), operand, dst));
+
+    if (node_is_compare(node.kind)) {
+        cond = compare_cond(node.kind);
+        emit(cg, x86_setcc(swapped ? x86_cond_swap(cond) : cond, x86_reg(dst.reg, 1)));
+        emit(cg, x86_inst2(X86_MOVZX, x86_reg(dst.reg, 1), dst));
+    } else if (swapped && node.kind == NODE_SUB) {
+        emit(cg, x86_inst1(X86_NEG, dst));
+    }
+}
+
+/*
+ * Puts `nodeid' into the address of the tile as a register scaled by
+ * `scale': a parameter living in a register, or the one leaf, which is
+ * computed into the destination register beforehand. `lea' reads 64 bit
+ * registers, but the low 32 bits of the result only depend on the low 32
+ * bits of the inputs.
+ * */
+static inline bool address_reg(struct codegen* cg, u32 nodeid, u8 scale, struct tile* tile) {
+    struct node node = cg->ast->ptr[nodeid];
+    enum x86_reg reg;
+
+    if (node.kind == NODE_PARAMREF && param_in_register(cg, node.param_ref.index)) {
+        reg = param_operand(cg, node.param_ref.index, 8).reg;
+    } else if (tile->nleaves == 0) {
+        tile->leaves[tile->nleaves++] = nodeid;
+        reg = X86_NO_REG;
+    } else {
+        return false;
+    }
+
+    if (scale == 1 && !tile->has_base) {
+        tile->address.reg = reg;
+        tile->has_base = true;
+    } else if (tile->address.scale == 0) {
+        tile->address.index = reg;
+        tile->address.scale = scale;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static inline bool address_disp(struct tile* tile, i64 disp) {
+    disp += tile->address.disp;
+    if (disp < INT32_MIN || disp > INT32_MAX) return false;
+
+    tile->address.disp = (i32)disp;
+    return true;
+}
+
+/* Splits `base + index*scale + disp' out of the tree below `nodeid' */
+static bool match_address(struct codegen* cg, u32 nodeid, struct tile* tile) {
+    struct node node = cg->ast->ptr[nodeid];
+    struct node rhs;
+
+    switch (node.kind) {
+        case NODE_NUMBER:
+            return address_disp(tile, node.number);
+        case NODE_ADD:
+            return match_address(cg, node.binary.lhs, tile) && match_address(cg, node.binary.rhs, tile);
+        case NODE_SUB:
+            rhs = cg->ast->ptr[node.binary.rhs];
+            if (rhs.kind != NODE_NUMBER) break;
+            return match_address(cg, node.binary.lhs, tile) && address_disp(tile, -rhs.number);
+        case NODE_MUL:
+            rhs = cg->ast->ptr[node.binary.rhs];
+            if (rhs.kind != NODE_NUMBER) break;
+
+            switch (rhs.number) {
+                case 1: case 2: case 4: case 8:
+                    return address_reg(cg, node.binary.lhs, (u8)rhs.number, tile);
+                case 3: case 5: case 9:
+                    /* x*9 is x + x*8 */
+                    if (tile->has_base || tile->address.scale != 0) return false;
+                    if (!address_reg(cg, node.binary.lhs, 1, tile)) return false;
+                    tile->address.index = tile->address.reg;
+                    tile->address.scale = (u8)(rhs.number - 1);
+                    return true;
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return address_reg(cg, nodeid, 1, tile);
+}
+
+static bool match_number(struct codegen* cg, struct node node, struct tile* tile) {
+    UNUSED(cg);
+    if (node.kind != NODE_NUMBER) return false;
+
+    tile->operand = x86_imm(node.number);
+    tile->cost = x86_inst_cycles(x86_inst2(X86_MOV, tile->operand, EAX));
+    return true;
+}
+
+/* The pointer of a slice is all 64 bits of the parameter */
+static bool match_param(struct codegen* cg, struct node node, struct tile* tile) {
+    if (node.kind != NODE_PARAMREF) return false;
+
+    tile->operand = param_operand(cg, node.param_ref.index, type_is_pointer(node.type) ? 8 : 4);
+    tile->cost = x86_inst_cycles(x86_inst2(X86_MOV, tile->operand, EAX));
+    return true;
+}
+
+static bool match_data(struct codegen* cg, struct node node, struct tile* tile) {
+    UNUSED(cg);
+    if (node.kind != NODE_DATA) return false;
+
+    tile->operand = x86_data(node.data.elems);
+    tile->cost = x86_inst_cycles(x86_inst2(X86_LEA, tile->operand, RAX));
+    return true;
+}
+
+static bool match_call(struct codegen* cg, struct node node, struct tile* tile) {
+    UNUSED(cg);
+    if (node.kind != NODE_CALL) return false;
+
+    /* the arguments are not leaves, there is nothing to choose for them here */
+    tile->cost = x86_inst_cycles(x86_inst0(X86_CALL));
+    return true;
+}
+
+/* The index is the leaf. The pointer is loaded into a scratch register unless it is in one already */
+static bool match_index(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node slice, ptr;
+
+    if (node.kind != NODE_INDEX) return false;
+    slice = cg->ast->ptr[node.index.slice];
+    ptr = cg->ast->ptr[slice.slice.ptr];
+
+    tile->leaves[tile->nleaves++] = node.index.expr;
+    tile->operand = len_operand(cg, slice);
+    tile->cost = x86_inst_cycles(x86_inst2(X86_MOVSXD, EAX, RAX)) +
+                 x86_inst_cycles(x86_inst2(X86_MOV, x86_mem_index(X86_R11, X86_RAX, 4, 0, 4), EAX));
+    if (index_checked(cg, node.id)) {
+        tile->cost += x86_inst_cycles(x86_inst2(X86_CMP, tile->operand, EAX)) +
+                      x86_inst_cycles(x86_jcc(X86_CC_AE, 0));
+    }
+    if (ptr.kind != NODE_PARAMREF || !param_in_register(cg, ptr.param_ref.index)) {
+        tile->cost += x86_inst_cycles(x86_inst2(X86_MOV, x86_mem(X86_RSP, 0, 8), x86_reg(X86_R11, 8)));
+    }
+    return true;
+}
+
+static bool match_op_imm(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node rhs;
+
+    if (!node_is_binary(node.kind)) return false;
+    rhs = cg->ast->ptr[node.binary.rhs];
+    if (rhs.kind != NODE_NUMBER) return false;
+
+    tile->leaves[tile->nleaves++] = node.binary.lhs;
+    tile->operand = x86_imm(rhs.number);
+    tile->cost = binary_cost(node, tile->operand, tile->swapped);
+    return true;
+}
+
+static bool match_op_rm(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node rhs;
+
+    if (!node_is_binary(node.kind)) return false;
+    rhs = cg->ast->ptr[node.binary.rhs];
+    if (rhs.kind != NODE_PARAMREF) return false;
+
+    tile->leaves[tile->nleaves++] = node.binary.lhs;
+    tile->operand = param_operand(cg, rhs.param_ref.index, 4);
+    tile->cost = binary_cost(node, tile->operand, tile->swapped);
+    return true;
+}
+
+/* Reading a parameter has no side effects, so it can happen after the other side */
+static bool match_op_rm_swap(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node lhs;
+
+    if (!node_is_binary(node.kind)) return false;
+    lhs = cg->ast->ptr[node.binary.lhs];
+    if (lhs.kind != NODE_PARAMREF) return false;
+
+    tile->leaves[tile->nleaves++] = node.binary.rhs;
+    tile->swapped = true;
+    tile->operand = param_operand(cg, lhs.param_ref.index, 4);
+    tile->cost = binary_cost(node, tile->operand, tile->swapped);
+    return true;
+}
+
+static bool match_imul_imm(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node lhs, rhs;
+    struct x86_inst inst;
+
+    if (node.kind != NODE_MUL) return false;
+    lhs = cg->ast->ptr[node.binary.lhs];
+    rhs = cg->ast->ptr[node.binary.rhs];
+    if (lhs.kind != NODE_PARAMREF || rhs.kind != NODE_NUMBER) return false;
+
+    tile->operand = param_operand(cg, lhs.param_ref.index, 4);
+    inst = x86_inst2(X86_IMUL3, tile->operand, EAX);
+    inst.aux = x86_imm(rhs.number);
+    tile->cost = x86_inst_cycles(inst);
+    return true;
+}
+
+static bool match_lea(struct codegen* cg, struct node node, struct tile* tile) {
+    struct node rhs;
+
+    if (!node_is_arithmetic(node.kind)) return false;
+
+    /* the root has to be taken apart here, or it would become its own leaf */
+    rhs = cg->ast->ptr[node.binary.rhs];
+    if (node.kind != NODE_ADD && rhs.kind != NODE_NUMBER) return false;
+    if (node.kind == NODE_MUL && rhs.number != 1 && rhs.number != 2 && rhs.number != 3 &&
+        rhs.number != 4 && rhs.number != 5 && rhs.number != 8 && rhs.number != 9) return false;
+
+    tile->address = x86_mem_index(X86_NO_REG, X86_NO_REG, 0, 0, 4);
+    if (!match_address(cg, node.id, tile)) return false;
+    if (!tile->has_base) tile->address.reg = X86_NO_REG;
+
+    tile->cost = x86_inst_cycles(x86_inst2(X86_LEA, tile->address, EAX));
+    return true;
+}
+
+static bool match_op_reg(struct codegen* cg, struct node node, struct tile* tile) {
+    if (!node_is_binary(node.kind)) return false;
+    /* a call would clobber the scratch registers */
+    if (contains_call(cg->ast, node.binary.rhs)) return false;
+
+    tile->leaves[tile->nleaves++] = node.binary.lhs;
+    tile->leaves[tile->nleaves++] = node.binary.rhs;
+    tile->cost = binary_cost(node, x86_reg(scratch_regs[0], 4), false);
+    return true;
+}
+
+static bool match_op_spill(struct codegen* cg, struct node node, struct tile* tile) {
+    UNUSED(cg);
+    if (!node_is_binary(node.kind)) return false;
+
+    tile->leaves[tile->nleaves++] = node.binary.lhs;
+    tile->leaves[tile->nleaves++] = node.binary.rhs;
+    tile->swapped = true;
+    tile->cost = x86_inst_cycles(x86_inst2(X86_MOV, RAX, x86_mem(X86_RBP, -8, 8))) +
+                 binary_cost(node, x86_mem(X86_RBP, -8, 4), tile->swapped);
+    return true;
+}
+
+static void emit_mov(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    UNUSED(node);
+    if (tile->operand.size == 8) dst = x86_reg(dst.reg, 8);
+    emit(cg, x86_inst2(X86_MOV, tile->operand, dst));
+}
+
+static void emit_data(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    cg->literals[node.data.elems] = true;
+    emit(cg, x86_inst2(X86_LEA, tile->operand, x86_reg(dst.reg, 8)));
+}
+
+static void emit_call_value(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    UNUSED(tile);
+    emit_call(cg, node);
+    if (dst.reg != X86_RAX) emit(cg, x86_inst2(X86_MOV, EAX, dst));
+}
+
+/*
+ * One unsigned compare checks both ends, a negative index is a huge one.
+ * Past the check the index is not negative, so sign extending it for the
+ * address is the same as zero extending it. With every scratch register
+ * taken, one of them is saved around the load.
+ * */
+static void emit_index(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    struct node slice = cg->ast->ptr[node.index.slice];
+    struct node ptr = cg->ast->ptr[slice.slice.ptr];
+    struct x86_operand base;
+    bool borrowed = false;
+
+    emit_tile(cg, tile->leaves[0], dst);
+    if (index_checked(cg, node.id)) {
+        emit(cg, x86_inst2(X86_CMP, len_operand(cg, slice), dst));
+        emit(cg, x86_jcc(X86_CC_AE, trap_label(cg)));
+    }
+    emit(cg, x86_inst2(X86_MOVSXD, dst, x86_reg(dst.reg, 8)));
+
+    if (ptr.kind == NODE_PARAMREF && param_in_register(cg, ptr.param_ref.index)) {
+        base = param_operand(cg, ptr.param_ref.index, 8);
+    } else {
+        if (cg->scratch < SCRATCH_REGS) {
+            base = x86_reg(scratch_regs[cg->scratch], 8);
+        } else {
+            base = x86_reg(scratch_regs[0] != dst.reg ? scratch_regs[0] : scratch_regs[1], 8);
+            emit_spill(cg, base);
+            borrowed = true;
+        }
+        emit_tile(cg, slice.slice.ptr, base);
+    }
+
+    emit(cg, x86_inst2(X86_MOV, x86_mem_index(base.reg, dst.reg, 4, 0, 4), dst));
+
+    if (borrowed) emit_reload(cg, base);
+}
+
+static void emit_op_operand(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    emit_tile(cg, tile->leaves[0], dst);
+    emit_binary_op(cg, node, tile->operand, dst, tile->swapped);
+}
+
+static void emit_imul_imm(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    struct x86_inst inst = x86_inst2(X86_IMUL3, tile->operand, dst);
+
+    inst.aux = x86_imm(cg->ast->ptr[node.binary.rhs].number);
+    emit(cg, inst);
+}
+
+/* Parameters never live in the destination register, so the leaf can go there first */
+static void emit_lea(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    struct x86_operand address = tile->address;
+
+    UNUSED(node);
+    if (tile->nleaves) {
+        emit_tile(cg, tile->leaves[0], dst);
+        if (tile->has_base && address.reg == X86_NO_REG) address.reg = dst.reg;
+        if (address.scale != 0 && address.index == X86_NO_REG) address.index = dst.reg;
+    }
+
+    emit(cg, x86_inst2(X86_LEA, address, dst));
+}
+
+static void emit_op_reg(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    struct x86_operand scratch;
+
+    if (cg->scratch == SCRATCH_REGS) {
+        emit_op_spill(cg, node, tile, dst);
+        return;
+    }
+
+    emit_tile(cg, tile->leaves[0], dst);
+
+    scratch = x86_reg(scratch_regs[cg->scratch++], 4);
+    emit_tile(cg, tile->leaves[1], scratch);
+    cg->scratch--;
+
+    emit_binary_op(cg, node, scratch, dst, false);
+}
+
+/* x - y is computed as -(y - x), so that the left hand side can be used from its slot */
+static void emit_op_spill(struct codegen* cg, struct node node, struct tile* tile, struct x86_operand dst) {
+    struct x86_operand slot;
+
+    emit_tile(cg, tile->leaves[0], dst);
+    slot = emit_spill(cg, dst);
+
+    emit_tile(cg, tile->leaves[1], dst);
+    slot.size = 4;
+    emit_binary_op(cg, node, slot, dst, true);
+
+    emit_reload(cg, (struct x86_operand){0});
+}
+
+/* The cheapest pattern for `nodeid', given the cheapest covers of its leaves */
+static inline u32 select_tile(struct codegen* cg, u32 nodeid) {
+    struct cover* cover = &cg->covers[nodeid];
+    struct node node = cg->ast->ptr[nodeid];
+    u32 cost;
+
+    if (cover->cost) return cover->pattern;
+
+    for (u32 p = 0; p < PATTERNS; ++p) {
+        struct tile tile = {0};
+        if (!patterns[p].match(cg, node, &tile)) continue;
+
+        /* one more, 0 is taken to mean not looked at yet */
+        cost = tile.cost + 1;
+        for (u32 i = 0; i < tile.nleaves; ++i) {
+            select_tile(cg, tile.leaves[i]);
+            cost += cg->covers[tile.leaves[i]].cost;
+        }
+
+        if (cover->cost == 0 || cost < cover->cost) {
+            cover->cost = cost;
+            cover->pattern = (u8)p;
+        }
+    }
+
+    if (cover->cost == 0) UNREACHABLE("select_tile: no pattern matches");
+    return cover->pattern;
+}
+
+static inline void emit_tile(struct codegen* cg, u32 nodeid, struct x86_operand dst) {
+    const struct pattern* pattern = &patterns[select_tile(cg, nodeid)];
+    struct node node = cg->ast->ptr[nodeid];
+    struct tile tile = {0};
+
+    /* matched again, operands on the stack move as things are pushed */
+    if (!pattern->match(cg, node, &tile)) UNREACHABLE("emit_tile: the pattern no longer matches");
+    pattern->emit(cg, node, &tile, dst);
+}
+
+/* Leaves the value of the expression in %eax */
+static inline void emit_expression(struct codegen* cg, struct node node) {
+    emit_tile(cg, node.id, EAX);
+}
+
+static inline void emit_expression_into(struct codegen* cg, struct node node, struct x86_operand reg) {
+    emit_tile(cg, node.id, reg);
+}
+
+static inline void emit_push(struct codegen* cg, struct node node) {
+    switch (node.kind) {
+        case NODE_NUMBER:
+            emit(cg, x86_inst1(X86_PUSH, x86_imm(node.number)));
+            break;
+        case NODE_PARAMREF:
+            emit(cg, x86_inst1(X86_PUSH, param_operand(cg, node.param_ref.index, 8)));
+            break;
+        default:
+            emit_expression(cg, node);
+            emit(cg, x86_inst1(X86_PUSH, RAX));
+            break;
+    }
+
+    cg->depth += 8;
+}
+
+/* The arguments of `node' into `args', their count returned */
+static inline u32 call_args(struct codegen* cg, struct node node, u32 args[CODEGEN_MAX_ARGS]) {
+    struct string name = ast_func_name(cg->ast, cg->ast->ptr[node.call.callee]);
+    struct node_link link;
+    u32 nargs = 0;
+
+    if (node.call.args == 0) return 0;
+
+    link = cg->ast->ptr[node.call.args].link;
+    do {
+        if (nargs == CODEGEN_MAX_ARGS) {
+            fprintf(stderr, "nomic: error: call to `%.*s' has more than %d arguments\n", (i32)name.length, name.cstr,
+                    CODEGEN_MAX_ARGS);
+            exit(1);
+        }
+        args[nargs++] = link.ptr;
+    } while (ast_link_advance(cg->ast, &link));
+    return nargs;
+}
+
+static inline void emit_call(struct codegen* cg, struct node node) {
+    struct node callee = cg->ast->ptr[node.call.callee];
+    bool is_extern = callee.func_decl.body == 0;
+    const struct syscall* syscall = is_extern ? syscall_of(cg->ast, node) : NULL;
+    u32 args[CODEGEN_MAX_ARGS];
+    bool complex[ARG_REGS] = {0};
+    u32 nargs = 0, nregs, nstack, pad, cleanup;
+
+    if (syscall != NULL) {
+        emit_syscall(cg, node, syscall);
+        return;
+    }
+
+    nargs = call_args(cg, node, args);
+
+    if (cg->options.call_conv == CALL_CONV_STACK && !is_extern) {
+        nregs = 0;
+        nstack = nargs;
+    } else {
+        nregs = MIN(nargs, (u32)ARG_REGS);
+        nstack = nargs - nregs;
+    }
+
+    pad = (cg->depth + 8 * nstack) % 16 ? 8 : 0;
+    if (pad) {
+        emit(cg, x86_inst2(X86_SUB, x86_imm(8), RSP));
+        cg->depth += 8;
+    }
+
+    for (u32 i = nargs; i-- > nregs;) {
+        emit_push(cg, cg->ast->ptr[args[i]]);
+    }
+
+    /*
+     * Arguments which make calls of their own would clobber the argument
+     * registers, so they are evaluated first and parked on the stack.
+     * */
+    for (u32 i = 0; i < nregs; ++i) {
+        complex[i] = contains_call(cg->ast, args[i]);
+        if (!complex[i]) continue;
+
+        emit_expression(cg, cg->ast->ptr[args[i]]);
+        emit_spill(cg, RAX);
+    }
+
+    for (u32 i = 0; i < nregs; ++i) {
+        if (!complex[i]) emit_expression_into(cg, cg->ast->ptr[args[i]], x86_reg(arg_regs[i], 4));
+    }
+
+    for (u32 i = nregs; i-- > 0;) {
+        if (complex[i]) emit_reload(cg, x86_reg(arg_regs[i], 8));
+    }
+
+    emit(cg, x86_inst1(X86_CALL, x86_sym(ast_func_name(cg->ast, callee), is_extern)));
+
+    cleanup = 8 * nstack + pad;
+    if (cleanup) {
+        emit(cg, x86_inst2(X86_ADD, x86_imm(cleanup), RSP));
+        cg->depth -= cleanup;
+    }
+}
+
+/* `bytes': the argument is the length of a slice, which is counted in i32s */
+static inline void emit_syscall_arg(struct codegen* cg, struct node arg, bool bytes, struct x86_operand reg) {
+    if (bytes && arg.kind == NODE_NUMBER) {
+        emit(cg, x86_inst2(X86_MOV, x86_imm(arg.number * (i64)sizeof(i32)), reg));
+        return;
+    }
+
+    emit_expression_into(cg, arg, reg);
+    if (bytes) emit(cg, x86_inst2(X86_LEA, x86_mem_index(X86_NO_REG, reg.reg, sizeof(i32), 0, 8), reg));
+}
+
+/*
+ * Arguments making calls of their own are parked first, like those of
+ * `emit_call'. %r10 is also a scratch register, so the fourth argument goes
+ * there once everything else has been computed.
+ * */
+static inline void emit_syscall(struct codegen* cg, struct node node, const struct syscall* syscall) {
+    struct node callee = cg->ast->ptr[node.call.callee];
+    bool exits = is_noreturn_call(cg, node.id), read;
+    u32 args[SYSCALL_REGS];
+    bool complex[SYSCALL_REGS] = {0};
+    bool bytes[SYSCALL_REGS] = {0};
+    u32 nargs = 0, params;
+    struct node arg;
+    struct node_link link;
+
+    if (node.call.args != 0) {
+        link = cg->ast->ptr[node.call.args].link;
+        do {
+            args[nargs++] = link.ptr;
+        } while (ast_link_advance(cg->ast, &link));
+    }
+
+    /* the parameter after the pointer of a slice is its length */
+    params = ast_func_proto(cg->ast, callee).proto.params;
+    if (params != 0) {
+        link = cg->ast->ptr[params].link;
+        for (u32 i = 0; i + 1 < nargs; ++i) {
+            bytes[i + 1] = type_is_pointer(cg->ast->ptr[link.ptr].type);
+            if (!ast_link_advance(cg->ast, &link)) break;
+        }
+    }
+
+    /* the program won't get to `ret' or `call exit', where the counters are written otherwise */
+    if (exits && cg->options.instrument) {
+        emit(cg, x86_inst1(X86_CALL, x86_sym(STRING("__nomi_profile_write"), false)));
+    }
+
+    for (u32 i = 0; i < nargs; ++i) {
+        complex[i] = contains_call(cg->ast, args[i]);
+        if (!complex[i]) continue;
+
+        emit_syscall_arg(cg, cg->ast->ptr[args[i]], bytes[i], EAX);
+        emit_spill(cg, RAX);
+    }
+
+    for (u32 i = 0; i < nargs; ++i) {
+        if (!complex[i] && syscall_regs[i] != X86_R10) {
+            emit_syscall_arg(cg, cg->ast->ptr[args[i]], bytes[i], x86_reg(syscall_regs[i], 4));
+        }
+    }
+
+    if (nargs > 3 && !complex[3]) {
+        arg = cg->ast->ptr[args[3]];
+        if (arg.kind == NODE_NUMBER || arg.kind == NODE_PARAMREF) {
+            emit_syscall_arg(cg, arg, bytes[3], x86_reg(X86_R10, 4));
+        } else {
+            emit_syscall_arg(cg, arg, bytes[3], EAX);
+            emit(cg, x86_inst2(X86_MOV, RAX, x86_reg(X86_R10, 8)));
+        }
+    }
+
+    for (u32 i = nargs; i-- > 0;) {
+        if (complex[i]) emit_reload(cg, x86_reg(syscall_regs[i], 8));
+    }
+
+    /*
+     * The parameters of a leaf which are gone afterwards, an argument passed
+     * in its own register stays. Nothing runs after a call that exits, but
+     * the arguments are still computed into registers which other arguments,
+     * or the rest of their own, may read.
+     * */
+    if (cg->leaf) {
+        if (!exits) cg->clobbered |= (u64)1 << 3;   /* %rcx */
+        for (u32 i = 0; i < nargs; ++i) {
+            arg = cg->ast->ptr[args[i]];
+            if (syscall_regs[i] != arg_regs[i]) continue;
+            if (!bytes[i] && arg.kind == NODE_PARAMREF && arg.param_ref.index == i) continue;
+
+            read = !exits;
+            for (u32 j = 0; j < nargs && !read; ++j) {
+                read = reads_param(cg->ast, args[j], i);
+            }
+            if (read) cg->clobbered |= (u64)1 << i;
+        }
+    }
+
+    emit(cg, x86_inst2(X86_MOV, x86_imm(syscall->number), EAX));
+    emit(cg, x86_inst0(X86_SYSCALL));
+}
+
+static inline struct x86_operand tail_arg_operand(struct codegen* cg, bool self, u32 index, u8 size) {
+    return self ? param_operand(cg, index, size) : x86_reg(arg_regs[index], size);
+}
+
+/*
+ * A call to ourselves stores the arguments over the parameters and jumps
+ * back to the top of the body, anything else tears the frame down and jumps
+ * to the callee, which returns straight to our caller. When the new values
+ * go where the parameters live, an argument read by a later argument would
+ * be overwritten too soon: those are parked on the stack with the ones
+ * making calls, and stored last.
+ * */
+static inline void emit_tail_call(struct codegen* cg, struct node node) {
+    struct node callee = cg->ast->ptr[node.call.callee];
+    bool self = node.call.callee == cg->decl;
+    bool clobbers = self || cg->leaf;
+    u32 args[CODEGEN_MAX_ARGS];
+    bool parked[CODEGEN_MAX_ARGS] = {0};
+    struct x86_operand dst;
+    u32 nargs = 0;
+    u8 size;
+
+    nargs = call_args(cg, node, args);
+
+    for (u32 i = 0; i < nargs; ++i) {
+        parked[i] = contains_call(cg->ast, args[i]);
+        for (u32 j = i + 1; clobbers && j < nargs && !parked[i]; ++j) {
+            parked[i] = reads_param(cg->ast, args[j], i);
+        }
+        if (!parked[i]) continue;
+
+        emit_expression(cg, cg->ast->ptr[args[i]]);
+        emit_spill(cg, RAX);
+    }
+
+    for (u32 i = 0; i < nargs; ++i) {
+        if (parked[i]) continue;
+
+        size = type_is_pointer(cg->ast->ptr[args[i]].type) ? 8 : 4;
+        dst = tail_arg_operand(cg, self, i, size);
+        if (dst.kind == X86_REG && !(clobbers && reads_param(cg->ast, args[i], i))) {
+            emit_expression_into(cg, cg->ast->ptr[args[i]], dst);
+        } else {
+            /* a tile may write its destination before it is done reading the parameter there */
+            emit_expression(cg, cg->ast->ptr[args[i]]);
+            emit(cg, x86_inst2(X86_MOV, x86_reg(X86_RAX, size), dst));
+        }
+    }
+
+    for (u32 i = nargs; i-- > 0;) {
+        if (!parked[i]) continue;
+
+        size = type_is_pointer(cg->ast->ptr[args[i]].type) ? 8 : 4;
+        dst = tail_arg_operand(cg, self, i, size);
+        if (dst.kind == X86_REG) {
+            emit_reload(cg, dst);
+        } else {
+            emit_reload(cg, RAX);
+            emit(cg, x86_inst2(X86_MOV, x86_reg(X86_RAX, size), dst));
+        }
+    }
+
+    /* the arguments of some of them keep the guards of the fast version true */
+    if (self) {
+        if (cg->fast && bounds_of(cg->options.bounds, node.id) == BOUNDS_KEEPS_GUARDS) {
+            emit(cg, x86_inst1(X86_JMP, x86_label(cg->fast_label)));
+        } else {
+            emit(cg, x86_inst1(X86_JMP, x86_label(cg->body_label)));
+        }
+        return;
+    }
+
+    emit_epilogue(cg);
+    emit(cg, x86_inst1(X86_JMP, x86_sym(ast_func_name(cg->ast, callee), callee.func_decl.body == 0)));
+}
+
+static inline void emit_epilogue(struct codegen* cg) {
+    if (!cg->frame) return;
+
+    emit_frame_adjust(cg, X86_ADD);
+    for (u32 i = cg->saved; i-- > 0;) {
+        emit(cg, x86_inst1(X86_POP, x86_reg(saved_regs[i], 8)));
+    }
+    emit(cg, x86_inst1(X86_POP, RBP));
+}
+
+/* The jump to the epilogue right before it is cleaned up by the peephole optimizer */
+static inline void emit_return(struct codegen* cg, struct node node) {
+    if (is_tail_call(cg, node)) {
+        emit_tail_call(cg, cg->ast->ptr[node.return_stmt.expr]);
+        return;
+    }
+
+    if (node.return_stmt.expr != 0) {
+        emit_expression(cg, cg->ast->ptr[node.return_stmt.expr]);
+    }
+
+    emit(cg, x86_inst1(X86_JMP, x86_label(cg->ret_label)));
+}
+
+/* Jumps to `label' when `nodeid' is `when', comparisons go straight to the flags */
+static inline void emit_branch(struct codegen* cg, u32 nodeid, bool when, u32 label) {
+    struct node node = cg->ast->ptr[nodeid];
+    struct node lhs, rhs;
+    struct x86_operand a, b;
+    enum x86_cond cond;
+
+    if (!node_is_compare(node.kind)) {
+        emit_expression(cg, node);
+        emit(cg, x86_inst2(X86_TEST, EAX, EAX));
+        emit(cg, x86_jcc(when ? X86_CC_NE : X86_CC_E, label));
+        return;
+    }
+
+    lhs = cg->ast->ptr[node.binary.lhs];
+    rhs = cg->ast->ptr[node.binary.rhs];
+
+    if (rhs.kind == NODE_NUMBER || rhs.kind == NODE_PARAMREF) {
+        b = rhs.kind == NODE_NUMBER ? x86_imm(rhs.number) : param_operand(cg, rhs.param_ref.index, 4);
+        if (lhs.kind == NODE_PARAMREF && (b.kind == X86_IMM || param_in_register(cg, lhs.param_ref.index))) {
+            a = param_operand(cg, lhs.param_ref.index, 4);
+        } else {
+            emit_expression(cg, lhs);
+            a = EAX;
+        }
+    } else {
+        /* conditions are only looked at by statements, no scratch register is taken yet */
+        emit_expression(cg, lhs);
+        emit_spill(cg, RAX);
+        emit_expression(cg, rhs);
+        emit_reload(cg, x86_reg(scratch_regs[0], 8));
+        a = x86_reg(scratch_regs[0], 4);
+        b = EAX;
+    }
+
+    cond = compare_cond(node.kind);
+    emit(cg, x86_inst2(X86_CMP, b, a));
+    emit(cg, x86_jcc(when ? cond : x86_cond_negate(cond), label));
+}
+
+/* add $1 to counter `offset' of `nodeid', when instrumenting */
+static inline void emit_count(struct codegen* cg, u32 nodeid, u32 offset) {
+    u32 counter;
+
+    if (!cg->options.instrument) return;
+
+    counter = profile_counter(cg->options.profile, nodeid);
+    if (counter == PROFILE_NO_COUNTER) return;
+
+    emit(cg, x86_inst2(X86_ADD, x86_imm(1), x86_counter(counter + offset)));
+}
+
+static inline void emit_arm(struct codegen* cg, u32 ifid, u32 stmt, bool then) {
+    if (then) emit_count(cg, ifid, 1);
+    emit_statement(cg, cg->ast->ptr[stmt]);
+}
+
+static inline bool is_noreturn_call(struct codegen* cg, u32 nodeid) {
+    struct node node = cg->ast->ptr[nodeid];
+    struct node callee;
+
+    if (node.kind != NODE_CALL) return false;
+
+    callee = cg->ast->ptr[node.call.callee];
+    if (callee.func_decl.body != 0) return false;
+
+    for (u32 i = 0; i < ARRLENGTH(noreturn_funcs); ++i) {
+        if (string_equal(ast_func_name(cg->ast, callee), noreturn_funcs[i])) return true;
+    }
+    return false;
+}
+
+/* Does the arm call a function which never returns, one of its own statements at least? */
+static inline bool arm_traps(struct codegen* cg, u32 stmt) {
+    struct node node = cg->ast->ptr[stmt];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            return node.return_stmt.expr != 0 && is_noreturn_call(cg, node.return_stmt.expr);
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return false;
+            link = node.link;
+            do {
+                if (arm_traps(cg, link.ptr)) return true;
+            } while (ast_link_advance(cg->ast, &link));
+            return false;
+        case NODE_IF:
+            return false;
+        default:
+            return is_noreturn_call(cg, stmt);
+    }
+}
+
+/* Does the arm end in a `return'? */
+static inline bool arm_returns(struct codegen* cg, u32 stmt) {
+    struct node node = cg->ast->ptr[stmt];
+    struct node_link link;
+
+    if (node.kind != NODE_BLOCK) return node.kind == NODE_RETURN;
+    if (node.link.ptr == 0) return false;
+
+    link = node.link;
+    while (ast_link_advance(cg->ast, &link)) {}
+    return cg->ast->ptr[link.ptr].kind == NODE_RETURN;
+}
+
+static inline bool has_profile(struct codegen* cg) {
+    return cg->options.profile != NULL && cg->options.profile->counts != NULL;
+}
+
+/* Where the arms of the `if' go, `flip' when the `else' arm should fall through */
+static inline void place_arms(struct codegen* cg, struct node node, enum arm_place* then_place,
+                              enum arm_place* otherwise_place, bool* flip) {
+    struct node arms = cg->ast->ptr[node.if_stmt.arms];
+    u32 then = arms.arms.then, otherwise = arms.arms.otherwise;
+    u64 reached = 0, taken = 0;
+
+    *then_place = *otherwise_place = ARM_INLINE;
+    *flip = false;
+
+    if (!cg->options.layout) return;
+
+    if (has_profile(cg)) {
+        reached = profile_reached(cg->options.profile, node.id);
+        taken = profile_taken(cg->options.profile, node.id);
+    }
+
+    /* an `if' which never ran has nothing to say, it is in cold code anyway */
+    if (reached > 0) {
+        if (taken == 0) *then_place = ARM_COLD;
+        else if (otherwise != 0 && taken == reached) *otherwise_place = ARM_COLD;
+        else *flip = otherwise != 0 && reached - taken > taken;
+        return;
+    }
+
+    if (arm_traps(cg, then)) {
+        *then_place = ARM_COLD;
+    } else if (otherwise != 0 && arm_traps(cg, otherwise)) {
+        *otherwise_place = ARM_COLD;
+    } else if (arm_returns(cg, then)) {
+        if (otherwise == 0) *then_place = ARM_UNLIKELY;
+        else *flip = !arm_returns(cg, otherwise);
+    }
+}
+
+/*
+ * Without a layout the `then' arm falls through. With one, the likely arm
+ * does and an unlikely or cold arm is moved out of line, see `place_arms'.
+ * */
+static inline void emit_if(struct codegen* cg, struct node node) {
+    struct node arms = cg->ast->ptr[node.if_stmt.arms];
+    u32 then = arms.arms.then, otherwise = arms.arms.otherwise;
+    enum arm_place then_place, otherwise_place;
+    struct outlined_arm arm;
+    u32 label = cg->labels++;
+    u32 end_label;
+    bool flip;
+
+    emit_count(cg, node.id, 0);
+    place_arms(cg, node, &then_place, &otherwise_place, &flip);
+
+    if (then_place != ARM_INLINE || otherwise_place != ARM_INLINE) {
+        arm = (struct outlined_arm){
+            .label = label,
+            .ifid = node.id,
+            .stmt = then_place != ARM_INLINE ? then : otherwise,
+            .then = then_place != ARM_INLINE,
+            .cold = cg->in_cold || then_place == ARM_COLD || otherwise_place == ARM_COLD,
+            .resume = cg->labels++,
+            .depth = cg->depth,
+            .fast = cg->fast,
+        };
+        DYNARRAY_APPEND(cg->outlined, arm);
+
+        emit_branch(cg, node.if_stmt.cond, arm.then, label);
+        if (arm.then && otherwise != 0) emit_arm(cg, node.id, otherwise, false);
+        if (!arm.then) emit_arm(cg, node.id, then, true);
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(arm.resume)));
+        return;
+    }
+
+    emit_branch(cg, node.if_stmt.cond, flip, label);
+    emit_arm(cg, node.id, flip ? otherwise : then, !flip);
+
+    if (otherwise == 0) {
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(label)));
+        return;
+    }
+
+    end_label = cg->labels++;
+    emit(cg, x86_inst1(X86_JMP, x86_label(end_label)));
+    emit(cg, x86_inst1(X86_DEFLABEL, x86_label(label)));
+    emit_arm(cg, node.id, flip ? then : otherwise, flip);
+    emit(cg, x86_inst1(X86_DEFLABEL, x86_label(end_label)));
+}
+
+/* Jumps to `label' unless `0 <= param', or `param < len', holds */
+static inline void emit_guard(struct codegen* cg, struct bounds_guard guard, u32 label) {
+    struct x86_operand param = param_operand(cg, guard.param, 4);
+
+    if (guard.len == BOUNDS_NONNEG) {
+        emit(cg, x86_inst2(X86_CMP, x86_imm(0), param));
+        emit(cg, x86_jcc(X86_CC_L, label));
+        return;
+    }
+
+    if (param.kind != X86_REG) {
+        emit(cg, x86_inst2(X86_MOV, param, EAX));
+        param = EAX;
+    }
+    emit(cg, x86_inst2(X86_CMP, param_operand(cg, guard.len, 4), param));
+    emit(cg, x86_jcc(X86_CC_GE, label));
+}
+
+static inline void emit_statement(struct codegen* cg, struct node node) {
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            emit_return(cg, node);
+            break;
+        case NODE_IF:
+            emit_if(cg, node);
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) break;
+            link = node.link;
+            do {
+                emit_statement(cg, cg->ast->ptr[link.ptr]);
+            } while (ast_link_advance(cg->ast, &link));
+            break;
+        default:
+            /* expression statement, the value is thrown away */
+            emit_expression(cg, node);
+            break;
+    }
+}
+
+/*
+ * Where an instrumented program has to write its counters first. A system
+ * call lowered by `emit_syscall' writes them itself, `sys_exit' only gets
+ * here when it is a function after all.
+ * */
+static inline bool exits_program(struct codegen* cg, struct x86_inst inst) {
+    static const struct string exits[] = {
+        STRING_LIT("exit"), STRING_LIT("_exit"), STRING_LIT("sys_exit"), STRING_LIT("sys_exit_group"),
+    };
+
+    if (inst.op == X86_RET) return cg->is_main;
+    if ((inst.op != X86_CALL && inst.op != X86_JMP) || inst.dst.kind != X86_SYM) return false;
+
+    for (u32 i = 0; i < ARRLENGTH(exits); ++i) {
+        if (string_equal(inst.dst.sym, exits[i])) return true;
+    }
+    return false;
+}
+
+/* Labels are numbered across the file, those of two functions are the same when they are as far into each */
+static inline bool same_operand(struct x86_operand a, u32 a_labels, struct x86_operand b, u32 b_labels) {
+    if (a.kind == X86_LABEL && b.kind == X86_LABEL) return a.label - a_labels == b.label - b_labels;
+    return x86_operand_equal(a, b);
+}
+
+/*
+ * An instance of the same generic emitted earlier with exactly the
+ * instructions in `cg->insts', whose labels start at `labels', or NULL when
+ * there is none, in which case the instance is kept for the ones after it.
+ * */
+static inline const struct emitted_instance* fold_instance(struct codegen* cg, u32 labels) {
+    struct emitted_instance instance = {
+        .generic = cg->generic_of[cg->decl],
+        .name = ast_func_name(cg->ast, cg->ast->ptr[cg->decl]),
+        .labels = labels,
+        .cold_label = cg->cold_label,
+        .cold = cg->cold,
+        .insts = {0},
+    };
+    const struct emitted_instance* other;
+    struct x86_inst a, b;
+    bool same;
+
+    for (usize i = 0; i < cg->emitted.length; ++i) {
+        other = &cg->emitted.at[i];
+        if (other->generic != instance.generic || other->cold != instance.cold) continue;
+        if (other->insts.length != cg->insts.length) continue;
+        if ((other->cold_label == UINT32_MAX) != (instance.cold_label == UINT32_MAX)) continue;
+        if (other->cold_label != UINT32_MAX && other->cold_label - other->labels != instance.cold_label - labels) {
+            continue;
+        }
+
+        same = true;
+        for (usize j = 0; j < cg->insts.length && same; ++j) {
+            a = other->insts.at[j];
+            b = cg->insts.at[j];
+            same = a.op == b.op && a.cond == b.cond && same_operand(a.src, other->labels, b.src, labels) &&
+                   same_operand(a.dst, other->labels, b.dst, labels) &&
+                   same_operand(a.aux, other->labels, b.aux, labels);
+        }
+        if (same) return other;
+    }
+
+    for (usize j = 0; j < cg->insts.length; ++j) DYNARRAY_APPEND(instance.insts, cg->insts.at[j]);
+    DYNARRAY_APPEND(cg->emitted, instance);
+    return NULL;
+}
+
+/* Instructions which do something, labels and deleted ones don't count */
+static inline u32 count_insts(const struct x86_insts* insts) {
+    u32 count = 0;
+
+    for (usize i = 0; i < insts->length; ++i) {
+        count += insts->at[i].op != X86_NOP && insts->at[i].op != X86_DEFLABEL;
+    }
+    return count;
+}
+
+/* Everything but the peephole optimizer, into `insts', can be run again from the same labels */
+static inline void emit_func_insts(struct codegen* cg, struct node node) {
+    struct node proto = ast_func_proto(cg->ast, node);
+    struct string name = ast_func_name(cg->ast, node);
+    const struct bounds_guard* guards;
+    struct node_link link;
+    u32 nregs, nguards, slow_label = 0;
+    bool versioned;
+
+    cg->decl = node.id;
+    cg->is_main = string_equal(name, STRING("main"));
+    cg->local = cg->has_roots && !prune_is_root(cg->ast, node.id);
+    cg->cold = has_profile(cg) && cg->options.layout && profile_entries(cg->options.profile, node.id) == 0;
+    cg->in_cold = false;
+    cg->cold_label = UINT32_MAX;
+    cg->nparams = ast_list_length(cg->ast, proto.proto.params);
+    cg->wide = 0;
+    if (proto.proto.params != 0) {
+        link = cg->ast->ptr[proto.proto.params].link;
+        for (u32 i = 0; i < 64; ++i) {
+            if (type_is_pointer(cg->ast->ptr[link.ptr].type)) cg->wide |= (u64)1 << i;
+            if (!ast_link_advance(cg->ast, &link)) break;
+        }
+    }
+    cg->trap_label = UINT32_MAX;
+    cg->loops = false;
+    cg->leaf = !needs_frame(cg, node.func_decl.body) && !cg->framed;
+    cg->read_params = 0;
+    cg->clobbered = 0;
+    cg->depth = 0;
+    cg->scratch = 0;
+    cg->ret_label = cg->labels++;
+    DYNARRAY_CLEAR(cg->insts);
+    DYNARRAY_CLEAR(cg->outlined);
+
+    if (cg->options.call_conv == CALL_CONV_STACK) {
+        cg->frame = true;
+        cg->saved = 0;
+        cg->slots = 0;
+    } else {
+        cg->frame = !cg->leaf;
+        cg->saved = cg->leaf ? 0 : MIN(cg->nparams, (u32)SAVED_REGS);
+        cg->slots = cg->leaf ? 0 : MIN(cg->nparams, (u32)ARG_REGS) - cg->saved;
+    }
+    cg->temps = 0;
+    cg->spilled = false;
+    DYNARRAY_CLEAR(cg->fixups);
+
+    if (cg->frame) {
+        emit(cg, x86_inst1(X86_PUSH, RBP));
+        emit(cg, x86_inst2(X86_MOV, RSP, RBP));
+        for (u32 i = 0; i < cg->saved; ++i) {
+            emit(cg, x86_inst1(X86_PUSH, x86_reg(saved_regs[i], 8)));
+        }
+        emit_frame_adjust(cg, X86_SUB);
+
+        nregs = cg->options.call_conv == CALL_CONV_STACK ? 0 : MIN(cg->nparams, (u32)ARG_REGS);
+        for (u32 i = 0; i < nregs; ++i) {
+            emit(cg, x86_inst2(X86_MOV, x86_reg(arg_regs[i], param_size(cg, i)),
+                               param_operand(cg, i, param_size(cg, i))));
+        }
+    }
+
+    if (cg->loops) {
+        cg->body_label = cg->labels++;
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(cg->body_label)));
+    }
+
+    /* after `body_label', calls to ourselves are entries too */
+    emit_count(cg, node.id, 0);
+
+    /* the counts would be off if tail calls skipped the entry, so instrumented builds don't version */
+    guards = bounds_guards_of(cg->options.bounds, node.id, &nguards);
+    versioned = nguards > 0 && !cg->options.instrument;
+    if (versioned) {
+        slow_label = cg->labels++;
+        for (u32 i = 0; i < nguards; ++i) emit_guard(cg, guards[i], slow_label);
+
+        cg->fast_label = cg->labels++;
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(cg->fast_label)));
+    }
+
+    cg->fast = versioned;
+    emit_statement(cg, cg->ast->ptr[node.func_decl.body]);
+
+    emit(cg, x86_inst1(X86_DEFLABEL, x86_label(cg->ret_label)));
+    emit_epilogue(cg);
+    emit(cg, x86_inst0(X86_RET));
+
+    /* the fully checked version, for when the guards don't hold */
+    if (versioned) {
+        cg->fast = false;
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(slow_label)));
+        emit_statement(cg, cg->ast->ptr[node.func_decl.body]);
+        emit(cg, x86_inst1(X86_JMP, x86_label(cg->ret_label)));
+    }
+
+    emit_outlined(cg, false);
+    emit_outlined(cg, true);
+
+    /* after everything, cold, out of the way of the code that runs */
+    if (cg->trap_label != UINT32_MAX) {
+        if (cg->options.layout && !cg->cold && cg->cold_label == UINT32_MAX) cg->cold_label = cg->trap_label;
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(cg->trap_label)));
+        emit(cg, x86_inst0(X86_UD2));
+    }
+
+    ASSERT(cg->temps == 0);
+    fix_frame(cg);
+}
+
+static inline void emit_func_decl(struct codegen* cg, struct node node) {
+    struct string name = ast_func_name(cg->ast, node);
+    struct x86_inst flush = x86_inst1(X86_CALL, x86_sym(STRING("__nomi_profile_write"), false));
+    struct x86_inst inst;
+    struct x86_insts slotted;
+    const struct emitted_instance* folded;
+    u32 labels = cg->labels, end, cold_label;
+
+    if (node.func_decl.body == 0) return;
+
+    cg->push_temps = false;
+    cg->framed = false;
+    emit_func_insts(cg, node);
+
+    /* a system call overwrote a parameter the leaf still reads, the tiles chosen for it no longer fit */
+    if (cg->leaf && (cg->read_params & cg->clobbered) != 0) {
+        memset(cg->covers, 0, cg->ast->length * sizeof(*cg->covers));
+        cg->labels = labels;
+        cg->framed = true;
+        emit_func_insts(cg, node);
+    }
+
+    /*
+     * With a frame, slots can cost a frame which the pushes did without, and
+     * pushes sometimes happen to be the padding a call needs. Such functions
+     * are emitted again with their temporaries pushed, and the version with
+     * fewer instructions is kept.
+     * */
+    if (cg->frame && cg->spilled) {
+        slotted = cg->insts;
+        end = cg->labels;
+        cold_label = cg->cold_label;
+
+        cg->insts = cg->pushed;
+        cg->labels = labels;
+        cg->push_temps = true;
+        emit_func_insts(cg, node);
+
+        if (count_insts(&slotted) <= count_insts(&cg->insts)) {
+            cg->pushed = cg->insts;
+            cg->insts = slotted;
+            cg->labels = end;
+            cg->cold_label = cold_label;
+        } else {
+            cg->pushed = slotted;
+        }
+    }
+
+    if (cg->options.peephole) peephole(&cg->insts, cg->options.peephole_stats);
+
+    if (cg->options.fold && cg->generic_of[node.id] != UINT32_MAX && (folded = fold_instance(cg, labels)) != NULL) {
+        if (!cg->local) femit(cg->out, "    .globl %.*s", (i32)name.length, name.cstr);
+        femit(cg->out, "    .set %.*s, %.*s", (i32)name.length, name.cstr, (i32)folded->name.length, folded->name.cstr);
+        if (cg->options.folded) (*cg->options.folded)++;
+        return;
+    }
+
+    switch_section(cg, cg->cold);
+    if (!cg->local) femit(cg->out, "    .globl %.*s", (i32)name.length, name.cstr);
+    femit(cg->out, "    .type %.*s, @function", (i32)name.length, name.cstr);
+    femit(cg->out, "%.*s:", (i32)name.length, name.cstr);
+
+    for (usize i = 0; i < cg->insts.length; ++i) {
+        inst = cg->insts.at[i];
+
+        /* the rest is cold, under a symbol of its own so that profilers can tell */
+        if (inst.op == X86_DEFLABEL && inst.dst.label == cg->cold_label) {
+            femit(cg->out, "    .size %.*s, .-%.*s", (i32)name.length, name.cstr, (i32)name.length, name.cstr);
+            switch_section(cg, true);
+            femit(cg->out, "    .type %.*s.cold, @function", (i32)name.length, name.cstr);
+            femit(cg->out, "%.*s.cold:", (i32)name.length, name.cstr);
+        }
+
+        /* added after the peephole optimizer, liveness has no idea what it preserves */
+        if (cg->options.instrument && exits_program(cg, inst)) {
+            x86_print_inst(cg->out, flush);
+            stats_items(STATS_PHASE_CODEGEN, 1);
+        }
+        x86_print_inst(cg->out, inst);
+        stats_items(STATS_PHASE_CODEGEN, inst.op != X86_DEFLABEL);
+    }
+
+    if (cg->section_cold && !cg->cold) {
+        femit(cg->out, "    .size %.*s.cold, .-%.*s.cold", (i32)name.length, name.cstr, (i32)name.length, name.cstr);
+    } else {
+        femit(cg->out, "    .size %.*s, .-%.*s", (i32)name.length, name.cstr, (i32)name.length, name.cstr);
+    }
+}
+
+/*
+ * Writes the header and the counters to the profile file and leaves every
+ * register it touches as it was, so that it can be called right before any
+ * `ret' or `call exit'. Plain system calls, the program may well be on its
+ * way out of libc already.
+ * */
+static inline void emit_profile_runtime(struct codegen* cg) {
+    static const char* saved[] = { "%rax", "%rcx", "%rdx", "%rsi", "%rdi", "%r11" };
+    const struct profile* profile = cg->options.profile;
+
+    /* runs once, on the way out */
+    switch_section(cg, true);
+    femit(cg->out, "__nomi_profile_write:");
+    for (u32 i = 0; i < ARRLENGTH(saved); ++i) {
+        femit(cg->out, "    push %s", saved[i]);
+    }
+    /* open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), write, close */
+    femit(cg->out, "    mov $2, %%eax");
+    femit(cg->out, "    lea __nomi_profile_path(%%rip), %%rdi");
+    femit(cg->out, "    mov $0x241, %%esi");
+    femit(cg->out, "    mov $0644, %%edx");
+    femit(cg->out, "    syscall");
+    femit(cg->out, "    test %%eax, %%eax");
+    femit(cg->out, "    js 1f");
+    femit(cg->out, "    mov %%eax, %%edi");
+    femit(cg->out, "    mov $1, %%eax");
+    femit(cg->out, "    lea __nomi_profile_header(%%rip), %%rsi");
+    femit(cg->out, "    mov $%u, %%edx", PROFILE_HEADER_SIZE + 8 * profile->ncounters);
+    femit(cg->out, "    syscall");
+    femit(cg->out, "    mov $3, %%eax");
+    femit(cg->out, "    syscall");
+    femit(cg->out, "1:");
+    for (u32 i = ARRLENGTH(saved); i-- > 0;) {
+        femit(cg->out, "    pop %s", saved[i]);
+    }
+    femit(cg->out, "    ret");
+
+    femit(cg->out, "    .data");
+    femit(cg->out, "    .p2align 3");
+    femit(cg->out, "__nomi_profile_header:");
+    femit(cg->out, "    .ascii \"%s\"", PROFILE_MAGIC);
+    femit(cg->out, "    .quad %lu", profile->checksum);
+    femit(cg->out, "    .quad %u", profile->ncounters);
+    femit(cg->out, "__nomi_profile_counters:");
+    femit(cg->out, "    .zero %u", 8 * profile->ncounters);
+    femit(cg->out, "__nomi_profile_path:");
+    fprintf(cg->out, "    .asciz \"");
+    for (const char* c = cg->options.profile_path; *c; ++c) {
+        if (*c == '"' || *c == '\\') fputc('\\', cg->out);
+        fputc(*c, cg->out);
+    }
+    femit(cg->out, "\"");
+}
+
+/*
+ * The outlined arms which are `cold' or not, after the `ret'. Arms may
+ * outline arms of their own, which are appended as we go: everything
+ * outlined from a cold arm is cold as well.
+ * */
+static inline void emit_outlined(struct codegen* cg, bool cold) {
+    struct outlined_arm arm;
+
+    cg->in_cold = cold;
+
+    for (usize i = 0; i < cg->outlined.length; ++i) {
+        arm = cg->outlined.at[i];
+        if (arm.cold != cold) continue;
+
+        if (cold && cg->cold_label == UINT32_MAX && !cg->cold) cg->cold_label = arm.label;
+        cg->depth = arm.depth;
+        cg->fast = arm.fast;
+        emit(cg, x86_inst1(X86_DEFLABEL, x86_label(arm.label)));
+        emit_arm(cg, arm.ifid, arm.stmt, arm.then);
+        emit(cg, x86_inst1(X86_JMP, x86_label(arm.resume)));
+    }
+
+    cg->in_cold = false;
+    cg->fast = false;
+}
+
+/* The elements of every slice literal used by the code, once each */
+static inline void emit_literals(struct codegen* cg) {
+    struct node node;
+    struct node_link link;
+    bool first = true;
+
+    for (u32 i = 0; i < cg->ast->length; ++i) {
+        node = cg->ast->ptr[i];
+        if (node.kind != NODE_DATA || !cg->literals[node.data.elems]) continue;
+        cg->literals[node.data.elems] = false;
+
+        if (first) {
+            femit(cg->out, "    .section .rodata");
+            femit(cg->out, "    .p2align 2");
+            first = false;
+        }
+
+        femit(cg->out, ".Lslice%u:", node.data.elems);
+        if (node.data.elems == 0) continue;
+
+        fprintf(cg->out, "    .long ");
+        link = cg->ast->ptr[node.data.elems].link;
+        do {
+            fprintf(cg->out, "%ld%s", cg->ast->ptr[link.ptr].number, link.next != 0 ? ", " : "\n");
+        } while (ast_link_advance(cg->ast, &link));
+    }
+}
+
+static inline void switch_section(struct codegen* cg, bool cold) {
+    if (cold == cg->section_cold) return;
+
+    cg->section_cold = cold;
+    if (cold) femit(cg->out, "    .section .text.unlikely,\"ax\",@progbits");
+    else femit(cg->out, "    .text");
+}
+
+/*
+ * How often each call runs, by node id, for the function layout: from the
+ * profile when there is one, otherwise once per call outside cold arms.
+ * */
+static inline void count_calls(struct codegen* cg, u32 nodeid, u64 count, u64* counts) {
+    struct node node = cg->ast->ptr[nodeid];
+    enum arm_place then_place, otherwise_place;
+    struct node arms;
+    struct node_link link;
+    u64 taken;
+    bool flip;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr != 0) count_calls(cg, node.return_stmt.expr, count, counts);
+            break;
+        case NODE_IF:
+            arms = cg->ast->ptr[node.if_stmt.arms];
+            count_calls(cg, node.if_stmt.cond, count, counts);
+
+            if (has_profile(cg)) {
+                taken = profile_taken(cg->options.profile, nodeid);
+                count_calls(cg, arms.arms.then, taken, counts);
+                if (arms.arms.otherwise != 0) {
+                    count_calls(cg, arms.arms.otherwise, profile_reached(cg->options.profile, nodeid) - taken, counts);
+                }
+                break;
+            }
+
+            place_arms(cg, node, &then_place, &otherwise_place, &flip);
+            count_calls(cg, arms.arms.then, then_place == ARM_COLD ? 0 : count, counts);
+            if (arms.arms.otherwise != 0) {
+                count_calls(cg, arms.arms.otherwise, otherwise_place == ARM_COLD ? 0 : count, counts);
+            }
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) break;
+            link = node.link;
+            do {
+                count_calls(cg, link.ptr, count, counts);
+            } while (ast_link_advance(cg->ast, &link));
+            break;
+        case NODE_INDEX:
+            count_calls(cg, node.index.expr, count, counts);
+            break;
+        case NODE_CALL:
+            counts[nodeid] = count;
+            if (node.call.args == 0) break;
+            link = cg->ast->ptr[node.call.args].link;
+            do {
+                count_calls(cg, link.ptr, count, counts);
+            } while (ast_link_advance(cg->ast, &link));
+            break;
+        default:
+            if (!node_is_binary(node.kind)) break;
+            count_calls(cg, node.binary.lhs, count, counts);
+            count_calls(cg, node.binary.rhs, count, counts);
+            break;
+    }
+}
+
+void code_gen(struct ast* ast, FILE* outfile, struct codegen_options options) {
+    struct codegen cg = {
+        .out = outfile,
+        .ast = ast,
+        .options = options,
+        .insts = {0},
+        .labels = 0,
+        .covers = calloc(ast->length, sizeof(struct cover)),
+        .has_roots = false,
+        .outlined = {0},
+        .section_cold = false,
+        .fast = false,
+        .literals = calloc(ast->length, sizeof(bool)),
+        .generic_of = malloc(MAX(ast->length, 1) * sizeof(u32)),
+        .emitted = {0},
+    };
+    struct call_graph graph = call_graph_build(ast);
+    u32 nfuncs = (u32)graph.funcs.length;
+    u64* counts = NULL;
+    u64* weights = NULL;
+    u64* heat = NULL;
+    u32* order = NULL;
+    struct call_graph_func func;
+
+    femit(outfile, "    .text");
+
+    for (u32 i = 0; i < ast->length; ++i) cg.generic_of[i] = UINT32_MAX;
+    for (usize i = 0; i < ast->instances.length; ++i) {
+        cg.generic_of[ast->instances.at[i].decl] = ast->instances.at[i].generic;
+    }
+
+    if (options.layout) {
+        counts = calloc(ast->length, sizeof(*counts));
+        weights = malloc(MAX(graph.sites.length, 1) * sizeof(*weights));
+        if (has_profile(&cg)) heat = malloc(MAX(nfuncs, 1) * sizeof(*heat));
+
+        for (u32 f = 0; f < nfuncs; ++f) {
+            func = graph.funcs.at[f];
+            if (heat) heat[f] = profile_entries(options.profile, func.decl);
+
+            cg.decl = func.decl;
+            if (!func.is_extern) {
+                count_calls(&cg, ast->ptr[func.decl].func_decl.body, heat ? heat[f] : 1, counts);
+            }
+        }
+        for (usize s = 0; s < graph.sites.length; ++s) {
+            weights[s] = counts[graph.sites.at[s].call];
+        }
+
+        order = call_graph_layout(&graph, weights, heat);
+    }
+
+    /* like pruning, a file with neither `main' nor exports is a library and every function in it is global */
+    for (u32 f = 0; f < nfuncs && !cg.has_roots; ++f) {
+        cg.has_roots = prune_is_root(ast, graph.funcs.at[f].decl);
+    }
+
+    for (u32 i = 0; i < nfuncs; ++i) {
+        emit_func_decl(&cg, ast->ptr[graph.funcs.at[order ? order[i] : i].decl]);
+    }
+
+    if (options.instrument) emit_profile_runtime(&cg);
+    emit_literals(&cg);
+
+    femit(outfile, "    .section .note.GNU-stack,\"\",@progbits");
+
+    free(counts);
+    free(weights);
+    free(heat);
+    free(order);
+    call_graph_free(&graph);
+    DYNARRAY_FREE(cg.insts);
+    DYNARRAY_FREE(cg.outlined);
+    DYNARRAY_FREE(cg.fixups);
+    DYNARRAY_FREE(cg.pushed);
+    free(cg.covers);
+    free(cg.literals);
+    free(cg.generic_of);
+    for (usize i = 0; i < cg.emitted.length; ++i) {
+        DYNARRAY_FREE(cg.emitted.at[i].insts);
+    }
+    DYNARRAY_FREE(cg.emitted);
+}
@@ -0,0 +1,75 @@
+#ifndef __CODEGEN_H
+#define __CODEGEN_H
+
+#include "base.h"
+#include "ast.h"
+#include "x86.h"
+#include "peephole.h"
+#include "profile.h"
+#include "bounds.h"
+
+struct codegen_options {
+    /*
+     * How calls between Nomi functions pass their arguments. Calls to extern
+     * functions always follow the SysV AMD64 ABI. CALL_CONV_STACK pushes every
+     * argument and always sets up a frame; it only exists as a baseline to
+     * benchmark the register convention against.
+     * */
+    enum call_conv : u8 {
+        CALL_CONV_SYSV,
+        CALL_CONV_STACK,
+    } call_conv;
+
+    bool peephole;
+    /* `return f(...)' jumps to `f', calls to the function itself become loops */
+    bool tail_calls;
+    /*
+     * Unlikely arms of `if's are moved out of the way of the likely path,
+     * cold ones into .text.unlikely, and functions are laid out next to the
+     * callers which call them most (see callgraph.h)
+     * */
+    bool layout;
+    /* what the peephole optimizer did is added up here, when it is not NULL */
+    struct peephole_stats* peephole_stats;
+
+    /*
+     * With `instrument', functions and `if's count how often they run in the
+     * counters numbered by `profile', which the program writes to
+     * `profile_path' on its way out. Once `profile' has counts, they
+     * replace the static guesses of the layout.
+     * */
+    const struct profile* profile;
+    bool instrument;
+    const char* profile_path;
+
+    /* which bounds checks can go (see bounds.h), every access is checked when it is NULL */
+    const struct bounds* bounds;
+
+    /*
+     * Instances of one generic function which come out as the same
+     * instructions share the first one's code, the others only become
+     * another name for it. How many did is counted in `folded', when it is
+     * not NULL.
+     * */
+    bool fold;
+    u32* folded;
+};
+
+#define CODEGEN_OPTIONS_DEFAULT (struct codegen_options){ \
+    .call_conv = CALL_CONV_SYSV, \
+    .peephole = true, \
+    .tail_calls = true, \
+    .layout = true, \
+    .peephole_stats = NULL, \
+    .profile = NULL, \
+    .instrument = false, \
+    .profile_path = PROFILE_PATH_DEFAULT, \
+    .bounds = NULL, \
+    .fold = true, \
+    .folded = NULL, \
+}
+
+/* Emits GNU assembler syntax for the whole translation unit into `outfile' */
+void code_gen(struct ast* ast, FILE* outfile, struct codegen_options options);
+
+#endif  /*__CODEGEN_H*/
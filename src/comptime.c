@@ -0,0 +1,449 @@
+#include "comptime.h"
+#include "arena.h"
+#include "fold.h"
+
+/*
+ * Values are i64 holding an i32, except for the pointer half of a slice,
+ * which is the number of its table: the elements of one slice literal, made
+ * the first time the literal is evaluated. 0 is the pointer of a null slice.
+ * */
+
+struct table {
+    i64* at;
+    u32 count;
+};
+
+struct tables {
+    struct table* at;
+    DYNARRAY_FIELDS;
+};
+
+/* A call which has been evaluated, its arguments are at `args' in `memo_args' */
+struct memo_slot {
+    u32 decl;       /* 0 for empty slots */
+    u32 nargs;
+    usize args;
+    i64 result;
+};
+
+struct memo {
+    struct memo_slot* at;
+    usize capacity;     /* always a power of two */
+    usize size;
+};
+
+struct memo_args {
+    i64* at;
+    DYNARRAY_FIELDS;
+};
+
+enum flow : u8 {
+    FLOW_NEXT,
+    FLOW_RETURN,
+    FLOW_TAIL_CALL,     /* `tail_decl' with the arguments at the top of the arena */
+};
+
+struct comptime {
+    struct ast* ast;
+    struct comptime_options options;
+    struct comptime_stats stats;
+    bool* is_comptime;  /* by node id, the NODE_FUNCDECLs declared `comptime' */
+
+    struct arena frames;    /* the arguments of every call being evaluated */
+    u32* table_of;          /* by node id of a NODE_DATA, its table, 0 until it is made */
+    struct tables tables;
+    struct memo memo;
+    struct memo_args memo_args;
+    usize heap;             /* bytes of tables and memo */
+
+    u32 where;          /* the function holding the expression being evaluated */
+    const i64* args;    /* of the call being evaluated, NULL outside of calls */
+    u32 depth;
+    u32 tail_decl;
+    i64 result;
+};
+
+static inline void comptime_error(struct comptime* ct, const char* msg);
+static inline void step(struct comptime* ct);
+static inline void reserve(struct comptime* ct, usize heap, usize frames);
+static inline i64* push_args(struct comptime* ct, u32 nargs);
+static inline u32 make_table(struct comptime* ct, struct node data);
+static inline u64 hash_call(u32 decl, const i64* args, u32 nargs);
+static inline struct memo_slot* memo_slot(struct comptime* ct, u32 decl, const i64* args, u32 nargs);
+static inline void memo_grow(struct comptime* ct);
+static inline void memo_put(struct comptime* ct, u32 decl, const i64* args, u32 nargs, i64 result);
+static inline u32 eval_args(struct comptime* ct, u32 args, i64** values);
+static inline i64 eval_call(struct comptime* ct, struct node call);
+static inline i64 eval_expression(struct comptime* ct, u32 nodeid);
+static inline enum flow eval_statement(struct comptime* ct, u32 nodeid);
+static inline void bake(struct comptime* ct, u32 nodeid, bool in_comptime);
+
+static inline void comptime_error(struct comptime* ct, const char* msg) {
+    struct string name = ast_func_name(ct->ast, ct->ast->ptr[ct->where]);
+    fprintf(stderr, "nomic: error: comptime in `%.*s': %s\n", (i32)name.length, name.cstr, msg);
+    exit(1);
+}
+
+static inline void step(struct comptime* ct) {
+    char msg[64];
+
+    if (++ct->stats.steps <= ct->options.max_steps) return;
+
+    snprintf(msg, sizeof(msg), "more than %lu steps, see --comptime-steps", ct->options.max_steps);
+    comptime_error(ct, msg);
+}
+
+/* Makes sure `heap' more bytes of tables or memo and `frames' more of frames fit, and counts the first */
+static inline void reserve(struct comptime* ct, usize heap, usize frames) {
+    usize used = ct->heap + heap + arena_used(&ct->frames) + frames;
+    char msg[64];
+
+    if (used > ct->options.max_memory) {
+        snprintf(msg, sizeof(msg), "more than %lu bytes, see --comptime-memory", ct->options.max_memory);
+        comptime_error(ct, msg);
+    }
+
+    ct->heap += heap;
+    ct->stats.peak_memory = MAX(ct->stats.peak_memory, used);
+}
+
+static inline i64* push_args(struct comptime* ct, u32 nargs) {
+    reserve(ct, 0, nargs * sizeof(i64));
+    return arena_alloc(&ct->frames, nargs * sizeof(i64));
+}
+
+static inline u32 make_table(struct comptime* ct, struct node data) {
+    struct table table = { .at = NULL, .count = data.data.count };
+    struct node_link link;
+    u32 i = 0;
+
+    if (ct->table_of[data.id] != 0) return ct->table_of[data.id];
+
+    reserve(ct, table.count * sizeof(i64), 0);
+    table.at = malloc(MAX(table.count, 1) * sizeof(i64));
+    if (data.data.elems != 0) {
+        link = ct->ast->ptr[data.data.elems].link;
+        do {
+            table.at[i++] = eval_expression(ct, link.ptr);
+        } while (ast_link_advance(ct->ast, &link));
+    }
+
+    DYNARRAY_APPEND(ct->tables, table);
+    ct->table_of[data.id] = (u32)ct->tables.length;
+    return ct->table_of[data.id];
+}
+
+static inline u64 hash_call(u32 decl, const i64* args, u32 nargs) {
+    return fnv1a(fnv1a(FNV_OFFSET, &decl, sizeof(decl)), args, nargs * sizeof(*args));
+}
+
+static inline struct memo_slot* memo_slot(struct comptime* ct, u32 decl, const i64* args, u32 nargs) {
+    usize i = hash_call(decl, args, nargs) & (ct->memo.capacity - 1);
+    struct memo_slot* slot;
+
+    while ((slot = &ct->memo.at[i])->decl != 0) {
+        if (slot->decl == decl && slot->nargs == nargs &&
+            (nargs == 0 || memcmp(&ct->memo_args.at[slot->args], args, nargs * sizeof(i64)) == 0)) {
+            break;
+        }
+        i = (i + 1) & (ct->memo.capacity - 1);
+    }
+
+    return slot;
+}
+
+static inline void memo_grow(struct comptime* ct) {
+    struct memo old = ct->memo;
+    struct memo_slot* slot;
+
+    ct->memo.capacity = old.capacity ? old.capacity * 2 : 64;
+    ct->memo.at = calloc(ct->memo.capacity, sizeof(*ct->memo.at));
+    reserve(ct, (ct->memo.capacity - old.capacity) * sizeof(*ct->memo.at), 0);
+
+    for (usize i = 0; i < old.capacity; ++i) {
+        if (old.at[i].decl == 0) continue;
+        slot = memo_slot(ct, old.at[i].decl, &ct->memo_args.at[old.at[i].args], old.at[i].nargs);
+        *slot = old.at[i];
+    }
+
+    free(old.at);
+}
+
+static inline void memo_put(struct comptime* ct, u32 decl, const i64* args, u32 nargs, i64 result) {
+    struct memo_slot* slot;
+
+    if (ct->memo.size * 2 >= ct->memo.capacity) memo_grow(ct);
+
+    slot = memo_slot(ct, decl, args, nargs);
+    if (slot->decl != 0) return;
+
+    reserve(ct, nargs * sizeof(i64), 0);
+    *slot = (struct memo_slot){ .decl = decl, .nargs = nargs, .args = ct->memo_args.length, .result = result };
+    for (u32 i = 0; i < nargs; ++i) DYNARRAY_APPEND(ct->memo_args, args[i]);
+    ct->memo.size++;
+}
+
+/* Evaluates the arguments into a new frame on top of the arena */
+static inline u32 eval_args(struct comptime* ct, u32 args, i64** values) {
+    u32 nargs = ast_list_length(ct->ast, args), i = 0;
+    struct node_link link;
+    i64* frame = push_args(ct, nargs);
+
+    if (args != 0) {
+        link = ct->ast->ptr[args].link;
+        do {
+            frame[i++] = eval_expression(ct, link.ptr);
+        } while (ast_link_advance(ct->ast, &link));
+    }
+
+    *values = frame;
+    return nargs;
+}
+
+/* Runs the callee to its `return', following its tail calls in the same frame */
+static inline i64 eval_call(struct comptime* ct, struct node call) {
+    const i64* caller = ct->args;
+    void* top = ct->frames.mem_cursor;
+    u32 decl = call.call.callee, nargs, entry_nargs;
+    i64* args;
+    i64* entry;
+    struct memo_slot* slot;
+    struct node func;
+    enum flow flow;
+
+    entry_nargs = nargs = eval_args(ct, call.call.args, &entry);
+
+    if (ct->memo.capacity != 0 && (slot = memo_slot(ct, decl, entry, nargs))->decl != 0) {
+        ct->stats.memoized++;
+        ct->frames.mem_cursor = top;
+        return slot->result;
+    }
+
+    /* a copy to work on, which tail calls write over, the arguments of the call itself go in the memo */
+    args = push_args(ct, nargs);
+    memcpy(args, entry, nargs * sizeof(i64));
+
+    if (++ct->depth > COMPTIME_MAX_DEPTH) comptime_error(ct, "calls nested too deep");
+
+    while (true) {
+        func = ct->ast->ptr[decl];
+        if (func.func_decl.body == 0) {
+            struct string name = ast_func_name(ct->ast, func);
+            char msg[128];
+
+            snprintf(msg, sizeof(msg), "can't call extern function `%.*s'", (i32)name.length, name.cstr);
+            comptime_error(ct, msg);
+        }
+
+        ct->stats.calls++;
+        ct->args = args;
+        ct->result = 0;
+        flow = eval_statement(ct, func.func_decl.body);
+        if (flow != FLOW_TAIL_CALL) break;
+
+        /* the new arguments are on top of the arena, right above the frame they move down into */
+        decl = ct->tail_decl;
+        nargs = ast_list_length(ct->ast, ast_func_proto(ct->ast, ct->ast->ptr[decl]).proto.params);
+        memmove(args, (i64*)ct->frames.mem_cursor - nargs, nargs * sizeof(i64));
+        ct->frames.mem_cursor = (u8*)args + nargs * sizeof(i64);
+    }
+
+    ct->depth--;
+    ct->args = caller;
+    memo_put(ct, call.call.callee, entry, entry_nargs, ct->result);
+    ct->frames.mem_cursor = top;
+    return ct->result;
+}
+
+static inline i64 eval_expression(struct comptime* ct, u32 nodeid) {
+    struct node node = ct->ast->ptr[nodeid];
+    struct node slice;
+    struct table table;
+    i64 ptr, len, index;
+
+    step(ct);
+
+    switch (node.kind) {
+        case NODE_NUMBER:
+            return node.number;
+        case NODE_PARAMREF:
+            if (ct->args == NULL) comptime_error(ct, "can't use the parameters of the function it is in");
+            return ct->args[node.param_ref.index];
+        case NODE_DATA:
+            return make_table(ct, node);
+        case NODE_COMPTIME:
+            return eval_expression(ct, node.comptime.expr);
+        case NODE_CALL:
+            return eval_call(ct, node);
+        case NODE_INDEX:
+            slice = ct->ast->ptr[node.index.slice];
+            ptr = eval_expression(ct, slice.slice.ptr);
+            len = eval_expression(ct, slice.slice.len);
+            index = eval_expression(ct, node.index.expr);
+            if (index < 0 || index >= len || ptr == 0) comptime_error(ct, "index out of bounds");
+
+            table = ct->tables.at[ptr - 1];
+            ASSERT(index < table.count);
+            return table.at[index];
+        default:
+            break;
+    }
+
+    if (node_is_binary(node.kind)) {
+        return fold_binary(node.kind, eval_expression(ct, node.binary.lhs), eval_expression(ct, node.binary.rhs));
+    }
+
+    UNREACHABLE("eval_expression: not an expression");
+}
+
+static inline enum flow eval_statement(struct comptime* ct, u32 nodeid) {
+    struct node node = ct->ast->ptr[nodeid];
+    struct node arms, expr;
+    struct node_link link;
+    i64* args;
+    enum flow flow;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr == 0) return FLOW_RETURN;
+
+            expr = ct->ast->ptr[node.return_stmt.expr];
+            if (expr.kind == NODE_CALL) {
+                /* a loop, it must not take a C frame per iteration */
+                step(ct);
+                eval_args(ct, expr.call.args, &args);
+                ct->tail_decl = expr.call.callee;
+                return FLOW_TAIL_CALL;
+            }
+
+            ct->result = eval_expression(ct, node.return_stmt.expr);
+            return FLOW_RETURN;
+        case NODE_IF:
+            arms = ct->ast->ptr[node.if_stmt.arms];
+            if (eval_expression(ct, node.if_stmt.cond) != 0) return eval_statement(ct, arms.arms.then);
+            if (arms.arms.otherwise != 0) return eval_statement(ct, arms.arms.otherwise);
+            return FLOW_NEXT;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return FLOW_NEXT;
+            link = node.link;
+            do {
+                if ((flow = eval_statement(ct, link.ptr)) != FLOW_NEXT) return flow;
+            } while (ast_link_advance(ct->ast, &link));
+            return FLOW_NEXT;
+        default:
+            eval_expression(ct, nodeid);
+            return FLOW_NEXT;
+    }
+}
+
+/* Evaluates the compile time expressions under `nodeid', calls to comptime functions too unless `in_comptime' */
+static inline void bake(struct comptime* ct, u32 nodeid, bool in_comptime) {
+    struct node node = ct->ast->ptr[nodeid];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_COMPTIME:
+            replace_with_number(ct->ast, nodeid, eval_expression(ct, node.comptime.expr));
+            ct->stats.expressions++;
+            return;
+        case NODE_CALL:
+            if (!in_comptime && ct->is_comptime[node.call.callee]) {
+                replace_with_number(ct->ast, nodeid, eval_expression(ct, nodeid));
+                ct->stats.expressions++;
+                return;
+            }
+            if (node.call.args != 0) bake(ct, node.call.args, in_comptime);
+            return;
+        case NODE_DATA:
+            if (node.data.elems == 0) return;
+            link = ct->ast->ptr[node.data.elems].link;
+            do {
+                ct->stats.baked += ct->ast->ptr[link.ptr].kind == NODE_COMPTIME;
+            } while (ast_link_advance(ct->ast, &link));
+            bake(ct, node.data.elems, in_comptime);
+            return;
+        case NODE_LINK:
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return;
+            link = node.link;
+            do {
+                bake(ct, link.ptr, in_comptime);
+            } while (ast_link_advance(ct->ast, &link));
+            return;
+        case NODE_RETURN:
+            if (node.return_stmt.expr != 0) bake(ct, node.return_stmt.expr, in_comptime);
+            return;
+        case NODE_IF:
+            bake(ct, node.if_stmt.cond, in_comptime);
+            bake(ct, node.if_stmt.arms, in_comptime);
+            return;
+        case NODE_ARMS:
+            bake(ct, node.arms.then, in_comptime);
+            if (node.arms.otherwise != 0) bake(ct, node.arms.otherwise, in_comptime);
+            return;
+        case NODE_INDEX:
+            bake(ct, node.index.slice, in_comptime);
+            bake(ct, node.index.expr, in_comptime);
+            return;
+        case NODE_SLICE:
+            bake(ct, node.slice.ptr, in_comptime);
+            bake(ct, node.slice.len, in_comptime);
+            return;
+        default:
+            break;
+    }
+
+    if (node_is_binary(node.kind)) {
+        bake(ct, node.binary.lhs, in_comptime);
+        bake(ct, node.binary.rhs, in_comptime);
+    }
+}
+
+struct comptime_stats comptime_eval(struct ast* ast, struct comptime_options options) {
+    struct comptime ct = {
+        .ast = ast,
+        .options = options,
+        .stats = {0},
+        .is_comptime = calloc(MAX(ast->length, 1), sizeof(bool)),
+        .frames = arena_create(MAX(options.max_memory, 1)),
+        .table_of = calloc(MAX(ast->length, 1), sizeof(u32)),
+        .tables = {0},
+        .memo = {0},
+        .memo_args = {0},
+        .heap = 0,
+        .args = NULL,
+        .depth = 0,
+    };
+    struct node_link link = ast->ptr[0].link;
+    struct node decl;
+
+    for (usize i = 0; i < ast->comptime.length; ++i) ct.is_comptime[ast->comptime.at[i]] = true;
+
+    if (link.ptr != 0) {
+        do {
+            decl = ast->ptr[link.ptr];
+            if (decl.func_decl.body == 0) continue;
+
+            ct.where = decl.id;
+            bake(&ct, decl.func_decl.body, ct.is_comptime[decl.id]);
+        } while (ast_link_advance(ast, &link));
+    }
+
+    for (usize i = 0; i < ct.tables.length; ++i) free(ct.tables.at[i].at);
+    DYNARRAY_FREE(ct.tables);
+    DYNARRAY_FREE(ct.memo_args);
+    free(ct.memo.at);
+    free(ct.table_of);
+    free(ct.is_comptime);
+    arena_destroy(&ct.frames);
+
+    return ct.stats;
+}
+
+void comptime_report(FILE* out, const struct comptime_stats* stats) {
+    fprintf(out, "%-16s %10u (%u baked into .rodata)\n", "expressions", stats->expressions, stats->baked);
+    fprintf(out, "%-16s %10u\n", "calls", stats->calls);
+    fprintf(out, "%-16s %10u\n", "memoized", stats->memoized);
+    fprintf(out, "%-16s %10lu\n", "steps", stats->steps);
+    fprintf(out, "%-16s %10lu bytes\n", "peak memory", stats->peak_memory);
+}
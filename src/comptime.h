@@ -0,0 +1,56 @@
+#ifndef __COMPTIME_H
+#define __COMPTIME_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Compile time evaluation.
+ *
+ * `comptime expr' is worked out while compiling and replaced by the number
+ * it comes to, `comptime [f(0), f(1)]' is a slice literal whose elements
+ * are, so a lookup table goes into .rodata instead of being built when the
+ * program starts. A function declared `comptime func' is evaluated at every
+ * call outside of other comptime functions, its arguments have to be known
+ * while compiling.
+ *
+ * The evaluator walks the AST right after parsing. It can call any function
+ * with a body and index slice literals, but not call extern functions or
+ * read the parameters of the function the expression is in. Nomi functions
+ * have no effects besides their result, so every call is memoized by callee
+ * and arguments across the whole program, and tail calls reuse their frame
+ * like they do at run time. Evaluation stops with an error past `max_steps'
+ * expressions, or once the frames, tables and memo take up more than
+ * `max_memory' bytes.
+ * */
+
+#define COMPTIME_MAX_STEPS_DEFAULT 10000000
+#define COMPTIME_MAX_MEMORY_DEFAULT MEGABYTES(1)
+/* nested calls, which the evaluator makes on the C stack */
+#define COMPTIME_MAX_DEPTH 1000
+
+struct comptime_options {
+    u64 max_steps;
+    usize max_memory;
+};
+
+#define COMPTIME_OPTIONS_DEFAULT (struct comptime_options){ \
+    .max_steps = COMPTIME_MAX_STEPS_DEFAULT, \
+    .max_memory = COMPTIME_MAX_MEMORY_DEFAULT, \
+}
+
+struct comptime_stats {
+    u32 expressions;    /* `comptime' expressions and calls to comptime functions */
+    u32 baked;          /* of those, elements of slice literals */
+    u32 calls;          /* evaluated */
+    u32 memoized;       /* answered from the memo */
+    u64 steps;
+    usize peak_memory;
+};
+
+/* Replaces every compile time expression of the program by its value */
+struct comptime_stats comptime_eval(struct ast* ast, struct comptime_options options);
+
+void comptime_report(FILE* out, const struct comptime_stats* stats);
+
+#endif  /*__COMPTIME_H*/
@@ -0,0 +1,219 @@
+#include "dataflow.h"
+
+/* Everything comes out 8 byte aligned, u32 arrays sit between the sets */
+#define ROUND8(size) (((usize)(size) + 7) & ~(usize)7)
+
+static inline void* alloc(struct arena* arena, usize size);
+static inline void postorder(struct cfg* cfg, struct arena* arena, u32* post, u32* npost);
+
+static inline void* alloc(struct arena* arena, usize size) {
+    return arena_alloc(arena, ROUND8(size));
+}
+
+usize dataflow_arena_size(u32 nblocks, u32 max_edges, u32 bits) {
+    usize words = BITSET_WORDS(bits);
+    usize blocks = ROUND8(nblocks * sizeof(u32));
+    usize seen = BITSET_WORDS(nblocks) * sizeof(u64);
+    usize size = 0;
+
+    /* cfg_create */
+    size += ROUND8(max_edges * sizeof(struct cfg_edge));
+    /* cfg_finish: the edges both ways, the order, then postorder's stack, cursors, seen bits and result */
+    size += 2 * ROUND8((nblocks + 1) * sizeof(u32)) + 2 * ROUND8(max_edges * sizeof(u32)) + blocks;
+    size += 3 * blocks + seen;
+    /* dataflow_create */
+    size += (4 * nblocks * words + words) * sizeof(u64) + seen;
+
+    return size;
+}
+
+struct cfg cfg_create(struct arena* arena, u32 nblocks, u32 max_edges) {
+    return (struct cfg){
+        .nblocks = nblocks,
+        .edges = alloc(arena, max_edges * sizeof(struct cfg_edge)),
+        .nedges = 0,
+        .max_edges = max_edges,
+        .succ_start = NULL,
+        .succs = NULL,
+        .pred_start = NULL,
+        .preds = NULL,
+        .order = NULL,
+    };
+}
+
+void cfg_add_edge(struct cfg* cfg, u32 from, u32 to) {
+    ASSERT(from < cfg->nblocks && to < cfg->nblocks);
+    ASSERT(cfg->nedges < cfg->max_edges);
+    cfg->edges[cfg->nedges++] = (struct cfg_edge){ .from = from, .to = to };
+}
+
+/*
+ * The `npost' blocks reachable from the entry, in postorder, then the rest.
+ * Iterative, functions with thousands of blocks would blow the C stack.
+ * */
+static inline void postorder(struct cfg* cfg, struct arena* arena, u32* post, u32* npost) {
+    u32* stack = alloc(arena, cfg->nblocks * sizeof(u32));
+    u32* next = alloc(arena, cfg->nblocks * sizeof(u32));   /* successors looked at so far */
+    u64* seen = alloc(arena, BITSET_WORDS(cfg->nblocks) * sizeof(u64));
+    u32 depth = 0, block, succ;
+
+    memset(next, 0, cfg->nblocks * sizeof(u32));
+    bitset_fill(seen, BITSET_WORDS(cfg->nblocks), false);
+
+    *npost = 0;
+    if (cfg->nblocks == 0) return;
+
+    stack[depth++] = 0;
+    bitset_set(seen, 0);
+
+    while (depth > 0) {
+        block = stack[depth - 1];
+
+        if (cfg->succ_start[block] + next[block] == cfg->succ_start[block + 1]) {
+            post[(*npost)++] = block;
+            depth--;
+            continue;
+        }
+
+        succ = cfg->succs[cfg->succ_start[block] + next[block]++];
+        if (bitset_test(seen, succ)) continue;
+
+        bitset_set(seen, succ);
+        stack[depth++] = succ;
+    }
+
+    /* unreachable blocks still get sets, nothing flows into them from the entry */
+    for (u32 b = 0, n = *npost; b < cfg->nblocks; ++b) {
+        if (!bitset_test(seen, b)) post[n++] = b;
+    }
+}
+
+void cfg_finish(struct cfg* cfg, struct arena* arena) {
+    u32* post;
+    u32 npost;
+
+    cfg->succ_start = alloc(arena, (cfg->nblocks + 1) * sizeof(u32));
+    cfg->pred_start = alloc(arena, (cfg->nblocks + 1) * sizeof(u32));
+    cfg->succs = alloc(arena, cfg->max_edges * sizeof(u32));
+    cfg->preds = alloc(arena, cfg->max_edges * sizeof(u32));
+    cfg->order = alloc(arena, cfg->nblocks * sizeof(u32));
+
+    /*
+     * Counting sort of the edges by source and by destination. Filling in a
+     * block's edges moves its start to the next block's, so the starts are
+     * shifted back into place afterwards.
+     * */
+    memset(cfg->succ_start, 0, (cfg->nblocks + 1) * sizeof(u32));
+    memset(cfg->pred_start, 0, (cfg->nblocks + 1) * sizeof(u32));
+    for (u32 i = 0; i < cfg->nedges; ++i) {
+        cfg->succ_start[cfg->edges[i].from + 1]++;
+        cfg->pred_start[cfg->edges[i].to + 1]++;
+    }
+    for (u32 b = 0; b < cfg->nblocks; ++b) {
+        cfg->succ_start[b + 1] += cfg->succ_start[b];
+        cfg->pred_start[b + 1] += cfg->pred_start[b];
+    }
+    for (u32 i = 0; i < cfg->nedges; ++i) {
+        struct cfg_edge edge = cfg->edges[i];
+        cfg->succs[cfg->succ_start[edge.from]++] = edge.to;
+        cfg->preds[cfg->pred_start[edge.to]++] = edge.from;
+    }
+    for (u32 b = cfg->nblocks; b > 0; --b) {
+        cfg->succ_start[b] = cfg->succ_start[b - 1];
+        cfg->pred_start[b] = cfg->pred_start[b - 1];
+    }
+    cfg->succ_start[0] = 0;
+    cfg->pred_start[0] = 0;
+
+    post = alloc(arena, cfg->nblocks * sizeof(u32));
+    postorder(cfg, arena, post, &npost);
+
+    for (u32 i = 0; i < npost; ++i) {
+        cfg->order[i] = post[npost - 1 - i];
+    }
+    for (u32 i = npost; i < cfg->nblocks; ++i) {
+        cfg->order[i] = post[i];
+    }
+}
+
+struct dataflow dataflow_create(struct arena* arena, const struct cfg* cfg, enum dataflow_direction direction,
+                                enum dataflow_meet meet, u32 bits) {
+    struct dataflow df = {
+        .direction = direction,
+        .meet = meet,
+        .bits = bits,
+        .words = BITSET_WORDS(bits),
+        .nblocks = cfg->nblocks,
+        .visits = 0,
+    };
+    usize sets = (usize)df.nblocks * df.words;
+
+    df.gen = alloc(arena, sets * sizeof(u64));
+    df.kill = alloc(arena, sets * sizeof(u64));
+    df.in = alloc(arena, sets * sizeof(u64));
+    df.out = alloc(arena, sets * sizeof(u64));
+    df.boundary = alloc(arena, df.words * sizeof(u64));
+    df.pending = alloc(arena, BITSET_WORDS(df.nblocks) * sizeof(u64));
+
+    bitset_fill(df.gen, (u32)sets, false);
+    bitset_fill(df.kill, (u32)sets, false);
+    bitset_fill(df.boundary, df.words, false);
+
+    return df;
+}
+
+void dataflow_solve(struct dataflow* df, const struct cfg* cfg) {
+    bool forward = df->direction == DATAFLOW_FORWARD;
+    bool top = df->meet == DATAFLOW_INTERSECT;
+    /* the side of a block the meet goes into, and the side the transfer writes */
+    u64* joined = forward ? df->in : df->out;
+    u64* result = forward ? df->out : df->in;
+    const u32* from_start = forward ? cfg->pred_start : cfg->succ_start;
+    const u32* from = forward ? cfg->preds : cfg->succs;
+    const u32* to_start = forward ? cfg->succ_start : cfg->pred_start;
+    const u32* to = forward ? cfg->succs : cfg->preds;
+    u32 pending = df->nblocks;
+    u32 block, words = df->words;
+    u64* set;
+
+    ASSERT(cfg->nblocks == df->nblocks);
+
+    bitset_fill(result, df->nblocks * words, top);
+    bitset_fill(df->pending, BITSET_WORDS(df->nblocks), true);
+
+    while (pending > 0) {
+        for (u32 k = 0; k < df->nblocks; ++k) {
+            block = cfg->order[forward ? k : df->nblocks - 1 - k];
+            if (!bitset_test(df->pending, block)) continue;
+
+            bitset_clear(df->pending, block);
+            pending--;
+            df->visits++;
+
+            set = dataflow_set(df, joined, block);
+            bitset_fill(set, words, top);
+
+            if (forward ? block == 0 : from_start[block] == from_start[block + 1]) {
+                if (top) bitset_intersect(set, df->boundary, words);
+                else bitset_union(set, df->boundary, words);
+            }
+
+            for (u32 e = from_start[block]; e < from_start[block + 1]; ++e) {
+                if (top) bitset_intersect(set, dataflow_set(df, result, from[e]), words);
+                else bitset_union(set, dataflow_set(df, result, from[e]), words);
+            }
+
+            if (!bitset_transfer(dataflow_set(df, result, block), set,
+                                 dataflow_set(df, df->gen, block), dataflow_set(df, df->kill, block), words)) {
+                continue;
+            }
+
+            for (u32 e = to_start[block]; e < to_start[block + 1]; ++e) {
+                if (bitset_test(df->pending, to[e])) continue;
+
+                bitset_set(df->pending, to[e]);
+                pending++;
+            }
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef __DATAFLOW_H
+#define __DATAFLOW_H
+
+#include "base.h"
+#include "arena.h"
+
+/*
+ * Dataflow analysis over basic blocks
+ *
+ * A client numbers its blocks, adds the edges between them to a `struct
+ * cfg' and describes its problem as a gen and a kill set per block: the
+ * values (registers, definitions, variables) the block makes true and the
+ * ones it makes false. That covers liveness (backward, union), reaching
+ * definitions (forward, union) and definite assignment (forward,
+ * intersection). `dataflow_solve' then finds the fixed point of
+ *
+ *     out = gen | (in & ~kill)
+ *
+ * with `in' (`out' for backward problems) the meet over the neighbours.
+ *
+ * Sets are dense bitsets, `words' u64s each. They and the graph are taken
+ * from an arena the client sizes with `dataflow_arena_size', so solving the
+ * same function again after rewriting it is an `arena_clear' away and costs
+ * no allocations. The solver visits blocks in reverse postorder (postorder
+ * for backward problems), so most edges carry a finished set and acyclic
+ * code settles in one pass; loops only cost another pass per level of
+ * nesting.
+ * */
+
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+
+static inline bool bitset_test(const u64* set, u32 bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void bitset_set(u64* set, u32 bit) {
+    set[bit / 64] |= (u64)1 << (bit % 64);
+}
+
+static inline void bitset_clear(u64* set, u32 bit) {
+    set[bit / 64] &= ~((u64)1 << (bit % 64));
+}
+
+static inline void bitset_fill(u64* set, u32 words, bool value) {
+    memset(set, value ? 0xff : 0, words * sizeof(u64));
+}
+
+static inline void bitset_copy(u64* dst, const u64* src, u32 words) {
+    memcpy(dst, src, words * sizeof(u64));
+}
+
+/* The whole loop is straight word operations, left for the compiler to vectorize */
+static inline void bitset_union(u64* dst, const u64* src, u32 words) {
+    for (u32 i = 0; i < words; ++i) dst[i] |= src[i];
+}
+
+static inline void bitset_intersect(u64* dst, const u64* src, u32 words) {
+    for (u32 i = 0; i < words; ++i) dst[i] &= src[i];
+}
+
+/* dst = gen | (src & ~kill), returns whether dst changed */
+static inline bool bitset_transfer(u64* dst, const u64* src, const u64* gen, const u64* kill, u32 words) {
+    u64 changed = 0;
+
+    for (u32 i = 0; i < words; ++i) {
+        u64 value = gen[i] | (src[i] & ~kill[i]);
+        changed |= value ^ dst[i];
+        dst[i] = value;
+    }
+
+    return changed != 0;
+}
+
+struct cfg_edge {
+    u32 from;
+    u32 to;
+};
+
+/*
+ * Block 0 is the entry. `succs' and `preds' are filled in by `cfg_finish',
+ * the neighbours of block b are at [start[b], start[b + 1]).
+ * */
+struct cfg {
+    u32 nblocks;
+    struct cfg_edge* edges;
+    u32 nedges;
+    u32 max_edges;
+
+    u32* succ_start;
+    u32* succs;
+    u32* pred_start;
+    u32* preds;
+    u32* order;     /* reverse postorder from the entry, unreachable blocks last */
+};
+
+/* What `cfg_create', `cfg_finish' and `dataflow_create' take from the arena */
+usize dataflow_arena_size(u32 nblocks, u32 max_edges, u32 bits);
+
+struct cfg cfg_create(struct arena* arena, u32 nblocks, u32 max_edges);
+void cfg_add_edge(struct cfg* cfg, u32 from, u32 to);
+void cfg_finish(struct cfg* cfg, struct arena* arena);
+
+enum dataflow_direction : u8 {
+    DATAFLOW_FORWARD,
+    DATAFLOW_BACKWARD,
+};
+
+enum dataflow_meet : u8 {
+    DATAFLOW_UNION,         /* may: true along some path */
+    DATAFLOW_INTERSECT,     /* must: true along every path */
+};
+
+struct dataflow {
+    enum dataflow_direction direction;
+    enum dataflow_meet meet;
+    u32 bits;
+    u32 words;          /* per set */
+    u32 nblocks;
+
+    /* nblocks sets each, block b starts at b * words */
+    u64* gen;
+    u64* kill;
+    u64* in;
+    u64* out;
+    /*
+     * What flows into the entry (forward) or out of the blocks without
+     * successors (backward), empty unless the client fills it in
+     * */
+    u64* boundary;
+
+    u64* pending;       /* the worklist, blocks whose neighbours changed */
+    u32 visits;         /* blocks transferred before the fixed point was reached */
+};
+
+/* gen, kill and the boundary start out empty */
+struct dataflow dataflow_create(struct arena* arena, const struct cfg* cfg, enum dataflow_direction direction,
+                                enum dataflow_meet meet, u32 bits);
+void dataflow_solve(struct dataflow* df, const struct cfg* cfg);
+
+static inline u64* dataflow_set(const struct dataflow* df, u64* sets, u32 block) {
+    return sets + (usize)block * df->words;
+}
+
+#endif  /*__DATAFLOW_H*/
@@ -0,0 +1,244 @@
+#include "fold.h"
+
+static inline bool is_number(struct ast* ast, u32 nodeid, i64 value);
+static inline void replace_with(struct ast* ast, u32 nodeid, u32 with);
+static inline bool reassociate(struct ast* ast, u32 nodeid);
+static inline void fold_index(struct ast* ast, u32 nodeid);
+
+i64 fold_binary(enum node_kind kind, i64 lhs, i64 rhs) {
+    switch (kind) {
+        case NODE_ADD: return (i32)((u32)lhs + (u32)rhs); break;
+        case NODE_SUB: return (i32)((u32)lhs - (u32)rhs); break;
+        case NODE_MUL: return (i32)((u32)lhs * (u32)rhs); break;
+        case NODE_EQ: return lhs == rhs; break;
+        case NODE_NE: return lhs != rhs; break;
+        case NODE_LT: return lhs < rhs; break;
+        case NODE_LE: return lhs <= rhs; break;
+        case NODE_GT: return lhs > rhs; break;
+        case NODE_GE: return lhs >= rhs; break;
+        default: break;
+    }
+
+    UNREACHABLE("fold_binary: not a binary operator");
+}
+
+bool expression_has_effects(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+
+    switch (node.kind) {
+        case NODE_CALL:
+            /* we don't know what the callee does, so every call counts */
+            return true;
+        case NODE_INDEX:
+            /* out of bounds traps, which can't go away or happen somewhere else */
+            return true;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            return expression_has_effects(ast, node.binary.lhs) ||
+                   expression_has_effects(ast, node.binary.rhs);
+        default:
+            return false;
+    }
+}
+
+static inline bool is_number(struct ast* ast, u32 nodeid, i64 value) {
+    return ast->ptr[nodeid].kind == NODE_NUMBER && ast->ptr[nodeid].number == value;
+}
+
+/* Everything pointing at `nodeid' now sees the node `with' */
+static inline void replace_with(struct ast* ast, u32 nodeid, u32 with) {
+    ast->ptr[nodeid] = ast->ptr[with];
+    ast->ptr[nodeid].id = nodeid;
+}
+
+void replace_with_number(struct ast* ast, u32 nodeid, i64 value) {
+    struct node node = node_create_number(value);
+    node.id = nodeid;
+    ast->ptr[nodeid] = node;
+}
+
+/*
+ * `(x + c1) + c2' -> `x + (c1 + c2)' and friends. The constant always ends
+ * up on the right, where the backends can use it as an immediate.
+ * */
+static inline bool reassociate(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node lhs = ast->ptr[node.binary.lhs];
+    struct node rhs = ast->ptr[node.binary.rhs];
+    struct node inner;
+
+    if (rhs.kind != NODE_NUMBER || !node_is_arithmetic(node.kind) || !node_is_arithmetic(lhs.kind)) return false;
+
+    inner = ast->ptr[lhs.binary.rhs];
+    if (inner.kind != NODE_NUMBER) return false;
+
+    if (node.kind == NODE_MUL && lhs.kind == NODE_MUL) {
+        replace_with_number(ast, node.binary.rhs, fold_binary(NODE_MUL, inner.number, rhs.number));
+    } else if (node.kind != NODE_MUL && lhs.kind != NODE_MUL) {
+        /* x + c1 + c2, x - c1 + c2, x + c1 - c2 and x - c1 - c2 are all x + c */
+        i64 c1 = lhs.kind == NODE_ADD ? inner.number : fold_binary(NODE_SUB, 0, inner.number);
+        i64 c2 = node.kind == NODE_ADD ? rhs.number : fold_binary(NODE_SUB, 0, rhs.number);
+
+        ast->ptr[nodeid].kind = NODE_ADD;
+        replace_with_number(ast, node.binary.rhs, fold_binary(NODE_ADD, c1, c2));
+    } else {
+        return false;
+    }
+
+    ast->ptr[nodeid].binary.lhs = lhs.binary.lhs;
+    return true;
+}
+
+/* A constant index into a slice literal is the element, as long as it is in bounds */
+static inline void fold_index(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node data = ast->ptr[ast->ptr[node.index.slice].slice.ptr];
+    struct node index = ast->ptr[node.index.expr];
+    struct node_link link;
+
+    if (data.kind != NODE_DATA || index.kind != NODE_NUMBER) return;
+    if (index.number < 0 || index.number >= data.data.count) return;
+
+    link = ast->ptr[data.data.elems].link;
+    for (i64 i = 0; i < index.number; ++i) ast_link_advance(ast, &link);
+    replace_with_number(ast, nodeid, ast->ptr[link.ptr].number);
+}
+
+void fold_expression(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+    u32 tmp;
+
+    switch (node.kind) {
+        case NODE_CALL:
+            if (node.call.args == 0) break;
+            link = ast->ptr[node.call.args].link;
+            do {
+                fold_expression(ast, link.ptr);
+            } while (ast_link_advance(ast, &link));
+            break;
+        case NODE_INDEX:
+            fold_expression(ast, node.index.expr);
+            fold_index(ast, nodeid);
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+            fold_expression(ast, node.binary.lhs);
+            fold_expression(ast, node.binary.rhs);
+
+            if (ast->ptr[node.binary.lhs].kind == NODE_NUMBER && ast->ptr[node.binary.rhs].kind == NODE_NUMBER) {
+                replace_with_number(ast, nodeid, fold_binary(node.kind, ast->ptr[node.binary.lhs].number,
+                                                             ast->ptr[node.binary.rhs].number));
+                break;
+            }
+
+            /* constants go on the right of commutative operators */
+            if (node.kind != NODE_SUB && ast->ptr[node.binary.lhs].kind == NODE_NUMBER) {
+                tmp = node.binary.lhs;
+                ast->ptr[nodeid].binary.lhs = node.binary.rhs;
+                ast->ptr[nodeid].binary.rhs = tmp;
+                node = ast->ptr[nodeid];
+            }
+
+            if (node.kind != NODE_MUL && is_number(ast, node.binary.rhs, 0)) {
+                replace_with(ast, nodeid, node.binary.lhs);
+            } else if (node.kind == NODE_MUL && is_number(ast, node.binary.rhs, 1)) {
+                replace_with(ast, nodeid, node.binary.lhs);
+            } else if (node.kind == NODE_MUL && is_number(ast, node.binary.rhs, 0) &&
+                       !expression_has_effects(ast, node.binary.lhs)) {
+                replace_with_number(ast, nodeid, 0);
+            } else if (node.kind == NODE_SUB && ast->ptr[node.binary.lhs].kind == NODE_PARAMREF &&
+                       ast->ptr[node.binary.rhs].kind == NODE_PARAMREF &&
+                       ast->ptr[node.binary.lhs].param_ref.index == ast->ptr[node.binary.rhs].param_ref.index) {
+                replace_with_number(ast, nodeid, 0);
+            } else if (reassociate(ast, nodeid)) {
+                /* the new constant might be 0 or 1 */
+                fold_expression(ast, nodeid);
+            }
+            break;
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            fold_expression(ast, node.binary.lhs);
+            fold_expression(ast, node.binary.rhs);
+
+            if (ast->ptr[node.binary.lhs].kind == NODE_NUMBER && ast->ptr[node.binary.rhs].kind == NODE_NUMBER) {
+                replace_with_number(ast, nodeid, fold_binary(node.kind, ast->ptr[node.binary.lhs].number,
+                                                             ast->ptr[node.binary.rhs].number));
+            } else if (ast->ptr[node.binary.lhs].kind == NODE_NUMBER) {
+                /* `0 < x' -> `x > 0' */
+                ast->ptr[nodeid].kind = node_compare_mirror(node.kind);
+                ast->ptr[nodeid].binary.lhs = node.binary.rhs;
+                ast->ptr[nodeid].binary.rhs = node.binary.lhs;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void fold_statement(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr != 0) fold_expression(ast, node.return_stmt.expr);
+            break;
+        case NODE_IF:
+            fold_expression(ast, node.if_stmt.cond);
+            fold_statement(ast, ast->ptr[node.if_stmt.arms].arms.then);
+            if (ast->ptr[node.if_stmt.arms].arms.otherwise != 0) {
+                fold_statement(ast, ast->ptr[node.if_stmt.arms].arms.otherwise);
+            }
+
+            /* only one of the arms can ever run */
+            if (ast->ptr[node.if_stmt.cond].kind == NODE_NUMBER) {
+                struct node arms = ast->ptr[node.if_stmt.arms];
+                u32 taken = ast->ptr[node.if_stmt.cond].number != 0 ? arms.arms.then : arms.arms.otherwise;
+
+                if (taken != 0) {
+                    replace_with(ast, nodeid, taken);
+                } else {
+                    ast->ptr[nodeid] = node_create_block((struct node_link){0, 0});
+                    ast->ptr[nodeid].id = nodeid;
+                }
+            }
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) break;
+            link = node.link;
+            do {
+                fold_statement(ast, link.ptr);
+            } while (ast_link_advance(ast, &link));
+            break;
+        default:
+            /* expression statement */
+            fold_expression(ast, nodeid);
+            if (!expression_has_effects(ast, nodeid)) {
+                ast->ptr[nodeid] = node_create_block((struct node_link){0, 0});
+                ast->ptr[nodeid].id = nodeid;
+            }
+            break;
+    }
+}
+
+void fold_constants(struct ast* ast) {
+    struct node_link link = ast->ptr[0].link;
+
+    do {
+        struct node decl = ast->ptr[link.ptr];
+        if (decl.kind == NODE_FUNCDECL && decl.func_decl.body != 0) fold_statement(ast, decl.func_decl.body);
+    } while (ast_link_advance(ast, &link));
+}
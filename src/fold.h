@@ -0,0 +1,35 @@
+#ifndef __FOLD_H
+#define __FOLD_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Constant folding over the AST.
+ *
+ * Nodes are rewritten in place, so whatever points at a folded node keeps
+ * pointing at the right thing. Besides evaluating arithmetic on literals it
+ * applies the identities that show up once calls have been inlined
+ * (`x + 0', `x * 1', `(x + 1) + 2') and throws away expression statements
+ * which have no effect.
+ * */
+
+/* Folds the expression `nodeid' and everything below it */
+void fold_expression(struct ast* ast, u32 nodeid);
+
+/* Folds every expression in the statement `nodeid' */
+void fold_statement(struct ast* ast, u32 nodeid);
+
+/* Folds the body of every function */
+void fold_constants(struct ast* ast);
+
+/* Does evaluating `nodeid' do anything besides produce a value? */
+bool expression_has_effects(struct ast* ast, u32 nodeid);
+
+/* The result of `lhs kind rhs' wrapped around to i32, 0 or 1 for comparisons */
+i64 fold_binary(enum node_kind kind, i64 lhs, i64 rhs);
+
+/* Turns `nodeid' into the number `value' in place, for everything pointing at it */
+void replace_with_number(struct ast* ast, u32 nodeid, i64 value);
+
+#endif  /*__FOLD_H*/
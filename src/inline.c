@@ -0,0 +1,388 @@
+#include "inline.h"
+#include "callgraph.h"
+#include "fold.h"
+
+#define INLINE_MAX_ARGS 64
+
+/* Calling costs a `call' and moving the result, on top of setting up every argument */
+#define INLINE_CALL_COST 2
+
+/* What a function's body does, as far as the inliner is concerned */
+enum body_shape : u8 {
+    BODY_OPAQUE,        /* anything we can't turn into an expression */
+    BODY_RETURN,        /* returns `expr' (0 for `return;') straight away */
+    BODY_FALLTHROUGH,   /* does nothing and falls off the end */
+};
+
+struct inline_body {
+    enum body_shape shape;
+    u32 expr;
+};
+
+struct inliner {
+    struct ast* ast;
+    struct call_graph graph;
+    struct inline_options options;
+    struct inline_report report;
+    struct inline_body* bodies; /* filled in as functions are finished, by function index */
+    i64 growth;                 /* nodes added by inlining so far */
+    i64 limit;                  /* how far `growth' may go */
+    u64 count;                  /* times the statement being looked at ran, with a profile */
+};
+
+static inline enum body_shape body_shape(struct ast* ast, u32 nodeid, u32* expr);
+static inline void count_param_uses(struct ast* ast, u32 nodeid, u32* uses);
+static inline u32 clone_expression(struct ast* ast, u32 nodeid, const u32* args);
+static inline void try_inline(struct inliner* in, u32 call, bool statement);
+static inline void inline_expression(struct inliner* in, u32 nodeid, bool statement);
+static inline void inline_statement(struct inliner* in, u32 nodeid);
+
+u32 inline_cost(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+    u32 cost = 0;
+
+    switch (node.kind) {
+        case NODE_NUMBER:
+        case NODE_PARAMREF:
+        case NODE_DATA:
+            return 1;
+        case NODE_INDEX:
+            /* the check and the load */
+            return 2 + inline_cost(ast, node.index.expr);
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            return 1 + inline_cost(ast, node.binary.lhs) + inline_cost(ast, node.binary.rhs);
+        case NODE_CALL:
+            cost = INLINE_CALL_COST;
+            if (node.call.args == 0) return cost;
+            link = ast->ptr[node.call.args].link;
+            do {
+                cost += 1 + inline_cost(ast, link.ptr);
+            } while (ast_link_advance(ast, &link));
+            return cost;
+        case NODE_RETURN:
+            return 1 + (node.return_stmt.expr ? inline_cost(ast, node.return_stmt.expr) : 0);
+        case NODE_IF:
+            return 1 + inline_cost(ast, node.if_stmt.cond) + inline_cost(ast, node.if_stmt.arms);
+        case NODE_ARMS:
+            return inline_cost(ast, node.arms.then) +
+                   (node.arms.otherwise ? 1 + inline_cost(ast, node.arms.otherwise) : 0);
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return 0;
+            link = node.link;
+            do {
+                cost += inline_cost(ast, link.ptr);
+            } while (ast_link_advance(ast, &link));
+            return cost;
+        default:
+            UNREACHABLE("inline_cost: not a statement or expression");
+    }
+}
+
+static inline enum body_shape body_shape(struct ast* ast, u32 nodeid, u32* expr) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+    enum body_shape shape;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            *expr = node.return_stmt.expr;
+            return BODY_RETURN;
+        case NODE_IF:
+            /* an expression can't branch */
+            return BODY_OPAQUE;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) return BODY_FALLTHROUGH;
+            link = node.link;
+            do {
+                shape = body_shape(ast, link.ptr, expr);
+                if (shape != BODY_FALLTHROUGH) return shape;
+            } while (ast_link_advance(ast, &link));
+            return BODY_FALLTHROUGH;
+        default:
+            return expression_has_effects(ast, nodeid) ? BODY_OPAQUE : BODY_FALLTHROUGH;
+    }
+}
+
+static inline void count_param_uses(struct ast* ast, u32 nodeid, u32* uses) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_PARAMREF:
+            uses[node.param_ref.index]++;
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            count_param_uses(ast, node.binary.lhs, uses);
+            count_param_uses(ast, node.binary.rhs, uses);
+            break;
+        case NODE_INDEX:
+            count_param_uses(ast, ast->ptr[node.index.slice].slice.ptr, uses);
+            count_param_uses(ast, ast->ptr[node.index.slice].slice.len, uses);
+            count_param_uses(ast, node.index.expr, uses);
+            break;
+        case NODE_CALL:
+            if (node.call.args == 0) break;
+            link = ast->ptr[node.call.args].link;
+            do {
+                count_param_uses(ast, link.ptr, uses);
+            } while (ast_link_advance(ast, &link));
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Deep copy of the expression `nodeid'. With `args', parameter references
+ * are replaced by copies of the matching argument instead. The tree may be
+ * reallocated, so nothing here holds on to node pointers.
+ * */
+static inline u32 clone_expression(struct ast* ast, u32 nodeid, const u32* args) {
+    struct node node = ast->ptr[nodeid];
+    struct node_link link;
+    u32 lhs, rhs, head = 0, tail = 0, linkid;
+
+    switch (node.kind) {
+        case NODE_PARAMREF:
+            if (args) return clone_expression(ast, args[node.param_ref.index], NULL);
+            return ast_add_node(ast, node);
+        case NODE_NUMBER:
+        case NODE_DATA:
+            return ast_add_node(ast, node);
+        case NODE_INDEX:
+            lhs = clone_expression(ast, node.index.slice, args);
+            rhs = clone_expression(ast, node.index.expr, args);
+            return ast_add_node(ast, node_create_index(lhs, rhs));
+        case NODE_SLICE:
+            lhs = clone_expression(ast, node.slice.ptr, args);
+            rhs = clone_expression(ast, node.slice.len, args);
+            return ast_add_node(ast, node_create_slice(lhs, rhs));
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            lhs = clone_expression(ast, node.binary.lhs, args);
+            rhs = clone_expression(ast, node.binary.rhs, args);
+            return ast_add_node(ast, node_create_binary(node.kind, lhs, rhs));
+        case NODE_CALL:
+            if (node.call.args != 0) {
+                link = ast->ptr[node.call.args].link;
+                do {
+                    linkid = ast_add_node(ast, node_create_link(clone_expression(ast, link.ptr, args), 0));
+                    if (head == 0) head = linkid;
+                    else ast->ptr[tail].link.next = linkid;
+                    tail = linkid;
+                } while (ast_link_advance(ast, &link));
+            }
+            return ast_add_node(ast, node_create_call(node.call.callee, head));
+        default:
+            UNREACHABLE("clone_expression: not an expression");
+    }
+}
+
+static inline void try_inline(struct inliner* in, u32 call, bool statement) {
+    struct ast* ast = in->ast;
+    struct node node = ast->ptr[call];
+    u32 callee = call_graph_func(&in->graph, node.call.callee);
+    struct call_graph_func func = in->graph.funcs.at[callee];
+    struct inline_body body = in->bodies[callee];
+    u32 args[INLINE_MAX_ARGS];
+    u32 uses[INLINE_MAX_ARGS] = {0};
+    u32 nargs = 0, effects = 0, mark, result = 0;
+    i64 old_cost, new_cost, growth;
+    bool cold = in->options.profile != NULL && in->count == 0;
+    bool hot = in->options.profile != NULL && in->count >= in->options.profile->hot;
+    bool small;
+    struct node_link link;
+
+    if (func.is_extern) return;
+    in->report.sites++;
+
+    if (func.recursive || body.shape == BODY_OPAQUE) return;
+    if (!statement && (body.shape != BODY_RETURN || body.expr == 0)) return;
+
+    if (node.call.args != 0) {
+        link = ast->ptr[node.call.args].link;
+        do {
+            if (nargs >= INLINE_MAX_ARGS) return;
+            args[nargs++] = link.ptr;
+        } while (ast_link_advance(ast, &link));
+    }
+
+    if (body.expr != 0) count_param_uses(ast, body.expr, uses);
+
+    /*
+     * Arguments get substituted where the parameters are used, so one which
+     * has side effects must end up evaluated exactly once, and not reordered
+     * with any other side effect.
+     * */
+    for (u32 i = 0; i < nargs; ++i) {
+        if (!expression_has_effects(ast, args[i])) continue;
+        if (uses[i] != 1) return;
+        effects++;
+    }
+    if (effects > 1 || (effects == 1 && body.expr != 0 && expression_has_effects(ast, body.expr))) return;
+
+    /* inline for real, measure after folding and throw it away if it is too big */
+    mark = (u32)ast->length;
+    old_cost = inline_cost(ast, call);
+
+    if (body.expr != 0) {
+        result = clone_expression(ast, body.expr, args);
+        fold_expression(ast, result);
+        new_cost = statement && !expression_has_effects(ast, result) ? 0 : inline_cost(ast, result);
+    } else {
+        new_cost = 0;
+    }
+
+    growth = new_cost - old_cost;
+    small = new_cost <= in->options.threshold && in->growth + growth <= in->limit;
+    if (growth > 0 && (cold || (!small && !(hot && new_cost <= in->options.threshold * INLINE_HOT_FACTOR)))) {
+        ast->length = mark;
+        return;
+    }
+
+    in->growth += growth;
+    in->report.inlined++;
+    in->report.hot += growth > 0 && !small;
+
+    if (result != 0) {
+        ast->ptr[call] = ast->ptr[result];
+    } else {
+        ast->ptr[call] = node_create_block((struct node_link){0, 0});
+    }
+    ast->ptr[call].id = call;
+
+    if (statement) fold_statement(ast, call);
+}
+
+static inline void inline_expression(struct inliner* in, u32 nodeid, bool statement) {
+    struct node node = in->ast->ptr[nodeid];
+    struct node_link link;
+
+    switch (node.kind) {
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_EQ:
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_LE:
+        case NODE_GT:
+        case NODE_GE:
+            inline_expression(in, node.binary.lhs, false);
+            inline_expression(in, node.binary.rhs, false);
+            break;
+        case NODE_INDEX:
+            inline_expression(in, node.index.expr, false);
+            break;
+        case NODE_CALL:
+            if (node.call.args != 0) {
+                link = in->ast->ptr[node.call.args].link;
+                do {
+                    inline_expression(in, link.ptr, false);
+                } while (ast_link_advance(in->ast, &link));
+            }
+            try_inline(in, nodeid, statement);
+            break;
+        default:
+            break;
+    }
+}
+
+static inline void inline_statement(struct inliner* in, u32 nodeid) {
+    struct node node = in->ast->ptr[nodeid];
+    struct node_link link;
+    u64 count;
+
+    switch (node.kind) {
+        case NODE_RETURN:
+            if (node.return_stmt.expr != 0) inline_expression(in, node.return_stmt.expr, false);
+            break;
+        case NODE_IF:
+            count = in->count;
+            inline_expression(in, node.if_stmt.cond, false);
+            if (in->options.profile != NULL) in->count = profile_taken(in->options.profile, nodeid);
+            inline_statement(in, in->ast->ptr[node.if_stmt.arms].arms.then);
+            if (in->ast->ptr[node.if_stmt.arms].arms.otherwise != 0) {
+                if (in->options.profile != NULL) {
+                    in->count = profile_reached(in->options.profile, nodeid) - in->count;
+                }
+                inline_statement(in, in->ast->ptr[node.if_stmt.arms].arms.otherwise);
+            }
+            in->count = count;
+            break;
+        case NODE_BLOCK:
+            if (node.link.ptr == 0) break;
+            link = node.link;
+            do {
+                inline_statement(in, link.ptr);
+            } while (ast_link_advance(in->ast, &link));
+            break;
+        default:
+            inline_expression(in, nodeid, true);
+            break;
+    }
+}
+
+struct inline_report inline_calls(struct ast* ast, struct inline_options options) {
+    struct inliner in = {
+        .ast = ast,
+        .graph = call_graph_build(ast),
+        .options = options,
+        .report = {0},
+        .bodies = NULL,
+        .growth = 0,
+        .limit = 0,
+        .count = 0,
+    };
+
+    in.bodies = calloc(MAX(in.graph.funcs.length, 1), sizeof(*in.bodies));
+
+    for (usize i = 0; i < in.graph.funcs.length; ++i) {
+        u32 body = ast->ptr[in.graph.funcs.at[i].decl].func_decl.body;
+        if (body != 0) in.report.size_before += inline_cost(ast, body);
+    }
+    in.limit = (i64)in.report.size_before * options.budget / 100;
+
+    for (usize i = 0; i < in.graph.funcs.length; ++i) {
+        u32 f = in.graph.order[i];
+        u32 body = ast->ptr[in.graph.funcs.at[f].decl].func_decl.body;
+
+        if (body == 0) continue;
+
+        if (options.profile != NULL) in.count = profile_entries(options.profile, in.graph.funcs.at[f].decl);
+        if (options.enabled) inline_statement(&in, body);
+        fold_statement(ast, body);
+
+        in.bodies[f].shape = body_shape(ast, body, &in.bodies[f].expr);
+        in.report.size_after += inline_cost(ast, body);
+    }
+
+    free(in.bodies);
+    call_graph_free(&in.graph);
+
+    return in.report;
+}
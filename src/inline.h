@@ -0,0 +1,59 @@
+#ifndef __INLINE_H
+#define __INLINE_H
+
+#include "base.h"
+#include "ast.h"
+#include "profile.h"
+
+/*
+ * Bottom-up function inliner.
+ *
+ * Functions are visited callees first (see callgraph.h), so by the time a
+ * call is considered its callee has already had its own calls inlined and
+ * its constants folded. A call is inlined when the callee's body boils down
+ * to `return expr;' and the folded copy of `expr', with the arguments put in
+ * for the parameters, is cheap enough:
+ *
+ *  - it is never bigger than the call it replaces (trivial wrappers such as
+ *    `func f() i32 { return 42; }'), which is always done, or
+ *  - it is at most `threshold' nodes and the whole translation unit has not
+ *    grown by more than `budget' percent because of inlining so far.
+ *
+ * Recursive functions are never inlined. With a profile, calls which never
+ * ran only get the first kind, and hot ones (see profile.h) may be up to
+ * INLINE_HOT_FACTOR times bigger and don't count against the budget.
+ * */
+
+#define INLINE_THRESHOLD_DEFAULT 24
+#define INLINE_BUDGET_DEFAULT 50
+#define INLINE_HOT_FACTOR 4
+
+struct inline_options {
+    bool enabled;
+    u32 threshold;  /* biggest expression (in nodes) that gets inlined if it grows the code */
+    u32 budget;     /* how much the program may grow, in percent of its size after parsing */
+    const struct profile* profile;  /* with counts from `profile_read', or NULL */
+};
+
+#define INLINE_OPTIONS_DEFAULT (struct inline_options){ \
+    .enabled = true, \
+    .threshold = INLINE_THRESHOLD_DEFAULT, \
+    .budget = INLINE_BUDGET_DEFAULT, \
+    .profile = NULL, \
+}
+
+struct inline_report {
+    u32 sites;      /* calls to functions with a body */
+    u32 inlined;
+    u32 hot;        /* inlined because they are hot, when they were too big otherwise */
+    u32 size_before;
+    u32 size_after;
+};
+
+/* Inlines calls and folds constants in every function. Works on the AST in place */
+struct inline_report inline_calls(struct ast* ast, struct inline_options options);
+
+/* Size of a statement or expression according to the cost model */
+u32 inline_cost(struct ast* ast, u32 nodeid);
+
+#endif  /*__INLINE_H*/
@@ -0,0 +1,132 @@
+#include "layout.h"
+
+static inline u32 align_up(u32 value, u32 align);
+static inline bool optional_param(struct ast* ast, u32 nodeid);
+
+static inline u32 align_up(u32 value, u32 align) {
+    return (value + align - 1) / align * align;
+}
+
+struct layout layout_struct(const struct layout* fields, u32 count, u32* offsets) {
+    struct layout layout = { .size = 0, .align = 1, .kind = LAYOUT_STRUCT };
+
+    for (u32 i = 0; i < count; ++i) {
+        layout.size = align_up(layout.size, fields[i].align);
+        if (offsets != NULL) offsets[i] = layout.size;
+        layout.size += fields[i].size;
+        layout.align = MAX(layout.align, fields[i].align);
+    }
+
+    layout.size = align_up(layout.size, layout.align);
+    return layout;
+}
+
+struct layout layout_of(enum type_kind type) {
+    struct layout parts[2];
+
+    switch (type) {
+        case TYPE_I32:
+            return (struct layout){ .size = 4, .align = 4, .kind = LAYOUT_SCALAR };
+        case TYPE_SLICE:
+            parts[0] = (struct layout){ .size = 8, .align = 8, .kind = LAYOUT_SCALAR };
+            parts[1] = layout_of(TYPE_I32);
+            return layout_struct(parts, 2, NULL);
+        case TYPE_OPT_SLICE:
+            /* `len == -1' */
+            parts[0] = layout_of(TYPE_SLICE);
+            parts[0].kind = LAYOUT_NICHE;
+            return parts[0];
+        case TYPE_OPT_I32:
+            return layout_tagged(type);
+        case TYPE_NONE:
+        case TYPE_VOID:
+        case TYPE_NULL:
+        case __type_kind_count:
+            break;
+    }
+
+    UNREACHABLE("layout_of: a type without values");
+}
+
+struct layout layout_tagged(enum type_kind type) {
+    struct layout parts[2];
+
+    if (layout_payload(type) == TYPE_NONE) return layout_of(type);
+
+    parts[0] = layout_of(layout_payload(type));
+    parts[1] = (struct layout){ .size = 1, .align = 1, .kind = LAYOUT_SCALAR };
+    parts[0] = layout_struct(parts, 2, NULL);
+    parts[0].kind = LAYOUT_TAGGED;
+    return parts[0];
+}
+
+enum type_kind layout_payload(enum type_kind type) {
+    switch (type) {
+        case TYPE_OPT_I32: return TYPE_I32; break;
+        case TYPE_OPT_SLICE: return TYPE_SLICE; break;
+        default: break;
+    }
+
+    return TYPE_NONE;
+}
+
+/* `len < 0' for a slice, `present == 0' with a tag */
+enum node_kind layout_null_test(enum type_kind type, bool is_null) {
+    switch (type) {
+        case TYPE_OPT_SLICE: return is_null ? NODE_LT : NODE_GE; break;
+        case TYPE_OPT_I32: return is_null ? NODE_EQ : NODE_NE; break;
+        default: break;
+    }
+
+    UNREACHABLE("layout_null_test: not an optional");
+}
+
+i64 layout_null_part(enum type_kind type, u32 part) {
+    ASSERT(part < 2);
+
+    switch (type) {
+        case TYPE_OPT_SLICE: return part == 0 ? 0 : -1; break;
+        case TYPE_OPT_I32: return 0; break;
+        default: break;
+    }
+
+    UNREACHABLE("layout_null_part: not an optional");
+}
+
+/* every tag says the same */
+i64 layout_present(enum type_kind type) {
+    UNUSED(type);
+    ASSERT(layout_of(type).kind == LAYOUT_TAGGED);
+    return 1;
+}
+
+static inline bool optional_param(struct ast* ast, u32 nodeid) {
+    struct node node = ast->ptr[nodeid];
+    return node.kind == NODE_PARAM && layout_payload(node.type) != TYPE_NONE;
+}
+
+void layout_report(FILE* out, struct ast* ast) {
+    u32 counts[__type_kind_count] = {0};
+    u32 params = 0, saved = 0;
+    struct layout layout, tagged;
+
+    for (u32 i = 0; i < ast->length; ++i) {
+        if (!optional_param(ast, i)) continue;
+        counts[ast->ptr[i].type]++;
+    }
+
+    fprintf(out, "%-8s %6s %6s %6s %-8s %8s %6s\n", "type", "params", "size", "align", "layout", "tagged", "saved");
+    for (u32 type = 0; type < __type_kind_count; ++type) {
+        if (counts[type] == 0) continue;
+
+        layout = layout_of(type);
+        tagged = layout_tagged(type);
+        params += counts[type];
+        saved += counts[type] * (tagged.size - layout.size);
+
+        fprintf(out, "%-8s %6u %6u %6u %-8s %4u/%-3u %6u\n", type_kind_to_cstr(type), counts[type], layout.size,
+                layout.align, layout.kind == LAYOUT_NICHE ? "niche" : "tagged", tagged.size, tagged.align,
+                tagged.size - layout.size);
+    }
+    fprintf(out, "%u optional parameter(s), %u byte(s) saved by niches\n", params, saved);
+}
@@ -0,0 +1,59 @@
+#ifndef __LAYOUT_H
+#define __LAYOUT_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Memory layout of values.
+ *
+ * Every value is laid out like a C struct of its parts, each part at the
+ * next multiple of its alignment and the whole thing padded to a multiple of
+ * the largest one: a slice is { i32* ptr; i32 len; }, 16 bytes.
+ *
+ * An optional needs one bit pattern of its payload that no value uses to
+ * stand for `null'. When the payload has one, a niche, the optional is
+ * exactly as big as the payload: no slice has a negative length, so a null
+ * `?[]i32' is any slice with `len == -1'. An i32 has no pattern to spare, so
+ * `?i32' is { i32 value; u8 present; }. Either way the optional is passed
+ * around as two parts, and checking for `null' is a single compare of the
+ * second one against 0.
+ * */
+
+enum layout_kind : u8 {
+    LAYOUT_SCALAR,
+    LAYOUT_STRUCT,      /* a slice */
+    LAYOUT_NICHE,       /* an optional, null is a pattern the payload never uses */
+    LAYOUT_TAGGED,      /* an optional, with a byte saying whether it holds a value */
+};
+
+struct layout {
+    u32 size;
+    u32 align;
+    enum layout_kind kind;
+};
+
+/* Lays `fields' out one after the other, writing their offsets when `offsets' is not NULL */
+struct layout layout_struct(const struct layout* fields, u32 count, u32* offsets);
+
+struct layout layout_of(enum type_kind type);
+/* How `type' would be laid out without a niche, the same as `layout_of' for everything but optionals */
+struct layout layout_tagged(enum type_kind type);
+
+/* The payload of an optional type, TYPE_NONE for everything else */
+enum type_kind layout_payload(enum type_kind type);
+
+/*
+ * The comparison of the second part of an optional with 0 which is true when
+ * it is `null' (or with `is_null' false, when it holds a value), and the
+ * value of either part of a `null'.
+ * */
+enum node_kind layout_null_test(enum type_kind type, bool is_null);
+i64 layout_null_part(enum type_kind type, u32 part);
+/* The second part of an optional holding a value which is passed along as one, ignored for niches */
+i64 layout_present(enum type_kind type);
+
+/* Every optional parameter in the program, how big it is and what its niche saves */
+void layout_report(FILE* out, struct ast* ast);
+
+#endif  /*__LAYOUT_H*/
@@ -20,16 +20,42 @@ static inline void make_lexeme(struct lexer* lexer, u32 lexeme_len);
 static inline void make_id(struct lexer* lexer);
 static inline void make_num(struct lexer* lexer);
 
+static inline void lexer_error(struct lexer* lexer, usize start, usize length, const char* msg);
+static inline void make_operator(struct lexer* lexer, enum token_kind one, enum token_kind with_eq);
+static inline u32 digit_value(char c);
+static inline bool is_eight_digits(u64 chunk);
+static inline u64 parse_eight_digits(u64 chunk);
+
 const char* token_kind_to_cstr(enum token_kind kind) {
     switch (kind) {
         case TOK_LPAREN: return "LPAREN"; break;
         case TOK_RPAREN: return "RPAREN"; break;
         case TOK_LCURLY: return "LCURLY"; break;
         case TOK_RCURLY: return "RCURLY"; break;
+        case TOK_LBRACKET: return "LBRACKET"; break;
+        case TOK_RBRACKET: return "RBRACKET"; break;
         case TOK_SEMICOLON: return "SEMICOLON"; break;
+        case TOK_COMMA: return "COMMA"; break;
+        case TOK_QUESTION: return "QUESTION"; break;
+        case TOK_PLUS: return "PLUS"; break;
+        case TOK_MINUS: return "MINUS"; break;
+        case TOK_STAR: return "STAR"; break;
+        case TOK_EQEQ: return "EQEQ"; break;
+        case TOK_NEQ: return "NEQ"; break;
+        case TOK_LT: return "LT"; break;
+        case TOK_LE: return "LE"; break;
+        case TOK_GT: return "GT"; break;
+        case TOK_GE: return "GE"; break;
         case TOK_FUNC: return "FUNC"; break;
+        case TOK_EXTERN: return "EXTERN"; break;
         case TOK_RETURN: return "RETURN"; break;
         case TOK_I32: return "I32"; break;
+        case TOK_VOID: return "VOID"; break;
+        case TOK_IF: return "IF"; break;
+        case TOK_ELSE: return "ELSE"; break;
+        case TOK_NULL: return "NULL"; break;
+        case TOK_COMPTIME: return "COMPTIME"; break;
+        case TOK_EXPORT: return "EXPORT"; break;
         case TOK_ID: return "ID"; break;
         case TOK_NUM: return "NUM"; break;
         case __token_kind_count: break;
@@ -45,7 +71,7 @@ void token_print(struct token token) {
 
 struct lexer lex(struct string program) {
     return (struct lexer){
-        .token = {{0}, 0},
+        .token = {{0}, 0, 0},
         .src = program,
         .src_ptr = 0,
         .eof = false,
@@ -110,6 +136,20 @@ static inline void check_keyword(struct lexer* lexer) {
         lexer->token.kind = TOK_FUNC;
     } else if (string_equal(lexer->token.lexeme, STRING("return"))) {
         lexer->token.kind = TOK_RETURN;
+    } else if (string_equal(lexer->token.lexeme, STRING("void"))) {
+        lexer->token.kind = TOK_VOID;
+    } else if (string_equal(lexer->token.lexeme, STRING("extern"))) {
+        lexer->token.kind = TOK_EXTERN;
+    } else if (string_equal(lexer->token.lexeme, STRING("if"))) {
+        lexer->token.kind = TOK_IF;
+    } else if (string_equal(lexer->token.lexeme, STRING("else"))) {
+        lexer->token.kind = TOK_ELSE;
+    } else if (string_equal(lexer->token.lexeme, STRING("null"))) {
+        lexer->token.kind = TOK_NULL;
+    } else if (string_equal(lexer->token.lexeme, STRING("comptime"))) {
+        lexer->token.kind = TOK_COMPTIME;
+    } else if (string_equal(lexer->token.lexeme, STRING("export"))) {
+        lexer->token.kind = TOK_EXPORT;
     }
 
     return;
@@ -133,15 +173,129 @@ static inline void make_id(struct lexer* lexer) {
     check_keyword(lexer);
 }
 
+/* TASK(251223-031459): Come up with an error scheme for the lexing of the source */
+static inline void lexer_error(struct lexer* lexer, usize start, usize length, const char* msg) {
+    fprintf(stderr, "nomic: error: %s: `%.*s'\n", msg, (i32)length, lexer->src.cstr + start);
+    exit(1);
+}
+
+/* `<' or `<=' and friends. `one' is __token_kind_count when the character needs the `=' */
+static inline void make_operator(struct lexer* lexer, enum token_kind one, enum token_kind with_eq) {
+    usize next = lexer->src_ptr + 1;
+
+    if (next < lexer->src.length && lexer->src.cstr[next] == '=') {
+        lexer->token.kind = with_eq;
+        make_lexeme(lexer, 2);
+        return;
+    }
+
+    if (one == __token_kind_count) lexer_error(lexer, lexer->src_ptr, 1, "unknown operator");
+    lexer->token.kind = one;
+    make_lexeme(lexer, 1);
+}
+
+/* Returns 16 for anything which is not a digit in any of the bases we lex */
+static inline u32 digit_value(char c) {
+    if (c >= '0' && c <= '9') return (u32)(c - '0');
+    if (c >= 'a' && c <= 'f') return (u32)(c - 'a') + 10;
+    if (c >= 'A' && c <= 'F') return (u32)(c - 'A') + 10;
+    return 16;
+}
+
+/*
+ * SWAR decimal parsing: eight ASCII digits loaded as one little-endian u64
+ * are checked and converted with a handful of multiplies instead of eight
+ * dependent multiply-adds.
+ * */
+static inline bool is_eight_digits(u64 chunk) {
+    return ((chunk & 0xf0f0f0f0f0f0f0f0ull) |
+            (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) ==
+            0x3333333333333333ull;
+}
+
+static inline u64 parse_eight_digits(u64 chunk) {
+    const u64 mask = 0x000000ff000000ffull;
+    const u64 mul1 = 100 + (1000000ull << 32);
+    const u64 mul2 = 1 + (10000ull << 32);
+
+    chunk -= 0x3030303030303030ull;
+    chunk = (chunk * 10) + (chunk >> 8);
+    return (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+}
+
+/*
+ * Integer literals are `123', `1_000_000', `0x7f', `0b1010' and `0o17'. The
+ * value is computed right here while the digits are hot and handed to the
+ * parser in `token.number', so nothing has to scan the lexeme a second time.
+ * */
 static inline void make_num(struct lexer* lexer) {
-    usize savepoint = lexer->src_ptr;
-    u32 len = 0;
-    while (is_numeric(peek_char(lexer))) {
-        len++;
-        consume_char(lexer);
+    const char* src = lexer->src.cstr;
+    usize start = lexer->src_ptr;
+    usize end = lexer->src.length;
+    usize i = start;
+    u64 value = 0;
+    u32 base = 10;
+    bool overflow = false;
+    bool digits = false;
+
+    if (src[i] == '0' && i + 1 < end) {
+        switch (src[i + 1]) {
+            case 'x': case 'X': base = 16; i += 2; break;
+            case 'o': case 'O': base = 8;  i += 2; break;
+            case 'b': case 'B': base = 2;  i += 2; break;
+            default: break;
+        }
     }
-    lexer->src_ptr = savepoint;
-    make_lexeme(lexer, len);
+
+    while (i < end) {
+        u64 chunk;
+        u32 digit;
+        char c;
+
+        if (base == 10 && i + 8 <= end) {
+            memcpy(&chunk, src + i, sizeof(chunk));
+            if (is_eight_digits(chunk)) {
+                u64 eight = parse_eight_digits(chunk);
+                if (value > (UINT64_MAX - eight) / 100000000ull) overflow = true;
+                value = value * 100000000ull + eight;
+                digits = true;
+                i += 8;
+                continue;
+            }
+        }
+
+        c = src[i];
+
+        if (c == '_') {
+            /* separators have to sit between two digits */
+            if (!digits || src[i - 1] == '_' || i + 1 >= end || digit_value(src[i + 1]) >= base) {
+                lexer_error(lexer, start, i + 1 - start, "misplaced `_' in integer literal");
+            }
+            i++;
+            continue;
+        }
+
+        digit = digit_value(c);
+        if (digit >= base) break;
+
+        if (value > (UINT64_MAX - digit) / base) overflow = true;
+        value = value * base + digit;
+        digits = true;
+        i++;
+    }
+
+    if (!digits) {
+        lexer_error(lexer, start, i - start, "expected digits in integer literal");
+    }
+    if (i < end && is_alphanumeric(src[i])) {
+        lexer_error(lexer, start, i + 1 - start, "invalid digit in integer literal");
+    }
+    if (overflow) {
+        lexer_error(lexer, start, i - start, "integer literal does not fit in 64 bits");
+    }
+
+    lexer->token.number = value;
+    make_lexeme(lexer, (u32)(i - start));
 }
 
 bool lexer_advance(struct lexer* lexer) {
@@ -173,10 +327,50 @@ bool lexer_advance(struct lexer* lexer) {
             lexer->token.kind = TOK_RCURLY;
             make_lexeme(lexer, 1);
             break;
+        case '[':
+            lexer->token.kind = TOK_LBRACKET;
+            make_lexeme(lexer, 1);
+            break;
+        case ']':
+            lexer->token.kind = TOK_RBRACKET;
+            make_lexeme(lexer, 1);
+            break;
         case ';':
             lexer->token.kind = TOK_SEMICOLON;
             make_lexeme(lexer, 1);
             break;
+        case ',':
+            lexer->token.kind = TOK_COMMA;
+            make_lexeme(lexer, 1);
+            break;
+        case '?':
+            lexer->token.kind = TOK_QUESTION;
+            make_lexeme(lexer, 1);
+            break;
+        case '+':
+            lexer->token.kind = TOK_PLUS;
+            make_lexeme(lexer, 1);
+            break;
+        case '-':
+            lexer->token.kind = TOK_MINUS;
+            make_lexeme(lexer, 1);
+            break;
+        case '*':
+            lexer->token.kind = TOK_STAR;
+            make_lexeme(lexer, 1);
+            break;
+        case '=':
+            make_operator(lexer, __token_kind_count, TOK_EQEQ);
+            break;
+        case '!':
+            make_operator(lexer, __token_kind_count, TOK_NEQ);
+            break;
+        case '<':
+            make_operator(lexer, TOK_LT, TOK_LE);
+            break;
+        case '>':
+            make_operator(lexer, TOK_GT, TOK_GE);
+            break;
         default:
             if (is_alpha(ch)) {
                 lexer->token.kind = TOK_ID;
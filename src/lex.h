@@ -6,16 +6,39 @@
 struct token {
     struct string lexeme;
 
+    /* value of a TOK_NUM, computed by the lexer */
+    u64 number;
+
     enum token_kind : u8 {
         TOK_LPAREN,
         TOK_RPAREN,
         TOK_LCURLY,
         TOK_RCURLY,
+        TOK_LBRACKET,
+        TOK_RBRACKET,
         TOK_SEMICOLON,
+        TOK_COMMA,
+        TOK_QUESTION,
+        TOK_PLUS,
+        TOK_MINUS,
+        TOK_STAR,
+        TOK_EQEQ,
+        TOK_NEQ,
+        TOK_LT,
+        TOK_LE,
+        TOK_GT,
+        TOK_GE,
 
         TOK_FUNC,
+        TOK_EXTERN,
         TOK_RETURN,
         TOK_I32,
+        TOK_VOID,
+        TOK_IF,
+        TOK_ELSE,
+        TOK_NULL,
+        TOK_COMPTIME,
+        TOK_EXPORT,
 
         TOK_ID,
         TOK_NUM,
@@ -5,83 +5,446 @@
 #include "string.h"
 #include "lex.h"
 #include "parser.h"
+#include "callgraph.h"
+#include "inline.h"
+#include "prune.h"
+#include "comptime.h"
+#include "bounds.h"
+#include "layout.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "stats.h"
+#include "codegen.h"
+#include "profile.h"
+#include "server.h"
+#include "cache.h"
 
-/* TASK(251227-124400): Add compilation from files instead of a string */
+struct string read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    char* buf;
+    long length;
 
-#define femit(f, ...) STATEMENT( fprintf(f, __VA_ARGS__); fprintf(f, "\n"); )
+    if (file == NULL) {
+        fprintf(stderr, "nomic: could not open `%s'\n", path);
+        exit(1);
+    }
 
-void emit_return(FILE* file, struct ast* ast, struct node node) {
-    UNUSED(ast);
-    femit(file, "    mov $%ld, %%rax", node.number);
-    femit(file, "    ret");
-}
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
 
-void emit_statement(FILE* file, struct ast* ast, struct node node) {
-    if (node.kind == NODE_RETURN) {
-        emit_return(file, ast, ast->ptr[node.return_stmt.expr]);
+    buf = malloc(length + 1);
+    ASSERT(buf);
+    if (fread(buf, 1, length, file) != (usize)length) {
+        fprintf(stderr, "nomic: could not read `%s'\n", path);
+        exit(1);
     }
-}
-
-void emit_func_decl(FILE* file, struct ast* ast, struct node node) {
-    struct node sym, body;
+    buf[length] = '\0';
 
-    sym = ast->ptr[node.func_decl.symbol];
-    body = ast->ptr[node.func_decl.body];
+    fclose(file);
 
-    femit(file, "%.*s:", (i32)sym.length, sym.str);
+    return STRING_FROM_PARTS(buf, (usize)length);
+}
 
-    emit_statement(file, ast, body);
+static inline f64 seconds_now(void) {
+    return (f64)stats_now().ns * 1e-9;
 }
 
-void code_gen(struct ast* ast) {
-    FILE* outfile = fopen("main.s", "wb");
+/*
+ * Runs `main' over and over, doubling the iteration count until a run takes
+ * long enough to be worth measuring, and reports how many instructions the
+ * interpreter dispatched per second.
+ * */
+void bench_vm(const char* path, struct bc_program* program) {
+    u32 entry = bc_find_func(program, STRING("main"));
+    struct vm vm = vm_create();
+    u64 iterations = 1;
+    f64 elapsed;
 
-    struct node root = ast->ptr[0];
-    femit(outfile, "    .text");
-    femit(outfile, "    .globl main");
+    if (entry == BC_NO_FUNC) {
+        fprintf(stderr, "nomic: `%s' has no main function\n", path);
+        exit(1);
+    }
 
-    struct node_link link = root.link;
-    struct node decl = ast->ptr[link.ptr];
+    while (true) {
+        f64 start = seconds_now();
+        vm.dispatches = 0;
 
-    emit_func_decl(outfile, ast, decl);
+        for (u64 i = 0; i < iterations; ++i) {
+            vm_call(&vm, program, entry);
+        }
 
-    while (link.next != 0) {
-        link = ast->ptr[link.next].link;
-        decl = ast->ptr[link.ptr];
+        if (vm.status != VM_OK) {
+            fprintf(stderr, "nomic: error: interpreter: %s\n", vm_status_to_cstr(vm.status));
+            exit(1);
+        }
 
-        emit_func_decl(outfile, ast, decl);
+        elapsed = seconds_now() - start;
+        if (elapsed >= 0.25) break;
+        iterations *= 2;
     }
 
-    fclose(outfile);
+    printf("%-32s %12lu calls %14lu dispatches %8.3fs %10.2f Mdispatch/s\n",
+           path, iterations, vm.dispatches, elapsed,
+           (f64)vm.dispatches / elapsed / 1e6);
+
+    vm_destroy(&vm);
 }
 
-i32 main(i32 argc, char** argv) {
-    UNUSED(argc);
-    UNUSED(argv);
-    const char src[] = "func main() i32\n"
-                       "    return 42;";
+static i32 compile(i32 argc, char** argv) {
+    const char* path = "main.nomi";
+    bool print_tokens = false;
+    bool print_ast = false;
+    bool interp = false;
+    bool dump_bytecode = false;
+    bool bench = false;
+    bool print_call_graph = false;
+    bool inline_report = false;
+    bool bounds_report_wanted = false;
+    bool bounds_elim = true;
+    bool layout_report_wanted = false;
+    bool generics_report_wanted = false;
+    bool comptime_report_wanted = false;
+    struct comptime_options comptime_options = COMPTIME_OPTIONS_DEFAULT;
+    struct comptime_stats comptime;
+    u32 folded = 0;
+    struct bounds bounds;
+    const char* output = "main.s";
+    struct codegen_options options = CODEGEN_OPTIONS_DEFAULT;
+    struct inline_options inlining = INLINE_OPTIONS_DEFAULT;
+    struct inline_report report;
+    struct prune pruned;
+    bool prune_enabled = true;
+    bool prune_report_wanted = false;
+    struct peephole_stats peephole_stats = {0};
+    bool peephole_report_wanted = false;
+    const char* profile_use = NULL;
+    struct profile profile = {0};
+    const char* cache_dir = getenv("NOMIC_CACHE_DIR");
+    u64 cache_limit = CACHE_LIMIT_DEFAULT;
+    bool cache_stats_wanted = false;
+    bool use_cache;
+    struct cache cache;
+    struct stats_stamp start;
+    i32 exit_code = 0;
 
-    struct string program = STRING_LIT(src);
+    for (i32 i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--print-tokens") == 0) {
+            print_tokens = true;
+        } else if (strcmp(argv[i], "--print-ast") == 0) {
+            print_ast = true;
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            stats.time_passes = true;
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            stats.mem_stats = true;
+        } else if (strcmp(argv[i], "--stats-format=json") == 0) {
+            stats.format = STATS_FORMAT_JSON;
+        } else if (strcmp(argv[i], "--stats-format=table") == 0) {
+            stats.format = STATS_FORMAT_TABLE;
+        } else if (strcmp(argv[i], "--interp") == 0) {
+            interp = true;
+        } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            dump_bytecode = true;
+        } else if (strcmp(argv[i], "--bench-vm") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--call-conv=sysv") == 0) {
+            options.call_conv = CALL_CONV_SYSV;
+        } else if (strcmp(argv[i], "--call-conv=stack") == 0) {
+            options.call_conv = CALL_CONV_STACK;
+        } else if (strcmp(argv[i], "--print-call-graph") == 0) {
+            print_call_graph = true;
+        } else if (strcmp(argv[i], "--no-inline") == 0) {
+            inlining.enabled = false;
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+            inlining.threshold = (u32)strtoul(argv[i] + 19, NULL, 10);
+        } else if (strncmp(argv[i], "--inline-budget=", 16) == 0) {
+            inlining.budget = (u32)strtoul(argv[i] + 16, NULL, 10);
+        } else if (strcmp(argv[i], "--inline-report") == 0) {
+            inline_report = true;
+        } else if (strcmp(argv[i], "--no-prune") == 0) {
+            prune_enabled = false;
+        } else if (strcmp(argv[i], "--prune-report") == 0) {
+            prune_report_wanted = true;
+        } else if (strcmp(argv[i], "--bounds-report") == 0) {
+            bounds_report_wanted = true;
+        } else if (strcmp(argv[i], "--no-bounds-elim") == 0) {
+            bounds_elim = false;
+        } else if (strcmp(argv[i], "--layout-report") == 0) {
+            layout_report_wanted = true;
+        } else if (strcmp(argv[i], "--generics-report") == 0) {
+            generics_report_wanted = true;
+            options.folded = &folded;
+        } else if (strcmp(argv[i], "--no-fold") == 0) {
+            options.fold = false;
+        } else if (strcmp(argv[i], "--comptime-report") == 0) {
+            comptime_report_wanted = true;
+        } else if (strncmp(argv[i], "--comptime-steps=", 17) == 0) {
+            comptime_options.max_steps = strtoull(argv[i] + 17, NULL, 10);
+        } else if (strncmp(argv[i], "--comptime-memory=", 18) == 0) {
+            comptime_options.max_memory = strtoull(argv[i] + 18, NULL, 10);
+        } else if (strcmp(argv[i], "--no-peephole") == 0) {
+            options.peephole = false;
+        } else if (strcmp(argv[i], "--no-tail-calls") == 0) {
+            options.tail_calls = false;
+        } else if (strcmp(argv[i], "--no-layout") == 0) {
+            options.layout = false;
+        } else if (strcmp(argv[i], "--peephole-report") == 0) {
+            peephole_report_wanted = true;
+            options.peephole_stats = &peephole_stats;
+        } else if (strcmp(argv[i], "-fprofile-generate") == 0) {
+            options.instrument = true;
+        } else if (strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+            options.instrument = true;
+            options.profile_path = argv[i] + 19;
+        } else if (strcmp(argv[i], "-fprofile-use") == 0) {
+            profile_use = PROFILE_PATH_DEFAULT;
+        } else if (strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+            profile_use = argv[i] + 14;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            cache_dir = cache_dir_default();
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cache_dir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            cache_dir = NULL;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_limit = strtoull(argv[i] + 13, NULL, 10);
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            cache_stats_wanted = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "nomic: unknown option `%s'\n", argv[i]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
 
-    /* 
-     * TASK(251223-040819): Introduce flags to print various aspects of the
-     * compiler as its running.
-     * */
+    start = stats_begin();
+    struct string program = read_file(path);
+    stats_end(STATS_PHASE_READ, start);
+    stats_items(STATS_PHASE_READ, program.length);
+
+    /* only a run whose one product is the assembly can be answered from the cache */
+    if (cache_dir != NULL && cache_dir[0] == '\0') cache_dir = NULL;
+    use_cache = cache_dir != NULL && !(print_tokens || print_ast || interp || dump_bytecode || bench ||
+                                       print_call_graph || inline_report || prune_report_wanted ||
+                                       bounds_report_wanted || layout_report_wanted || generics_report_wanted ||
+                                       comptime_report_wanted || peephole_report_wanted || stats.time_passes ||
+                                       stats.mem_stats);
+    if (cache_dir != NULL || cache_stats_wanted) {
+        cache = cache_open(cache_dir != NULL ? cache_dir : cache_dir_default(), cache_limit);
+    }
 
-    struct lexer lexer = lex(program);
+    if (use_cache) {
+        cache_key(&cache, program, argc, argv, profile_use);
 
-    while (lexer_advance(&lexer)) {
-        token_print(lexer.token);
+        if (cache_fetch(&cache, output)) {
+            if (cache_stats_wanted) cache_report(stderr, &cache);
+            cache_close(&cache);
+            stats_free();
+            free((void*)program.cstr);
+            return 0;
+        }
     }
 
-    puts("end of input.");
+    /*
+     * The parser pulls tokens on demand, so lexing on its own only happens
+     * when someone wants to look at the tokens or at how long lexing takes.
+     * */
+    if (print_tokens || stats.time_passes) {
+        struct lexer lexer = lex(program);
+
+        start = stats_begin();
+        while (lexer_advance(&lexer)) {
+            if (print_tokens) token_print(lexer.token);
+            stats_items(STATS_PHASE_LEX, 1);
+        }
+        stats_end(STATS_PHASE_LEX, start);
 
+        if (print_tokens) puts("end of input.");
+    }
+
+    start = stats_begin();
     struct ast ast = parse(program);
-    ast_pretty_print(&ast);
+    stats_end(STATS_PHASE_PARSE, start);
+    stats_items(STATS_PHASE_PARSE, ast.length);
+
+    if (layout_report_wanted) layout_report(stderr, &ast);
+
+    /* before anything else looks at the tree, nothing after parsing knows NODE_COMPTIME */
+    start = stats_begin();
+    comptime = comptime_eval(&ast, comptime_options);
+    stats_end(STATS_PHASE_COMPTIME, start);
+    stats_items(STATS_PHASE_COMPTIME, comptime.steps);
+
+    if (comptime_report_wanted) comptime_report(stderr, &comptime);
+
+    /* counters are numbered before inlining moves anything around */
+    if (options.instrument || profile_use != NULL) {
+        profile = profile_number(&ast);
+        options.profile = &profile;
+    }
+    if (profile_use != NULL) {
+        profile_read(&profile, profile_use);
+        inlining.profile = &profile;
+    }
+
+    if (print_call_graph) {
+        struct call_graph graph = call_graph_build(&ast);
+        call_graph_print(&ast, &graph);
+        call_graph_free(&graph);
+    }
+
+    /* constants are folded even when nothing gets inlined */
+    start = stats_begin();
+    report = inline_calls(&ast, inlining);
+    stats_end(STATS_PHASE_INLINE, start);
+    stats_items(STATS_PHASE_INLINE, report.inlined);
+    stats_record_memory("ast", ast.length * sizeof(struct node), ast.capacity * sizeof(struct node));
+
+    if (inline_report) {
+        fprintf(stderr, "inlined %u of %u calls (%u hot), size %u -> %u\n",
+                report.inlined, report.sites, report.hot, report.size_before, report.size_after);
+    }
+
+    /* after inlining, which leaves the functions it inlined everywhere without callers */
+    start = stats_begin();
+    pruned = prune_functions(&ast, prune_enabled);
+    stats_end(STATS_PHASE_PRUNE, start);
+    stats_items(STATS_PHASE_PRUNE, pruned.removed.length);
+
+    if (prune_report_wanted) prune_report(stderr, &ast, &pruned);
 
-    code_gen(&ast);
+    if (print_ast) ast_pretty_print(&ast);
 
-    free(ast.ptr);
+    /* after inlining, which brings the lengths of literals and the checks of callers together */
+    start = stats_begin();
+    bounds = bounds_analyze(&ast, bounds_elim);
+    stats_end(STATS_PHASE_BOUNDS, start);
+    stats_items(STATS_PHASE_BOUNDS, bounds.stats.accesses);
+    options.bounds = &bounds;
+
+    if (bounds_report_wanted) bounds_report(stderr, &bounds);
+
+    if (interp || dump_bytecode || bench) {
+        start = stats_begin();
+        struct bc_program bc = bc_lower(&ast, &bounds);
+        stats_end(STATS_PHASE_BYTECODE, start);
+        stats_items(STATS_PHASE_BYTECODE, bc.code.length);
+        stats_record_memory("bytecode",
+                            bc.code.length * sizeof(bc_inst) + bc.constants.length * sizeof(i64),
+                            bc.code.capacity * sizeof(bc_inst) + bc.constants.capacity * sizeof(i64));
+
+        if (dump_bytecode) bc_print(&bc);
+        if (bench) bench_vm(path, &bc);
+
+        if (interp) {
+            u32 entry = bc_find_func(&bc, STRING("main"));
+            struct vm vm = vm_create();
+            i64 result;
+
+            if (entry == BC_NO_FUNC) {
+                fprintf(stderr, "nomic: `%s' has no main function\n", path);
+                exit_code = 1;
+            } else {
+                start = stats_begin();
+                result = vm_call(&vm, &bc, entry);
+                stats_end(STATS_PHASE_INTERP, start);
+                stats_items(STATS_PHASE_INTERP, vm.dispatches);
+                stats_record_arena("vm stack", &vm.stack);
+                stats_record_arena("vm frames", &vm.frames);
+
+                if (vm.status != VM_OK) {
+                    fprintf(stderr, "nomic: error: interpreter: %s\n", vm_status_to_cstr(vm.status));
+                    exit_code = 1;
+                } else {
+                    printf("main returned %ld\n", result);
+                }
+            }
+
+            vm_destroy(&vm);
+        }
+
+        bc_program_free(&bc);
+    } else {
+        FILE* outfile = fopen(output, "wb");
+
+        if (outfile == NULL) {
+            fprintf(stderr, "nomic: could not open `%s'\n", output);
+            exit(1);
+        }
+
+        start = stats_begin();
+        code_gen(&ast, outfile, options);
+        stats_end(STATS_PHASE_CODEGEN, start);
+
+        if (peephole_report_wanted) peephole_report(stderr, &peephole_stats);
+
+        start = stats_begin();
+        stats_items(STATS_PHASE_OUTPUT, (u64)ftell(outfile));
+        fclose(outfile);
+        stats_end(STATS_PHASE_OUTPUT, start);
+
+        if (use_cache) cache_store(&cache, output);
+    }
+
+    if (generics_report_wanted) {
+        fprintf(stderr, "%u generic call(s), %zu instance(s), %zu from the cache, %u folded\n",
+                ast.generic_calls, ast.instances.length, ast.generic_calls - ast.instances.length, folded);
+    }
+
+    if (cache_dir != NULL || cache_stats_wanted) {
+        if (cache_stats_wanted) cache_report(stderr, &cache);
+        cache_close(&cache);
+    }
+
+    stats_report(stderr);
+    stats_free();
+
+    bounds_free(&bounds);
+    prune_free(&pruned);
+    profile_free(&profile);
+    ast_free(&ast);
+    free((void*)program.cstr);
+
+    return exit_code;
+}
+
+/*
+ * `--server' turns this process into a compile server and `--connect' (or
+ * NOMIC_SERVER) hands the rest of the command line to one, see server.h.
+ * Without a server to talk to we compile right here.
+ * */
+i32 main(i32 argc, char** argv) {
+    char socket[256];
+    const char* serve = NULL;
+    const char* connect = getenv("NOMIC_SERVER");
+    char** args = malloc((argc + 1) * sizeof(char*));
+    i32 nargs = 0, exit_code;
+
+    server_socket_path(socket, sizeof(socket));
+    for (i32 i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--server") == 0) {
+            serve = socket;
+        } else if (strncmp(argv[i], "--server=", 9) == 0) {
+            serve = argv[i] + 9;
+        } else if (strcmp(argv[i], "--connect") == 0) {
+            connect = socket;
+        } else if (strncmp(argv[i], "--connect=", 10) == 0) {
+            connect = argv[i] + 10;
+        } else {
+            args[nargs++] = argv[i];
+        }
+    }
+    args[nargs] = NULL;
+
+    if (serve != NULL) {
+        exit_code = server_run(serve, compile);
+    } else if (connect == NULL || connect[0] == '\0' || !server_forward(connect, nargs, args, &exit_code)) {
+        exit_code = compile(nargs, args);
+    }
 
-    return 0;
+    free(args);
+    return exit_code;
 }
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "layout.h"
 
 static inline struct token curr_token(struct parser* parser) {
     return parser->lexer.token;
@@ -26,17 +27,15 @@ u32 parser_reserve_node(struct parser* parser, enum node_kind kind) {
     return parser_add_node(parser, node);
 }
 
-void parser_append_nodeid_to_link(struct parser* parser, u32 link_node, u32 nodeid) {
+u32 parser_append_nodeid_to_link(struct parser* parser, u32 link_node, u32 nodeid) {
     u32 next_link;
     u32 linkid;
 
     if (parser->nodes.at[link_node].link.ptr == 0) {
         parser->nodes.at[link_node].link = (struct node_link){ nodeid, 0 };
-        return;
+        return link_node;
     }
 
-    next_link = parser->nodes.at[link_node].link.next;
-
     while ((next_link = parser->nodes.at[link_node].link.next) != 0) {
         ASSERT(parser->nodes.at[next_link].kind == NODE_LINK);
         link_node = next_link;
@@ -44,63 +43,483 @@ void parser_append_nodeid_to_link(struct parser* parser, u32 link_node, u32 node
 
     linkid = parser_add_node(parser, node_create_link(nodeid, 0));
     parser->nodes.at[link_node].link.next = linkid;
+    return linkid;
 }
 
 /* TASK(251223-031434): Come up with an error scheme for parsing */
+static inline void parse_error(struct token tok, const char* msg) {
+    fprintf(stderr, "nomic: error: %s, found `%.*s'\n", msg, (i32)tok.lexeme.length, tok.lexeme.cstr);
+    exit(1);
+}
 
+static inline u32 scalar(struct parser* parser, u32 expr);
+static inline u32 null_test(struct parser* parser, enum node_kind kind, u32 lhs, u32 rhs);
+static inline bool narrows(struct parser* parser, u32 cond, u32* index, bool* in_then);
+static inline bool always_returns(struct parser* parser, u32 statement);
 static inline u32 parse_block(struct parser* parser);
-static inline u32 parse_number(struct parser* parser);
+static inline u32 parse_number(struct parser* parser, bool negative);
+static inline u32 parse_len(struct parser* parser);
+static inline u32 parse_call(struct parser* parser, struct token name);
+static inline u32 parse_identifier(struct parser* parser);
+static inline u32 parse_slice_literal(struct parser* parser, bool comptime);
+static inline u32 parse_primary(struct parser* parser);
+static inline u32 parse_postfix(struct parser* parser);
+static inline u32 parse_term(struct parser* parser);
+static inline u32 parse_sum(struct parser* parser);
 static inline u32 parse_expression(struct parser* parser);
 static inline u32 parse_return(struct parser* parser);
+static inline u32 parse_if(struct parser* parser);
 static inline u32 parse_statement(struct parser* parser);
-static inline u32 parse_symbol(struct parser* parser);
-static inline u32 parse_func_decl(struct parser* parser);
+static inline enum type_kind parse_type(struct parser* parser, bool allow_void);
+static inline u32 parse_params(struct parser* parser);
+static inline u32 type_param(const struct generic* generic, struct string name);
+static inline void parse_generic(struct parser* parser, struct string name, bool comptime);
+static inline u32 parse_func_rest(struct parser* parser, u32 sym, bool is_extern, bool comptime);
+static inline u32 parse_func_decl(struct parser* parser, bool is_extern, bool comptime);
 static inline u32 parse_decl(struct parser* parser);
 
+/*
+ * Slices only make sense indexed, passed along or asked for their `len',
+ * optionals passed along or compared with `null', everywhere else an
+ * expression has to be an i32.
+ * */
+static inline u32 scalar(struct parser* parser, u32 expr) {
+    switch (parser->nodes.at[expr].type) {
+        case TYPE_SLICE:
+            fprintf(stderr, "nomic: error: a slice is not a number, index it or take its len()\n");
+            exit(1);
+        case TYPE_OPT_I32:
+        case TYPE_OPT_SLICE:
+        case TYPE_NULL:
+            fprintf(stderr, "nomic: error: an optional is not a value, compare it with null first\n");
+            exit(1);
+        default:
+            return expr;
+    }
+}
+
+/*
+ * `o == null' is a test of the second part of `o' against 0, what the test
+ * is depends on the layout of the optional
+ * */
+static inline u32 null_test(struct parser* parser, enum node_kind kind, u32 lhs, u32 rhs) {
+    struct node optional = parser->nodes.at[lhs];
+    struct node null = parser->nodes.at[rhs];
+
+    if (optional.type == TYPE_NULL) {
+        optional = parser->nodes.at[rhs];
+        null = parser->nodes.at[lhs];
+    }
+    if ((kind != NODE_EQ && kind != NODE_NE) || null.type != TYPE_NULL || layout_payload(optional.type) == TYPE_NONE) {
+        fprintf(stderr, "nomic: error: optionals can only be compared with null, with `==' or `!='\n");
+        exit(1);
+    }
+
+    return parser_add_node(parser, node_create_binary(layout_null_test(optional.type, kind == NODE_EQ),
+                                                      optional.optional.present,
+                                                      parser_add_node(parser, node_create_number(0))));
+}
+
+/*
+ * Whether `cond' is a test of an optional parameter against `null', which
+ * parameter and whether it is known to hold a value in the `then' arm or in
+ * the `else' arm. The second part of an optional can't be named, anything
+ * comparing it with 0 came from `null_test'.
+ * */
+static inline bool narrows(struct parser* parser, u32 cond, u32* index, bool* in_then) {
+    struct node node = parser->nodes.at[cond];
+    struct node lhs, rhs, param;
+    u32 i = 0;
+
+    if (!node_is_compare(node.kind)) return false;
+    lhs = parser->nodes.at[node.binary.lhs];
+    rhs = parser->nodes.at[node.binary.rhs];
+    if (lhs.kind != NODE_PARAMREF || rhs.kind != NODE_NUMBER || rhs.number != 0) return false;
+    if (lhs.param_ref.index == 0 || lhs.param_ref.index > 64) return false;
+
+    for (u32 link = parser->params; link != 0; link = parser->nodes.at[link].link.next, ++i) {
+        if (i + 1 != lhs.param_ref.index) continue;
+
+        param = parser->nodes.at[parser->nodes.at[link].link.ptr];
+        if (layout_payload(param.type) == TYPE_NONE) return false;
+
+        *index = i;
+        if (node.kind == layout_null_test(param.type, false)) *in_then = true;
+        else if (node.kind == layout_null_test(param.type, true)) *in_then = false;
+        else return false;
+        return true;
+    }
+
+    return false;
+}
+
+/* Whether control never gets past `statement', as far as the parser can tell */
+static inline bool always_returns(struct parser* parser, u32 statement) {
+    struct node node = parser->nodes.at[statement];
+    u32 last = 0;
+
+    if (node.kind == NODE_RETURN) return true;
+    if (node.kind != NODE_BLOCK || node.link.ptr == 0) return false;
+
+    for (u32 link = statement; link != 0; link = parser->nodes.at[link].link.next) {
+        last = parser->nodes.at[link].link.ptr;
+    }
+    return always_returns(parser, last);
+}
+
+/* `if o == null return 0;' narrows `o' until the end of the block */
 static inline u32 parse_block(struct parser* parser) {
     u32 block = parser_reserve_node(parser, NODE_BLOCK);
+    u32 tail = block;
+    u64 narrowed = parser->narrowed;
 
     while (!parser->lexer.eof && curr_token(parser).kind != TOK_RCURLY) {
         u32 statement = parse_statement(parser);
-        parser_append_nodeid_to_link(parser, block, statement);
+        tail = parser_append_nodeid_to_link(parser, tail, statement);
     }
 
     if (curr_token(parser).kind == TOK_RCURLY) {
         parser_advance(parser);
     }
 
+    parser->narrowed = narrowed;
     return block;
 }
 
-static inline u32 parse_number(struct parser* parser) {
-    char buf[32] = {0};
+/* 
+ * Expressions leave the parser on the first token after them, statements
+ * on the first token of the next statement.
+ * */
+
+/* With `negative', the literal after a minus, which may go one further down to INT32_MIN */
+static inline u32 parse_number(struct parser* parser, bool negative) {
     struct token tok = curr_token(parser);
     ASSERT(tok.kind == TOK_NUM);
 
-    ASSERT(tok.lexeme.length < 32);
-    memcpy(buf, tok.lexeme.cstr, tok.lexeme.length);
-    i64 num = atoll(buf);
-    return parser_add_node(parser, node_create_number(num));
+    /* i32 is the only integer type there is, so that is what every literal targets */
+    if (tok.number > (u64)INT32_MAX + negative) {
+        fprintf(stderr, "nomic: error: integer literal does not fit in i32: `%.*s'\n",
+                (i32)tok.lexeme.length, tok.lexeme.cstr);
+        exit(1);
+    }
+
+    parser_advance(parser);
+    return parser_add_node(parser, node_create_number(negative ? -(i64)tok.number : (i64)tok.number));
 }
 
-static inline u32 parse_expression(struct parser* parser) {
+/* `len(s)' is the length half of the slice, there is no call */
+static inline u32 parse_len(struct parser* parser) {
+    struct node slice;
+    u32 expr;
+
+    ASSERT(curr_token(parser).kind == TOK_LPAREN);
+    parser_advance(parser);
+
+    /* parsing it can move `nodes', so it is only looked up afterwards */
+    expr = parse_expression(parser);
+    slice = parser->nodes.at[expr];
+    if (slice.type != TYPE_SLICE) {
+        fprintf(stderr, "nomic: error: len() takes a slice\n");
+        exit(1);
+    }
+
+    if (curr_token(parser).kind != TOK_RPAREN) parse_error(curr_token(parser), "expected `)' after the slice");
+    parser_advance(parser);
+
+    return slice.slice.len;
+}
+
+static inline u32 parse_call(struct parser* parser, struct token name) {
+    u32 callee, args = 0, tail = 0;
+
+    if (string_equal(name.lexeme, STRING("len"))) return parse_len(parser);
+
+    callee = parser_add_node(parser, node_create_symbol(name.lexeme.cstr, (u16)name.lexeme.length));
+
+    ASSERT(curr_token(parser).kind == TOK_LPAREN);
+    parser_advance(parser);
+
+    while (curr_token(parser).kind != TOK_RPAREN) {
+        u32 arg = parse_expression(parser);
+        struct node slice = parser->nodes.at[arg];
+
+        /* slices and optionals are passed as their two halves, like the parameters they go to */
+        if (slice.kind == NODE_SLICE || (slice.kind == NODE_OPTIONAL && slice.type != TYPE_NULL)) {
+            arg = slice.kind == NODE_SLICE ? slice.slice.ptr : slice.optional.value;
+            if (args == 0) args = tail = parser_add_node(parser, node_create_link(arg, 0));
+            else tail = parser_append_nodeid_to_link(parser, tail, arg);
+            arg = slice.kind == NODE_SLICE ? slice.slice.len : slice.optional.present;
+        }
+
+        if (args == 0) args = tail = parser_add_node(parser, node_create_link(arg, 0));
+        else tail = parser_append_nodeid_to_link(parser, tail, arg);
+
+        if (curr_token(parser).kind != TOK_COMMA) break;
+        parser_advance(parser);
+    }
+
+    if (curr_token(parser).kind != TOK_RPAREN) parse_error(curr_token(parser), "expected `)' after arguments");
+    parser_advance(parser);
+
+    return parser_add_node(parser, node_create_call(callee, args));
+}
+
+static inline u32 parse_identifier(struct parser* parser) {
     struct token tok = curr_token(parser);
+    struct node ptr;
+    enum type_kind type;
+    u32 index = 0;
+
+    parser_advance(parser);
+
+    if (curr_token(parser).kind == TOK_LPAREN) {
+        /* `if p (7);' has no parentheses around the condition, it reads as a call to `p' */
+        for (u32 link = parser->params; link != 0; link = parser->nodes.at[link].link.next) {
+            struct node param = parser->nodes.at[parser->nodes.at[link].link.ptr];
+            if (string_equal(STRING_FROM_PARTS(param.str, param.length), tok.lexeme)) {
+                parse_error(tok, "call to a non-function");
+            }
+        }
+        return parse_call(parser, tok);
+    }
+
+    /* the only names that can be referenced in an expression are parameters */
+    for (u32 link = parser->params; link != 0; link = parser->nodes.at[link].link.next) {
+        struct node param = parser->nodes.at[parser->nodes.at[link].link.ptr];
+        if (string_equal(STRING_FROM_PARTS(param.str, param.length), tok.lexeme)) {
+            /* past a test against `null' an optional is its payload */
+            type = param.type;
+            if (index < 64 && (parser->narrowed >> index) & 1) type = layout_payload(type);
+
+            if (!type_is_pair(type)) return parser_add_node(parser, node_create_param_ref(index));
+
+            /* the length, or whether there is a value, is the unnamed parameter right after */
+            ptr = node_create_param_ref(index);
+            ptr.type = type;
+            ptr.id = parser_add_node(parser, ptr);
+            if (type == TYPE_SLICE) {
+                return parser_add_node(parser, node_create_slice(ptr.id, parser_add_node(parser,
+                                                                                         node_create_param_ref(index + 1))));
+            }
+            return parser_add_node(parser, node_create_optional(ptr.id, parser_add_node(parser,
+                                                                                        node_create_param_ref(index + 1)),
+                                                                type));
+        }
+        index++;
+    }
+
+    parse_error(tok, "unknown identifier");
+    return PARSE_ERROR;
+}
+
+/*
+ * `[1, -2, 3]', constants only, they go into read-only memory as they are.
+ * With `comptime' in front the elements can be any expression, they are
+ * worked out while compiling and end up in read-only memory all the same.
+ * */
+static inline u32 parse_slice_literal(struct parser* parser, bool comptime) {
+    u32 elems = 0, tail = 0, count = 0, elem;
+    struct token tok;
+    bool negative;
+
+    ASSERT(curr_token(parser).kind == TOK_LBRACKET);
+    parser_advance(parser);
+
+    while (curr_token(parser).kind != TOK_RBRACKET) {
+        /* `comptime [f(0), f(1)]', any expression, computed while compiling */
+        if (comptime) {
+            elem = parser_add_node(parser, node_create_comptime(scalar(parser, parse_expression(parser))));
+            if (elems == 0) elems = tail = parser_add_node(parser, node_create_link(elem, 0));
+            else tail = parser_append_nodeid_to_link(parser, tail, elem);
+            count++;
+
+            if (curr_token(parser).kind != TOK_COMMA) break;
+            parser_advance(parser);
+            continue;
+        }
+
+        negative = curr_token(parser).kind == TOK_MINUS;
+        if (negative) parser_advance(parser);
+
+        tok = curr_token(parser);
+        if (tok.kind != TOK_NUM) parse_error(tok, "slice literals can only hold integer literals");
+
+        elem = parse_number(parser, negative);
+        if (elems == 0) elems = tail = parser_add_node(parser, node_create_link(elem, 0));
+        else tail = parser_append_nodeid_to_link(parser, tail, elem);
+        count++;
+
+        if (curr_token(parser).kind != TOK_COMMA) break;
+        parser_advance(parser);
+    }
+
+    if (curr_token(parser).kind != TOK_RBRACKET) parse_error(curr_token(parser), "expected `]' after the elements");
+    parser_advance(parser);
+
+    return parser_add_node(parser, node_create_slice(parser_add_node(parser, node_create_data(elems, count)),
+                                                     parser_add_node(parser, node_create_number(count))));
+}
+
+static inline u32 parse_primary(struct parser* parser) {
+    struct token tok = curr_token(parser);
+    u32 expression;
+
     if (tok.kind == TOK_NUM) {
-        return parse_number(parser);
+        return parse_number(parser, false);
+    } else if (tok.kind == TOK_ID) {
+        return parse_identifier(parser);
+    } else if (tok.kind == TOK_LBRACKET) {
+        return parse_slice_literal(parser, false);
+    } else if (tok.kind == TOK_COMPTIME) {
+        parser_advance(parser);
+        if (curr_token(parser).kind == TOK_LBRACKET) return parse_slice_literal(parser, true);
+        expression = scalar(parser, parse_postfix(parser));
+        return parser_add_node(parser, node_create_comptime(expression));
+    } else if (tok.kind == TOK_NULL) {
+        parser_advance(parser);
+        return parser_add_node(parser, node_create_optional(0, 0, TYPE_NULL));
+    } else if (tok.kind == TOK_LPAREN) {
+        parser_advance(parser);
+        expression = parse_expression(parser);
+        if (curr_token(parser).kind != TOK_RPAREN) parse_error(curr_token(parser), "expected `)'");
+        parser_advance(parser);
+        return expression;
+    } else if (tok.kind == TOK_MINUS) {
+        /* there is no negate node, `-x' is just `0 - x', and a negative literal is a number of its own */
+        parser_advance(parser);
+        if (curr_token(parser).kind == TOK_NUM) return parse_number(parser, true);
+        expression = scalar(parser, parse_postfix(parser));
+        return parser_add_node(parser, node_create_binary(NODE_SUB,
+                                                          parser_add_node(parser, node_create_number(0)),
+                                                          expression));
+    }
+
+    parse_error(tok, "expected an expression");
+    return PARSE_ERROR;
+}
+
+/* `s[i]', the only postfix operator there is */
+static inline u32 parse_postfix(struct parser* parser) {
+    u32 expression = parse_primary(parser);
+    u32 index;
+
+    while (curr_token(parser).kind == TOK_LBRACKET) {
+        if (parser->nodes.at[expression].type != TYPE_SLICE) {
+            parse_error(curr_token(parser), "only slices can be indexed");
+        }
+
+        parser_advance(parser);
+        index = scalar(parser, parse_expression(parser));
+        if (curr_token(parser).kind != TOK_RBRACKET) parse_error(curr_token(parser), "expected `]' after the index");
+        parser_advance(parser);
+
+        expression = parser_add_node(parser, node_create_index(expression, index));
+    }
+
+    return expression;
+}
+
+static inline u32 parse_term(struct parser* parser) {
+    u32 lhs = parse_postfix(parser);
+
+    while (curr_token(parser).kind == TOK_STAR) {
+        parser_advance(parser);
+        lhs = parser_add_node(parser, node_create_binary(NODE_MUL, scalar(parser, lhs),
+                                                         scalar(parser, parse_postfix(parser))));
     }
 
-    TODO("The rest of them...");
+    return lhs;
+}
+
+static inline u32 parse_sum(struct parser* parser) {
+    u32 lhs = parse_term(parser);
+    enum node_kind kind;
+
+    while (curr_token(parser).kind == TOK_PLUS || curr_token(parser).kind == TOK_MINUS) {
+        kind = curr_token(parser).kind == TOK_PLUS ? NODE_ADD : NODE_SUB;
+        parser_advance(parser);
+        lhs = parser_add_node(parser, node_create_binary(kind, scalar(parser, lhs), scalar(parser, parse_term(parser))));
+    }
+
+    return lhs;
+}
+
+/* Comparisons don't chain, `a < b < c' is an error */
+static inline u32 parse_expression(struct parser* parser) {
+    u32 lhs = parse_sum(parser);
+    u32 rhs;
+    enum node_kind kind;
+
+    switch (curr_token(parser).kind) {
+        case TOK_EQEQ: kind = NODE_EQ; break;
+        case TOK_NEQ: kind = NODE_NE; break;
+        case TOK_LT: kind = NODE_LT; break;
+        case TOK_LE: kind = NODE_LE; break;
+        case TOK_GT: kind = NODE_GT; break;
+        case TOK_GE: kind = NODE_GE; break;
+        default: return lhs;
+    }
+
+    parser_advance(parser);
+    rhs = parse_sum(parser);
+    if (layout_payload(parser->nodes.at[lhs].type) != TYPE_NONE || parser->nodes.at[lhs].type == TYPE_NULL ||
+        layout_payload(parser->nodes.at[rhs].type) != TYPE_NONE || parser->nodes.at[rhs].type == TYPE_NULL) {
+        lhs = null_test(parser, kind, lhs, rhs);
+    } else {
+        lhs = parser_add_node(parser, node_create_binary(kind, scalar(parser, lhs), scalar(parser, rhs)));
+    }
+
+    switch (curr_token(parser).kind) {
+        case TOK_EQEQ: case TOK_NEQ: case TOK_LT: case TOK_LE: case TOK_GT: case TOK_GE:
+            parse_error(curr_token(parser), "comparisons can't be chained");
+            break;
+        default:
+            break;
+    }
+
+    return lhs;
 }
 
 static inline u32 parse_return(struct parser* parser) {
-    u32 expression = parse_expression(parser);
-    if (!parser_expect(parser, TOK_SEMICOLON)) TODO("EXPECTED ';'");
+    u32 expression = 0;
+
+    if (curr_token(parser).kind != TOK_SEMICOLON) expression = scalar(parser, parse_expression(parser));
+    if (curr_token(parser).kind != TOK_SEMICOLON) parse_error(curr_token(parser), "expected `;'");
     parser_advance(parser);
     /* error checking and shit */
     return parser_add_node(parser, 
                            node_create_return(expression));
 }
 
+/*
+ * An optional parameter tested against `null' is its payload in the arm
+ * where it holds a value, and after the `if' when the other arm returns.
+ * */
+static inline u32 parse_if(struct parser* parser) {
+    u32 cond = scalar(parser, parse_expression(parser));
+    u64 narrowed = parser->narrowed;
+    u64 bit = 0;
+    bool in_then = false;
+    u32 index, then, otherwise = 0;
+
+    if (narrows(parser, cond, &index, &in_then)) bit = (u64)1 << index;
+
+    if (in_then) parser->narrowed |= bit;
+    then = parse_statement(parser);
+    parser->narrowed = narrowed;
+
+    if (!parser->lexer.eof && curr_token(parser).kind == TOK_ELSE) {
+        parser_advance(parser);
+        if (!in_then) parser->narrowed |= bit;
+        otherwise = parse_statement(parser);
+        parser->narrowed = narrowed;
+    } else if (!in_then && always_returns(parser, then)) {
+        parser->narrowed |= bit;
+    }
+
+    return parser_add_node(parser, node_create_if(cond, parser_add_node(parser, node_create_arms(then, otherwise))));
+}
+
 static inline u32 parse_statement(struct parser* parser) {
     struct token tok = curr_token(parser);
     if (tok.kind == TOK_LCURLY) {
@@ -109,48 +528,599 @@ static inline u32 parse_statement(struct parser* parser) {
     } else if (tok.kind == TOK_RETURN) {
         parser_advance(parser);
         return parse_return(parser);
+    } else if (tok.kind == TOK_IF) {
+        parser_advance(parser);
+        return parse_if(parser);
+    } else if (tok.kind == TOK_ID || tok.kind == TOK_NUM || tok.kind == TOK_LPAREN || tok.kind == TOK_MINUS ||
+               tok.kind == TOK_LBRACKET || tok.kind == TOK_COMPTIME || tok.kind == TOK_NULL) {
+        u32 expression = scalar(parser, parse_expression(parser));
+        if (curr_token(parser).kind != TOK_SEMICOLON) parse_error(curr_token(parser), "expected `;'");
+        parser_advance(parser);
+        return expression;
     }
 
-    TODO("the rest of them...");
+    parse_error(tok, "expected a statement");
+    return PARSE_ERROR;
 }
 
-static inline u32 parse_symbol(struct parser* parser) {
-    struct token token = curr_token(parser);
-    struct node node = node_create_symbol(token.lexeme.cstr, (u16)token.lexeme.length);
-    return parser_add_node(parser, node);
+/* `void' is only for return types, which can't be slices or optionals */
+static inline enum type_kind parse_type(struct parser* parser, bool allow_void) {
+    struct token tok = curr_token(parser);
+    u32 k;
+
+    /* a type parameter of the generic being instantiated stands for its type argument */
+    if (tok.kind == TOK_ID && parser->generic != NULL && !allow_void &&
+        (k = type_param(parser->generic, tok.lexeme)) < parser->generic->ntypes) {
+        parser_advance(parser);
+        return parser->bindings[k];
+    }
+
+    if (tok.kind == TOK_I32) {
+        parser_advance(parser);
+        return TYPE_I32;
+    } else if (tok.kind == TOK_VOID && allow_void) {
+        parser_advance(parser);
+        return TYPE_VOID;
+    } else if (tok.kind == TOK_LBRACKET && !allow_void) {
+        if (!parser_expect(parser, TOK_RBRACKET)) parse_error(curr_token(parser), "expected `]'");
+        if (!parser_expect(parser, TOK_I32)) parse_error(curr_token(parser), "slices can only hold `i32'");
+        parser_advance(parser);
+        return TYPE_SLICE;
+    } else if (tok.kind == TOK_QUESTION && !allow_void) {
+        parser_advance(parser);
+        if (curr_token(parser).kind == TOK_QUESTION) parse_error(curr_token(parser), "optionals can't be nested");
+        return parse_type(parser, false) == TYPE_SLICE ? TYPE_OPT_SLICE : TYPE_OPT_I32;
+    }
+
+    parse_error(tok, allow_void ? "expected `i32' or `void'" : "expected `i32', `[]i32' or `?'");
+    return TYPE_NONE;
 }
 
-static inline u32 parse_func_decl(struct parser* parser) {
-    u32 sym, body;
+/*
+ * Parameters are `name type', or just `type' when the name is not needed.
+ * A slice is two parameters, the pointer to its first element followed by
+ * an unnamed i32 with its length, which is also how they are passed to C.
+ * An optional is its payload (or the pointer of a slice) followed by the
+ * length or whether there is a value, see layout.h.
+ * */
+static inline u32 parse_params(struct parser* parser) {
+    u32 params = 0;
+    u32 tail = 0;
 
-    if (!parser_expect(parser, TOK_ID))     TODO("EXPECTED IDENTIFIER");
+    ASSERT(curr_token(parser).kind == TOK_LPAREN);
+    parser_advance(parser);
 
-    sym = parse_symbol(parser);
+    while (curr_token(parser).kind != TOK_RPAREN) {
+        struct token name = {0};
+        u32 param;
 
-    if (!parser_expect(parser, TOK_LPAREN)) TODO("EXPECTED '('");
-    if (!parser_expect(parser, TOK_RPAREN)) TODO("EXPECTED ')'");
-    if (!parser_expect(parser, TOK_I32))    TODO("EXPECTED 'i32'");
+        if (curr_token(parser).kind == TOK_ID) {
+            name = curr_token(parser);
+            parser_advance(parser);
+        }
 
+        param = parser_add_node(parser, node_create_param(name.lexeme.cstr, (u16)name.lexeme.length,
+                                                          parse_type(parser, false)));
+
+        if (params == 0) params = tail = parser_add_node(parser, node_create_link(param, 0));
+        else tail = parser_append_nodeid_to_link(parser, tail, param);
+
+        if (type_is_pair(parser->nodes.at[param].type)) {
+            param = parser_add_node(parser, node_create_param(NULL, 0, TYPE_I32));
+            tail = parser_append_nodeid_to_link(parser, tail, param);
+        }
+
+        if (curr_token(parser).kind != TOK_COMMA) break;
+        parser_advance(parser);
+    }
+
+    if (curr_token(parser).kind != TOK_RPAREN) parse_error(curr_token(parser), "expected `)' after parameters");
+    parser_advance(parser);
+
+    return params;
+}
+
+/* The index of the type parameter called `name', `generic->ntypes' when there is none */
+static inline u32 type_param(const struct generic* generic, struct string name) {
+    u32 k = 0;
+    while (k < generic->ntypes && !string_equal(generic->types[k], name)) k++;
+    return k;
+}
+
+/*
+ * `func name[T, U](a T, b []i32) i32 { ... }', from the `['. Type parameters
+ * can only be the whole type of a parameter, which is how their type
+ * arguments are worked out at each call. Only the parameters are looked at,
+ * the return type and the body are checked for every instance, see
+ * `instantiate'.
+ * */
+static inline void parse_generic(struct parser* parser, struct string name, bool comptime) {
+    struct generic generic = {0};
+    struct token tok;
+    u32 depth = 0;
+
+    generic.name = name;
+    generic.comptime = comptime;
+
+    for (usize i = 0; i < parser->generics.length; ++i) {
+        if (string_equal(parser->generics.at[i].name, name)) {
+            fprintf(stderr, "nomic: error: redefinition of `%.*s'\n", (i32)name.length, name.cstr);
+            exit(1);
+        }
+    }
+
+    do {
+        if (!parser_expect(parser, TOK_ID)) parse_error(curr_token(parser), "expected a type parameter");
+        tok = curr_token(parser);
+        if (type_param(&generic, tok.lexeme) < generic.ntypes) parse_error(tok, "duplicate type parameter");
+        if (generic.ntypes == GENERIC_MAX_TYPES) parse_error(tok, "too many type parameters");
+        generic.types[generic.ntypes++] = tok.lexeme;
+    } while (parser_expect(parser, TOK_COMMA));
+
+    if (curr_token(parser).kind != TOK_RBRACKET) parse_error(curr_token(parser), "expected `]' after type parameters");
+    if (!parser_expect(parser, TOK_LPAREN)) parse_error(curr_token(parser), "expected `(' after type parameters");
+
+    generic.at = parser->lexer;
     parser_advance(parser);
 
-    body = parse_statement(parser);
+    while (curr_token(parser).kind != TOK_RPAREN) {
+        u32 k;
 
-    return parser_add_node(parser, node_create_func_decl(sym, body));
+        if (curr_token(parser).kind == TOK_ID) parser_advance(parser);
+        if (generic.nparams == GENERIC_MAX_PARAMS) parse_error(curr_token(parser), "too many parameters");
+
+        tok = curr_token(parser);
+        if (tok.kind == TOK_ID && (k = type_param(&generic, tok.lexeme)) < generic.ntypes) {
+            generic.params[generic.nparams++] = (u8)(GENERIC_TYPE_PARAM | k);
+            parser_advance(parser);
+        } else {
+            generic.params[generic.nparams++] = (u8)parse_type(parser, false);
+        }
+
+        if (curr_token(parser).kind != TOK_COMMA) break;
+        parser_advance(parser);
+    }
+
+    if (curr_token(parser).kind != TOK_RPAREN) parse_error(curr_token(parser), "expected `)' after parameters");
+    parser_advance(parser);
+    parse_type(parser, true);
+
+    if (curr_token(parser).kind != TOK_LCURLY) parse_error(curr_token(parser), "expected the body of a generic function");
+    do {
+        if (curr_token(parser).kind == TOK_LCURLY) depth++;
+        else if (curr_token(parser).kind == TOK_RCURLY) depth--;
+
+        if (depth != 0 && parser->lexer.eof) parse_error(curr_token(parser), "expected `}'");
+        parser_advance(parser);
+    } while (depth != 0);
+
+    DYNARRAY_APPEND(parser->generics, generic);
+}
+
+/* The rest of a function declaration, from the `(' of its parameters */
+static inline u32 parse_func_rest(struct parser* parser, u32 sym, bool is_extern, bool comptime) {
+    u32 params, proto, body = 0, decl;
+    enum type_kind ret;
+
+    params = parse_params(parser);
+    ret = parse_type(parser, true);
+    proto = parser_add_node(parser, node_create_proto(sym, params, ret));
+
+    /* all they can do is come to a value */
+    if (comptime && ret == TYPE_VOID) {
+        fprintf(stderr, "nomic: error: comptime function `%.*s' has to return i32\n",
+                (i32)parser->nodes.at[sym].length, parser->nodes.at[sym].str);
+        exit(1);
+    }
+
+    if (is_extern) {
+        if (curr_token(parser).kind != TOK_SEMICOLON) parse_error(curr_token(parser), "expected `;'");
+        parser_advance(parser);
+    } else {
+        parser->params = params;
+        parser->narrowed = 0;
+        body = parse_statement(parser);
+        parser->params = 0;
+    }
+
+    decl = parser_add_node(parser, node_create_func_decl(proto, body));
+    if (comptime) DYNARRAY_APPEND(parser->comptime, decl);
+    return decl;
+}
+
+/* Returns 0 for generic functions, which only become declarations once they are called */
+static inline u32 parse_func_decl(struct parser* parser, bool is_extern, bool comptime) {
+    struct token name;
+    u32 sym;
+
+    if (!parser_expect(parser, TOK_ID))     TODO("EXPECTED IDENTIFIER");
+
+    name = curr_token(parser);
+    parser_advance(parser);
+
+    if (curr_token(parser).kind == TOK_LBRACKET) {
+        if (is_extern) parse_error(curr_token(parser), "extern functions can't be generic");
+        parse_generic(parser, name.lexeme, comptime);
+        return 0;
+    }
+
+    sym = parser_add_node(parser, node_create_symbol(name.lexeme.cstr, (u16)name.lexeme.length));
+
+    if (curr_token(parser).kind != TOK_LPAREN) TODO("EXPECTED '('");
+
+    return parse_func_rest(parser, sym, is_extern, comptime);
 }
 
 static inline u32 parse_decl(struct parser* parser) {
+    u32 decl;
+
     if (curr_token(parser).kind == TOK_FUNC) {
-        return parse_func_decl(parser);
+        return parse_func_decl(parser, false, false);
+    } else if (curr_token(parser).kind == TOK_EXTERN) {
+        if (!parser_expect(parser, TOK_FUNC)) TODO("EXPECTED 'func'");
+        return parse_func_decl(parser, true, false);
+    } else if (curr_token(parser).kind == TOK_COMPTIME) {
+        if (!parser_expect(parser, TOK_FUNC)) parse_error(curr_token(parser), "expected `func' after `comptime'");
+        return parse_func_decl(parser, false, true);
+    } else if (curr_token(parser).kind == TOK_EXPORT) {
+        if (!parser_expect(parser, TOK_FUNC)) parse_error(curr_token(parser), "expected `func' after `export'");
+        if ((decl = parse_func_decl(parser, false, false)) == 0) {
+            fprintf(stderr, "nomic: error: generic functions can't be exported, only their instances exist\n");
+            exit(1);
+        }
+        DYNARRAY_APPEND(parser->exports, decl);
+        return decl;
     }
 
     TODO("Other declarations");
 }
 
+/*
+ * Calls can refer to functions declared further down, so callees are
+ * resolved in one sweep over the nodes once everything has been parsed. The
+ * functions are found through a small open addressing table keyed by name.
+ * */
+
+struct func_table {
+    u32* at;        /* NODE_FUNCDECL ids, 0 for empty slots */
+    usize capacity; /* always a power of two */
+};
+
+static inline u64 hash_string(struct string str) {
+    return fnv1a(FNV_OFFSET, str.cstr, str.length);
+}
+
+static inline u32* func_table_slot(struct func_table* table, struct ast* ast, struct string name) {
+    usize i = hash_string(name) & (table->capacity - 1);
+
+    while (table->at[i] != 0 && !string_equal(ast_func_name(ast, ast->ptr[table->at[i]]), name)) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+
+    return &table->at[i];
+}
+
+/* Slices and optionals are two elements of the list, but only count once */
+static inline u32 list_arity(struct ast* ast, u32 head) {
+    struct node_link link;
+    u32 arity = 0;
+
+    if (head == 0) return 0;
+
+    link = ast->ptr[head].link;
+    do {
+        arity += !type_is_pair(ast->ptr[link.ptr].type);
+    } while (ast_link_advance(ast, &link));
+
+    return arity;
+}
+
+/* Points the list element `link' at a new NODE_NUMBER, and returns the number */
+static inline u32 set_link_number(struct ast* ast, u32 link, i64 value, enum type_kind type) {
+    struct node number = node_create_number(value);
+
+    number.type = type;
+    number.id = ast_add_node(ast, number);
+    ast->ptr[link].link.ptr = number.id;
+    return number.id;
+}
+
+/* Inserts a new NODE_NUMBER into the list after `link', returns the link holding it */
+static inline u32 insert_link_number(struct ast* ast, u32 link, i64 value) {
+    u32 number = ast_add_node(ast, node_create_number(value));
+    u32 inserted = ast_add_node(ast, node_create_link(number, ast->ptr[link].link.next));
+
+    ast->ptr[link].link.next = inserted;
+    return inserted;
+}
+
+/*
+ * Slices have to go where slices are expected and i32s where i32s are. An
+ * optional takes `null', a value of its payload or an optional of the same
+ * type: `null' becomes its two parts, a payload gets the second part a tag
+ * needs, while a slice with its niche is passed as it is.
+ * */
+static inline void check_args(struct ast* ast, struct node sym, u32 args, u32 params) {
+    enum type_kind want, have;
+    u32 arg, param, position = 1;
+
+    for (arg = args, param = params; arg != 0 && param != 0; position++) {
+        want = ast->ptr[ast->ptr[param].link.ptr].type;
+        have = ast->ptr[ast->ptr[arg].link.ptr].type;
+        if (have == TYPE_NONE) have = TYPE_I32;
+
+        if (have == TYPE_NULL && layout_payload(want) != TYPE_NONE) {
+            set_link_number(ast, arg, layout_null_part(want, 0), want);
+            arg = insert_link_number(ast, arg, layout_null_part(want, 1));
+        } else if (have == layout_payload(want) && layout_of(want).kind == LAYOUT_TAGGED) {
+            arg = insert_link_number(ast, arg, layout_present(want));
+        } else if (have != want && !(have == layout_payload(want) && layout_of(want).kind == LAYOUT_NICHE)) {
+            fprintf(stderr, "nomic: error: argument %u of `%.*s' has to be %s, not %s\n",
+                    position, (i32)sym.length, sym.str, type_kind_to_cstr(want), type_kind_to_cstr(have));
+            exit(1);
+        } else if (type_is_pair(have)) {
+            /* the second part comes right after the first, on both sides */
+            arg = ast->ptr[arg].link.next;
+        }
+
+        if (type_is_pair(want)) param = ast->ptr[param].link.next;
+        arg = ast->ptr[arg].link.next;
+        param = ast->ptr[param].link.next;
+    }
+}
+
+static inline void resolve_calls(struct ast* ast) {
+    struct func_table table = {0};
+    struct node_link link = ast->ptr[0].link;
+    u32 funcs = 0;
+
+    for (u32 i = 0; i < ast->length; ++i) funcs += ast->ptr[i].kind == NODE_FUNCDECL;
+
+    table.capacity = 16;
+    while (table.capacity < funcs * 2) table.capacity *= 2;
+    table.at = calloc(table.capacity, sizeof(*table.at));
+
+    do {
+        struct node decl = ast->ptr[link.ptr];
+        struct string name = ast_func_name(ast, decl);
+        u32* slot = func_table_slot(&table, ast, name);
+
+        if (*slot != 0) {
+            fprintf(stderr, "nomic: error: redefinition of `%.*s'\n", (i32)name.length, name.cstr);
+            exit(1);
+        }
+        *slot = decl.id;
+    } while (ast_link_advance(ast, &link));
+
+    /* `check_args' adds nodes, which moves the tree around */
+    for (u32 i = 0; i < ast->length; ++i) {
+        struct node call = ast->ptr[i];
+        struct node sym, proto;
+        u32 callee;
+
+        if (call.kind != NODE_CALL) continue;
+
+        sym = ast->ptr[call.call.callee];
+        callee = *func_table_slot(&table, ast, STRING_FROM_PARTS(sym.str, sym.length));
+
+        if (callee == 0) {
+            fprintf(stderr, "nomic: error: call to undeclared function `%.*s'\n", (i32)sym.length, sym.str);
+            exit(1);
+        }
+
+        proto = ast_func_proto(ast, ast->ptr[callee]);
+        if (list_arity(ast, call.call.args) != list_arity(ast, proto.proto.params)) {
+            fprintf(stderr, "nomic: error: `%.*s' takes %u argument(s), %u given\n",
+                    (i32)sym.length, sym.str, list_arity(ast, proto.proto.params),
+                    list_arity(ast, call.call.args));
+            exit(1);
+        }
+        check_args(ast, sym, call.call.args, proto.proto.params);
+
+        ast->ptr[i].call.callee = callee;
+    }
+
+    free(table.at);
+}
+
+/*
+ * Generic functions are instantiated once every declaration is in, for the
+ * type arguments of each call, worked out from the types of its arguments.
+ * Instances are cached by generic and type arguments, so every call with the
+ * same ones shares a single declaration. Instances are parsed like any other
+ * function and their own calls to generics come after every node seen so
+ * far, so they are instantiated in the same sweep.
+ * */
+
+static inline u32 find_generic(struct parser* parser, struct string name) {
+    u32 i = 0;
+    while (i < parser->generics.length && !string_equal(parser->generics.at[i].name, name)) i++;
+    return i;
+}
+
+static inline const char* type_mangle(enum type_kind type) {
+    switch (type) {
+        case TYPE_I32: return "i32"; break;
+        case TYPE_SLICE: return "slice"; break;
+        case TYPE_OPT_I32: return "opt_i32"; break;
+        case TYPE_OPT_SLICE: return "opt_slice"; break;
+        default: break;
+    }
+
+    UNREACHABLE("type_mangle: not the type of a value");
+}
+
+/* Fills `types' with the type arguments of a call with `args' */
+static inline void infer_types(struct parser* parser, const struct generic* generic, u32 args, u8* types) {
+    u32 link = args, given = 0;
+    enum type_kind have;
+
+    for (u32 i = 0; i < generic->nparams && link != 0; ++i, ++given) {
+        u32 k = generic->params[i] & ~GENERIC_TYPE_PARAM;
+
+        have = parser->nodes.at[parser->nodes.at[link].link.ptr].type;
+        if (have == TYPE_NONE) have = TYPE_I32;
+
+        if (generic->params[i] & GENERIC_TYPE_PARAM) {
+            if (have == TYPE_NULL) {
+                fprintf(stderr, "nomic: error: can't tell what `%.*s' of `%.*s' is from `null'\n",
+                        (i32)generic->types[k].length, generic->types[k].cstr,
+                        (i32)generic->name.length, generic->name.cstr);
+                exit(1);
+            } else if (types[k] != TYPE_NONE && types[k] != have) {
+                fprintf(stderr, "nomic: error: `%.*s' of `%.*s' is both %s and %s\n",
+                        (i32)generic->types[k].length, generic->types[k].cstr,
+                        (i32)generic->name.length, generic->name.cstr,
+                        type_kind_to_cstr(types[k]), type_kind_to_cstr(have));
+                exit(1);
+            }
+            types[k] = have;
+        }
+
+        link = parser->nodes.at[link].link.next;
+        if (type_is_pair(have) && link != 0) link = parser->nodes.at[link].link.next;
+    }
+
+    for (; link != 0; link = parser->nodes.at[link].link.next) {
+        given += !type_is_pair(parser->nodes.at[parser->nodes.at[link].link.ptr].type);
+    }
+    if (given != generic->nparams) {
+        fprintf(stderr, "nomic: error: `%.*s' takes %u argument(s), %u given\n",
+                (i32)generic->name.length, generic->name.cstr, generic->nparams, given);
+        exit(1);
+    }
+
+    for (u32 k = 0; k < generic->ntypes; ++k) {
+        if (types[k] != TYPE_NONE) continue;
+        fprintf(stderr, "nomic: error: `%.*s' of `%.*s' is not the type of any parameter\n",
+                (i32)generic->types[k].length, generic->types[k].cstr,
+                (i32)generic->name.length, generic->name.cstr);
+        exit(1);
+    }
+}
+
+static inline struct instance_slot* instance_slot(struct instance_cache* cache, u32 generic, const u8* types) {
+    u64 hash = fnv1a(fnv1a(FNV_OFFSET, &generic, sizeof(generic)), types, GENERIC_MAX_TYPES);
+    usize i;
+
+    i = hash & (cache->capacity - 1);
+    while (cache->at[i].symbol != 0 &&
+           (cache->at[i].generic != generic || memcmp(cache->at[i].types, types, GENERIC_MAX_TYPES) != 0)) {
+        i = (i + 1) & (cache->capacity - 1);
+    }
+
+    return &cache->at[i];
+}
+
+static inline void instance_cache_grow(struct instance_cache* cache) {
+    struct instance_cache grown = { .capacity = cache->capacity ? cache->capacity * 2 : 16, .size = cache->size };
+
+    grown.at = calloc(grown.capacity, sizeof(*grown.at));
+    for (usize i = 0; i < cache->capacity; ++i) {
+        if (cache->at[i].symbol == 0) continue;
+        *instance_slot(&grown, cache->at[i].generic, cache->at[i].types) = cache->at[i];
+    }
+
+    free(cache->at);
+    *cache = grown;
+}
+
+/* Parses `generic' again with `types' for its type parameters, and appends the declaration after `*tail' */
+static inline u32 instantiate(struct parser* parser, u32 generic, const u8* types, u32* tail) {
+    const struct generic* g = &parser->generics.at[generic];
+    struct lexer resume = parser->lexer;
+    usize length = g->name.length;
+    u32 sym, decl;
+    char* name;
+
+    for (u32 k = 0; k < g->ntypes; ++k) length += 1 + strlen(type_mangle(types[k]));
+    if (length > UINT16_MAX) {
+        fprintf(stderr, "nomic: error: the name of an instance of `%.*s' is too long\n",
+                (i32)g->name.length, g->name.cstr);
+        exit(1);
+    }
+
+    /* `max.i32', `find.slice.opt_i32' */
+    name = malloc(length + 1);
+    memcpy(name, g->name.cstr, g->name.length);
+    name[g->name.length] = '\0';
+    for (u32 k = 0; k < g->ntypes; ++k) {
+        strcat(name, ".");
+        strcat(name, type_mangle(types[k]));
+    }
+    DYNARRAY_APPEND(parser->names, name);
+
+    sym = parser_add_node(parser, node_create_symbol(name, (u16)length));
+
+    parser->lexer = g->at;
+    parser->generic = g;
+    parser->bindings = types;
+    decl = parse_func_rest(parser, sym, false, g->comptime);
+    parser->lexer = resume;
+    parser->generic = NULL;
+    parser->bindings = NULL;
+
+    *tail = parser_append_nodeid_to_link(parser, *tail, decl);
+    DYNARRAY_APPEND(parser->instances, ((struct ast_instance){ .decl = decl, .generic = generic }));
+    return sym;
+}
+
+static inline void instantiate_generics(struct parser* parser, u32* tail) {
+    struct instance_slot* slot;
+    u32 link = 0;
+
+    if (parser->generics.length == 0) return;
+
+    /* a function can't have the name of a generic one */
+    if (parser->nodes.at[0].link.ptr != 0) do {
+        struct node decl = parser->nodes.at[parser->nodes.at[link].link.ptr];
+        struct node sym = parser->nodes.at[parser->nodes.at[decl.func_decl.proto].proto.symbol];
+
+        if (find_generic(parser, STRING_FROM_PARTS(sym.str, sym.length)) < parser->generics.length) {
+            fprintf(stderr, "nomic: error: redefinition of `%.*s'\n", (i32)sym.length, sym.str);
+            exit(1);
+        }
+    } while ((link = parser->nodes.at[link].link.next) != 0);
+
+    for (u32 i = 0; i < parser->nodes.length; ++i) {
+        struct node call = parser->nodes.at[i];
+        u8 types[GENERIC_MAX_TYPES] = {0};
+        struct node sym;
+        u32 generic;
+
+        if (call.kind != NODE_CALL) continue;
+
+        sym = parser->nodes.at[call.call.callee];
+        generic = find_generic(parser, STRING_FROM_PARTS(sym.str, sym.length));
+        if (generic == parser->generics.length) continue;
+
+        parser->generic_calls++;
+        infer_types(parser, &parser->generics.at[generic], call.call.args, types);
+
+        if (parser->cache.size * 2 >= parser->cache.capacity) instance_cache_grow(&parser->cache);
+        slot = instance_slot(&parser->cache, generic, types);
+        if (slot->symbol == 0) {
+            /* instantiating never touches the cache, `slot' stays put */
+            slot->symbol = instantiate(parser, generic, types, tail);
+            slot->generic = generic;
+            memcpy(slot->types, types, GENERIC_MAX_TYPES);
+            parser->cache.size++;
+        }
+
+        parser->nodes.at[i].call.callee = slot->symbol;
+    }
+
+    free(parser->cache.at);
+    DYNARRAY_FREE(parser->generics);
+}
+
 struct ast parse(struct string src) {
     struct parser parser = {0};
+    struct ast ast;
     parser.lexer = lex(src);
 
     u32 root = parser_reserve_node(&parser, NODE_ROOT);
+    u32 tail = root;
 
     if (!parser_advance(&parser)) {
         /* TASK(251223-032647): Handle the case of an empty source */
@@ -158,8 +1128,19 @@ struct ast parse(struct string src) {
     }
 
     while (!parser.lexer.eof) {
-        parser_append_nodeid_to_link(&parser, root, parse_decl(&parser));
+        u32 decl = parse_decl(&parser);
+        if (decl != 0) tail = parser_append_nodeid_to_link(&parser, tail, decl);
     }
 
-    return ast_from_node_list(parser.nodes);
+    instantiate_generics(&parser, &tail);
+
+    ast = ast_from_node_list(parser.nodes);
+    ast.instances = parser.instances;
+    ast.names = parser.names;
+    ast.generic_calls = parser.generic_calls;
+    ast.comptime = parser.comptime;
+    ast.exports = parser.exports;
+    resolve_calls(&ast);
+
+    return ast;
 }
@@ -12,16 +12,71 @@
  * */
 #define PARSE_ERROR UINT32_MAX
 
+#define GENERIC_MAX_TYPES 4
+#define GENERIC_MAX_PARAMS 16
+/* In `generic.params', a parameter of the `k'th type parameter is GENERIC_TYPE_PARAM | k */
+#define GENERIC_TYPE_PARAM 0x80
+
+/*
+ * `func max[T](a T, b T) i32 { ... }'. Nothing but its signature is looked
+ * at where it is declared. Its parameters and body are parsed again, from
+ * `at', for every set of type arguments it is called with.
+ * */
+struct generic {
+    struct string name;
+    struct lexer at;    /* on the `(' of its parameters */
+    u32 ntypes;
+    struct string types[GENERIC_MAX_TYPES];
+    u32 nparams;
+    u8 params[GENERIC_MAX_PARAMS];  /* an `enum type_kind', or GENERIC_TYPE_PARAM | k */
+    bool comptime;      /* and so are its instances */
+};
+
+struct generics {
+    struct generic* at;
+    DYNARRAY_FIELDS;
+};
+
+/* The instances made so far, by generic and type arguments */
+struct instance_slot {
+    u32 generic;
+    u8 types[GENERIC_MAX_TYPES];
+    u32 symbol;         /* NODE_SYMBOL of the instance, 0 for empty slots */
+};
+
+struct instance_cache {
+    struct instance_slot* at;
+    usize capacity;     /* always a power of two */
+    usize size;
+};
+
 struct parser {
     struct lexer lexer;
     struct node_list nodes;
+    u32 params; /* parameters of the function being parsed, for resolving names */
+    u64 narrowed; /* optional parameters known not to be `null' here, by index */
+
+    struct generics generics;
+    struct instance_cache cache;
+    const struct generic* generic;      /* being instantiated, with these type arguments */
+    const u8* bindings;
+    struct ast_instances instances;     /* handed over to the `struct ast' */
+    struct ast_names names;
+    u32 generic_calls;
+    struct ast_decls comptime;
+    struct ast_decls exports;
 };
 
 bool parser_advance(struct parser* parser);
 bool parser_expect(struct parser* parser, enum token_kind kind);
 u32 parser_add_node(struct parser* parser, struct node node);
 u32 parser_reserve_node(struct parser* parser, enum node_kind kind);
-void parser_append_nodeid_to_link(struct parser* parser, u32 link_node, u32 nodeid);
+/*
+ * Appends `nodeid' to the list starting at (or anywhere in) `link_node' and
+ * returns the node holding the new tail. Passing the previous tail back in
+ * keeps building a list linear instead of walking it on every append.
+ * */
+u32 parser_append_nodeid_to_link(struct parser* parser, u32 link_node, u32 nodeid);
 
 /* TASK(251223-031434): Come up with an error scheme for parsing */
 
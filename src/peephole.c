@@ -0,0 +1,436 @@
+#include "peephole.h"
+#include "dataflow.h"
+#include "stats.h"
+
+struct peephole_rule {
+    const char* name;
+    /*
+     * `window' has `length' instructions, the first one is never an X86_NOP.
+     * `live[k]' has the registers live after `window[k]' as they were at the
+     * start of the pass. Deleting instructions can only leave it too big,
+     * which is safe to act on.
+     * */
+    bool (*apply)(struct x86_inst* window, usize length, const u64* live);
+};
+
+static inline struct x86_inst* next_inst(struct x86_inst* window, usize length);
+static inline bool writes_whole_reg(struct x86_inst inst, enum x86_reg reg);
+static inline bool fits_i32(i64 value);
+static inline bool only_writes_regs(struct x86_inst inst);
+static inline bool ends_block(struct x86_inst inst);
+static inline void liveness(struct x86_insts* insts, u64* live, u32* block_of, struct arena* arena);
+
+static bool rule_dead_code(struct x86_inst* window, usize length, const u64* live);
+static bool rule_jmp_next(struct x86_inst* window, usize length, const u64* live);
+static bool rule_mov_self(struct x86_inst* window, usize length, const u64* live);
+static bool rule_push_pop(struct x86_inst* window, usize length, const u64* live);
+static bool rule_dead_mov(struct x86_inst* window, usize length, const u64* live);
+static bool rule_reload(struct x86_inst* window, usize length, const u64* live);
+static bool rule_merge_imm(struct x86_inst* window, usize length, const u64* live);
+static bool rule_identity(struct x86_inst* window, usize length, const u64* live);
+static bool rule_mov_zero(struct x86_inst* window, usize length, const u64* live);
+static bool rule_dead_def(struct x86_inst* window, usize length, const u64* live);
+static bool rule_retarget(struct x86_inst* window, usize length, const u64* live);
+
+/* Tried in this order at every instruction */
+static const struct peephole_rule rules[] = {
+    { "dead-code", rule_dead_code },    /* anything between a jmp/ret/ud2 and the next label */
+    { "jmp-next", rule_jmp_next },      /* jmp .L1; .L1: */
+    { "mov-self", rule_mov_self },      /* mov %eax, %eax */
+    { "push-pop", rule_push_pop },      /* push x; pop %r -> mov x, %r */
+    { "dead-mov", rule_dead_mov },      /* mov x, %r; mov y, %r -> mov y, %r */
+    { "reload", rule_reload },          /* mov a, b; mov b, a -> mov a, b */
+    { "merge-imm", rule_merge_imm },    /* add $a, %r; sub $b, %r -> add $(a-b), %r */
+    { "identity", rule_identity },      /* add $0, %r and imul $1, %r */
+    { "mov-zero", rule_mov_zero },      /* mov $0, %r -> xor %r, %r */
+    { "dead-def", rule_dead_def },      /* anything only writing dead registers and flags */
+    { "retarget", rule_retarget },      /* lea x, %eax; mov %eax, %r -> lea x, %r, %eax dead after */
+};
+
+#define RULES ARRLENGTH(rules)
+
+/* The instruction after the first one, unless it was just deleted */
+static inline struct x86_inst* next_inst(struct x86_inst* window, usize length) {
+    if (length < 2 || window[1].op == X86_NOP) return NULL;
+    return &window[1];
+}
+
+static inline bool writes_whole_reg(struct x86_inst inst, enum x86_reg reg) {
+    switch (inst.op) {
+        case X86_MOV:
+            /* writing the 32 bit register clears the upper half, so that counts too */
+            return inst.dst.kind == X86_REG && inst.dst.reg == reg && !x86_operand_uses(inst.src, reg);
+        case X86_LEA:
+        case X86_IMUL3:
+        case X86_MOVSXD:
+            return inst.dst.reg == reg && !x86_operand_uses(inst.src, reg);
+        case X86_POP:
+            return inst.dst.reg == reg;
+        case X86_XOR:
+            return inst.dst.kind == X86_REG && inst.dst.reg == reg && x86_operand_equal(inst.src, inst.dst);
+        default:
+            return false;
+    }
+}
+
+static inline bool fits_i32(i64 value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/* Nothing but registers and flags change, deleting it is only a matter of liveness */
+static inline bool only_writes_regs(struct x86_inst inst) {
+    switch (inst.op) {
+        case X86_MOV:
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_IMUL3:
+        case X86_NEG:
+        case X86_LEA:
+        case X86_XOR:
+        case X86_CMP:
+        case X86_TEST:
+        case X86_SETCC:
+        case X86_MOVZX:
+        case X86_MOVSXD:
+            return !x86_operand_is_memory(inst.dst);
+        default:
+            return false;
+    }
+}
+
+static inline bool ends_block(struct x86_inst inst) {
+    return inst.op == X86_JMP || inst.op == X86_JCC || inst.op == X86_RET || inst.op == X86_UD2;
+}
+
+/*
+ * The registers live after every instruction, from liveness over the basic
+ * blocks of the function. Blocks start at every label and after every jump
+ * or return. A register set is a single `X86_REGSET' word.
+ *
+ * The arena is sized on the first pass. Passes only delete instructions, so
+ * there are never more blocks or labels later on.
+ * */
+static inline void liveness(struct x86_insts* insts, u64* live, u32* block_of, struct arena* arena) {
+    struct stats_stamp start = stats_begin();
+    u32* label_block;
+    u64 *uses, *defs;
+    u32 nblocks = 0, first_label = UINT32_MAX, nlabels = 0;
+    usize labels_size;
+    struct cfg cfg;
+    struct dataflow df;
+    struct x86_inst inst;
+    u64 set = 0;
+
+    for (usize i = 0; i < insts->length; ++i) {
+        inst = insts->at[i];
+        if (i == 0 || inst.op == X86_DEFLABEL || ends_block(insts->at[i - 1])) nblocks++;
+        block_of[i] = nblocks - 1;
+        if (inst.op == X86_DEFLABEL) {
+            first_label = MIN(first_label, inst.dst.label);
+            nlabels = MAX(nlabels, inst.dst.label + 1);
+        }
+    }
+
+    /* labels are numbered across the whole file, but a function only jumps to its own */
+    nlabels = nlabels > first_label ? nlabels - first_label : 0;
+    /* rounded up, so that the sets after it stay aligned */
+    labels_size = (nlabels * sizeof(u32) + 7) & ~(usize)7;
+
+    if (arena->capacity == 0) {
+        *arena = arena_create(2 * insts->length * sizeof(u64) + labels_size +
+                              dataflow_arena_size(nblocks, 2 * nblocks, __x86_reg_count + 1));
+    }
+    arena_clear(arena);
+
+    uses = arena_alloc(arena, insts->length * sizeof(u64));
+    defs = arena_alloc(arena, insts->length * sizeof(u64));
+    label_block = arena_alloc(arena, labels_size);
+    for (usize i = 0; i < insts->length; ++i) {
+        if (insts->at[i].op == X86_DEFLABEL) label_block[insts->at[i].dst.label - first_label] = block_of[i];
+    }
+
+    cfg = cfg_create(arena, nblocks, 2 * nblocks);
+    for (usize i = 0; i < insts->length; ++i) {
+        inst = insts->at[i];
+        if (inst.op == X86_JCC || (inst.op == X86_JMP && inst.dst.kind == X86_LABEL)) {
+            cfg_add_edge(&cfg, block_of[i], label_block[inst.dst.label - first_label]);
+        }
+        if (i + 1 < insts->length && block_of[i + 1] != block_of[i] && inst.op != X86_JMP && inst.op != X86_RET &&
+            inst.op != X86_UD2) {
+            cfg_add_edge(&cfg, block_of[i], block_of[i + 1]);
+        }
+    }
+    cfg_finish(&cfg, arena);
+
+    /* returns and calls read what they need, nothing is live past the end */
+    df = dataflow_create(arena, &cfg, DATAFLOW_BACKWARD, DATAFLOW_UNION, __x86_reg_count + 1);
+    for (usize i = insts->length; i-- > 0;) {
+        u64* gen = dataflow_set(&df, df.gen, block_of[i]);
+        u64* kill = dataflow_set(&df, df.kill, block_of[i]);
+        uses[i] = x86_inst_uses(insts->at[i]);
+        defs[i] = x86_inst_defs(insts->at[i]);
+        gen[0] = (gen[0] & ~defs[i]) | uses[i];
+        kill[0] |= defs[i];
+    }
+    dataflow_solve(&df, &cfg);
+
+    for (usize i = insts->length; i-- > 0;) {
+        if (i + 1 == insts->length || block_of[i + 1] != block_of[i]) set = dataflow_set(&df, df.out, block_of[i])[0];
+        live[i] = set;
+        set = (set & ~defs[i]) | uses[i];
+    }
+
+    stats_items(STATS_PHASE_DATAFLOW, df.visits);
+    stats_end(STATS_PHASE_DATAFLOW, start);
+}
+
+static bool rule_dead_code(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    UNUSED(live);
+
+    if (window[0].op != X86_JMP && window[0].op != X86_RET && window[0].op != X86_UD2) return false;
+    if (next == NULL || next->op == X86_DEFLABEL) return false;
+
+    next->op = X86_NOP;
+    return true;
+}
+
+static bool rule_jmp_next(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    UNUSED(live);
+
+    if (window[0].op != X86_JMP || next == NULL || next->op != X86_DEFLABEL) return false;
+    if (window[0].dst.kind != X86_LABEL || window[0].dst.label != next->dst.label) return false;
+
+    window[0].op = X86_NOP;
+    return true;
+}
+
+static bool rule_mov_self(struct x86_inst* window, usize length, const u64* live) {
+    UNUSED(live);
+    UNUSED(length);
+
+    if (window[0].op != X86_MOV) return false;
+    if (window[0].src.kind != X86_REG || window[0].dst.kind != X86_REG) return false;
+    if (window[0].src.reg != window[0].dst.reg) return false;
+
+    window[0].op = X86_NOP;
+    return true;
+}
+
+static bool rule_push_pop(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    struct x86_operand src = window[0].dst;
+    struct x86_operand dst;
+    UNUSED(live);
+
+    if (window[0].op != X86_PUSH || next == NULL || next->op != X86_POP) return false;
+
+    dst = next->dst;
+    window[0].op = X86_NOP;
+
+    if (src.kind == X86_REG && src.reg == dst.reg) {
+        next->op = X86_NOP;
+    } else if (src.kind == X86_IMM) {
+        /* everything is an i32, nobody looks at the upper half */
+        *next = x86_inst2(X86_MOV, src, x86_reg(dst.reg, 4));
+    } else {
+        src.size = 8;
+        *next = x86_inst2(X86_MOV, src, dst);
+    }
+
+    return true;
+}
+
+static bool rule_dead_mov(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    enum x86_reg reg = window[0].dst.reg;
+
+    if (next == NULL || window[0].dst.kind != X86_REG) return false;
+    if (window[0].op != X86_MOV && !(window[0].op == X86_XOR && writes_whole_reg(window[0], reg))) return false;
+    if (!writes_whole_reg(*next, reg)) return false;
+    /* the xor idiom also sets the flags */
+    if (window[0].op == X86_XOR && (live[0] & X86_FLAGS)) return false;
+
+    window[0].op = X86_NOP;
+    return true;
+}
+
+static bool rule_reload(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    struct x86_inst first = window[0];
+    UNUSED(live);
+
+    if (first.op != X86_MOV || next == NULL || next->op != X86_MOV) return false;
+    if (first.src.kind == X86_IMM || x86_operand_uses(first.src, first.dst.reg)) return false;
+    if (first.src.kind != X86_REG && first.dst.kind != X86_REG) return false;
+
+    if (x86_operand_equal(next->src, first.dst) && x86_operand_equal(next->dst, first.src)) {
+        /* mov a, b; mov b, a */
+        next->op = X86_NOP;
+        return true;
+    }
+
+    if (first.src.kind == X86_REG && first.dst.kind == X86_MEM && x86_operand_equal(next->src, first.dst) &&
+        next->dst.kind == X86_REG) {
+        /* mov %r, m; mov m, %r2 -> mov %r, m; mov %r, %r2 */
+        next->src = first.src;
+        next->src.size = next->dst.size;
+        return true;
+    }
+
+    return false;
+}
+
+static bool rule_merge_imm(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    i64 value;
+
+    if (window[0].op != X86_ADD && window[0].op != X86_SUB) return false;
+    if (next == NULL || (next->op != X86_ADD && next->op != X86_SUB)) return false;
+    if (window[0].src.kind != X86_IMM || next->src.kind != X86_IMM) return false;
+    if (window[0].dst.kind != X86_REG || !x86_operand_equal(window[0].dst, next->dst)) return false;
+    /* the flags are those of `next' */
+    if (live[1] & X86_FLAGS) return false;
+
+    value = (window[0].op == X86_ADD ? window[0].src.imm : -window[0].src.imm) +
+            (next->op == X86_ADD ? next->src.imm : -next->src.imm);
+    if (!fits_i32(value)) return false;
+
+    next->op = X86_NOP;
+    if (value == 0) {
+        window[0].op = X86_NOP;
+    } else {
+        window[0].op = value < 0 ? X86_SUB : X86_ADD;
+        window[0].src.imm = value < 0 ? -value : value;
+    }
+
+    return true;
+}
+
+static bool rule_identity(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst inst = window[0];
+    UNUSED(length);
+
+    if (inst.src.kind != X86_IMM || inst.dst.kind != X86_REG) return false;
+    if (!((inst.op == X86_ADD || inst.op == X86_SUB) && inst.src.imm == 0) &&
+        !(inst.op == X86_IMUL && inst.src.imm == 1)) return false;
+    if (live[0] & X86_FLAGS) return false;
+
+    window[0].op = X86_NOP;
+    return true;
+}
+
+static bool rule_mov_zero(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_operand reg = window[0].dst;
+    UNUSED(length);
+
+    if (window[0].op != X86_MOV || window[0].src.kind != X86_IMM || window[0].src.imm != 0) return false;
+    /* xor sets the flags, which may be read further down than the next instruction */
+    if (reg.kind != X86_REG || (live[0] & X86_FLAGS)) return false;
+
+    /* the 32 bit form is shorter and clears the whole register anyway */
+    reg.size = 4;
+    window[0] = x86_inst2(X86_XOR, reg, reg);
+    return true;
+}
+
+static bool rule_dead_def(struct x86_inst* window, usize length, const u64* live) {
+    u64 defs = x86_inst_defs(window[0]);
+    UNUSED(length);
+
+    if (!only_writes_regs(window[0]) || defs == 0 || (defs & live[0]) != 0) return false;
+
+    window[0].op = X86_NOP;
+    return true;
+}
+
+static bool rule_retarget(struct x86_inst* window, usize length, const u64* live) {
+    struct x86_inst* next = next_inst(window, length);
+    struct x86_operand dst = window[0].dst;
+
+    if (window[0].op != X86_MOV && window[0].op != X86_LEA && window[0].op != X86_IMUL3 &&
+        window[0].op != X86_MOVZX) return false;
+    if (next == NULL || next->op != X86_MOV || dst.kind != X86_REG || next->dst.kind != X86_REG) return false;
+    if (!x86_operand_equal(next->src, dst) || next->dst.size != dst.size) return false;
+    if (live[1] & X86_REGSET(dst.reg)) return false;
+
+    /* all of them read their sources before writing the destination */
+    window[0].dst.reg = next->dst.reg;
+    next->op = X86_NOP;
+    return true;
+}
+
+void peephole(struct x86_insts* insts, struct peephole_stats* stats) {
+    bool changed;
+    usize kept;
+    u64* live = malloc(MAX(insts->length, 1) * sizeof(u64));
+    u32* block_of = malloc(MAX(insts->length, 1) * sizeof(u32));
+    struct arena arena = {0};
+
+    ASSERT(RULES <= PEEPHOLE_MAX_RULES);
+
+    if (stats) {
+        for (usize i = 0; i < insts->length; ++i) {
+            stats->size_before += x86_inst_size(insts->at[i]);
+            stats->cycles_before += x86_inst_cycles(insts->at[i]);
+        }
+    }
+
+    do {
+        changed = false;
+        liveness(insts, live, block_of, &arena);
+
+        for (usize i = 0; i < insts->length; ++i) {
+            for (u32 r = 0; r < RULES && insts->at[i].op != X86_NOP; ++r) {
+                if (!rules[r].apply(&insts->at[i], insts->length - i, &live[i])) continue;
+
+                changed = true;
+                if (stats) stats->hits[r]++;
+            }
+        }
+
+        kept = 0;
+        for (usize i = 0; i < insts->length; ++i) {
+            if (insts->at[i].op != X86_NOP) insts->at[kept++] = insts->at[i];
+        }
+        insts->length = kept;
+    } while (changed);
+
+    free(live);
+    free(block_of);
+    arena_destroy(&arena);
+
+    if (stats) {
+        for (usize i = 0; i < insts->length; ++i) {
+            stats->size_after += x86_inst_size(insts->at[i]);
+            stats->cycles_after += x86_inst_cycles(insts->at[i]);
+        }
+    }
+}
+
+u32 peephole_rule_count(void) {
+    return RULES;
+}
+
+const char* peephole_rule_name(u32 rule) {
+    ASSERT(rule < RULES);
+    return rules[rule].name;
+}
+
+static inline f64 percent_change(u64 before, u64 after) {
+    return before ? 100.0 * ((f64)after - (f64)before) / (f64)before : 0.0;
+}
+
+void peephole_report(FILE* out, const struct peephole_stats* stats) {
+    fprintf(out, "%-16s %10s\n", "rule", "hits");
+    for (u32 r = 0; r < RULES; ++r) {
+        fprintf(out, "%-16s %10lu\n", rules[r].name, stats->hits[r]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "%-16s %10lu -> %10lu (%+.1f%%)\n", "size (bytes)",
+            stats->size_before, stats->size_after, percent_change(stats->size_before, stats->size_after));
+    fprintf(out, "%-16s %10lu -> %10lu (%+.1f%%)\n", "cycles",
+            stats->cycles_before, stats->cycles_after, percent_change(stats->cycles_before, stats->cycles_after));
+}
@@ -0,0 +1,36 @@
+#ifndef __PEEPHOLE_H
+#define __PEEPHOLE_H
+
+#include "base.h"
+#include "x86.h"
+
+/*
+ * Peephole optimizer over the instructions of one function.
+ *
+ * Every rule in the table in peephole.c looks at a small window starting at
+ * one instruction and either rewrites it in place or leaves it alone.
+ * Deleted instructions are turned into X86_NOPs and swept out after each
+ * pass, and passes are repeated until no rule fires, so one rewrite can
+ * expose the next. Adding a rule means writing one function and adding a
+ * line to the table.
+ * */
+
+#define PEEPHOLE_MAX_RULES 32
+
+struct peephole_stats {
+    u64 hits[PEEPHOLE_MAX_RULES];   /* per rule, in table order */
+    u64 size_before;                /* estimated bytes of machine code */
+    u64 size_after;
+    u64 cycles_before;              /* estimated cycles, one execution of every instruction */
+    u64 cycles_after;
+};
+
+/* `stats' may be NULL */
+void peephole(struct x86_insts* insts, struct peephole_stats* stats);
+
+u32 peephole_rule_count(void);
+const char* peephole_rule_name(u32 rule);
+
+void peephole_report(FILE* out, const struct peephole_stats* stats);
+
+#endif  /*__PEEPHOLE_H*/
@@ -0,0 +1,114 @@
+#include "profile.h"
+
+static inline void read_exactly(FILE* file, const char* path, void* buf, usize length);
+
+struct profile profile_number(struct ast* ast) {
+    struct profile profile = {
+        .counter_of = malloc(MAX(ast->length, 1) * sizeof(u32)),
+        .nodes = (u32)ast->length,
+        .ncounters = 0,
+        .checksum = FNV_OFFSET,
+        .counts = NULL,
+        .hot = 1,
+    };
+    struct node node;
+    struct string name;
+
+    ASSERT(profile.counter_of);
+
+    for (u32 i = 0; i < profile.nodes; ++i) {
+        node = ast->ptr[i];
+        profile.counter_of[i] = PROFILE_NO_COUNTER;
+
+        if (node.kind == NODE_FUNCDECL && node.func_decl.body != 0) {
+            name = ast_func_name(ast, node);
+            profile.checksum = fnv1a(profile.checksum, name.cstr, name.length);
+            profile.counter_of[i] = profile.ncounters;
+            profile.ncounters += 1;
+        } else if (node.kind == NODE_IF) {
+            /* reached, then the `then' arm */
+            profile.counter_of[i] = profile.ncounters;
+            profile.ncounters += 2;
+        } else {
+            continue;
+        }
+
+        /* where the counters are, an `if' moving around is a different program */
+        profile.checksum = fnv1a(profile.checksum, &node.kind, sizeof(node.kind));
+        profile.checksum = fnv1a(profile.checksum, &i, sizeof(i));
+    }
+
+    return profile;
+}
+
+static inline void read_exactly(FILE* file, const char* path, void* buf, usize length) {
+    if (fread(buf, 1, length, file) == length) return;
+
+    fprintf(stderr, "nomic: error: profile `%s' is truncated\n", path);
+    exit(1);
+}
+
+void profile_read(struct profile* profile, const char* path) {
+    FILE* file = fopen(path, "rb");
+    char magic[sizeof(PROFILE_MAGIC) - 1];
+    u64 checksum, ncounters, max = 0;
+
+    if (file == NULL) {
+        fprintf(stderr, "nomic: error: could not open profile `%s'\n", path);
+        exit(1);
+    }
+
+    read_exactly(file, path, magic, sizeof(magic));
+    if (memcmp(magic, PROFILE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "nomic: error: `%s' is not a nomi profile\n", path);
+        exit(1);
+    }
+
+    read_exactly(file, path, &checksum, sizeof(checksum));
+    read_exactly(file, path, &ncounters, sizeof(ncounters));
+    if (checksum != profile->checksum || ncounters != profile->ncounters) {
+        fprintf(stderr, "nomic: error: profile `%s' is for a different program, "
+                        "build with -fprofile-generate and run it again\n", path);
+        exit(1);
+    }
+
+    profile->counts = malloc(MAX(profile->ncounters, 1) * sizeof(u64));
+    ASSERT(profile->counts);
+    read_exactly(file, path, profile->counts, profile->ncounters * sizeof(u64));
+    fclose(file);
+
+    for (u32 i = 0; i < profile->ncounters; ++i) {
+        max = MAX(max, profile->counts[i]);
+    }
+    profile->hot = MAX(max / PROFILE_HOT_FRACTION, 1);
+}
+
+void profile_free(struct profile* profile) {
+    free(profile->counter_of);
+    free(profile->counts);
+    profile->counter_of = NULL;
+    profile->counts = NULL;
+}
+
+u32 profile_counter(const struct profile* profile, u32 nodeid) {
+    if (nodeid >= profile->nodes) return PROFILE_NO_COUNTER;
+    return profile->counter_of[nodeid];
+}
+
+u64 profile_entries(const struct profile* profile, u32 decl) {
+    u32 counter = profile_counter(profile, decl);
+    if (profile->counts == NULL || counter == PROFILE_NO_COUNTER) return 0;
+    return profile->counts[counter];
+}
+
+u64 profile_reached(const struct profile* profile, u32 ifid) {
+    u32 counter = profile_counter(profile, ifid);
+    if (profile->counts == NULL || counter == PROFILE_NO_COUNTER) return 0;
+    return profile->counts[counter];
+}
+
+u64 profile_taken(const struct profile* profile, u32 ifid) {
+    u32 counter = profile_counter(profile, ifid);
+    if (profile->counts == NULL || counter == PROFILE_NO_COUNTER) return 0;
+    return profile->counts[counter + 1];
+}
@@ -0,0 +1,63 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Execution profiles
+ *
+ * With -fprofile-generate the backend counts, in 64 bit counters in the
+ * program's .data, how often every function is entered and, for every `if',
+ * how often it is reached and how often its `then' arm runs. The program
+ * writes them to the profile file when `main' returns or it calls `exit' or
+ * `_exit'; every run overwrites the file. With -fprofile-use the counts are
+ * read back and steer the inliner, the order of the arms of every `if' and
+ * the order of the functions in the output.
+ *
+ * Counters are numbered right after parsing, in node id order, so both
+ * builds agree on them as long as the source is the same. Passes after that
+ * only add nodes or rewrite them in place, node ids past `nodes' simply have
+ * no counter. The checksum covers the names of the functions and the node
+ * ids the counters belong to, a profile of some other program is refused.
+ *
+ * The file is
+ *
+ *     "NOMIPROF" | checksum u64 | ncounters u64 | ncounters u64 counts
+ *
+ * in the byte order of the machine, exactly the layout of the data the
+ * instrumented program writes out.
+ * */
+
+#define PROFILE_MAGIC "NOMIPROF"
+#define PROFILE_HEADER_SIZE 24
+#define PROFILE_PATH_DEFAULT "nomi.profile"
+#define PROFILE_NO_COUNTER UINT32_MAX
+
+/* Sites run at least 1/PROFILE_HOT_FRACTION as often as the hottest counter are hot */
+#define PROFILE_HOT_FRACTION 64
+
+struct profile {
+    u32* counter_of;    /* by node id: the first counter of a NODE_FUNCDECL or NODE_IF */
+    u32 nodes;          /* length of `counter_of' */
+    u32 ncounters;
+    u64 checksum;
+    u64* counts;        /* NULL until `profile_read' */
+    u64 hot;            /* counts from here up are hot */
+};
+
+/* Numbers the counters of `ast', which has to come straight from the parser */
+struct profile profile_number(struct ast* ast);
+/* Reads the counts from `path', exits with an error when they don't belong to this program */
+void profile_read(struct profile* profile, const char* path);
+void profile_free(struct profile* profile);
+
+/* The counter of a function's entries or of the times an `if' is reached, PROFILE_NO_COUNTER if none */
+u32 profile_counter(const struct profile* profile, u32 nodeid);
+
+/* Counts from `profile_read', 0 for nodes without counters */
+u64 profile_entries(const struct profile* profile, u32 decl);
+u64 profile_reached(const struct profile* profile, u32 ifid);
+u64 profile_taken(const struct profile* profile, u32 ifid);
+
+#endif  /*__PROFILE_H*/
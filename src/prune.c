@@ -0,0 +1,168 @@
+#include "prune.h"
+#include "callgraph.h"
+
+static inline u32 count_nodes(struct ast* ast, u32 nodeid, bool* seen);
+static inline void unlink_decls(struct ast* ast, const bool* dead);
+
+bool prune_is_root(struct ast* ast, u32 decl) {
+    if (string_equal(ast_func_name(ast, ast->ptr[decl]), STRING("main"))) return true;
+
+    for (usize i = 0; i < ast->exports.length; ++i) {
+        if (ast->exports.at[i] == decl) return true;
+    }
+    return false;
+}
+
+/* Nodes only reachable from `nodeid', every one counted once, callees are functions of their own */
+static inline u32 count_nodes(struct ast* ast, u32 nodeid, bool* seen) {
+    struct node node;
+    u32 count;
+
+    if (nodeid == 0 || seen[nodeid]) return 0;
+    seen[nodeid] = true;
+    node = ast->ptr[nodeid];
+
+    switch (node.kind) {
+        case NODE_FUNCDECL:
+            return 1 + count_nodes(ast, node.func_decl.proto, seen) + count_nodes(ast, node.func_decl.body, seen);
+        case NODE_PROTO:
+            return 1 + count_nodes(ast, node.proto.symbol, seen) + count_nodes(ast, node.proto.params, seen);
+        case NODE_LINK:
+        case NODE_BLOCK:
+            /* along the list rather than down it, blocks can be long */
+            count = 1 + count_nodes(ast, node.link.ptr, seen);
+            for (u32 next = node.link.next; next != 0 && !seen[next]; next = ast->ptr[next].link.next) {
+                seen[next] = true;
+                count += 1 + count_nodes(ast, ast->ptr[next].link.ptr, seen);
+            }
+            return count;
+        case NODE_RETURN:
+            return 1 + count_nodes(ast, node.return_stmt.expr, seen);
+        case NODE_CALL:
+            return 1 + count_nodes(ast, node.call.args, seen);
+        case NODE_IF:
+            return 1 + count_nodes(ast, node.if_stmt.cond, seen) + count_nodes(ast, node.if_stmt.arms, seen);
+        case NODE_ARMS:
+            return 1 + count_nodes(ast, node.arms.then, seen) + count_nodes(ast, node.arms.otherwise, seen);
+        case NODE_INDEX:
+            return 1 + count_nodes(ast, node.index.slice, seen) + count_nodes(ast, node.index.expr, seen);
+        case NODE_SLICE:
+            return 1 + count_nodes(ast, node.slice.ptr, seen) + count_nodes(ast, node.slice.len, seen);
+        case NODE_DATA:
+            return 1 + count_nodes(ast, node.data.elems, seen);
+        case NODE_OPTIONAL:
+            return 1 + count_nodes(ast, node.optional.value, seen) + count_nodes(ast, node.optional.present, seen);
+        case NODE_COMPTIME:
+            return 1 + count_nodes(ast, node.comptime.expr, seen);
+        default:
+            if (node_is_binary(node.kind)) {
+                return 1 + count_nodes(ast, node.binary.lhs, seen) + count_nodes(ast, node.binary.rhs, seen);
+            }
+            return 1;
+    }
+}
+
+/*
+ * Takes the dead declarations out of the root list. An element goes by
+ * pulling the next one into the node holding it, the last one by ending
+ * the list at the one before.
+ * */
+static inline void unlink_decls(struct ast* ast, const bool* dead) {
+    u32 holder = 0, prev = 0;
+    bool first = true;
+    struct node_link link;
+
+    while (true) {
+        link = ast->ptr[holder].link;
+
+        if (link.ptr != 0 && dead[link.ptr]) {
+            if (link.next != 0) {
+                ast->ptr[holder].link = ast->ptr[link.next].link;
+                continue;
+            }
+
+            if (first) ast->ptr[holder].link = (struct node_link){0};
+            else ast->ptr[prev].link.next = 0;
+            return;
+        }
+
+        if (link.next == 0) return;
+        prev = holder;
+        holder = link.next;
+        first = false;
+    }
+}
+
+struct prune prune_functions(struct ast* ast, bool enabled) {
+    struct prune prune = {0};
+    struct call_graph graph = call_graph_build(ast);
+    u32 nfuncs = (u32)graph.funcs.length;
+    bool* reached = calloc(MAX(nfuncs, 1), sizeof(*reached));
+    u32* queue = malloc(MAX(nfuncs, 1) * sizeof(*queue));
+    u32 head = 0, tail = 0;
+    const struct call_graph_func* func;
+    bool *dead, *seen;
+
+    for (u32 f = 0; f < nfuncs; ++f) {
+        func = &graph.funcs.at[f];
+        if (func->is_extern) continue;
+
+        prune.funcs++;
+        if (prune_is_root(ast, func->decl)) {
+            reached[f] = true;
+            queue[tail++] = f;
+        }
+    }
+
+    /* with nothing to start from, everything stays */
+    if (enabled && tail > 0) {
+        while (head < tail) {
+            func = &graph.funcs.at[queue[head++]];
+            for (u32 s = func->sites; s < func->sites + func->nsites; ++s) {
+                u32 callee = graph.sites.at[s].callee;
+                if (reached[callee]) continue;
+
+                reached[callee] = true;
+                queue[tail++] = callee;
+            }
+        }
+
+        for (u32 f = 0; f < nfuncs; ++f) {
+            if (!reached[f] && !graph.funcs.at[f].is_extern) DYNARRAY_APPEND(prune.removed, graph.funcs.at[f].decl);
+        }
+    }
+
+    if (prune.removed.length > 0) {
+        dead = calloc(ast->length, sizeof(*dead));
+        seen = calloc(ast->length, sizeof(*seen));
+
+        for (usize i = 0; i < prune.removed.length; ++i) {
+            dead[prune.removed.at[i]] = true;
+            prune.nodes += count_nodes(ast, prune.removed.at[i], seen);
+        }
+        unlink_decls(ast, dead);
+
+        free(dead);
+        free(seen);
+    }
+
+    free(reached);
+    free(queue);
+    call_graph_free(&graph);
+    return prune;
+}
+
+void prune_free(struct prune* prune) {
+    DYNARRAY_FREE(prune->removed);
+}
+
+void prune_report(FILE* out, struct ast* ast, const struct prune* prune) {
+    struct string name;
+
+    for (usize i = 0; i < prune->removed.length; ++i) {
+        name = ast_func_name(ast, ast->ptr[prune->removed.at[i]]);
+        fprintf(out, "removed %.*s\n", (i32)name.length, name.cstr);
+    }
+    fprintf(out, "%zu of %u function(s) removed, %u node(s), %zu byte(s) of tree\n", prune->removed.length,
+            prune->funcs, prune->nodes, prune->nodes * sizeof(struct node));
+}
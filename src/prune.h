@@ -0,0 +1,37 @@
+#ifndef __PRUNE_H
+#define __PRUNE_H
+
+#include "base.h"
+#include "ast.h"
+
+/*
+ * Dead function elimination.
+ *
+ * A program starts at `main', and anything linked against it can only come
+ * in through the functions declared `export'. Whatever can't be reached by
+ * calls from those is unlinked from the list of declarations, so that bounds
+ * analysis, the interpreter and code generation never look at it and it
+ * takes no room in the output. The pass runs on the call graph after
+ * inlining, so functions which were inlined everywhere go too, along with
+ * `comptime' functions which were only ever called while compiling.
+ *
+ * A file with neither `main' nor exports is a library nobody said anything
+ * about, and keeps every function.
+ * */
+
+struct prune {
+    u32 funcs;              /* with a body, before */
+    u32 nodes;              /* in the functions removed */
+    struct ast_decls removed;   /* NODE_FUNCDECLs, in declaration order */
+};
+
+/* Removes the functions nothing reaches, with `enabled' false only counts the ones there are */
+struct prune prune_functions(struct ast* ast, bool enabled);
+void prune_free(struct prune* prune);
+
+void prune_report(FILE* out, struct ast* ast, const struct prune* prune);
+
+/* `main' or declared `export', where calls from outside the file come in */
+bool prune_is_root(struct ast* ast, u32 decl);
+
+#endif  /*__PRUNE_H*/
@@ -0,0 +1,72 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+
+#include "base.h"
+
+/*
+ * Compile server.
+ *
+ * `nomic --server' stays up, listening on a Unix domain socket, and `nomic
+ * --connect' (or any nomic run with NOMIC_SERVER set to the socket) hands it
+ * its command line and working directory instead of compiling itself. When
+ * nobody is listening the client just compiles.
+ *
+ * The server remembers what every compile produced: the output file, what
+ * went to stdout and stderr and the exit code. They are keyed by a hash of
+ * the flags and of the contents of the source (and of the profile with
+ * -fprofile-use), so a build asking for the same thing again gets it back
+ * without any work, and an edited file simply misses. The flags and the
+ * contents are kept with the entry and compared in full on a hit, so two
+ * compiles whose hashes collide never get each other's output. The least recently
+ * used results go once they add up to more than SERVER_CACHE_LIMIT bytes.
+ *
+ * Everything else runs in a child forked from the server, which saves
+ * starting a process but above all keeps the server up: the compiler exits
+ * on the first error. The child's stdout and stderr go to temporary files
+ * which are sent back. Requests are served one at a time. Runs whose output
+ * changes every time (--bench-vm, --time-passes, --mem-stats, --cache-stats)
+ * are never kept.
+ *
+ * Only the user the server runs as is served, whoever else connects is
+ * dropped, and the client in turn only talks to a server of its own user.
+ * The socket goes in $XDG_RUNTIME_DIR, or else in a directory under /tmp
+ * which the server creates for the user. Either way the directory has to
+ * belong to the user and be closed to everyone else, or the server won't
+ * listen in it. A client which doesn't get its request across within
+ * SERVER_TIMEOUT seconds is dropped as well, it would hold up everyone
+ * after it.
+ *
+ * What was asked for was more than this: a server holding on to the interned
+ * strings, the parsed ASTs, the type tables and the machine code of every
+ * function, so that editing one function only redoes that function. That is
+ * not what it does. Inlining, pruning, layout and the folding of generics all
+ * look at the whole program, so one changed function can change the code of
+ * any other, and machine code kept per function can't be trusted. The server
+ * therefore keeps only whole outputs, and a file with any edit in it goes
+ * through the front end and the back end again from the start, in a fresh
+ * child. What it does save is starting the process and compiling again what
+ * hasn't changed at all.
+ *
+ * A request is the number of strings that follow, then the working directory
+ * and the arguments. The reply is the exit code, then stdout and stderr.
+ * Numbers are u32 and strings are a u32 length followed by the bytes, in the
+ * byte order of the machine.
+ * */
+
+#define SERVER_SOCKET_NAME "nomic.sock"
+#define SERVER_DIR_FORMAT "/tmp/nomic-%u"       /* by user id, without XDG_RUNTIME_DIR */
+#define SERVER_TIMEOUT 10                       /* seconds */
+#define SERVER_CACHE_LIMIT MEGABYTES(256)
+#define SERVER_MAX_STRINGS 4096                 /* in a request, the working directory and the arguments */
+#define SERVER_MAX_STRING KILOBYTES(64)         /* one of them */
+
+/* The socket of the current user's server, in XDG_RUNTIME_DIR or SERVER_DIR_FORMAT */
+void server_socket_path(char* buf, usize size);
+
+/* Serves requests on `path' with `compile' until it is killed, only returns when it can't listen */
+i32 server_run(const char* path, i32 (*compile)(i32 argc, char** argv));
+
+/* Has the server on `path' run the command line and writes out its answer, false when no server is there */
+bool server_forward(const char* path, i32 argc, char** argv, i32* exit_code);
+
+#endif  /*__SERVER_H*/
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 199309L
+#include "stats.h"
+
+#include <time.h>
+
+struct stats stats = {0};
+
+const char* stats_phase_to_cstr(enum stats_phase phase) {
+    switch (phase) {
+        case STATS_PHASE_READ: return "read"; break;
+        case STATS_PHASE_LEX: return "lex"; break;
+        case STATS_PHASE_PARSE: return "parse"; break;
+        case STATS_PHASE_COMPTIME: return "comptime"; break;
+        case STATS_PHASE_INLINE: return "inline"; break;
+        case STATS_PHASE_PRUNE: return "prune"; break;
+        case STATS_PHASE_BOUNDS: return "bounds"; break;
+        case STATS_PHASE_BYTECODE: return "bytecode"; break;
+        case STATS_PHASE_INTERP: return "interp"; break;
+        case STATS_PHASE_CODEGEN: return "codegen"; break;
+        case STATS_PHASE_DATAFLOW: return "dataflow"; break;
+        case STATS_PHASE_OUTPUT: return "output"; break;
+        case __stats_phase_count: break;
+    }
+
+    UNREACHABLE("stats_phase_to_cstr");
+}
+
+const char* stats_phase_unit(enum stats_phase phase) {
+    switch (phase) {
+        case STATS_PHASE_READ: return "bytes"; break;
+        case STATS_PHASE_LEX: return "tokens"; break;
+        case STATS_PHASE_PARSE: return "nodes"; break;
+        case STATS_PHASE_COMPTIME: return "steps"; break;
+        case STATS_PHASE_INLINE: return "calls"; break;
+        case STATS_PHASE_PRUNE: return "funcs"; break;
+        case STATS_PHASE_BOUNDS: return "accesses"; break;
+        case STATS_PHASE_BYTECODE: return "insts"; break;
+        case STATS_PHASE_INTERP: return "dispatches"; break;
+        case STATS_PHASE_CODEGEN: return "insts"; break;
+        case STATS_PHASE_DATAFLOW: return "blocks"; break;
+        case STATS_PHASE_OUTPUT: return "bytes"; break;
+        case __stats_phase_count: break;
+    }
+
+    UNREACHABLE("stats_phase_unit");
+}
+
+static inline u64 read_cycles(void) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct stats_stamp stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (struct stats_stamp){
+        .ns = (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec,
+        .cycles = read_cycles(),
+    };
+}
+
+void __stats_end(enum stats_phase phase, struct stats_stamp start) {
+    struct stats_stamp end = stats_now();
+    struct stats_phase_record* record = &stats.phases[phase];
+
+    record->ns += end.ns - start.ns;
+    record->cycles += end.cycles - start.cycles;
+    record->runs += 1;
+}
+
+void stats_record_arena(const char* name, const struct arena* arena) {
+    stats_record_memory(name, arena->peak, arena->capacity);
+}
+
+void stats_record_memory(const char* name, usize peak, usize capacity) {
+    struct stats_memory_record record = { name, peak, capacity };
+
+    if (!stats.mem_stats) return;
+
+    DYNARRAY_APPEND(stats.memory, record);
+}
+
+static inline void report_table(FILE* file) {
+    u64 total_ns = 0;
+
+    if (stats.time_passes) {
+        for (usize i = 0; i < __stats_phase_count; ++i) {
+            /* already counted in codegen */
+            if (i != STATS_PHASE_DATAFLOW) total_ns += stats.phases[i].ns;
+        }
+
+        fprintf(file, "%-10s %12s %7s %14s %14s %-10s %14s\n",
+                "phase", "time (ms)", "%", "cycles", "items", "", "items/s");
+
+        for (usize i = 0; i < __stats_phase_count; ++i) {
+            struct stats_phase_record r = stats.phases[i];
+            if (r.runs == 0) continue;
+
+            fprintf(file, "%-10s %12.3f %6.1f%% %14lu %14lu %-10s %14.0f\n",
+                    stats_phase_to_cstr(i),
+                    (f64)r.ns / 1e6,
+                    total_ns ? 100.0 * (f64)r.ns / (f64)total_ns : 0.0,
+                    r.cycles,
+                    r.items,
+                    stats_phase_unit(i),
+                    r.ns ? (f64)r.items / ((f64)r.ns / 1e9) : 0.0);
+        }
+
+        fprintf(file, "%-10s %12.3f\n", "total", (f64)total_ns / 1e6);
+    }
+
+    if (stats.mem_stats) {
+        if (stats.time_passes) fputc('\n', file);
+
+        fprintf(file, "%-24s %14s %14s\n", "memory", "peak (bytes)", "capacity");
+        for (usize i = 0; i < stats.memory.length; ++i) {
+            struct stats_memory_record r = stats.memory.at[i];
+            fprintf(file, "%-24s %14zu %14zu\n", r.name, r.peak, r.capacity);
+        }
+    }
+}
+
+static inline void report_json(FILE* file) {
+    bool first = true;
+
+    fprintf(file, "{");
+
+    if (stats.time_passes) {
+        fprintf(file, "\"phases\":[");
+        for (usize i = 0; i < __stats_phase_count; ++i) {
+            struct stats_phase_record r = stats.phases[i];
+            if (r.runs == 0) continue;
+
+            fprintf(file, "%s{\"name\":\"%s\",\"ns\":%lu,\"cycles\":%lu,\"runs\":%u,"
+                          "\"items\":%lu,\"unit\":\"%s\"}",
+                    first ? "" : ",", stats_phase_to_cstr(i), r.ns, r.cycles,
+                    r.runs, r.items, stats_phase_unit(i));
+            first = false;
+        }
+        fprintf(file, "]");
+    }
+
+    if (stats.mem_stats) {
+        fprintf(file, "%s\"memory\":[", stats.time_passes ? "," : "");
+        for (usize i = 0; i < stats.memory.length; ++i) {
+            struct stats_memory_record r = stats.memory.at[i];
+            fprintf(file, "%s{\"name\":\"%s\",\"peak\":%zu,\"capacity\":%zu}",
+                    i == 0 ? "" : ",", r.name, r.peak, r.capacity);
+        }
+        fprintf(file, "]");
+    }
+
+    fprintf(file, "}\n");
+}
+
+void stats_report(FILE* file) {
+    if (!stats.time_passes && !stats.mem_stats) return;
+
+    if (stats.format == STATS_FORMAT_JSON) report_json(file);
+    else report_table(file);
+}
+
+void stats_free(void) {
+    DYNARRAY_FREE(stats.memory);
+}
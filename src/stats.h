@@ -0,0 +1,101 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include "base.h"
+#include "arena.h"
+
+/*
+ * Compiler instrumentation (--time-passes / --mem-stats)
+ *
+ * Every phase of the compiler is bracketed by `stats_begin' / `stats_end'.
+ * When timing is disabled that costs one well predicted branch per phase, so
+ * the calls can stay in release builds. Phases also record how many items
+ * they produced (tokens, nodes, instructions) so throughput falls out of the
+ * report for free.
+ *
+ * Memory is reported per `struct arena' (peak bytes vs capacity) and for any
+ * other big buffer that a phase wants to show up in --mem-stats.
+ * */
+
+/* Keep this in sync with `stats_phase_to_cstr' and `stats_phase_unit' */
+enum stats_phase : u8 {
+    STATS_PHASE_READ,
+    STATS_PHASE_LEX,
+    STATS_PHASE_PARSE,
+    STATS_PHASE_COMPTIME,
+    STATS_PHASE_INLINE,
+    STATS_PHASE_PRUNE,
+    STATS_PHASE_BOUNDS,
+    STATS_PHASE_BYTECODE,
+    STATS_PHASE_INTERP,
+    STATS_PHASE_CODEGEN,
+    STATS_PHASE_DATAFLOW,   /* inside codegen */
+    STATS_PHASE_OUTPUT,
+    __stats_phase_count,
+};
+
+enum stats_format : u8 {
+    STATS_FORMAT_TABLE,
+    STATS_FORMAT_JSON,
+};
+
+struct stats_stamp {
+    u64 ns;
+    u64 cycles;
+};
+
+struct stats_phase_record {
+    u64 ns;
+    u64 cycles;
+    u64 items;
+    u32 runs;
+};
+
+struct stats_memory_record {
+    const char* name;
+    usize peak;
+    usize capacity;
+};
+
+struct stats_memory_records {
+    struct stats_memory_record* at;
+    DYNARRAY_FIELDS;
+};
+
+struct stats {
+    bool time_passes;
+    bool mem_stats;
+    enum stats_format format;
+
+    struct stats_phase_record phases[__stats_phase_count];
+    struct stats_memory_records memory;
+};
+
+extern struct stats stats;
+
+const char* stats_phase_to_cstr(enum stats_phase phase);
+const char* stats_phase_unit(enum stats_phase phase);
+
+struct stats_stamp stats_now(void);
+void __stats_end(enum stats_phase phase, struct stats_stamp start);
+
+static inline struct stats_stamp stats_begin(void) {
+    if (!stats.time_passes) return (struct stats_stamp){0, 0};
+    return stats_now();
+}
+
+static inline void stats_end(enum stats_phase phase, struct stats_stamp start) {
+    if (stats.time_passes) __stats_end(phase, start);
+}
+
+static inline void stats_items(enum stats_phase phase, u64 items) {
+    stats.phases[phase].items += items;
+}
+
+void stats_record_arena(const char* name, const struct arena* arena);
+void stats_record_memory(const char* name, usize peak, usize capacity);
+
+void stats_report(FILE* file);
+void stats_free(void);
+
+#endif  /*__STATS_H*/
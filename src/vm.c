@@ -0,0 +1,219 @@
+#include "vm.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define VM_COMPUTED_GOTO
+#endif
+
+struct vm vm_create(void) {
+    return (struct vm){
+        .stack = arena_create(VM_STACK_SIZE),
+        .frames = arena_create(VM_FRAMES_SIZE),
+        .dispatches = 0,
+        .status = VM_OK,
+    };
+}
+
+void vm_destroy(struct vm* vm) {
+    arena_destroy(&vm->stack);
+    arena_destroy(&vm->frames);
+    vm->dispatches = 0;
+}
+
+const char* vm_status_to_cstr(enum vm_status status) {
+    switch (status) {
+        case VM_OK: return "ok"; break;
+        case VM_STACK_OVERFLOW: return "stack overflow"; break;
+        case VM_EXTERN_CALL: return "call to an extern function"; break;
+        case VM_OUT_OF_BOUNDS: return "index out of bounds"; break;
+    }
+
+    UNREACHABLE("vm_status_to_cstr");
+}
+
+i64 vm_call(struct vm* vm, const struct bc_program* program, u32 func) {
+    ASSERT(func < program->funcs.length);
+
+    struct bc_func callee = program->funcs.at[func];
+    const bc_inst* code = program->code.at;
+    const bc_inst* ip = code + callee.code_start;
+    const i64* k = program->constants.at;
+    const i32* d = program->data.at;
+    const struct bc_func* funcs = program->funcs.at;
+    i64* r = vm->stack.mem_cursor;
+    i64* stack_end = (i64*)((u8*)vm->stack.mem_start + vm->stack.capacity);
+    struct vm_frame* frame_base = vm->frames.mem_cursor;
+    struct vm_frame* frame = frame_base;
+    struct vm_frame* frame_end = (struct vm_frame*)((u8*)vm->frames.mem_start + vm->frames.capacity);
+    i64* stack_high = r + callee.nregs;
+    struct vm_frame* frame_high = frame;
+    u64 dispatches = 0;
+    bc_inst inst;
+    i64 result = 0;
+
+    vm->status = VM_OK;
+
+    if (callee.is_extern) {
+        vm->status = VM_EXTERN_CALL;
+        return 0;
+    }
+    if (r + callee.nregs > stack_end) {
+        vm->status = VM_STACK_OVERFLOW;
+        return 0;
+    }
+
+#ifdef VM_COMPUTED_GOTO
+    static void* dispatch_table[__bc_op_count] = {
+        [BC_LOADI] = &&op_BC_LOADI,
+        [BC_LOADK] = &&op_BC_LOADK,
+        [BC_MOV]   = &&op_BC_MOV,
+        [BC_ADD]   = &&op_BC_ADD,
+        [BC_SUB]   = &&op_BC_SUB,
+        [BC_MUL]   = &&op_BC_MUL,
+        [BC_EQ]    = &&op_BC_EQ,
+        [BC_NE]    = &&op_BC_NE,
+        [BC_LT]    = &&op_BC_LT,
+        [BC_LE]    = &&op_BC_LE,
+        [BC_DATA]  = &&op_BC_DATA,
+        [BC_INDEX] = &&op_BC_INDEX,
+        [BC_INDEXU] = &&op_BC_INDEXU,
+        [BC_JMP]   = &&op_BC_JMP,
+        [BC_JMPF]  = &&op_BC_JMPF,
+        [BC_CALL]  = &&op_BC_CALL,
+        [BC_TAILCALL] = &&op_BC_TAILCALL,
+        [BC_RET]   = &&op_BC_RET,
+        [BC_RETV]  = &&op_BC_RETV,
+    };
+#   define VM_CASE(op) CONCAT(op_, op)
+#   define VM_DISPATCH() STATEMENT( \
+        inst = *ip++; \
+        dispatches++; \
+        goto *dispatch_table[BC_OP(inst)]; \
+    )
+    VM_DISPATCH();
+#else
+#   define VM_CASE(op) case op
+#   define VM_DISPATCH() continue
+    while (true) {
+        inst = *ip++;
+        dispatches++;
+        switch (BC_OP(inst)) {
+#endif
+
+    VM_CASE(BC_LOADI):
+        r[BC_A(inst)] = BC_SBX(inst);
+        VM_DISPATCH();
+    VM_CASE(BC_LOADK):
+        r[BC_A(inst)] = k[BC_BX(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_MOV):
+        r[BC_A(inst)] = r[BC_B(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_ADD):
+        r[BC_A(inst)] = (i32)((u32)r[BC_B(inst)] + (u32)r[BC_C(inst)]);
+        VM_DISPATCH();
+    VM_CASE(BC_SUB):
+        r[BC_A(inst)] = (i32)((u32)r[BC_B(inst)] - (u32)r[BC_C(inst)]);
+        VM_DISPATCH();
+    VM_CASE(BC_MUL):
+        r[BC_A(inst)] = (i32)((u32)r[BC_B(inst)] * (u32)r[BC_C(inst)]);
+        VM_DISPATCH();
+    VM_CASE(BC_EQ):
+        r[BC_A(inst)] = r[BC_B(inst)] == r[BC_C(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_NE):
+        r[BC_A(inst)] = r[BC_B(inst)] != r[BC_C(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_LT):
+        r[BC_A(inst)] = r[BC_B(inst)] < r[BC_C(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_LE):
+        r[BC_A(inst)] = r[BC_B(inst)] <= r[BC_C(inst)];
+        VM_DISPATCH();
+    VM_CASE(BC_DATA):
+        r[BC_A(inst)] = (i64)(usize)(d + BC_BX(inst));
+        VM_DISPATCH();
+    VM_CASE(BC_INDEX):
+        /* a negative index is a huge unsigned one */
+        if ((u64)r[BC_C(inst)] >= (u64)r[BC_B(inst) + 1]) {
+            vm->status = VM_OUT_OF_BOUNDS;
+            goto done;
+        }
+        /* fallthrough */
+    VM_CASE(BC_INDEXU):
+        r[BC_A(inst)] = ((const i32*)(usize)r[BC_B(inst)])[r[BC_C(inst)]];
+        VM_DISPATCH();
+    VM_CASE(BC_JMP):
+        ip += BC_SBX(inst);
+        VM_DISPATCH();
+    VM_CASE(BC_JMPF):
+        if (r[BC_A(inst)] == 0) ip += BC_SBX(inst);
+        VM_DISPATCH();
+    VM_CASE(BC_CALL): {
+        const struct bc_func* target = &funcs[BC_BX(inst)];
+        i64* window = r + BC_A(inst);
+
+        if (target->is_extern) {
+            vm->status = VM_EXTERN_CALL;
+            goto done;
+        }
+        if (frame == frame_end || window + target->nregs > stack_end) {
+            vm->status = VM_STACK_OVERFLOW;
+            goto done;
+        }
+
+        *frame++ = (struct vm_frame){ ip, r };
+        r = window;
+        stack_high = MAX(stack_high, r + target->nregs);
+        frame_high = MAX(frame_high, frame);
+        ip = code + target->code_start;
+        VM_DISPATCH();
+    }
+    VM_CASE(BC_TAILCALL): {
+        const struct bc_func* target = &funcs[BC_BX(inst)];
+        i64* args = r + BC_A(inst);
+
+        if (target->is_extern) {
+            vm->status = VM_EXTERN_CALL;
+            goto done;
+        }
+        if (r + target->nregs > stack_end) {
+            vm->status = VM_STACK_OVERFLOW;
+            goto done;
+        }
+
+        /* the arguments sit above the parameters, copied down in order none is overwritten early */
+        for (u16 i = 0; i < target->nparams; ++i) r[i] = args[i];
+        stack_high = MAX(stack_high, r + target->nregs);
+        ip = code + target->code_start;
+        VM_DISPATCH();
+    }
+    VM_CASE(BC_RET):
+        r[0] = r[BC_A(inst)];
+        /* fallthrough */
+    VM_CASE(BC_RETV):
+        if (frame == frame_base) {
+            result = r[0];
+            goto done;
+        }
+
+        frame--;
+        ip = frame->ip;
+        r = frame->r;
+        VM_DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            UNREACHABLE("vm_call: bad opcode");
+        }
+    }
+#endif
+
+#undef VM_CASE
+#undef VM_DISPATCH
+
+done:
+    vm->stack.peak = MAX(vm->stack.peak, (usize)((u8*)stack_high - (u8*)vm->stack.mem_start));
+    vm->frames.peak = MAX(vm->frames.peak, (usize)((u8*)frame_high - (u8*)vm->frames.mem_start));
+    vm->dispatches += dispatches;
+    return result;
+}
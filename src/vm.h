@@ -0,0 +1,48 @@
+#ifndef __VM_H
+#define __VM_H
+
+#include "base.h"
+#include "arena.h"
+#include "bytecode.h"
+
+/*
+ * The bytecode interpreter.
+ *
+ * Dispatch is threaded through a table of label addresses (computed goto) on
+ * compilers which support it and falls back to a plain switch everywhere
+ * else. Register windows for every active call live in `stack', each one
+ * starting at the argument registers of its caller, and the return
+ * addresses live in `frames'.
+ * */
+
+#define VM_STACK_SIZE (MEGABYTES(1))
+#define VM_FRAMES_SIZE (MEGABYTES(1))
+
+enum vm_status : u8 {
+    VM_OK,
+    VM_STACK_OVERFLOW,
+    VM_EXTERN_CALL,     /* tried to call a function which only has a declaration */
+    VM_OUT_OF_BOUNDS,   /* a checked index past the end of its slice, or negative */
+};
+
+struct vm_frame {
+    const bc_inst* ip;  /* where to continue in the caller */
+    i64* r;             /* register window of the caller */
+};
+
+struct vm {
+    struct arena stack;
+    struct arena frames;
+    u64 dispatches; /* total number of instructions dispatched so far */
+    enum vm_status status;
+};
+
+struct vm vm_create(void);
+void vm_destroy(struct vm* vm);
+
+const char* vm_status_to_cstr(enum vm_status status);
+
+/* Runs `func' to completion. Check `vm->status' before trusting the result */
+i64 vm_call(struct vm* vm, const struct bc_program* program, u32 func);
+
+#endif  /*__VM_H*/
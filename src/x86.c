@@ -0,0 +1,584 @@
+#include "x86.h"
+
+static const char* regs64[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+
+static const char* regs32[] = {
+    "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+    "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d",
+};
+
+static const char* regs8[] = {
+    "%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+    "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b",
+};
+
+static inline bool fits_i8(i64 value);
+static inline u32 rex_size(struct x86_inst inst);
+static inline u32 modrm_size(struct x86_operand operand);
+
+struct x86_operand x86_reg(enum x86_reg reg, u8 size) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_REG;
+    operand.reg = reg;
+    operand.size = size;
+    return operand;
+}
+
+struct x86_operand x86_imm(i64 imm) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_IMM;
+    operand.imm = imm;
+    return operand;
+}
+
+struct x86_operand x86_mem(enum x86_reg base, i32 disp, u8 size) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_MEM;
+    operand.reg = base;
+    operand.disp = disp;
+    operand.size = size;
+    return operand;
+}
+
+struct x86_operand x86_mem_index(enum x86_reg base, enum x86_reg index, u8 scale, i32 disp, u8 size) {
+    struct x86_operand operand = x86_mem(base, disp, size);
+    operand.index = index;
+    operand.scale = scale;
+    return operand;
+}
+
+struct x86_operand x86_sym(struct string sym, bool plt) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_SYM;
+    operand.sym = sym;
+    operand.plt = plt;
+    return operand;
+}
+
+struct x86_operand x86_label(u32 label) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_LABEL;
+    operand.label = label;
+    return operand;
+}
+
+struct x86_operand x86_counter(u32 index) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_COUNTER;
+    operand.imm = index;
+    operand.size = 8;
+    return operand;
+}
+
+struct x86_operand x86_data(u32 literal) {
+    struct x86_operand operand = {0};
+    operand.kind = X86_DATA;
+    operand.imm = literal;
+    return operand;
+}
+
+struct x86_inst x86_inst0(enum x86_op op) {
+    struct x86_inst inst = {0};
+    inst.op = op;
+    return inst;
+}
+
+struct x86_inst x86_inst1(enum x86_op op, struct x86_operand operand) {
+    struct x86_inst inst = {0};
+    inst.op = op;
+    inst.dst = operand;
+    return inst;
+}
+
+struct x86_inst x86_inst2(enum x86_op op, struct x86_operand src, struct x86_operand dst) {
+    struct x86_inst inst = {0};
+    inst.op = op;
+    inst.src = src;
+    inst.dst = dst;
+    return inst;
+}
+
+struct x86_inst x86_setcc(enum x86_cond cond, struct x86_operand dst) {
+    struct x86_inst inst = x86_inst1(X86_SETCC, dst);
+    inst.cond = cond;
+    return inst;
+}
+
+struct x86_inst x86_jcc(enum x86_cond cond, u32 label) {
+    struct x86_inst inst = x86_inst1(X86_JCC, x86_label(label));
+    inst.cond = cond;
+    return inst;
+}
+
+enum x86_cond x86_cond_negate(enum x86_cond cond) {
+    switch (cond) {
+        case X86_CC_E: return X86_CC_NE; break;
+        case X86_CC_NE: return X86_CC_E; break;
+        case X86_CC_L: return X86_CC_GE; break;
+        case X86_CC_LE: return X86_CC_G; break;
+        case X86_CC_G: return X86_CC_LE; break;
+        case X86_CC_GE: return X86_CC_L; break;
+        case X86_CC_B: return X86_CC_AE; break;
+        case X86_CC_BE: return X86_CC_A; break;
+        case X86_CC_A: return X86_CC_BE; break;
+        case X86_CC_AE: return X86_CC_B; break;
+    }
+
+    UNREACHABLE("x86_cond_negate");
+}
+
+enum x86_cond x86_cond_swap(enum x86_cond cond) {
+    switch (cond) {
+        case X86_CC_E: return X86_CC_E; break;
+        case X86_CC_NE: return X86_CC_NE; break;
+        case X86_CC_L: return X86_CC_G; break;
+        case X86_CC_LE: return X86_CC_GE; break;
+        case X86_CC_G: return X86_CC_L; break;
+        case X86_CC_GE: return X86_CC_LE; break;
+        case X86_CC_B: return X86_CC_A; break;
+        case X86_CC_BE: return X86_CC_AE; break;
+        case X86_CC_A: return X86_CC_B; break;
+        case X86_CC_AE: return X86_CC_BE; break;
+    }
+
+    UNREACHABLE("x86_cond_swap");
+}
+
+const char* x86_cond_to_cstr(enum x86_cond cond) {
+    switch (cond) {
+        case X86_CC_E: return "e"; break;
+        case X86_CC_NE: return "ne"; break;
+        case X86_CC_L: return "l"; break;
+        case X86_CC_LE: return "le"; break;
+        case X86_CC_G: return "g"; break;
+        case X86_CC_GE: return "ge"; break;
+        case X86_CC_B: return "b"; break;
+        case X86_CC_BE: return "be"; break;
+        case X86_CC_A: return "a"; break;
+        case X86_CC_AE: return "ae"; break;
+    }
+
+    UNREACHABLE("x86_cond_to_cstr");
+}
+
+const char* x86_op_to_cstr(enum x86_op op) {
+    switch (op) {
+        case X86_NOP: return "nop"; break;
+        case X86_MOV: return "mov"; break;
+        case X86_ADD: return "add"; break;
+        case X86_SUB: return "sub"; break;
+        case X86_IMUL: return "imul"; break;
+        case X86_IMUL3: return "imul"; break;
+        case X86_NEG: return "neg"; break;
+        case X86_LEA: return "lea"; break;
+        case X86_XOR: return "xor"; break;
+        case X86_CMP: return "cmp"; break;
+        case X86_TEST: return "test"; break;
+        case X86_SETCC: return "set"; break;
+        case X86_MOVZX: return "movzbl"; break;
+        case X86_MOVSXD: return "movslq"; break;
+        case X86_PUSH: return "push"; break;
+        case X86_POP: return "pop"; break;
+        case X86_CALL: return "call"; break;
+        case X86_SYSCALL: return "syscall"; break;
+        case X86_JMP: return "jmp"; break;
+        case X86_JCC: return "j"; break;
+        case X86_RET: return "ret"; break;
+        case X86_UD2: return "ud2"; break;
+        case X86_DEFLABEL: return "<label>"; break;
+        case __x86_op_count: break;
+    }
+
+    UNREACHABLE("x86_op_to_cstr");
+}
+
+const char* x86_reg_to_cstr(enum x86_reg reg, u8 size) {
+    ASSERT(reg < X86_NO_REG);
+    if (size == 1) return regs8[reg];
+    return size == 8 ? regs64[reg] : regs32[reg];
+}
+
+bool x86_operand_equal(struct x86_operand a, struct x86_operand b) {
+    if (a.kind != b.kind) return false;
+
+    switch (a.kind) {
+        case X86_NONE: return true; break;
+        case X86_REG: return a.reg == b.reg && a.size == b.size; break;
+        case X86_IMM: return a.imm == b.imm; break;
+        case X86_MEM:
+            if (a.scale != b.scale || (a.scale != 0 && a.index != b.index)) return false;
+            return a.reg == b.reg && a.disp == b.disp && a.size == b.size;
+        case X86_SYM: return a.plt == b.plt && string_equal(a.sym, b.sym); break;
+        case X86_LABEL: return a.label == b.label; break;
+        case X86_COUNTER: return a.imm == b.imm; break;
+        case X86_DATA: return a.imm == b.imm; break;
+    }
+
+    UNREACHABLE("x86_operand_equal");
+}
+
+bool x86_operand_is_memory(struct x86_operand operand) {
+    return operand.kind == X86_MEM || operand.kind == X86_COUNTER || operand.kind == X86_DATA;
+}
+
+bool x86_operand_uses(struct x86_operand operand, enum x86_reg reg) {
+    if (operand.kind == X86_MEM && operand.scale != 0 && operand.index == reg) return true;
+    return (operand.kind == X86_REG || operand.kind == X86_MEM) && operand.reg == reg;
+}
+
+bool x86_reads_flags(struct x86_inst inst) {
+    return inst.op == X86_SETCC || inst.op == X86_JCC;
+}
+
+/* What evaluating `operand' reads, a memory destination still reads its address */
+static inline u64 operand_uses(struct x86_operand operand) {
+    u64 uses = 0;
+
+    if (operand.kind != X86_REG && operand.kind != X86_MEM) return 0;
+    if (operand.reg != X86_NO_REG) uses |= X86_REGSET(operand.reg);
+    if (operand.kind == X86_MEM && operand.scale != 0) uses |= X86_REGSET(operand.index);
+    return uses;
+}
+
+static inline u64 address_uses(struct x86_operand operand) {
+    return operand.kind == X86_MEM ? operand_uses(operand) : 0;
+}
+
+static inline u64 operand_defs(struct x86_operand operand) {
+    return operand.kind == X86_REG ? X86_REGSET(operand.reg) : 0;
+}
+
+#define ARG_REGSET (X86_REGSET(X86_RDI) | X86_REGSET(X86_RSI) | X86_REGSET(X86_RDX) | \
+                    X86_REGSET(X86_RCX) | X86_REGSET(X86_R8) | X86_REGSET(X86_R9))
+#define CALLEE_SAVED_REGSET (X86_REGSET(X86_RBX) | X86_REGSET(X86_RBP) | X86_REGSET(X86_R12) | \
+                             X86_REGSET(X86_R13) | X86_REGSET(X86_R14) | X86_REGSET(X86_R15))
+#define CALLER_SAVED_REGSET (ARG_REGSET | X86_REGSET(X86_RAX) | X86_REGSET(X86_R10) | X86_REGSET(X86_R11))
+#define SYSCALL_ARG_REGSET (X86_REGSET(X86_RAX) | X86_REGSET(X86_RDI) | X86_REGSET(X86_RSI) | X86_REGSET(X86_RDX) | \
+                            X86_REGSET(X86_R10) | X86_REGSET(X86_R8) | X86_REGSET(X86_R9))
+#define SYSCALL_CLOBBER_REGSET (X86_REGSET(X86_RAX) | X86_REGSET(X86_RCX) | X86_REGSET(X86_R11))
+
+u64 x86_inst_uses(struct x86_inst inst) {
+    switch (inst.op) {
+        case X86_NOP:
+        case X86_DEFLABEL:
+        case X86_UD2:
+            return 0;
+        case X86_MOV:
+        case X86_LEA:
+        case X86_MOVZX:
+        case X86_MOVSXD:
+            return operand_uses(inst.src) | address_uses(inst.dst);
+        case X86_XOR:
+            if (x86_operand_equal(inst.src, inst.dst)) return 0;
+            return operand_uses(inst.src) | operand_uses(inst.dst);
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_CMP:
+        case X86_TEST:
+            return operand_uses(inst.src) | operand_uses(inst.dst);
+        case X86_IMUL3:
+            return operand_uses(inst.src) | address_uses(inst.dst);
+        case X86_NEG:
+            return operand_uses(inst.dst);
+        case X86_SETCC:
+            return X86_FLAGS | operand_uses(inst.dst);
+        case X86_PUSH:
+            return operand_uses(inst.dst) | X86_REGSET(X86_RSP);
+        case X86_POP:
+            return address_uses(inst.dst) | X86_REGSET(X86_RSP);
+        case X86_CALL:
+            /* and the frame pointer chain, for whoever unwinds the stack */
+            return ARG_REGSET | X86_REGSET(X86_RSP) | X86_REGSET(X86_RBP);
+        case X86_SYSCALL:
+            /* however many arguments it takes, the kernel doesn't say */
+            return SYSCALL_ARG_REGSET;
+        case X86_JMP:
+            if (inst.dst.kind == X86_LABEL) return 0;
+            return ARG_REGSET | CALLEE_SAVED_REGSET | X86_REGSET(X86_RSP);
+        case X86_JCC:
+            return X86_FLAGS;
+        case X86_RET:
+            return X86_REGSET(X86_RAX) | CALLEE_SAVED_REGSET | X86_REGSET(X86_RSP);
+        case __x86_op_count: break;
+    }
+
+    UNREACHABLE("x86_inst_uses");
+}
+
+u64 x86_inst_defs(struct x86_inst inst) {
+    switch (inst.op) {
+        case X86_NOP:
+        case X86_DEFLABEL:
+        case X86_JMP:
+        case X86_JCC:
+        case X86_RET:
+        case X86_UD2:
+            return 0;
+        case X86_MOV:
+        case X86_LEA:
+        case X86_MOVZX:
+        case X86_MOVSXD:
+        case X86_SETCC:
+            return operand_defs(inst.dst);
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_IMUL3:
+        case X86_NEG:
+        case X86_XOR:
+            return operand_defs(inst.dst) | X86_FLAGS;
+        case X86_CMP:
+        case X86_TEST:
+            return X86_FLAGS;
+        case X86_PUSH:
+            return X86_REGSET(X86_RSP);
+        case X86_POP:
+            return operand_defs(inst.dst) | X86_REGSET(X86_RSP);
+        case X86_CALL:
+            return CALLER_SAVED_REGSET | X86_FLAGS;
+        case X86_SYSCALL:
+            /* the return address and the flags are kept in %rcx and %r11 */
+            return SYSCALL_CLOBBER_REGSET;
+        case __x86_op_count: break;
+    }
+
+    UNREACHABLE("x86_inst_defs");
+}
+
+static inline bool fits_i8(i64 value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+/* A REX prefix is needed for 64 bit operands and for r8-r15 */
+static inline u32 rex_size(struct x86_inst inst) {
+    struct x86_operand operands[2] = { inst.src, inst.dst };
+    bool wide = false, extended = false;
+
+    for (u32 i = 0; i < 2; ++i) {
+        if (operands[i].kind == X86_REG || operands[i].kind == X86_MEM) {
+            extended |= operands[i].reg >= X86_R8 && operands[i].reg != X86_NO_REG;
+            wide |= operands[i].size == 8;
+        }
+        if (operands[i].kind == X86_COUNTER) wide = true;
+        if (operands[i].kind == X86_MEM && operands[i].scale != 0) {
+            extended |= operands[i].index >= X86_R8;
+        }
+    }
+
+    /* push and pop are 64 bit without asking */
+    if (inst.op == X86_PUSH || inst.op == X86_POP) wide = false;
+    /* %spl, %bpl, %sil and %dil only exist with a REX prefix */
+    if (inst.dst.kind == X86_REG && inst.dst.size == 1 && inst.dst.reg >= X86_RSP) extended = true;
+    if (inst.src.kind == X86_REG && inst.src.size == 1 && inst.src.reg >= X86_RSP) extended = true;
+
+    return wide || extended;
+}
+
+/* ModRM, plus the SIB byte and displacement for memory operands */
+static inline u32 modrm_size(struct x86_operand operand) {
+    u32 size = 1;
+
+    /* %rip relative, always a 32 bit displacement */
+    if (operand.kind == X86_COUNTER || operand.kind == X86_DATA) return size + 4;
+    if (operand.kind != X86_MEM) return size;
+
+    /* without a base there is always a 32 bit displacement */
+    if (operand.reg == X86_NO_REG) return size + 1 + 4;
+
+    if ((operand.reg & 7) == X86_RSP || operand.scale != 0) size++;
+    if (operand.disp == 0 && (operand.reg & 7) != X86_RBP) return size;
+
+    return size + (fits_i8(operand.disp) ? 1 : 4);
+}
+
+u32 x86_inst_size(struct x86_inst inst) {
+    struct x86_operand rm = x86_operand_is_memory(inst.dst) ? inst.dst : inst.src;
+    u32 rex = rex_size(inst);
+
+    switch (inst.op) {
+        case X86_NOP:
+        case X86_DEFLABEL:
+            return 0;
+        case X86_MOV:
+            if (inst.src.kind == X86_IMM && inst.dst.kind == X86_REG) return rex + 1 + (inst.dst.size == 8 ? 8 : 4);
+            if (inst.src.kind == X86_IMM) return rex + 1 + modrm_size(inst.dst) + 4;
+            return rex + 1 + modrm_size(rm);
+        case X86_ADD:
+        case X86_SUB:
+        case X86_XOR:
+        case X86_CMP:
+            if (inst.src.kind == X86_IMM) {
+                if (fits_i8(inst.src.imm)) return rex + 1 + modrm_size(inst.dst) + 1;
+                if (inst.dst.kind == X86_REG && inst.dst.reg == X86_RAX) return rex + 1 + 4;
+                return rex + 1 + modrm_size(inst.dst) + 4;
+            }
+            return rex + 1 + modrm_size(rm);
+        case X86_IMUL:
+            if (inst.src.kind == X86_IMM) return rex + 1 + modrm_size(inst.dst) + (fits_i8(inst.src.imm) ? 1 : 4);
+            return rex + 2 + modrm_size(rm);
+        case X86_IMUL3:
+            return rex + 1 + modrm_size(inst.src) + (fits_i8(inst.aux.imm) ? 1 : 4);
+        case X86_NEG:
+        case X86_TEST:
+            return rex + 1 + modrm_size(inst.dst);
+        case X86_LEA:
+            return rex + 1 + modrm_size(inst.src);
+        case X86_SETCC:
+        case X86_MOVZX:
+            return rex + 2 + modrm_size(rm);
+        case X86_MOVSXD:
+            return rex + 1 + modrm_size(rm);
+        case X86_PUSH:
+            if (inst.dst.kind == X86_IMM) return fits_i8(inst.dst.imm) ? 2 : 5;
+            if (inst.dst.kind == X86_MEM) return rex + 1 + modrm_size(inst.dst);
+            return rex + 1;
+        case X86_POP:
+            return rex + 1;
+        case X86_CALL:
+            return 5;
+        case X86_SYSCALL:
+            return 2;
+        case X86_JMP:
+            if (inst.dst.kind == X86_SYM) return 5;
+            /* fallthrough */
+        case X86_JCC:
+            /* we don't know the distance, assume a short jump */
+            return 2;
+        case X86_RET:
+            return 1;
+        case X86_UD2:
+            return 2;
+        case __x86_op_count:
+            break;
+    }
+
+    UNREACHABLE("x86_inst_size");
+}
+
+/*
+ * Roughly the latency of the instruction on a recent core, memory operands
+ * counting as an L1 hit. Moves between registers are free in hardware these
+ * days (move elimination) but still take a slot, so they count as one.
+ * */
+u32 x86_inst_cycles(struct x86_inst inst) {
+    u32 load = x86_operand_is_memory(inst.src) ? 4 : 0;
+
+    switch (inst.op) {
+        case X86_NOP:
+        case X86_DEFLABEL:
+            return 0;
+        case X86_MOV:
+            return x86_operand_is_memory(inst.dst) ? 1 : 1 + load;
+        case X86_ADD:
+        case X86_SUB:
+            return 1 + load + (x86_operand_is_memory(inst.dst) ? 5 : 0);
+        case X86_XOR:
+            /* `xor %r, %r' is recognized as a zeroing idiom and never executes */
+            if (x86_operand_equal(inst.src, inst.dst)) return 0;
+            return 1 + load;
+        case X86_CMP:
+        case X86_TEST:
+            return 1 + load + (x86_operand_is_memory(inst.dst) ? 4 : 0);
+        case X86_SETCC:
+        case X86_MOVZX:
+        case X86_MOVSXD:
+        case X86_UD2:
+            return 1;
+        case X86_IMUL:
+        case X86_IMUL3:
+            return 3 + load;
+        case X86_NEG:
+            return 1;
+        case X86_LEA:
+            /* three component addresses are slower on most cores */
+            return inst.src.scale != 0 && inst.src.reg != X86_NO_REG && inst.src.disp != 0 ? 3 : 1;
+        case X86_PUSH:
+        case X86_POP:
+            return 1;
+        case X86_CALL:
+        case X86_RET:
+            return 2;
+        case X86_SYSCALL:
+            /* into the kernel and back, before it does any work */
+            return 100;
+        case X86_JMP:
+        case X86_JCC:
+            return 1;
+        case __x86_op_count:
+            break;
+    }
+
+    UNREACHABLE("x86_inst_cycles");
+}
+
+void x86_print_operand(FILE* out, struct x86_operand operand) {
+    switch (operand.kind) {
+        case X86_NONE:
+            break;
+        case X86_REG:
+            fprintf(out, "%s", x86_reg_to_cstr(operand.reg, operand.size));
+            break;
+        case X86_IMM:
+            fprintf(out, "$%ld", operand.imm);
+            break;
+        case X86_MEM:
+            if (operand.disp != 0 || operand.reg == X86_NO_REG) fprintf(out, "%d", operand.disp);
+            fputc('(', out);
+            if (operand.reg != X86_NO_REG) fprintf(out, "%s", x86_reg_to_cstr(operand.reg, 8));
+            if (operand.scale != 0) fprintf(out, ",%s,%u", x86_reg_to_cstr(operand.index, 8), operand.scale);
+            fputc(')', out);
+            break;
+        case X86_SYM:
+            fprintf(out, "%.*s%s", (i32)operand.sym.length, operand.sym.cstr, operand.plt ? "@PLT" : "");
+            break;
+        case X86_LABEL:
+            fprintf(out, ".L%u", operand.label);
+            break;
+        case X86_COUNTER:
+            fprintf(out, "__nomi_profile_counters+%ld(%%rip)", 8 * operand.imm);
+            break;
+        case X86_DATA:
+            fprintf(out, ".Lslice%ld(%%rip)", operand.imm);
+            break;
+    }
+}
+
+void x86_print_inst(FILE* out, struct x86_inst inst) {
+    bool suffix;
+
+    if (inst.op == X86_NOP) return;
+
+    if (inst.op == X86_DEFLABEL) {
+        x86_print_operand(out, inst.dst);
+        fprintf(out, ":\n");
+        return;
+    }
+
+    /* without a register operand the assembler can't tell how wide the operation is */
+    suffix = inst.src.kind != X86_REG && x86_operand_is_memory(inst.dst);
+
+    fprintf(out, "    %s", x86_op_to_cstr(inst.op));
+    if (inst.op == X86_SETCC || inst.op == X86_JCC) fprintf(out, "%s", x86_cond_to_cstr(inst.cond));
+    if (suffix) fputc(inst.dst.size == 8 ? 'q' : 'l', out);
+
+    if (inst.aux.kind != X86_NONE) {
+        fputc(' ', out);
+        x86_print_operand(out, inst.aux);
+        fputc(',', out);
+    }
+
+    if (inst.src.kind != X86_NONE) {
+        fputc(' ', out);
+        x86_print_operand(out, inst.src);
+        fputc(',', out);
+    }
+    if (inst.dst.kind != X86_NONE) {
+        fputc(' ', out);
+        x86_print_operand(out, inst.dst);
+    }
+    fputc('\n', out);
+}
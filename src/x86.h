@@ -0,0 +1,159 @@
+#ifndef __X86_H
+#define __X86_H
+
+#include "base.h"
+#include "string.h"
+
+/*
+ * x86_64 machine instructions (MIR)
+ *
+ * The backend no longer prints assembly as it walks the AST. It appends
+ * structured instructions to a `struct x86_insts' per function, which the
+ * peephole optimizer rewrites before they are printed in GNU assembler
+ * syntax. Instructions keep the AT&T operand order: `src' then `dst'.
+ *
+ * `x86_inst_size' and `x86_inst_cycles' are rough estimates of the encoded
+ * size and the cost of an instruction, good enough to compare two versions
+ * of the same code, not to predict how fast it runs.
+ * */
+
+/* In encoding order */
+enum x86_reg : u8 {
+    X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8, X86_R9, X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15,
+    X86_NO_REG,     /* memory operands without a base */
+    __x86_reg_count,
+};
+
+enum x86_operand_kind : u8 {
+    X86_NONE,
+    X86_REG,
+    X86_IMM,
+    X86_MEM,    /* disp(base, index, scale) */
+    X86_SYM,    /* call target */
+    X86_LABEL,  /* jump target, local to the function */
+    X86_COUNTER,    /* profile counter `imm', 8 bytes of memory addressed relative to %rip */
+    X86_DATA,       /* the elements of slice literal `imm' in .rodata, addressed relative to %rip */
+};
+
+struct x86_operand {
+    enum x86_operand_kind kind;
+    u8 size;            /* 1, 4 or 8, for registers and memory */
+    enum x86_reg reg;   /* X86_REG, base of X86_MEM */
+    enum x86_reg index; /* X86_MEM, only looked at when `scale' is not 0 */
+    u8 scale;           /* 1, 2, 4 or 8 */
+    bool plt;           /* X86_SYM goes through the PLT */
+    union {
+        i64 imm;            /* X86_IMM, X86_COUNTER, X86_DATA */
+        i32 disp;
+        u32 label;
+        struct string sym;
+    };
+};
+
+/* Keep this in sync with `x86_op_to_cstr', `x86_inst_size' and `x86_inst_cycles' */
+enum x86_op : u8 {
+    X86_NOP,    /* deleted, never printed */
+    X86_MOV,
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_IMUL3,  /* imul $aux, src, dst */
+    X86_NEG,
+    X86_LEA,
+    X86_XOR,
+    X86_CMP,
+    X86_TEST,
+    X86_SETCC,  /* set<cond> dst, dst is a byte register */
+    X86_MOVZX,  /* movzbl, byte register to 32 bits */
+    X86_MOVSXD, /* movslq, 32 bit source sign extended to the 64 bit destination */
+    X86_PUSH,
+    X86_POP,
+    X86_CALL,
+    X86_SYSCALL,    /* number in %rax, arguments in %rdi, %rsi, %rdx, %r10, %r8 and %r9 */
+    X86_JMP,
+    X86_JCC,    /* j<cond> label */
+    X86_RET,
+    X86_UD2,    /* traps, nothing runs after it */
+    X86_DEFLABEL,   /* `.L<label>:' */
+    __x86_op_count,
+};
+
+/* Signed conditions, what comparisons between i32s need, and unsigned ones for bounds checks */
+enum x86_cond : u8 {
+    X86_CC_E,
+    X86_CC_NE,
+    X86_CC_L,
+    X86_CC_LE,
+    X86_CC_G,
+    X86_CC_GE,
+    X86_CC_B,
+    X86_CC_BE,
+    X86_CC_A,
+    X86_CC_AE,
+};
+
+struct x86_inst {
+    enum x86_op op;
+    enum x86_cond cond;     /* X86_SETCC and X86_JCC */
+    struct x86_operand src;
+    struct x86_operand dst;
+    struct x86_operand aux;
+};
+
+struct x86_insts {
+    struct x86_inst* at;
+    DYNARRAY_FIELDS;
+};
+
+struct x86_operand x86_reg(enum x86_reg reg, u8 size);
+struct x86_operand x86_imm(i64 imm);
+struct x86_operand x86_mem(enum x86_reg base, i32 disp, u8 size);
+struct x86_operand x86_mem_index(enum x86_reg base, enum x86_reg index, u8 scale, i32 disp, u8 size);
+struct x86_operand x86_sym(struct string sym, bool plt);
+struct x86_operand x86_label(u32 label);
+struct x86_operand x86_counter(u32 index);
+struct x86_operand x86_data(u32 literal);
+
+struct x86_inst x86_inst0(enum x86_op op);
+struct x86_inst x86_inst1(enum x86_op op, struct x86_operand operand);
+struct x86_inst x86_inst2(enum x86_op op, struct x86_operand src, struct x86_operand dst);
+struct x86_inst x86_setcc(enum x86_cond cond, struct x86_operand dst);
+struct x86_inst x86_jcc(enum x86_cond cond, u32 label);
+
+/* The condition which holds exactly when `cond' doesn't */
+enum x86_cond x86_cond_negate(enum x86_cond cond);
+/* The condition to test after comparing the operands the other way around */
+enum x86_cond x86_cond_swap(enum x86_cond cond);
+const char* x86_cond_to_cstr(enum x86_cond cond);
+
+const char* x86_op_to_cstr(enum x86_op op);
+const char* x86_reg_to_cstr(enum x86_reg reg, u8 size);
+
+bool x86_operand_equal(struct x86_operand a, struct x86_operand b);
+bool x86_operand_is_memory(struct x86_operand operand);
+/* Does reading `operand' read (any part of) `reg'? */
+bool x86_operand_uses(struct x86_operand operand, enum x86_reg reg);
+/* Does `inst' look at the flags left behind by the instruction before it? */
+bool x86_reads_flags(struct x86_inst inst);
+
+/*
+ * Register sets: bit `reg' for every register, X86_FLAGS for the flags.
+ * Calls, returns and jumps to other functions follow the SysV AMD64 ABI:
+ * they read the argument or return registers and the callee-saved ones.
+ * `syscall' only changes %rax, %rcx and %r11.
+ * */
+#define X86_REGSET(reg) ((u64)1 << (reg))
+#define X86_FLAGS X86_REGSET(__x86_reg_count)
+
+u64 x86_inst_uses(struct x86_inst inst);
+/* Registers which `inst' may write, partially written ones are read as well */
+u64 x86_inst_defs(struct x86_inst inst);
+
+u32 x86_inst_size(struct x86_inst inst);
+u32 x86_inst_cycles(struct x86_inst inst);
+
+void x86_print_operand(FILE* out, struct x86_operand operand);
+void x86_print_inst(FILE* out, struct x86_inst inst);
+
+#endif  /*__X86_H*/